@@ -31,6 +31,7 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/wait.h>
 
@@ -845,6 +846,8 @@ typedef struct { /* a lock for the state machine, used for multi-threading
   fio_defer_queue_block_s *reader;
   /* current active block to push tasks */
   fio_defer_queue_block_s *writer;
+  /* the number of tasks waiting in the queue (protected by the lock) */
+  size_t count;
   /* static, built-in, queue */
   fio_defer_queue_block_s static_queue;
 } fio_task_queue_s;
@@ -858,6 +861,55 @@ static fio_task_queue_s task_queue_urgent = {
     .reader = &task_queue_urgent.static_queue,
     .writer = &task_queue_urgent.static_queue};
 
+/* *****************************************************************************
+Reactor Statistics - per thread counters (see `fio_stats`)
+***************************************************************************** */
+
+#ifndef FIO_STATS_THREAD_LIMIT
+/* threads beyond this limit share the last (atomic) counter slot */
+#define FIO_STATS_THREAD_LIMIT 64
+#endif
+
+/* a cache line per thread, so counting doesn't invalidate other threads */
+typedef struct {
+  size_t tasks;
+  uint8_t padding_[64 - sizeof(size_t)];
+} fio_stats_thread_s;
+
+static fio_stats_thread_s fio_stats_threads[FIO_STATS_THREAD_LIMIT];
+static size_t fio_stats_thread_count;
+static __thread fio_stats_thread_s *fio_stats_thread;
+
+/* reactor cycle data, only written by the (single) cycling task */
+static struct {
+  uint64_t started; /* last cycle's starting time (microseconds) */
+  uint64_t polled;  /* the time the last cycle's polling ended */
+  size_t cycles;
+  size_t cycle_time;
+  size_t cycle_lag;
+} fio_stats_reactor;
+
+/* returns the monotonic time in microseconds */
+static inline uint64_t fio_stats_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000) + (t.tv_nsec / 1000);
+}
+
+/* counts a performed task in the calling thread's slot */
+static inline void fio_stats_count_task(void) {
+  if (!fio_stats_thread) {
+    size_t i = fio_atomic_add(&fio_stats_thread_count, 1) - 1;
+    if (i >= FIO_STATS_THREAD_LIMIT)
+      i = FIO_STATS_THREAD_LIMIT - 1;
+    fio_stats_thread = fio_stats_threads + i;
+  }
+  if (fio_stats_thread == fio_stats_threads + (FIO_STATS_THREAD_LIMIT - 1))
+    fio_atomic_add(&fio_stats_thread->tasks, 1);
+  else
+    ++fio_stats_thread->tasks;
+}
+
 /* *****************************************************************************
 Internal Task API
 ***************************************************************************** */
@@ -900,6 +952,7 @@ static inline void fio_defer_push_task_fn(fio_defer_task_s task,
 
   /* place task and finish */
   queue->writer->tasks[queue->writer->write++] = task;
+  ++queue->count;
   /* cycle buffer */
   if (queue->writer->write == DEFER_QUEUE_BLOCK_COUNT) {
     queue->writer->write = 0;
@@ -942,6 +995,7 @@ static inline fio_defer_task_s fio_defer_pop_task(fio_task_queue_s *queue) {
     goto finish;
   /* collect task */
   ret = queue->reader->tasks[queue->reader->read++];
+  --queue->count;
   /* cycle */
   if (queue->reader->read == DEFER_QUEUE_BLOCK_COUNT) {
     queue->reader->read = 0;
@@ -990,6 +1044,7 @@ static inline void fio_defer_clear_tasks_for_queue(fio_task_queue_s *queue) {
   }
   queue->static_queue = (fio_defer_queue_block_s){.next = NULL};
   queue->reader = queue->writer = &queue->static_queue;
+  queue->count = 0;
   fio_unlock(&queue->lock);
 }
 
@@ -1002,6 +1057,7 @@ fio_defer_perform_single_task_for_queue(fio_task_queue_s *queue) {
   if (!task.func)
     return -1;
   task.func(task.arg1, task.arg2);
+  fio_stats_count_task();
   return 0;
 }
 
@@ -1017,6 +1073,11 @@ static void fio_defer_on_fork(void) {
 #if FIO_USE_URGENT_QUEUE
   task_queue_urgent.lock = FIO_LOCK_INIT;
 #endif
+  /* statistics are per process, the forking thread takes the first slot */
+  memset(fio_stats_threads, 0, sizeof(fio_stats_threads));
+  memset(&fio_stats_reactor, 0, sizeof(fio_stats_reactor));
+  fio_stats_thread_count = 1;
+  fio_stats_thread = fio_stats_threads;
 }
 
 /* *****************************************************************************
@@ -1726,8 +1787,11 @@ static size_t fio_poll(void) {
         epoll_wait(internal[j].data.fd, events, FIO_POLL_MAX_EVENTS, 0);
     if (active_count > 0) {
       for (int i = 0; i < active_count; i++) {
-        if (events[i].events & (~(EPOLLIN | EPOLLOUT))) {
+        if ((events[i].events & EPOLLERR) ||
+            !(events[i].events & (EPOLLIN | EPOLLOUT))) {
           // errors are hendled as disconnections (on_close)
+          // a hang up that's still readable (or writable) is left to the
+          // read / write calls, so data sent before the hang up isn't lost
           fio_force_close_in_poll(fd2uuid(events[i].data.fd));
         } else {
           // no error, then it's an active event(s)
@@ -2165,6 +2229,11 @@ static void deferred_on_ready_usr(void *arg, void *arg2) {
       return;
     goto postpone;
   }
+  if (!uuid_is_valid(arg)) {
+    /* the fd was closed and reused, the protocol belongs to a new uuid */
+    protocol_unlock(pr, FIO_PR_LOCK_WRITE);
+    return;
+  }
   pr->on_ready((intptr_t)arg, pr);
   protocol_unlock(pr, FIO_PR_LOCK_WRITE);
   return;
@@ -2202,15 +2271,23 @@ static void deferred_on_data(void *uuid, void *arg2) {
     }
     goto postpone;
   }
+  if (!uuid_is_valid(uuid)) {
+    /* the fd was closed and reused, the protocol belongs to a new uuid */
+    protocol_unlock(pr, FIO_PR_LOCK_TASK);
+    return;
+  }
   fio_unlock(&uuid_data(uuid).scheduled);
   pr->on_data((intptr_t)uuid, pr);
   protocol_unlock(pr, FIO_PR_LOCK_TASK);
-  if (!fio_trylock(&uuid_data(uuid).scheduled)) {
+  /* `on_data` might have closed the uuid, so its fd might be reused by now */
+  if (uuid_is_valid(uuid) && !fio_trylock(&uuid_data(uuid).scheduled)) {
     fio_poll_add_read(fio_uuid2fd((intptr_t)uuid));
   }
   return;
 
 postpone:
+  if (!uuid_is_valid(uuid))
+    return;
   if (arg2) {
     /* the event is being forced, so force rescheduling */
     fio_defer_push_task(deferred_on_data, (void *)uuid, (void *)1);
@@ -2234,8 +2311,16 @@ static void deferred_ping(void *arg, void *arg2) {
     return;
   }
   fio_protocol_s *pr = protocol_try_lock(fio_uuid2fd(arg), FIO_PR_LOCK_WRITE);
-  if (!pr)
+  if (!pr) {
+    if (!uuid_is_valid(arg))
+      return;
     goto postpone;
+  }
+  if (!uuid_is_valid(arg)) {
+    /* the fd was closed and reused, the protocol belongs to a new uuid */
+    protocol_unlock(pr, FIO_PR_LOCK_WRITE);
+    return;
+  }
   pr->ping((intptr_t)arg, pr);
   protocol_unlock(pr, FIO_PR_LOCK_WRITE);
   return;
@@ -2971,13 +3056,13 @@ ssize_t fio_flush(intptr_t uuid) {
     goto attacked;
   }
 
+  /* the last packet was written, drain the rw hook's internal buffer */
+  if (!uuid_data(uuid).packet)
+    goto flush_rw_hook;
+
   /* end critical section */
   fio_unlock(&uuid_data(uuid).sock_lock);
 
-  /* test for fio_close marker */
-  if (!uuid_data(uuid).packet && uuid_data(uuid).close)
-    goto closed;
-
   /* return state */
   return uuid_data(uuid).open && uuid_data(uuid).packet != NULL;
 
@@ -2992,8 +3077,12 @@ closed:
 flush_rw_hook:
   flushed = uuid_data(uuid).rw_hooks->flush(uuid, uuid_data(uuid).rw_udata);
   fio_unlock(&uuid_data(uuid).sock_lock);
-  if (!flushed)
+  if (!flushed) {
+    /* test for fio_close marker */
+    if (uuid_data(uuid).close && !uuid_data(uuid).packet)
+      goto closed;
     return 0;
+  }
   if (flushed < 0) {
     goto test_errno;
   }
@@ -3658,6 +3747,101 @@ Section Start Marker
 
 ***************************************************************************** */
 
+/* *****************************************************************************
+Reactor Statistics
+***************************************************************************** */
+
+/**
+ * Samples the reactor's state for the current process.
+ */
+fio_stats_s fio_stats(void) {
+  fio_stats_s s = {
+      .cycles = fio_stats_reactor.cycles,
+      .cycle_time = fio_stats_reactor.cycle_time,
+      .cycle_lag = fio_stats_reactor.cycle_lag,
+      .queue_normal = task_queue_normal.count,
+#if FIO_USE_URGENT_QUEUE
+      .queue_urgent = task_queue_urgent.count,
+#endif
+      .slowest = -1,
+  };
+  size_t threads = fio_stats_thread_count;
+  if (threads > FIO_STATS_THREAD_LIMIT)
+    threads = FIO_STATS_THREAD_LIMIT;
+  for (size_t i = 0; i < threads; ++i)
+    s.tasks += fio_stats_threads[i].tasks;
+
+  fio_lock(&fio_timer_lock);
+  FIO_LS_EMBD_FOR(&fio_timers, node) { ++s.timers; }
+  fio_unlock(&fio_timer_lock);
+
+  if (!fio_data)
+    return s;
+  for (size_t i = 0; i <= fio_data->max_protocol_fd; ++i) {
+    if (!fd_data(i).open)
+      continue;
+    ++s.open;
+    if (fd_data(i).protocol)
+      ++s.attached;
+    if (fd_data(i).close)
+      ++s.closing;
+    if (!fd_data(i).packet)
+      continue;
+    ++s.writing;
+    size_t count = 0;
+    fio_lock(&fd_data(i).sock_lock);
+    for (fio_packet_s *p = fd_data(i).packet; p; p = p->next) {
+      s.pending_bytes += p->length;
+      ++count;
+    }
+    fio_unlock(&fd_data(i).sock_lock);
+    s.pending_packets += count;
+    if (count > s.slowest_pending) {
+      s.slowest_pending = count;
+      s.slowest = fd2uuid(i);
+    }
+  }
+  return s;
+}
+
+/**
+ * Logs the reactor's statistics (see `fio_stats`) using `FIO_LOG_INFO`.
+ */
+void fio_stats_log(void) {
+  static fio_lock_i lock = FIO_LOCK_INIT;
+  static fio_stats_s last;
+  static pid_t last_pid;
+  fio_stats_s s = fio_stats();
+  fio_lock(&lock);
+  if (last_pid != getpid()) {
+    /* counters restart after forking */
+    last = (fio_stats_s){.cycles = 0};
+    last_pid = getpid();
+  }
+  size_t cycles = s.cycles - last.cycles;
+  size_t tasks = s.tasks - last.tasks;
+  last = s;
+  fio_unlock(&lock);
+  FIO_LOG_INFO("(%d) reactor: %zu cycles, %.1f tasks/cycle, cycle %zuus "
+               "(lag %zuus), queue %zu urgent / %zu normal, %zu timers",
+               (int)getpid(), cycles,
+               (cycles ? ((double)tasks / cycles) : (double)tasks),
+               s.cycle_time, s.cycle_lag, s.queue_urgent, s.queue_normal,
+               s.timers);
+  FIO_LOG_INFO("(%d) connections: %zu open, %zu attached, %zu writing, %zu "
+               "closing, %zu bytes in %zu packets pending (slowest: %zu "
+               "packets)",
+               (int)getpid(), s.open, s.attached, s.writing, s.closing,
+               s.pending_bytes, s.pending_packets, s.slowest_pending);
+}
+
+#if FIO_STATS_INTERVAL
+static void fio_stats_log_task(void *ignr_) {
+  fio_stats_log();
+  (void)ignr_;
+}
+#endif
+
 static void fio_cluster_signal_children(void);
 
 static void fio_review_timeout(void *arg, void *ignr) {
@@ -3707,6 +3891,13 @@ reschedule:
 static void fio_cycle_schedule_events(void) {
   static int idle = 0;
   static time_t last_to_review = 0;
+  uint64_t started = fio_stats_now();
+  if (fio_stats_reactor.started) {
+    fio_stats_reactor.cycle_time = started - fio_stats_reactor.started;
+    fio_stats_reactor.cycle_lag = started - fio_stats_reactor.polled;
+  }
+  fio_stats_reactor.started = started;
+  ++fio_stats_reactor.cycles;
   fio_mark_time();
   fio_timer_schedule();
   if (fio_signal_children_flag) {
@@ -3715,6 +3906,7 @@ static void fio_cycle_schedule_events(void) {
     fio_cluster_signal_children();
   }
   int events = fio_poll();
+  fio_stats_reactor.polled = fio_stats_now();
   if (events < 0) {
     return;
   }
@@ -3777,6 +3969,11 @@ static void fio_worker_startup(void) {
   /* require timeout review */
   fio_data->need_review = 1;
 
+#if FIO_STATS_INTERVAL
+  if (fio_data->is_worker)
+    fio_run_every(FIO_STATS_INTERVAL, 0, fio_stats_log_task, NULL, NULL);
+#endif
+
   /* the cycle task will loop by re-scheduling until it's time to finish */
   fio_defer_push_task(fio_cycle, NULL, NULL);
 
@@ -3956,6 +4153,465 @@ Section Start Marker
 
 
 
+                              Asynchronous Logging
+
+
+
+
+
+
+
+
+
+
+
+***************************************************************************** */
+
+#if FIO_LOG_ASYNC_RING_SIZE & (FIO_LOG_ASYNC_RING_SIZE - 1)
+#error FIO_LOG_ASYNC_RING_SIZE must be a power of 2
+#endif
+
+/* the maximal number of rings written by a single `writev` call */
+#define FIO_LOG_ASYNC_BATCH 32
+/* how often a log file is tested for rotation while idle (milliseconds) */
+#define FIO_LOG_ASYNC_ROTATION_TEST 1000
+
+/* a per-thread (single producer, single consumer) ring buffer */
+typedef struct fio_log_ring_s {
+  struct fio_log_ring_s *next;
+  volatile size_t head; /* the number of bytes logged by the thread */
+  volatile size_t tail; /* the number of bytes written by the writer thread */
+  fio_lock_i in_use;    /* set while the ring is owned by a thread */
+  /* set while the owning thread writes a message (see `fio_log_async_stop`) */
+  volatile uint8_t writing;
+  char buf[FIO_LOG_ASYNC_RING_SIZE];
+} fio_log_ring_s;
+
+static struct {
+  fio_log_ring_s *volatile rings;
+  char *filename;
+  void *thread;
+  size_t dropped;
+  size_t dropped_reported;
+  struct sigaction old_sig_hup;
+  pthread_key_t key;
+  int fd;
+  int wake[2];     /* a pipe used to wake the writer thread */
+  fio_lock_i lock; /* protects the ring list */
+  volatile uint8_t active;
+  volatile uint8_t running;
+  volatile uint8_t reopen;
+  volatile uint8_t sleeping; /* set while the writer waits for the pipe */
+  uint8_t block;
+  uint8_t initialized;
+} fio_log_async_data = {.fd = -1, .wake = {-1, -1}, .lock = FIO_LOCK_INIT};
+
+static __thread fio_log_ring_s *fio_log_ring;
+
+/* wakes the writer thread (async signal safe) */
+static void fio_log_async_wake(void) {
+  int old_errno = errno;
+  if (fio_log_async_data.wake[1] != -1 &&
+      write(fio_log_async_data.wake[1], "", 1) < 0) {
+    /* a full pipe means the writer has a pending wakeup anyway */
+  }
+  errno = old_errno;
+}
+
+/* (re)creates the wakeup pipe */
+static int fio_log_async_pipe(void) {
+  if (fio_log_async_data.wake[0] != -1) {
+    close(fio_log_async_data.wake[0]);
+    close(fio_log_async_data.wake[1]);
+    fio_log_async_data.wake[0] = fio_log_async_data.wake[1] = -1;
+  }
+  int fds[2];
+  if (pipe(fds))
+    return -1;
+  fio_set_non_block(fds[0]);
+  fio_set_non_block(fds[1]);
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  fio_log_async_data.wake[0] = fds[0];
+  fio_log_async_data.wake[1] = fds[1];
+  return 0;
+}
+
+/* releases a ring when the thread that owns it exits */
+static void fio_log_ring_release(void *r) {
+  fio_unlock(&((fio_log_ring_s *)r)->in_use);
+}
+
+/* assigns a ring to the current thread, reusing rings of exited threads */
+static fio_log_ring_s *fio_log_ring_claim(void) {
+  fio_log_ring_s *r;
+  fio_lock(&fio_log_async_data.lock);
+  for (r = fio_log_async_data.rings; r; r = r->next) {
+    if (!fio_trylock(&r->in_use))
+      goto found;
+  }
+  r = calloc(1, sizeof(*r));
+  if (!r) {
+    fio_unlock(&fio_log_async_data.lock);
+    return NULL;
+  }
+  fio_trylock(&r->in_use);
+  r->next = fio_log_async_data.rings;
+  /* the writer thread reads the list without locking */
+  (void)fio_atomic_xchange(&fio_log_async_data.rings, r);
+found:
+  fio_unlock(&fio_log_async_data.lock);
+  pthread_setspecific(fio_log_async_data.key, r);
+  fio_log_ring = r;
+  return r;
+}
+
+/**
+ * Writes a (complete) log message, asynchronously if `fio_log_async_start` was
+ * called. Otherwise, the data is written to `stderr`.
+ */
+void fio_log_write(const char *data, size_t len) {
+  fio_log_ring_s *r = fio_log_ring;
+  if (!fio_log_async_data.active || (!r && !(r = fio_log_ring_claim())))
+    goto write_sync;
+  /* `fio_log_async_stop` waits for the message once `writing` is set */
+  (void)fio_atomic_xchange(&r->writing, 1);
+  if (!fio_log_async_data.active) {
+    (void)fio_atomic_xchange(&r->writing, 0);
+    goto write_sync;
+  }
+  if (len > (FIO_LOG_ASYNC_RING_SIZE >> 1))
+    len = FIO_LOG_ASYNC_RING_SIZE >> 1; /* truncate oversized messages */
+  const size_t head = r->head;
+  while (FIO_LOG_ASYNC_RING_SIZE - (head - fio_atomic_add(&r->tail, 0)) <
+         len) {
+    if (!fio_log_async_data.block || !fio_log_async_data.running) {
+      fio_atomic_add(&fio_log_async_data.dropped, 1);
+      (void)fio_atomic_xchange(&r->writing, 0);
+      return;
+    }
+    fio_reschedule_thread();
+  }
+  const size_t pos = head & (FIO_LOG_ASYNC_RING_SIZE - 1);
+  const size_t first = (FIO_LOG_ASYNC_RING_SIZE - pos) < len
+                           ? (FIO_LOG_ASYNC_RING_SIZE - pos)
+                           : len;
+  memcpy(r->buf + pos, data, first);
+  if (first < len)
+    memcpy(r->buf, data + first, len - first);
+  /* publish the message (the barrier orders the copy before the update) */
+  (void)fio_atomic_xchange(&r->head, head + len);
+  (void)fio_atomic_xchange(&r->writing, 0);
+  /* the writer tests the rings after setting `sleeping`, so one is seen */
+  if (fio_log_async_data.sleeping &&
+      fio_atomic_xchange(&fio_log_async_data.sleeping, 0))
+    fio_log_async_wake();
+  return;
+write_sync:
+  fwrite(data, len, 1, stderr);
+}
+
+/* writes the whole `iov` array, retrying after partial writes */
+static void fio_log_async_writev(struct iovec *iov, int count) {
+  while (count) {
+    ssize_t w = writev(fio_log_async_data.fd, iov, count);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        fio_throttle_thread(1000000);
+        continue;
+      }
+      return; /* the data is lost */
+    }
+    while (count && (size_t)w >= iov->iov_len) {
+      w -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count) {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+}
+
+/* tests if any of the rings has data that wasn't written yet */
+static int fio_log_async_pending(void) {
+  for (fio_log_ring_s *r = fio_log_async_data.rings; r; r = r->next) {
+    if (fio_atomic_add(&r->head, 0) != r->tail)
+      return 1;
+  }
+  return 0;
+}
+
+/* writes all pending log data, returns the number of bytes written */
+static size_t fio_log_async_drain(void) {
+  struct iovec iov[(FIO_LOG_ASYNC_BATCH << 1) + 1];
+  fio_log_ring_s *rings[FIO_LOG_ASYNC_BATCH];
+  size_t heads[FIO_LOG_ASYNC_BATCH];
+  size_t total = 0;
+  fio_log_ring_s *r = fio_log_async_data.rings;
+  while (r) {
+    int count = 0;
+    int ring_count = 0;
+    /* collect a batch of rings with pending data */
+    for (; r && ring_count < FIO_LOG_ASYNC_BATCH; r = r->next) {
+      const size_t head = fio_atomic_add(&r->head, 0);
+      const size_t tail = r->tail;
+      if (head == tail)
+        continue;
+      const size_t pos = tail & (FIO_LOG_ASYNC_RING_SIZE - 1);
+      const size_t len = head - tail;
+      if (pos + len <= FIO_LOG_ASYNC_RING_SIZE) {
+        iov[count++] = (struct iovec){.iov_base = r->buf + pos, .iov_len = len};
+      } else {
+        iov[count++] = (struct iovec){.iov_base = r->buf + pos,
+                                      .iov_len = FIO_LOG_ASYNC_RING_SIZE - pos};
+        iov[count++] =
+            (struct iovec){.iov_base = r->buf,
+                           .iov_len = len - (FIO_LOG_ASYNC_RING_SIZE - pos)};
+      }
+      rings[ring_count] = r;
+      heads[ring_count++] = head;
+      total += len;
+    }
+    if (!ring_count)
+      break;
+    fio_log_async_writev(iov, count);
+    /* release the space for the logging threads */
+    for (int i = 0; i < ring_count; ++i)
+      (void)fio_atomic_xchange(&rings[i]->tail, heads[i]);
+  }
+  if (fio_log_async_data.dropped != fio_log_async_data.dropped_reported) {
+    char tmp[128];
+    const size_t dropped = fio_log_async_data.dropped;
+    int len = snprintf(tmp, sizeof(tmp),
+                       "WARNING: %zu log messages dropped (buffer full).\n",
+                       dropped - fio_log_async_data.dropped_reported);
+    fio_log_async_data.dropped_reported = dropped;
+    if (len > 0) {
+      iov[0] = (struct iovec){.iov_base = tmp, .iov_len = (size_t)len};
+      fio_log_async_writev(iov, 1);
+    }
+  }
+  return total;
+}
+
+/* (re)opens the log file, keeping the existing file on error */
+static int fio_log_async_open(void) {
+  if (!fio_log_async_data.filename) {
+    fio_log_async_data.fd = fileno(stderr);
+    return 0;
+  }
+  int fd = open(fio_log_async_data.filename,
+                O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1)
+    return -1;
+  int old = fio_log_async_data.fd;
+  fio_log_async_data.fd = fd;
+  if (old != -1)
+    close(old);
+  return 0;
+}
+
+/* tests if the log file was moved or removed (i.e., by `logrotate`) */
+static int fio_log_async_is_rotated(void) {
+  struct stat f, o;
+  if (stat(fio_log_async_data.filename, &f))
+    return 1;
+  if (fstat(fio_log_async_data.fd, &o))
+    return 1;
+  return (f.st_ino != o.st_ino || f.st_dev != o.st_dev);
+}
+
+/* the writer thread */
+static void *fio_log_async_thread(void *ignr_) {
+  time_t last_test = time(NULL);
+  char tmp[64];
+  while (fio_log_async_data.running) {
+    fio_log_async_drain();
+    if (fio_log_async_data.filename) {
+      /* workers can't always receive the SIGHUP, so rotation is tested */
+      time_t now = time(NULL);
+      if (fio_log_async_data.reopen ||
+          (now != last_test && fio_log_async_is_rotated())) {
+        fio_log_async_data.reopen = 0;
+        fio_log_async_open();
+      }
+      last_test = now;
+    }
+    /* sleep until a logging thread (or a signal) writes to the pipe */
+    (void)fio_atomic_xchange(&fio_log_async_data.sleeping, 1);
+    if (fio_log_async_pending() || fio_log_async_data.reopen ||
+        !fio_log_async_data.running) {
+      fio_log_async_data.sleeping = 0;
+      continue;
+    }
+    struct pollfd pfd = {.fd = fio_log_async_data.wake[0], .events = POLLIN};
+    poll(&pfd, 1,
+         (fio_log_async_data.filename ? FIO_LOG_ASYNC_ROTATION_TEST : -1));
+    fio_log_async_data.sleeping = 0;
+    while (read(fio_log_async_data.wake[0], tmp, sizeof(tmp)) > 0)
+      ;
+  }
+  fio_log_async_drain();
+  return NULL;
+  (void)ignr_;
+}
+
+/* handles SIGHUP, requesting the log file to be reopened */
+static void fio_log_async_on_sighup(int sig, siginfo_t *info, void *ctx) {
+  struct sigaction *old = &fio_log_async_data.old_sig_hup;
+  fio_log_async_data.reopen = 1;
+  fio_log_async_wake();
+  /* chain to the handler that was installed before us */
+  if (old->sa_flags & SA_SIGINFO) {
+    if (old->sa_sigaction)
+      old->sa_sigaction(sig, info, ctx);
+  } else if (old->sa_handler != SIG_IGN && old->sa_handler != SIG_DFL) {
+    old->sa_handler(sig);
+  }
+}
+
+/* restarts the writer thread in a forked worker */
+static void fio_log_async_on_fork(void *ignr_) {
+  if (!fio_log_async_data.active)
+    return;
+  /* the parent process writes any data that was pending during the fork */
+  fio_log_async_data.lock = FIO_LOCK_INIT;
+  for (fio_log_ring_s *r = fio_log_async_data.rings; r; r = r->next) {
+    r->tail = r->head;
+    r->in_use = FIO_LOCK_INIT;
+    r->writing = 0;
+  }
+  if (fio_log_ring)
+    fio_trylock(&fio_log_ring->in_use);
+  /* the parent's writer thread would steal our wakeups */
+  fio_log_async_data.sleeping = 0;
+  if (fio_log_async_pipe()) {
+    fio_log_async_data.active = 0;
+    fio_log_async_data.running = 0;
+    return;
+  }
+  fio_log_async_data.thread = fio_thread_new(fio_log_async_thread, NULL);
+  if (!fio_log_async_data.thread) {
+    fio_log_async_data.active = 0;
+    fio_log_async_data.running = 0;
+  }
+  (void)ignr_;
+}
+
+static void fio_log_async_on_exit(void *ignr_) {
+  fio_log_async_stop();
+  (void)ignr_;
+}
+
+/**
+ * Starts asynchronous logging for the process (and any forked workers).
+ *
+ * Returns -1 on error (i.e., the file couldn't be opened) and 0 on success.
+ */
+int fio_log_async_start FIO_IGNORE_MACRO(fio_log_async_args_s args) {
+  if (fio_log_async_data.active)
+    fio_log_async_stop();
+  if (!fio_log_async_data.initialized) {
+    if (pthread_key_create(&fio_log_async_data.key, fio_log_ring_release))
+      return -1;
+    if (fio_log_async_pipe()) {
+      pthread_key_delete(fio_log_async_data.key);
+      return -1;
+    }
+    fio_log_async_data.initialized = 1;
+    fio_state_callback_add(FIO_CALL_IN_CHILD, fio_log_async_on_fork, NULL);
+    fio_state_callback_add(FIO_CALL_AT_EXIT, fio_log_async_on_exit, NULL);
+  }
+  if (args.filename) {
+    size_t len = strlen(args.filename);
+    fio_log_async_data.filename = malloc(len + 1);
+    FIO_ASSERT_ALLOC(fio_log_async_data.filename);
+    memcpy(fio_log_async_data.filename, args.filename, len + 1);
+  }
+  if (fio_log_async_open()) {
+    FIO_LOG_ERROR("couldn't open log file %s", args.filename);
+    free(fio_log_async_data.filename);
+    fio_log_async_data.filename = NULL;
+    return -1;
+  }
+  if (fio_log_async_data.filename) {
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_sigaction = fio_log_async_on_sighup;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigaction(SIGHUP, &act, &fio_log_async_data.old_sig_hup);
+  }
+  fio_log_async_data.block = args.block;
+  fio_log_async_data.running = 1;
+  fio_log_async_data.thread = fio_thread_new(fio_log_async_thread, NULL);
+  if (!fio_log_async_data.thread) {
+    fio_log_async_data.running = 0;
+    return -1;
+  }
+  fio_log_async_data.active = 1;
+  return 0;
+}
+
+/**
+ * Writes any pending log messages and stops asynchronous logging (log messages
+ * will be written to `stderr` directly).
+ */
+void fio_log_async_stop(void) {
+  if (!fio_log_async_data.active)
+    return;
+  /* stop new writes, then wait for messages that are still being written */
+  (void)fio_atomic_xchange(&fio_log_async_data.active, 0);
+  for (fio_log_ring_s *r = fio_log_async_data.rings; r; r = r->next) {
+    while (fio_atomic_add(&r->writing, 0))
+      fio_reschedule_thread(); /* the writer thread is still running */
+  }
+  fio_log_async_data.running = 0;
+  fio_log_async_wake();
+  if (fio_log_async_data.thread)
+    fio_thread_join(fio_log_async_data.thread);
+  fio_log_async_data.thread = NULL;
+  /* the writer thread is gone, write whatever it left in the rings */
+  fio_log_async_drain();
+  if (fio_log_async_data.filename) {
+    /* restore the previous handler, unless ours was replaced since */
+    struct sigaction cur;
+    if (!sigaction(SIGHUP, NULL, &cur) && (cur.sa_flags & SA_SIGINFO) &&
+        cur.sa_sigaction == fio_log_async_on_sighup)
+      sigaction(SIGHUP, &fio_log_async_data.old_sig_hup, NULL);
+    close(fio_log_async_data.fd);
+    free(fio_log_async_data.filename);
+    fio_log_async_data.filename = NULL;
+  }
+  fio_log_async_data.fd = -1;
+}
+
+/** Reopens the log file (if any), i.e., after the log file was rotated. */
+void fio_log_async_reopen(void) {
+  fio_log_async_data.reopen = 1;
+  fio_log_async_wake();
+}
+
+/** Returns the number of log messages dropped due to full buffers. */
+size_t fio_log_async_dropped(void) { return fio_log_async_data.dropped; }
+
+/* *****************************************************************************
+Section Start Marker
+
+
+
+
+
+
+
+
+
+
+
 
 
 
@@ -4260,23 +4916,41 @@ size_t fio_ltoa(char *dest, int64_t num, uint8_t base) {
     break;
   }
   /* Base 10, the default base */
-
-  if (num < 0) {
-    dest[len++] = '-';
-    num = 0 - num;
-  }
-  uint64_t l = 0;
-  while (num) {
-    uint64_t t = num / 10;
-    buf[l++] = '0' + (num - (t * 10));
-    num = t;
-  }
-  while (l) {
-    --l;
-    dest[len++] = buf[l];
+  {
+    static const char digit_pairs[201] = "00010203040506070809"
+                                         "10111213141516171819"
+                                         "20212223242526272829"
+                                         "30313233343536373839"
+                                         "40414243444546474849"
+                                         "50515253545556575859"
+                                         "60616263646566676869"
+                                         "70717273747576777879"
+                                         "80818283848586878889"
+                                         "90919293949596979899";
+    uint64_t n = (uint64_t)num;
+    if (num < 0) {
+      dest[len++] = '-';
+      n = 0 - n;
+    }
+    /* write two digits at a time, from the end of the buffer */
+    size_t l = sizeof(buf);
+    while (n >= 100) {
+      const size_t i = (n % 100) << 1;
+      n /= 100;
+      buf[--l] = digit_pairs[i + 1];
+      buf[--l] = digit_pairs[i];
+    }
+    if (n >= 10) {
+      buf[--l] = digit_pairs[(n << 1) + 1];
+      buf[--l] = digit_pairs[(n << 1)];
+    } else {
+      buf[--l] = '0' + n;
+    }
+    memcpy(dest + len, buf + l, sizeof(buf) - l);
+    len += sizeof(buf) - l;
+    dest[len] = 0;
+    return len;
   }
-  dest[len] = 0;
-  return len;
 
 zero:
   switch (base) {
@@ -4299,6 +4973,263 @@ zero:
   return len;
 }
 
+/* *****************************************************************************
+Float to String - Grisu2 (shortest representation that round-trips)
+
+Based on Florian Loitsch's "Printing Floating-Point Numbers Quickly and
+Accurately with Integers" (2010), following Milo Yip's implementation. The
+output is the shortest round-trip representation for ~99.9% of the values and
+is always round-trip safe.
+***************************************************************************** */
+
+/* a "do it yourself" floating point: f * 2^e */
+typedef struct {
+  uint64_t f;
+  int e;
+} fio_diy_fp_s;
+
+/* normalized 64 bit approximations of 10^k, k = -348, -340, ..., 340 */
+static const uint64_t fio_grisu_cached_f[] = {
+    0xFA8FD5A0081C0288, 0xBAAEE17FA23EBF76, 0x8B16FB203055AC76,
+    0xCF42894A5DCE35EA, 0x9A6BB0AA55653B2D, 0xE61ACF033D1A45DF,
+    0xAB70FE17C79AC6CA, 0xFF77B1FCBEBCDC4F, 0xBE5691EF416BD60C,
+    0x8DD01FAD907FFC3C, 0xD3515C2831559A83, 0x9D71AC8FADA6C9B5,
+    0xEA9C227723EE8BCB, 0xAECC49914078536D, 0x823C12795DB6CE57,
+    0xC21094364DFB5637, 0x9096EA6F3848984F, 0xD77485CB25823AC7,
+    0xA086CFCD97BF97F4, 0xEF340A98172AACE5, 0xB23867FB2A35B28E,
+    0x84C8D4DFD2C63F3B, 0xC5DD44271AD3CDBA, 0x936B9FCEBB25C996,
+    0xDBAC6C247D62A584, 0xA3AB66580D5FDAF6, 0xF3E2F893DEC3F126,
+    0xB5B5ADA8AAFF80B8, 0x87625F056C7C4A8B, 0xC9BCFF6034C13053,
+    0x964E858C91BA2655, 0xDFF9772470297EBD, 0xA6DFBD9FB8E5B88F,
+    0xF8A95FCF88747D94, 0xB94470938FA89BCF, 0x8A08F0F8BF0F156B,
+    0xCDB02555653131B6, 0x993FE2C6D07B7FAC, 0xE45C10C42A2B3B06,
+    0xAA242499697392D3, 0xFD87B5F28300CA0E, 0xBCE5086492111AEB,
+    0x8CBCCC096F5088CC, 0xD1B71758E219652C, 0x9C40000000000000,
+    0xE8D4A51000000000, 0xAD78EBC5AC620000, 0x813F3978F8940984,
+    0xC097CE7BC90715B3, 0x8F7E32CE7BEA5C70, 0xD5D238A4ABE98068,
+    0x9F4F2726179A2245, 0xED63A231D4C4FB27, 0xB0DE65388CC8ADA8,
+    0x83C7088E1AAB65DB, 0xC45D1DF942711D9A, 0x924D692CA61BE758,
+    0xDA01EE641A708DEA, 0xA26DA3999AEF774A, 0xF209787BB47D6B85,
+    0xB454E4A179DD1877, 0x865B86925B9BC5C2, 0xC83553C5C8965D3D,
+    0x952AB45CFA97A0B3, 0xDE469FBD99A05FE3, 0xA59BC234DB398C25,
+    0xF6C69A72A3989F5C, 0xB7DCBF5354E9BECE, 0x88FCF317F22241E2,
+    0xCC20CE9BD35C78A5, 0x98165AF37B2153DF, 0xE2A0B5DC971F303A,
+    0xA8D9D1535CE3B396, 0xFB9B7CD9A4A7443C, 0xBB764C4CA7A44410,
+    0x8BAB8EEFB6409C1A, 0xD01FEF10A657842C, 0x9B10A4E5E9913129,
+    0xE7109BFBA19C0C9D, 0xAC2820D9623BF429, 0x80444B5E7AA7CF85,
+    0xBF21E44003ACDD2D, 0x8E679C2F5E44FF8F, 0xD433179D9C8CB841,
+    0x9E19DB92B4E31BA9, 0xEB96BF6EBADF77D9, 0xAF87023B9BF0EE6B,
+};
+/* the binary exponents matching `fio_grisu_cached_f` */
+static const int16_t fio_grisu_cached_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980, -954,
+    -927,  -901,  -874,  -847,  -821,  -794,  -768,  -741,  -715,  -688, -661,
+    -635,  -608,  -582,  -555,  -529,  -502,  -475,  -449,  -422,  -396, -369,
+    -343,  -316,  -289,  -263,  -236,  -210,  -183,  -157,  -130,  -103, -77,
+    -50,   -24,   3,     30,    56,    83,    109,   136,   162,   189,  216,
+    242,   269,   295,   322,   348,   375,   402,   428,   455,   481,  508,
+    534,   561,   588,   614,   641,   667,   694,   720,   747,   774,  800,
+    827,   853,   880,   907,   933,   960,   986,   1013,  1039,  1066,
+};
+
+static const uint64_t fio_grisu_pow10[] = {1ULL,
+                                           10ULL,
+                                           100ULL,
+                                           1000ULL,
+                                           10000ULL,
+                                           100000ULL,
+                                           1000000ULL,
+                                           10000000ULL,
+                                           100000000ULL,
+                                           1000000000ULL,
+                                           10000000000ULL,
+                                           100000000000ULL,
+                                           1000000000000ULL,
+                                           10000000000000ULL,
+                                           100000000000000ULL,
+                                           1000000000000000ULL,
+                                           10000000000000000ULL,
+                                           100000000000000000ULL,
+                                           1000000000000000000ULL,
+                                           10000000000000000000ULL};
+
+static inline fio_diy_fp_s fio_diy_fp_mul(fio_diy_fp_s a, fio_diy_fp_s b) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t p = (__uint128_t)a.f * b.f;
+  uint64_t h = (uint64_t)(p >> 64);
+  h += ((uint64_t)p >> 63); /* round */
+  return (fio_diy_fp_s){.f = h, .e = a.e + b.e + 64};
+#else
+  const uint64_t m32 = 0xFFFFFFFFULL;
+  const uint64_t a_h = a.f >> 32, a_l = a.f & m32;
+  const uint64_t b_h = b.f >> 32, b_l = b.f & m32;
+  const uint64_t hh = a_h * b_h, hl = a_h * b_l, lh = a_l * b_h,
+                 ll = a_l * b_l;
+  uint64_t tmp = (ll >> 32) + (hl & m32) + (lh & m32);
+  tmp += 1ULL << 31; /* round */
+  return (fio_diy_fp_s){.f = hh + (hl >> 32) + (lh >> 32) + (tmp >> 32),
+                        .e = a.e + b.e + 64};
+#endif
+}
+
+static inline fio_diy_fp_s fio_diy_fp_normalize(fio_diy_fp_s v) {
+#if __has_builtin(__builtin_clzll) || defined(__GNUC__)
+  const int s = __builtin_clzll(v.f);
+  v.f <<= s;
+  v.e -= s;
+#else
+  while (!(v.f & ((uint64_t)1 << 63))) {
+    v.f <<= 1;
+    --v.e;
+  }
+#endif
+  return v;
+}
+
+/* rounds the last digit towards the exact value, while staying in range */
+static inline void fio_grisu_round(char *buf, int len, uint64_t delta,
+                                   uint64_t rest, uint64_t ten_kappa,
+                                   uint64_t wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+    buf[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+/* writes the shortest digits for `w` (within the `mp` - `delta` range) */
+static inline int fio_grisu_digits(fio_diy_fp_s w, fio_diy_fp_s mp,
+                                   uint64_t delta, char *buf, int *k) {
+  const fio_diy_fp_s one = {.f = (uint64_t)1 << -mp.e, .e = mp.e};
+  const uint64_t wp_w = mp.f - w.f;
+  uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+  uint64_t p2 = mp.f & (one.f - 1);
+  int len = 0;
+  int kappa = 10;
+  while (kappa > 1 && p1 < fio_grisu_pow10[kappa - 1])
+    --kappa;
+  while (kappa > 0) {
+    const uint32_t p10 = (uint32_t)fio_grisu_pow10[kappa - 1];
+    const uint32_t d = p1 / p10;
+    p1 -= d * p10;
+    if (d || len)
+      buf[len++] = (char)('0' + d);
+    --kappa;
+    const uint64_t tmp = ((uint64_t)p1 << -one.e) + p2;
+    if (tmp <= delta) {
+      *k += kappa;
+      fio_grisu_round(buf, len, delta, tmp, fio_grisu_pow10[kappa] << -one.e,
+                      wp_w);
+      return len;
+    }
+  }
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    const char d = (char)(p2 >> -one.e);
+    if (d || len)
+      buf[len++] = (char)('0' + d);
+    p2 &= one.f - 1;
+    --kappa;
+    if (p2 < delta) {
+      *k += kappa;
+      fio_grisu_round(buf, len, delta, p2, one.f,
+                      (-kappa < 20 ? wp_w * fio_grisu_pow10[-kappa] : 0));
+      return len;
+    }
+  }
+}
+
+/* writes the digits of a positive, finite and non-zero double, sets `k` */
+static int fio_grisu2(double num, char *buf, int *k) {
+  uint64_t u;
+  memcpy(&u, &num, sizeof(u));
+  const int biased_e = (int)((u >> 52) & 0x7FF);
+  fio_diy_fp_s v = {.f = u & 0x000FFFFFFFFFFFFFULL};
+  if (biased_e) {
+    v.f += 0x0010000000000000ULL;
+    v.e = biased_e - 1075;
+  } else {
+    v.e = -1074;
+  }
+  /* the boundaries: the range of values that round to `num` */
+  fio_diy_fp_s pl =
+      fio_diy_fp_normalize((fio_diy_fp_s){.f = (v.f << 1) + 1, .e = v.e - 1});
+  fio_diy_fp_s mi = (v.f == 0x0010000000000000ULL)
+                        ? (fio_diy_fp_s){.f = (v.f << 2) - 1, .e = v.e - 2}
+                        : (fio_diy_fp_s){.f = (v.f << 1) - 1, .e = v.e - 1};
+  mi.f <<= mi.e - pl.e;
+  mi.e = pl.e;
+  /* find a cached power of 10, so the product's exponent is in [-60, -32] */
+  const double dk = (-61 - pl.e) * 0.30102999566398114 + 347;
+  int ki = (int)dk;
+  if (dk - ki > 0.0)
+    ++ki;
+  const unsigned index = (unsigned)((ki >> 3) + 1);
+  const fio_diy_fp_s c = {.f = fio_grisu_cached_f[index],
+                          .e = fio_grisu_cached_e[index]};
+  *k = -(-348 + (int)(index << 3));
+  const fio_diy_fp_s w = fio_diy_fp_mul(fio_diy_fp_normalize(v), c);
+  fio_diy_fp_s wp = fio_diy_fp_mul(pl, c);
+  fio_diy_fp_s wm = fio_diy_fp_mul(mi, c);
+  ++wm.f;
+  --wp.f;
+  return fio_grisu_digits(w, wp, wp.f - wm.f, buf, k);
+}
+
+/* formats Grisu2 digits (`len` digits, times 10^k) as a JSON / JS number */
+static size_t fio_grisu_format(char *buf, int len, int k) {
+  const int kk = len + k; /* 10^(kk-1) <= v < 10^kk */
+  if (len <= kk && kk <= 21) {
+    /* 1234e7 => 12340000000.0 */
+    for (int i = len; i < kk; ++i)
+      buf[i] = '0';
+    buf[kk] = '.';
+    buf[kk + 1] = '0';
+    return (size_t)kk + 2;
+  }
+  if (0 < kk && kk <= 21) {
+    /* 1234e-2 => 12.34 */
+    memmove(buf + kk + 1, buf + kk, (size_t)(len - kk));
+    buf[kk] = '.';
+    return (size_t)len + 1;
+  }
+  if (-6 < kk && kk <= 0) {
+    /* 1234e-6 => 0.001234 */
+    const int offset = 2 - kk;
+    memmove(buf + offset, buf, (size_t)len);
+    buf[0] = '0';
+    buf[1] = '.';
+    for (int i = 2; i < offset; ++i)
+      buf[i] = '0';
+    return (size_t)(len + offset);
+  }
+  /* 1234e30 => 1.234e+33 */
+  size_t pos = 1;
+  if (len > 1) {
+    memmove(buf + 2, buf + 1, (size_t)(len - 1));
+    buf[1] = '.';
+    pos = (size_t)len + 1;
+  }
+  int e = kk - 1;
+  buf[pos++] = 'e';
+  if (e < 0) {
+    buf[pos++] = '-';
+    e = 0 - e;
+  } else {
+    buf[pos++] = '+';
+  }
+  if (e >= 100) {
+    buf[pos++] = (char)('0' + e / 100);
+    e %= 100;
+    buf[pos++] = (char)('0' + e / 10);
+  } else if (e >= 10) {
+    buf[pos++] = (char)('0' + e / 10);
+  }
+  buf[pos++] = (char)('0' + e % 10);
+  return pos;
+}
+
 /**
  * A helper function that converts between a double to a string.
  *
@@ -4309,6 +5240,8 @@ zero:
  * default to base 10. Prefixes aren't added (i.e., no "0x" or "0b" at the
  * beginning of the string).
  *
+ * Base 10 uses the shortest representation that round-trips (Grisu2).
+ *
  * Returns the number of bytes actually written (excluding the NUL
  * terminator).
  */
@@ -4321,6 +5254,28 @@ size_t fio_ftoa(char *dest, double num, uint8_t base) {
     return fio_ltoa(dest, *i, base);
   }
 
+  uint64_t bits;
+  memcpy(&bits, &num, sizeof(bits));
+  if (((bits >> 52) & 0x7FF) != 0x7FF) {
+    /* finite values (not NaN or Infinity) */
+    size_t written = 0;
+    if ((bits >> 63)) {
+      dest[written++] = '-';
+      num = -num;
+    }
+    if (num == 0) {
+      dest[written++] = '0';
+      dest[written++] = '.';
+      dest[written++] = '0';
+    } else {
+      int k;
+      int len = fio_grisu2(num, dest + written, &k);
+      written += fio_grisu_format(dest + written, len, k);
+    }
+    dest[written] = 0;
+    return written;
+  }
+
   size_t written = sprintf(dest, "%g", num);
   uint8_t need_zero = 1;
   char *start = dest;
@@ -4373,6 +5328,15 @@ uintptr_t FIO_TLS_WEAK fio_tls_alpn_count(void *tls) {
   (void)tls;
 }
 
+/**
+ * Returns a number identifying the TLS object's current configuration (0 if
+ * `tls` is NULL).
+ */
+uintptr_t FIO_TLS_WEAK fio_tls_id(void *tls) {
+  return 0;
+  (void)tls;
+}
+
 /**
  * Establishes an SSL/TLS connection as an SSL/TLS Server, using the specified
  * context / settings object.
@@ -5175,6 +6139,7 @@ static int fio_channel_cmp(channel_s *ch1, channel_s *ch2) {
 }
 /* pub/sub channels and core data sets have a long life, so avoid fio_malloc */
 #define FIO_FORCE_MALLOC_TMP 1
+#define FIO_SET_SWISS 1
 #define FIO_SET_NAME fio_ch_set
 #define FIO_SET_OBJ_TYPE channel_s *
 #define FIO_SET_OBJ_COMPARE(o1, o2) fio_channel_cmp((o1), (o2))
@@ -5815,6 +6780,7 @@ finish:
 
 #define CLUSTER_READ_BUFFER 16384
 
+#define FIO_SET_SWISS 1
 #define FIO_SET_NAME fio_sub_hash
 #define FIO_SET_OBJ_TYPE subscription_s *
 #define FIO_SET_KEY_TYPE fio_str_s
@@ -9433,6 +10399,88 @@ FIO_FUNC void fio_timer_test(void) {
   fprintf(stderr, "* passed.\n");
 }
 
+/* *****************************************************************************
+Testing fio_stats
+***************************************************************************** */
+
+FIO_FUNC void fio_stats_test_task(void *arg, void *ignr_) {
+  fio_atomic_add((size_t *)arg, 1);
+  (void)ignr_;
+}
+
+/* blocks the thread until every thread in the pool performed a task */
+FIO_FUNC void fio_stats_test_wait_task(void *arg, void *threads) {
+  fio_atomic_add((size_t *)arg, 1);
+  while (fio_atomic_add((size_t *)arg, 0) < (uintptr_t)threads)
+    fio_reschedule_thread();
+}
+
+FIO_FUNC void fio_stats_test(void) {
+  fprintf(stderr, "=== Testing facil.io reactor statistics (fio_stats)\n");
+  const size_t total = 1024;
+  size_t result = 0;
+  fio_stats_s start = fio_stats();
+  FIO_ASSERT(!start.queue_normal, "tasks were left in the queue (%zu)",
+             start.queue_normal);
+  for (size_t i = 0; i < total; ++i)
+    fio_defer(fio_stats_test_task, &result, NULL);
+  fio_stats_s s = fio_stats();
+  FIO_ASSERT(s.queue_normal == total, "queue depth error (%zu != %zu)",
+             s.queue_normal, total);
+  fio_defer_perform();
+  s = fio_stats();
+  FIO_ASSERT(result == total, "tasks weren't performed (%zu != %zu)", result,
+             total);
+  FIO_ASSERT(!s.queue_normal, "queue depth error after performing (%zu)",
+             s.queue_normal);
+  FIO_ASSERT(s.tasks - start.tasks == total, "task count error (%zu != %zu)",
+             s.tasks - start.tasks, total);
+  fio_stats_log(); /* the first call logs the totals */
+
+  /* timers are counted while waiting and their tasks once scheduled */
+  fio_data->active = 1;
+  result = 0;
+  start = s;
+  FIO_ASSERT(fio_run_every(1000, 1, fio_timer_test_task, &result, NULL) == 0,
+             "Timer creation failure.");
+  s = fio_stats();
+  FIO_ASSERT(s.timers == start.timers + 1, "timer count error (%zu != %zu)",
+             s.timers, start.timers + 1);
+  fio_data->last_cycle.tv_sec += 2;
+  fio_timer_schedule();
+  s = fio_stats();
+  FIO_ASSERT(s.queue_normal == 1, "timer task not in queue (%zu)",
+             s.queue_normal);
+  fio_defer_perform();
+  s = fio_stats();
+  FIO_ASSERT(result == 1, "timer task wasn't performed");
+  FIO_ASSERT(s.timers == start.timers, "finished timer still counted (%zu)",
+             s.timers);
+  FIO_ASSERT(s.tasks - start.tasks >= 1, "timer task wasn't counted");
+  fio_data->active = 0;
+  fio_timer_clear_all();
+
+  /* threads beyond the slot limit share the last (atomic) slot */
+  const size_t threads = FIO_STATS_THREAD_LIMIT + 8;
+  result = 0;
+  start = fio_stats();
+  for (size_t i = 0; i < threads; ++i)
+    fio_defer(fio_stats_test_wait_task, &result, (void *)threads);
+  for (size_t i = threads; i < total * threads; ++i)
+    fio_defer(fio_stats_test_task, &result, NULL);
+  fio_defer_thread_pool_join(fio_defer_thread_pool_new(threads));
+  s = fio_stats();
+  FIO_ASSERT(fio_stats_thread_count > FIO_STATS_THREAD_LIMIT,
+             "thread slots should be exhausted (%zu threads)",
+             fio_stats_thread_count);
+  FIO_ASSERT(result == total * threads, "tasks weren't performed (%zu != %zu)",
+             result, total * threads);
+  FIO_ASSERT(s.tasks - start.tasks == total * threads,
+             "task count error with %zu threads (%zu != %zu)", threads,
+             s.tasks - start.tasks, total * threads);
+  fprintf(stderr, "* passed.\n");
+}
+
 /* *****************************************************************************
 Testing listening socket
 ***************************************************************************** */
@@ -9923,6 +10971,239 @@ FIO_FUNC void fio_set_test(void) {
   }
 }
 
+#define FIO_SET_SWISS 1
+#define FIO_SET_NAME fio_swiss_set_test
+#define FIO_SET_OBJ_TYPE uintptr_t
+#include <fio.h>
+
+#define FIO_SET_SWISS 1
+#define FIO_SET_NAME fio_swiss_hash_test
+#define FIO_SET_KEY_TYPE uintptr_t
+#define FIO_SET_OBJ_TYPE uintptr_t
+#include <fio.h>
+
+#define FIO_SET_SWISS 1
+#define FIO_SET_NAME fio_swiss_attack
+#define FIO_SET_OBJ_COMPARE(a, b) ((a) == (b))
+#define FIO_SET_OBJ_TYPE uintptr_t
+#include <fio.h>
+
+FIO_FUNC void fio_set_swiss_test(void) {
+  fio_swiss_set_test_s s = FIO_SET_INIT;
+  fio_swiss_hash_test_s h = FIO_SET_INIT;
+  fprintf(stderr,
+          "=== Testing Set / Hash Map grouped tags (FIO_SET_SWISS)\n");
+  for (uintptr_t i = 1; i < FIO_SET_TEST_COUNT; ++i) {
+    fio_swiss_set_test_insert(&s, i, i);
+    fio_swiss_hash_test_insert(&h, i, i, i + 1, NULL);
+    FIO_ASSERT(fio_swiss_set_test_find(&s, i, i) == i,
+               "swiss set insertion != find");
+    FIO_ASSERT(fio_swiss_hash_test_find(&h, i, i) == i + 1,
+               "swiss hash insertion != find");
+  }
+  FIO_ASSERT(fio_swiss_set_test_count(&s) == FIO_SET_TEST_COUNT - 1,
+             "swiss set count error");
+  {
+    uintptr_t i = 1;
+    FIO_SET_FOR_LOOP(&h, pos) {
+      FIO_ASSERT(pos->obj.key == i && pos->obj.obj == i + 1,
+                 "swiss hash order mismatch %lu != %lu.", (unsigned long)i,
+                 (unsigned long)pos->obj.key);
+      ++i;
+    }
+  }
+  for (uintptr_t i = 1; i < FIO_SET_TEST_COUNT; i += 2) {
+    FIO_ASSERT(!fio_swiss_set_test_remove(&s, i, i, NULL),
+               "swiss set removal failed");
+    FIO_ASSERT(!fio_swiss_hash_test_remove(&h, i, i, NULL),
+               "swiss hash removal failed");
+  }
+  for (uintptr_t i = 1; i < FIO_SET_TEST_COUNT; ++i) {
+    FIO_ASSERT(fio_swiss_set_test_find(&s, i, i) == ((i & 1) ? 0 : i),
+               "swiss set seek error after removal (%lu)", (unsigned long)i);
+    FIO_ASSERT(fio_swiss_hash_test_find(&h, i, i) == ((i & 1) ? 0 : i + 1),
+               "swiss hash seek error after removal (%lu)", (unsigned long)i);
+  }
+  {
+    uintptr_t i = 1;
+    FIO_SET_FOR_LOOP(&s, pos) {
+      FIO_ASSERT((pos->hash == 0) == (i & 1), "swiss set hole mismatch");
+      ++i;
+    }
+  }
+  {
+    const uintptr_t last = fio_swiss_set_test_last(&s);
+    fio_swiss_set_test_pop(&s);
+    FIO_ASSERT(last && !fio_swiss_set_test_find(&s, last, last) &&
+                   fio_swiss_set_test_last(&s) != last,
+               "swiss set pop failed");
+    fio_swiss_set_test_insert(&s, last, last);
+    FIO_ASSERT(fio_swiss_set_test_find(&s, last, last) == last &&
+                   fio_swiss_set_test_last(&s) == last,
+               "swiss set re-insertion after pop failed");
+  }
+  fio_swiss_set_test_compact(&s);
+  {
+    uintptr_t i = 2;
+    FIO_SET_FOR_LOOP(&s, pos) {
+      FIO_ASSERT(pos->hash != 0 && pos->obj == i,
+                 "swiss set compact error (%lu != %lu)", (unsigned long)i,
+                 (unsigned long)pos->obj);
+      FIO_ASSERT(fio_swiss_set_test_find(&s, i, i) == i,
+                 "swiss set seek error after compact");
+      i += 2;
+    }
+  }
+  /* emptying the Set (removal order is reversed) resets the map */
+  for (uintptr_t i = FIO_SET_TEST_COUNT; i; --i) {
+    fio_swiss_hash_test_remove(&h, i, i, NULL);
+  }
+  FIO_ASSERT(!fio_swiss_hash_test_count(&h) && !h.pos,
+             "swiss hash should be empty");
+  fio_swiss_hash_test_insert(&h, 1, 1, 2, NULL);
+  FIO_ASSERT(fio_swiss_hash_test_find(&h, 1, 1) == 2,
+             "swiss hash re-insertion after emptying failed");
+  fio_swiss_set_test_free(&s);
+  fio_swiss_hash_test_free(&h);
+  FIO_ASSERT(!s.map && !s.ordered && !s.pos && !s.capa,
+             "swiss set not re-initialized after free.");
+
+  fio_swiss_set_test_capa_require(&s, FIO_SET_TEST_COUNT);
+  const size_t capa = fio_swiss_set_test_capa(&s);
+  FIO_ASSERT(capa >= FIO_SET_TEST_COUNT, "swiss set capa_require failed");
+  fio_swiss_set_test_free(&s);
+
+  /* churn (popping keeps `pos` low): removed slots must be cleared by
+   * rehashing, or the map runs out of empty slots and misses probe it all */
+  for (uintptr_t i = 1; i <= 220; ++i)
+    fio_swiss_set_test_insert(&s, i, i);
+  for (uintptr_t i = 221; i < FIO_SET_TEST_COUNT;) {
+    for (size_t j = 0; j < 100; ++j)
+      fio_swiss_set_test_pop(&s);
+    for (size_t j = 0; j < 100; ++j, ++i)
+      fio_swiss_set_test_insert(&s, i, i);
+    FIO_ASSERT(fio_swiss_set_test_find(&s, i - 1, i - 1) == i - 1 &&
+                   !fio_swiss_set_test_find(&s, i - 101, i - 101),
+               "swiss set churn seek error");
+    size_t removed = 0;
+    for (size_t j = 0; j < s.capa; ++j)
+      removed += s.map[j >> 4].tag[j & 15] == FIO_SET_SWISS_REMOVED;
+    FIO_ASSERT(removed == s.removed &&
+                   s.count + removed <= s.capa - (s.capa >> 3),
+               "swiss set removed slots weren't cleared (%zu + %zu / %zu)",
+               (size_t)s.count, removed, (size_t)s.capa);
+  }
+  FIO_ASSERT(fio_swiss_set_test_capa(&s) <= 512,
+             "swiss set churn grew the map too much (%zu)",
+             fio_swiss_set_test_capa(&s));
+  fio_swiss_set_test_free(&s);
+
+  /* full / partial collision attacks */
+  fio_swiss_attack_s as = FIO_SET_INIT;
+  for (uintptr_t i = 0; i < FIO_SET_TEST_COUNT; ++i) {
+    fio_swiss_attack_insert(&as, 1, i + 1);
+  }
+  FIO_ASSERT(fio_swiss_attack_count(&as) != FIO_SET_TEST_COUNT,
+             "swiss set attack success! too many full-collisions inserts!");
+  fio_swiss_attack_free(&as);
+  for (uintptr_t i = 0; i < FIO_SET_TEST_COUNT; ++i) {
+    fio_swiss_attack_insert(&as, ((i << 20) | 1), i + 1);
+  }
+  FIO_ASSERT(fio_swiss_attack_count(&as) == FIO_SET_TEST_COUNT,
+             "swiss partial collision resolution failed (count error)");
+  fio_swiss_attack_free(&as);
+}
+
+#define FIO_SET_SMALL 8
+#define FIO_SET_NAME fio_small_hash_test
+#define FIO_SET_KEY_TYPE uintptr_t
+#define FIO_SET_OBJ_TYPE uintptr_t
+#include <fio.h>
+
+#define FIO_SET_SMALL 8
+#define FIO_SET_SWISS 1
+#define FIO_SET_NAME fio_small_swiss_test
+#define FIO_SET_OBJ_TYPE uintptr_t
+#include <fio.h>
+
+FIO_FUNC void fio_set_small_test(void) {
+  fio_small_hash_test_s h = FIO_SET_INIT;
+  fio_small_swiss_test_s s = FIO_SET_INIT;
+  fprintf(stderr,
+          "=== Testing Set / Hash Map inline storage (FIO_SET_SMALL)\n");
+  for (uintptr_t i = 1; i <= 8; ++i) {
+    fio_small_hash_test_insert(&h, i, i, i + 1, NULL);
+    fio_small_swiss_test_insert(&s, i, i);
+  }
+  FIO_ASSERT(!h.map && h.ordered == h.small && !s.map && s.ordered == s.small,
+             "small Set shouldn't allocate memory");
+  for (uintptr_t i = 1; i <= 8; ++i) {
+    FIO_ASSERT(fio_small_hash_test_find(&h, i, i) == i + 1,
+               "small hash insertion != find");
+    FIO_ASSERT(fio_small_swiss_test_find(&s, i, i) == i,
+               "small set insertion != find");
+  }
+  {
+    uintptr_t old = 0;
+    fio_small_hash_test_insert(&h, 3, 3, 30, &old);
+    FIO_ASSERT(old == 4 && fio_small_hash_test_find(&h, 3, 3) == 30 &&
+                   fio_small_hash_test_count(&h) == 8,
+               "small hash overwrite error");
+  }
+  FIO_ASSERT(!fio_small_hash_test_remove(&h, 5, 5, NULL) &&
+                 !fio_small_hash_test_find(&h, 5, 5) &&
+                 fio_small_hash_test_remove(&h, 5, 5, NULL) == -1,
+             "small hash removal error");
+  /* the "hole" is reused (compacted) before moving to allocated memory */
+  fio_small_hash_test_insert(&h, 9, 9, 10, NULL);
+  FIO_ASSERT(!h.map && h.ordered == h.small && h.pos == 8,
+             "small hash should compact rather than allocate memory");
+  fio_small_hash_test_insert(&h, 10, 10, 11, NULL);
+  fio_small_swiss_test_insert(&s, 9, 9);
+  FIO_ASSERT(h.map && h.ordered != h.small && s.map && s.ordered != s.small,
+             "small Set should move to allocated memory when full");
+  {
+    const uintptr_t expected[] = {1, 2, 3, 4, 6, 7, 8, 9, 10};
+    size_t i = 0;
+    FIO_SET_FOR_LOOP(&h, pos) {
+      FIO_ASSERT(i < 9 && pos->obj.key == expected[i],
+                 "small hash order error after growing (%lu)",
+                 (unsigned long)pos->obj.key);
+      ++i;
+    }
+    FIO_ASSERT(i == 9, "small hash count error after growing");
+  }
+  for (uintptr_t i = 1; i <= 10; ++i) {
+    FIO_ASSERT(fio_small_hash_test_find(&h, i, i) ==
+                   (i == 5 ? 0 : (i == 3 ? 30 : i + 1)),
+               "small hash seek error after growing (%lu)", (unsigned long)i);
+  }
+  for (uintptr_t i = 1; i <= 9; ++i) {
+    FIO_ASSERT(fio_small_swiss_test_find(&s, i, i) == i,
+               "small set seek error after growing (%lu)", (unsigned long)i);
+  }
+  fio_small_hash_test_free(&h);
+  fio_small_swiss_test_free(&s);
+  FIO_ASSERT(!h.map && !h.ordered && !h.pos && !h.capa,
+             "small hash not re-initialized after free.");
+
+  fio_small_swiss_test_capa_require(&s, 4);
+  FIO_ASSERT(fio_small_swiss_test_capa(&s) == 8 && !s.map,
+             "small set capa_require shouldn't allocate memory");
+  fio_small_swiss_test_insert(&s, 1, 1);
+  fio_small_swiss_test_insert(&s, 2, 2);
+  fio_small_swiss_test_pop(&s);
+  FIO_ASSERT(fio_small_swiss_test_count(&s) == 1 &&
+                 fio_small_swiss_test_last(&s) == 1 &&
+                 !fio_small_swiss_test_find(&s, 2, 2),
+             "small set pop error");
+  fio_small_swiss_test_capa_require(&s, 64);
+  FIO_ASSERT(fio_small_swiss_test_capa(&s) >= 64 && s.map &&
+                 fio_small_swiss_test_find(&s, 1, 1) == 1,
+             "small set capa_require error");
+  fio_small_swiss_test_free(&s);
+}
+
 /* *****************************************************************************
 Bad Hash (risky hash) tests
 ***************************************************************************** */
@@ -9981,6 +11262,67 @@ FIO_FUNC void fio_riskyhash_test(void) {
 #endif
 }
 
+FIO_FUNC uint64_t fio_aes_hash_test_risky(const void *data, size_t len,
+                                          uint64_t key1, uint64_t key2) {
+  return fio_risky_hash(data, len, key1 ^ fio_lrot64(key2, 31));
+}
+
+FIO_FUNC void fio_aes_hash_test_impl(uint64_t (*hash)(const void *, size_t,
+                                                      uint64_t, uint64_t)) {
+  uint8_t buffer[160];
+  uint64_t hashes[129];
+  for (size_t i = 0; i < sizeof(buffer); ++i)
+    buffer[i] = (uint8_t)((i * 7) + 1);
+  /* every length (including 0) has a unique value, regardless of alignment */
+  for (size_t len = 0; len <= 128; ++len) {
+    hashes[len] = hash(buffer, len, 1, 2);
+    memmove(buffer + 3, buffer, len);
+    FIO_ASSERT(hash(buffer + 3, len, 1, 2) == hashes[len],
+               "fio_aes_hash alignment error (length %zu)", len);
+    memmove(buffer, buffer + 3, len);
+    for (size_t i = 0; i < len; ++i) {
+      FIO_ASSERT(hashes[i] != hashes[len],
+                 "fio_aes_hash length collision (%zu vs. %zu)", i, len);
+    }
+  }
+  /* every byte and the key affect the result */
+  for (size_t len = 1; len <= 128; len += 3) {
+    for (size_t i = 0; i < len; ++i) {
+      buffer[i] ^= 1;
+      FIO_ASSERT(hash(buffer, len, 1, 2) != hashes[len],
+                 "fio_aes_hash ignored byte %zu of %zu", i, len);
+      buffer[i] ^= 1;
+    }
+    FIO_ASSERT(hash(buffer, len, 2, 2) != hashes[len] &&
+                   hash(buffer, len, 1, 1) != hashes[len],
+               "fio_aes_hash ignored the key (length %zu)", len);
+  }
+  FIO_ASSERT(hash("a", 1, 1, 2) != hash("a\0", 2, 1, 2),
+             "fio_aes_hash padding collision");
+}
+
+FIO_FUNC void fio_aes_hash_test(void) {
+  uint64_t (*selected)(const void *, size_t, uint64_t,
+                       uint64_t) = fio_aes_hash_test_risky;
+#if FIO_AES_HASH_NI
+  if (fio_aes_hash_ni_available())
+    selected = fio_aes_hash_ni;
+#endif
+  fprintf(stderr, "=== Testing fio_aes_hash (AES-NI %s)\n",
+          (selected == fio_aes_hash_test_risky
+               ? "unavailable, using Risky Hash"
+               : (FIO_AES_HASH_NI == 1 ? "enabled" : "detected at runtime")));
+  /* the fallback is tested even when AES-NI is used */
+  fio_aes_hash_test_impl(fio_aes_hash_test_risky);
+  if (selected != fio_aes_hash_test_risky)
+    fio_aes_hash_test_impl(selected);
+  const char data[] = "fio_aes_hash should use the selected implementation";
+  for (size_t len = 0; len < sizeof(data); ++len) {
+    FIO_ASSERT(fio_aes_hash(data, len, 1, 2) == selected(data, len, 1, 2),
+               "fio_aes_hash used the wrong implementation (length %zu)", len);
+  }
+}
+
 /* *****************************************************************************
 SipHash tests
 ***************************************************************************** */
@@ -11001,6 +12343,32 @@ FIO_FUNC void fio_atof_test(void) {
               5708990770823839524233143877797980545530986496.0, 0);
   TEST_DOUBLE("5708990770823839207320493820740630171355185152001e-3",
               5708990770823839524233143877797980545530986496.0, 0);
+#undef TEST_DOUBLE
+
+#define TEST_FTOA(d, expect)                                                   \
+  do {                                                                         \
+    char buf[130];                                                             \
+    size_t len = fio_ftoa(buf, (d), 10);                                       \
+    FIO_ASSERT(len == strlen(expect) && !memcmp(buf, expect, len),             \
+               "fio_ftoa error %s != %s", buf, expect);                        \
+    char *p = buf;                                                             \
+    FIO_ASSERT(fio_atof(&p) == (d), "fio_ftoa round-trip error for %s", buf);  \
+  } while (0)
+  TEST_FTOA(0.0, "0.0");
+  TEST_FTOA(-0.0, "-0.0");
+  TEST_FTOA(1.0, "1.0");
+  TEST_FTOA(-300.0, "-300.0");
+  TEST_FTOA(0.1, "0.1");
+  TEST_FTOA(0.1 + 0.2, "0.30000000000000004");
+  TEST_FTOA(3.1416, "3.1416");
+  TEST_FTOA(0.000001234, "0.000001234");
+  TEST_FTOA(1e-7, "1e-7");
+  TEST_FTOA(1.234E-10, "1.234e-10");
+  TEST_FTOA(1e21, "1e+21");
+  TEST_FTOA(123456789012345680000.0, "123456789012345680000.0");
+  TEST_FTOA(1.7976931348623157e+308, "1.7976931348623157e+308");
+  TEST_FTOA(4.9406564584124654e-324, "5e-324");
+#undef TEST_FTOA
   fprintf(stderr, "\n* passed.\n");
 }
 /* *****************************************************************************
@@ -11018,13 +12386,17 @@ void fio_test(void) {
   fio_llist_test();
   fio_ary_test();
   fio_set_test();
+  fio_set_swiss_test();
+  fio_set_small_test();
   fio_defer_test();
   fio_timer_test();
+  fio_stats_test();
   fio_poll_test();
   fio_socket_test();
   fio_uuid_link_test();
   fio_cycle_test();
   fio_riskyhash_test();
+  fio_aes_hash_test();
   fio_siphash_test();
   fio_sha1_test();
   fio_sha2_test();
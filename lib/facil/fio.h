@@ -190,6 +190,25 @@ Version and helper macros
 #define FIO_LOG_LENGTH_LIMIT 2048
 #endif
 
+#ifndef FIO_LOG_ASYNC_RING_SIZE
+/**
+ * The size of each thread's asynchronous logging buffer (must be a power of 2).
+ *
+ * See `fio_log_async_start`.
+ */
+#define FIO_LOG_ASYNC_RING_SIZE (1UL << 16)
+#endif
+
+#ifndef FIO_STATS_INTERVAL
+/**
+ * If set to a positive value, every worker process logs its reactor statistics
+ * (see `fio_stats_log`) every `FIO_STATS_INTERVAL` milliseconds.
+ *
+ * Defaults to 0 (disabled).
+ */
+#define FIO_STATS_INTERVAL 0
+#endif
+
 #ifndef FIO_IGNORE_MACRO
 /**
  * This is used internally to ignore macros that shadow functions (avoiding
@@ -432,6 +451,57 @@ Logging and testing helpers
 /** The logging level */
 int __attribute__((weak)) FIO_LOG_LEVEL;
 
+/** Named arguments for the `fio_log_async_start` function. */
+typedef struct {
+  /** A file to append log messages to. Defaults to `stderr` (when NULL). */
+  const char *filename;
+  /**
+   * The overflow policy. If a thread's buffer is full, log messages are dropped
+   * (the default) unless `block` is true, in which case the logging thread
+   * waits for the buffer to drain.
+   */
+  uint8_t block;
+} fio_log_async_args_s;
+
+/**
+ * Starts asynchronous logging for the process (and any forked workers).
+ *
+ * Log messages (both `FIO_LOG_*` and the HTTP access log) are copied to a
+ * per-thread buffer and written by a dedicated thread using `writev`, so a
+ * slow `stderr` (or log file) doesn't slow down the threads that log.
+ *
+ * When logging to a file, the file will be reopened when a `SIGHUP` signal is
+ * received or when the file was moved / removed (i.e., log rotation).
+ *
+ * Returns -1 on error (i.e., the file couldn't be opened) and 0 on success.
+ */
+int fio_log_async_start(fio_log_async_args_s args);
+#define fio_log_async_start(...)                                               \
+  fio_log_async_start((fio_log_async_args_s){__VA_ARGS__})
+
+/**
+ * Writes any pending log messages and stops asynchronous logging (log messages
+ * will be written to `stderr` directly).
+ *
+ * This is automatically called when the process exits.
+ */
+void fio_log_async_stop(void);
+
+/** Reopens the log file (if any), i.e., after the log file was rotated. */
+void fio_log_async_reopen(void);
+
+/** Returns the number of log messages dropped due to full buffers. */
+size_t fio_log_async_dropped(void);
+
+/**
+ * Writes a (complete) log message, asynchronously if `fio_log_async_start` was
+ * called. Otherwise, the data is written to `stderr`.
+ *
+ * The function is defined by `fio.c`. The symbol is weak, so `FIO_LOG_*` falls
+ * back to writing to `stderr` in programs that only use the header.
+ */
+void __attribute__((weak)) fio_log_write(const char *data, size_t len);
+
 #pragma weak FIO_LOG2STDERR
 void __attribute__((format(printf, 1, 0), weak))
 FIO_LOG2STDERR(const char *format, ...) {
@@ -452,7 +522,10 @@ FIO_LOG2STDERR(const char *format, ...) {
   }
   tmp___log[len___log++] = '\n';
   tmp___log[len___log] = '0';
-  fwrite(tmp___log, len___log, 1, stderr);
+  if (fio_log_write)
+    fio_log_write(tmp___log, len___log);
+  else
+    fwrite(tmp___log, len___log, 1, stderr);
 }
 
 #ifndef FIO_LOG_PRINT
@@ -1027,6 +1100,66 @@ struct timespec fio_last_tick(void);
  */
 char const *fio_engine(void);
 
+/** The reactor statistics returned by `fio_stats`. */
+typedef struct {
+  /** Reactor cycles performed by the process. */
+  size_t cycles;
+  /** Tasks performed by the process (all threads, including IO events). */
+  size_t tasks;
+  /** Microseconds between the last two reactor cycles (including polling). */
+  size_t cycle_time;
+  /**
+   * Event loop lag: the microseconds between the last time the reactor polled
+   * for IO events and the beginning of the cycle that followed.
+   */
+  size_t cycle_lag;
+  /** Tasks waiting in the urgent (outbound IO) queue. */
+  size_t queue_urgent;
+  /** Tasks waiting in the normal queue. */
+  size_t queue_normal;
+  /** Timers waiting to be scheduled (see `fio_run_every`). */
+  size_t timers;
+  /** Open connections (including listening sockets). */
+  size_t open;
+  /** Open connections attached to a protocol. */
+  size_t attached;
+  /** Open connections with outgoing data waiting in their queue. */
+  size_t writing;
+  /** Open connections marked for closure. */
+  size_t closing;
+  /** Outgoing bytes waiting in all the connection queues. */
+  size_t pending_bytes;
+  /** Outgoing packets (`fio_write` calls) waiting in all the queues. */
+  size_t pending_packets;
+  /** The connection with the longest outgoing queue, or -1 if none. */
+  intptr_t slowest;
+  /** The number of packets waiting in the `slowest` connection's queue. */
+  size_t slowest_pending;
+} fio_stats_s;
+
+/**
+ * Samples the reactor's state for the current process.
+ *
+ * Task counters are kept per thread, so sampling has little effect on the
+ * reactor. However, the connection data is collected by reviewing every open
+ * connection, so avoid calling this function too often.
+ *
+ * The `cycles` and `tasks` counters grow for the lifetime of the process. Use
+ * the difference between two samples to calculate the tasks performed per
+ * cycle.
+ */
+fio_stats_s fio_stats(void);
+
+/**
+ * Logs the reactor's statistics (see `fio_stats`) using `FIO_LOG_INFO`.
+ *
+ * The number of cycles and the tasks performed per cycle are calculated since
+ * the previous call to `fio_stats_log`.
+ *
+ * See also `FIO_STATS_INTERVAL`.
+ */
+void fio_stats_log(void);
+
 /* *****************************************************************************
 Socket / Connection Functions
 ***************************************************************************** */
@@ -2379,6 +2512,8 @@ size_t fio_ltoa(char *dest, int64_t num, uint8_t base);
  * default to base 10. Prefixes aren't added (i.e., no "0x" or "0b" at the
  * beginning of the string).
  *
+ * Base 10 uses the shortest representation that round-trips (Grisu2).
+ *
  * Returns the number of bytes actually written (excluding the NUL
  * terminator).
  */
@@ -2436,14 +2571,29 @@ uint8_t __attribute__((weak)) fio_hash_secret_marker2;
 #define FIO_HASH_SECRET_SEED64_2 ((uintptr_t)&fio_hash_secret_marker2)
 #endif
 
+/*
+ * FIO_HASH_FN is the keyed hashing function used by dynamic facil.io objects
+ * (FIOBJ keys, pub/sub channel names, etc'). The default is SipHash 1-3.
+ *
+ * Define FIO_USE_RISKY_HASH to use Risky Hash or FIO_USE_AES_HASH to use the
+ * AES-NI based `fio_aes_hash`. A custom FIO_HASH_FN(data, length, key1, key2)
+ * can also be defined.
+ *
+ * All translation units MUST use the same hashing function (and flags).
+ */
+#ifndef FIO_HASH_FN
 #if FIO_USE_RISKY_HASH
 #define FIO_HASH_FN(data, length, key1, key2)                                  \
   fio_risky_hash((data), (length),                                             \
                  ((uint64_t)(key1) >> 19) | ((uint64_t)(key2) << 27))
+#elif FIO_USE_AES_HASH
+#define FIO_HASH_FN(data, length, key1, key2)                                  \
+  fio_aes_hash((data), (length), (uint64_t)(key1), (uint64_t)(key2))
 #else
 #define FIO_HASH_FN(data, length, key1, key2)                                  \
   fio_siphash13((data), (length), (uint64_t)(key1), (uint64_t)(key2))
 #endif
+#endif
 
 /* *****************************************************************************
 Risky Hash (always available, even if using only the fio.h header)
@@ -2560,6 +2710,144 @@ FIO_FUNC inline uint64_t fio_risky_hash(const void *data_, size_t len,
 #undef FIO_RISKY_PRIME_0
 #undef FIO_RISKY_PRIME_1
 
+/* *****************************************************************************
+AES Hash (AES-NI when available, always available as a function)
+***************************************************************************** */
+
+#ifndef FIO_AES_HASH_NI
+/**
+ * Selects the `fio_aes_hash` implementation:
+ *
+ * 1 - AES-NI is always used (compiled with `-maes` or `-march=native`).
+ *
+ * 2 - AES-NI code is compiled for the `aes` target and used only if the CPU
+ *     supports it (tested once, at runtime). Otherwise Risky Hash is used.
+ *
+ * 0 - AES-NI isn't available and `fio_aes_hash` falls back to Risky Hash.
+ */
+#if defined(__AES__) && defined(__SSE2__) && defined(__x86_64__)
+#define FIO_AES_HASH_NI 1
+#elif defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 5)
+#define FIO_AES_HASH_NI 2
+#else
+#define FIO_AES_HASH_NI 0
+#endif
+#endif
+
+#if FIO_AES_HASH_NI
+#include <wmmintrin.h>
+#if FIO_AES_HASH_NI == 2
+#include <cpuid.h>
+#define FIO_AES_HASH_TARGET __attribute__((target("aes,sse2")))
+#else
+#define FIO_AES_HASH_TARGET
+#endif
+
+/**
+ * Returns 1 if the CPU supports the AES-NI instructions used by
+ * `fio_aes_hash` (the test is performed once per translation unit).
+ */
+FIO_FUNC inline int fio_aes_hash_ni_available(void) {
+#if FIO_AES_HASH_NI == 2
+  /* 0 == untested, 1 == available, 2 == unavailable (races are harmless) */
+  static volatile int state = 0;
+  if (!state) {
+    unsigned int a = 0, b = 0, c = 0, d = 0;
+    state = (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_AES)) ? 1 : 2;
+  }
+  return state == 1;
+#else
+  return 1;
+#endif
+}
+
+/**
+ * The AES-NI implementation of `fio_aes_hash` - don't call this function
+ * unless `fio_aes_hash_ni_available` returns 1.
+ */
+FIO_FUNC FIO_AES_HASH_TARGET uint64_t fio_aes_hash_ni(const void *data_,
+                                                      size_t len, uint64_t key1,
+                                                      uint64_t key2) {
+  const uint8_t *data = (const uint8_t *)data_;
+  const __m128i k0 = _mm_set_epi64x((long long)key2, (long long)key1);
+  const __m128i k1 =
+      _mm_xor_si128(k0, _mm_set_epi64x((long long)0xFBBA3FA15B22113BULL,
+                                       (long long)0xAB137439982B86C9ULL));
+  /* the length is part of the initial state (tail blocks are padded) */
+  __m128i v0 = _mm_xor_si128(k1, _mm_set_epi64x(0, (long long)len));
+  __m128i v1 = _mm_aesenc_si128(k1, k0);
+
+  /* consume 256 bit blocks */
+  for (size_t i = len >> 5; i; --i) {
+    v0 = _mm_aesenc_si128(
+        _mm_xor_si128(v0, _mm_loadu_si128((const __m128i *)data)), k0);
+    v1 = _mm_aesenc_si128(
+        _mm_xor_si128(v1, _mm_loadu_si128((const __m128i *)(data + 16))), k1);
+    v0 = _mm_aesenc_si128(v0, k1);
+    v1 = _mm_aesenc_si128(v1, k0);
+    data += 32;
+  }
+  /* consume any remaining 128 bit block */
+  if (len & 16) {
+    v0 = _mm_aesenc_si128(
+        _mm_xor_si128(v0, _mm_loadu_si128((const __m128i *)data)), k0);
+    v0 = _mm_aesenc_si128(v0, k1);
+    data += 16;
+  }
+  /* consume leftover bytes, using overlapping reads (never past the end) */
+  if (len & 15) {
+    const uint8_t *end = (const uint8_t *)data_ + len;
+    __m128i tail;
+    if (len > 16) {
+      tail = _mm_loadu_si128((const __m128i *)(end - 16));
+    } else if (len & 8) {
+      tail = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)data),
+                                _mm_loadl_epi64((const __m128i *)(end - 8)));
+    } else if (len & 4) {
+      uint32_t a, b;
+      memcpy(&a, data, 4);
+      memcpy(&b, end - 4, 4);
+      tail = _mm_set_epi32(0, 0, (int)b, (int)a);
+    } else {
+      tail = _mm_cvtsi32_si128((int)((uint32_t)data[0] |
+                                     ((uint32_t)data[len >> 1] << 8) |
+                                     ((uint32_t)end[-1] << 16)));
+    }
+    v1 = _mm_aesenc_si128(_mm_xor_si128(v1, tail), k0);
+    v1 = _mm_aesenc_si128(v1, k1);
+  }
+
+  /* merge and mix */
+  v0 = _mm_aesenc_si128(v0, v1);
+  v0 = _mm_aesenc_si128(v0, k0);
+  v0 = _mm_aesenc_si128(v0, k1);
+  return (uint64_t)_mm_cvtsi128_si64(v0) ^
+         (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(v0, v0));
+}
+#endif /* FIO_AES_HASH_NI */
+
+/**
+ * Computes a keyed 64 bit hash using AES encryption rounds (AES-NI).
+ *
+ * The key (`key1` and `key2`) is 128 bits long. Every 16 byte block is consumed
+ * by 2 rounds (using 2 interleaved lanes) and the lanes are merged by 3 more
+ * rounds. Short keys require a single block, so their hashing is very cheap.
+ *
+ * Like Risky Hash, this wasn't cryptographically analyzed, so it's only as
+ * safe against Hash Flooding as the secrecy of the key allows.
+ *
+ * Without AES-NI (see `FIO_AES_HASH_NI`), this falls back to a (keyed) Risky
+ * Hash, so the result depends on the compilation flags and the CPU.
+ */
+FIO_FUNC inline uint64_t fio_aes_hash(const void *data, size_t len,
+                                      uint64_t key1, uint64_t key2) {
+#if FIO_AES_HASH_NI
+  if (fio_aes_hash_ni_available())
+    return fio_aes_hash_ni(data, len, key1, key2);
+#endif
+  return fio_risky_hash(data, len, key1 ^ fio_lrot64(key2, 31));
+}
+
 /* *****************************************************************************
 SipHash
 ***************************************************************************** */
@@ -5501,6 +5789,12 @@ Done
  *
  * Note: Before freeing the Set, FIO_SET_OBJ_DESTROY will be automatically
  *       called for every existing object.
+ *
+ * Note: Defining FIO_SET_SWISS as 1 selects an alternative map layout (see
+ *       below), the API and the insertion order iteration are the same.
+ *
+ * Note: Defining FIO_SET_SMALL as a number of objects allows small Sets to be
+ *       stored within the Set structure itself, avoiding memory allocations.
  */
 
 /* Used for naming functions and types, prefixing FIO_SET_NAME to the name */
@@ -5591,6 +5885,35 @@ Done
 #define FIO_SET_CUCKOO_STEPS 11
 #endif
 
+#ifndef FIO_SET_SWISS
+/**
+ * If true, the map is an open addressing table of 1 byte control tags (7 bits
+ * of the hash), probed 16 tags at a time (using SSE2, when available), rather
+ * than a map of `{hash, pointer}` pairs probed using cuckoo steps.
+ *
+ * Every group of 16 tags stores the ordered array positions of its objects, so
+ * a lookup touches a single group before testing the object (the `ordered`
+ * array stores the hash, key and object inline). Probing stops at the first
+ * group with an empty slot, which is why the map is never more than 7/8 full.
+ */
+#define FIO_SET_SWISS 0
+#endif
+
+#ifndef FIO_SET_SMALL
+/**
+ * The number of objects stored within the Set structure itself (0 == none).
+ *
+ * Until the Set requires more than FIO_SET_SMALL objects, they are stored in
+ * an inline array that is searched linearly (by hash value) and no memory is
+ * allocated. Once the inline array is full, the objects are moved to an
+ * allocated (hashed) Set.
+ *
+ * NOTE: once an object was inserted, such a Set must not be moved (copied) to a
+ * different memory address, since `ordered` might point to the inline array.
+ */
+#define FIO_SET_SMALL 0
+#endif
+
 #ifdef FIO_SET_KEY_TYPE
 typedef struct {
   FIO_SET_KEY_TYPE key;
@@ -5812,16 +6135,72 @@ FIO_FUNC void FIO_NAME(rehash)(FIO_NAME(s) * set);
 Set / Hash Map Internal Data Structures
 ***************************************************************************** */
 
+#if FIO_SET_SWISS && !defined(H_FIO_SET_SWISS_H)
+#define H_FIO_SET_SWISS_H
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* control tags: empty, removed (probing continues) or 0x80 | 7 hash bits */
+#define FIO_SET_SWISS_EMPTY 0
+#define FIO_SET_SWISS_REMOVED 1
+/* the map's minimal capacity is a single group of 16 tags */
+#define FIO_SET_SWISS_MIN_BITS 4
+
+/** Returns a bit for every tag in the group (16 tags) that equals `tag`. */
+FIO_FUNC inline uint32_t fio_set_swiss_match(const uint8_t *tags,
+                                             uint8_t tag) {
+#if defined(__SSE2__)
+  return (uint32_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)tags),
+                     _mm_set1_epi8((char)tag)));
+#else
+  uint32_t r = 0;
+  for (size_t i = 0; i < 16; ++i)
+    r |= (uint32_t)(tags[i] == tag) << i;
+  return r;
+#endif
+}
+
+/** Returns a bit for every empty (or removed) slot in the group (16 tags). */
+FIO_FUNC inline uint32_t fio_set_swiss_available(const uint8_t *tags) {
+#if defined(__SSE2__)
+  return 0xFFFF &
+         ~(uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)tags));
+#else
+  uint32_t r = 0;
+  for (size_t i = 0; i < 16; ++i)
+    r |= (uint32_t)(tags[i] < 0x80) << i;
+  return r;
+#endif
+}
+#endif /* H_FIO_SET_SWISS_H */
+
 typedef struct FIO_NAME(_ordered_s_) {
   FIO_SET_HASH_TYPE hash;
   FIO_SET_TYPE obj;
 } FIO_NAME(_ordered_s_);
 
+#if FIO_SET_SWISS
+/* a group of 16 control tags and the ordered array positions they refer to */
+typedef struct FIO_NAME(_map_s_) {
+  uint8_t tag[16];
+  uint32_t pos[16];
+} FIO_NAME(_map_s_);
+
+/* the map's size, in bytes, for the Set's capacity */
+#define FIO_SET_MAP_SIZE(capa) (((capa) >> 4) * sizeof(FIO_NAME(_map_s_)))
+#define FIO_SET_MIN_BITS FIO_SET_SWISS_MIN_BITS
+#else
 typedef struct FIO_NAME(_map_s_) {
   FIO_SET_HASH_TYPE hash; /* another copy for memory cache locality */
   FIO_NAME(_ordered_s_) * pos;
 } FIO_NAME(_map_s_);
 
+#define FIO_SET_MAP_SIZE(capa) ((capa) * sizeof(FIO_NAME(_map_s_)))
+#define FIO_SET_MIN_BITS 2
+#endif
+
 /* the information in the Hash Map structure should be considered READ ONLY. */
 struct FIO_NAME(s) {
   uintptr_t count;
@@ -5832,6 +6211,12 @@ struct FIO_NAME(s) {
   uint8_t has_collisions;
   uint8_t used_bits;
   uint8_t under_attack;
+#if FIO_SET_SWISS
+  uintptr_t removed; /* map slots marked as removed (probing continues) */
+#endif
+#if FIO_SET_SMALL
+  FIO_NAME(_ordered_s_) small[FIO_SET_SMALL];
+#endif
 };
 
 #undef FIO_SET_FOR_LOOP
@@ -5843,6 +6228,8 @@ struct FIO_NAME(s) {
 Set / Hash Map Internal Helpers
 ***************************************************************************** */
 
+#if !FIO_SET_SWISS
+
 /** Locates an object's map position in the Set, if it exists. */
 FIO_FUNC inline FIO_NAME(_map_s_) *
     FIO_NAME(_find_map_pos_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
@@ -5909,6 +6296,162 @@ FIO_FUNC inline FIO_NAME(_map_s_) *
   return NULL;
   (void)obj; /* in cases where FIO_SET_OBJ_COMPARE does nothing */
 }
+
+#else /* FIO_SET_SWISS */
+
+/* mixes the hash, the high bits select a group and the low bits a tag */
+FIO_FUNC inline uint64_t FIO_NAME(_swiss_mix_)(FIO_SET_HASH_TYPE hash_value) {
+  return (uint64_t)FIO_SET_HASH2UINTPTR(hash_value, 0) * 0x9E3779B97F4A7C15ULL;
+}
+
+FIO_FUNC inline uint8_t FIO_NAME(_swiss_tag_)(uint64_t mixed) {
+  return (uint8_t)(0x80 | ((mixed ^ (mixed >> 29)) & 0x7F));
+}
+
+FIO_FUNC inline uintptr_t FIO_NAME(_swiss_group_)(FIO_NAME(s) * set,
+                                                  uint64_t mixed) {
+  return (uintptr_t)((mixed >> 1) >> (63 - (set->used_bits - 4)));
+}
+
+/**
+ * Locates an object in the Set, returning its ordered array entry (or NULL).
+ *
+ * `slot` is set to the object's map slot or, if the object is missing, to the
+ * first available slot on its probing sequence (or -1 if none).
+ */
+FIO_FUNC inline FIO_NAME(_ordered_s_) *
+    FIO_NAME(_swiss_seek_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
+                           FIO_SET_TYPE obj, uintptr_t *slot) {
+  *slot = (uintptr_t)-1;
+  if (!set->map)
+    return NULL;
+  if (FIO_SET_HASH_COMPARE(hash_value, FIO_SET_HASH_INVALID))
+    hash_value = FIO_SET_HASH_FORCE;
+  const uint64_t mixed = FIO_NAME(_swiss_mix_)(hash_value);
+  const uint8_t tag = FIO_NAME(_swiss_tag_)(mixed);
+  const uintptr_t mask = (set->capa >> 4) - 1;
+  uintptr_t group = FIO_NAME(_swiss_group_)(set, mixed);
+  size_t full_collisions_counter = 0;
+  /* triangular probing visits every group once */
+  for (uintptr_t i = 1; i <= mask + 1; ++i) {
+    FIO_NAME(_map_s_) *g = set->map + group;
+    __builtin_prefetch(g->pos + 15); /* may be on the next cache line */
+    for (uint32_t match = fio_set_swiss_match(g->tag, tag); match;
+         match &= match - 1) {
+      const uint32_t bit = __builtin_ctz(match);
+      FIO_NAME(_ordered_s_) *pos = set->ordered + g->pos[bit];
+      if (!FIO_SET_HASH_COMPARE(pos->hash, hash_value))
+        continue;
+      if (FIO_SET_COMPARE(pos->obj, obj)) {
+        *slot = (group << 4) | bit;
+        return pos;
+      }
+      /* full hash value collision detected */
+      if (++full_collisions_counter >= FIO_SET_MAX_MAP_FULL_COLLISIONS &&
+          !set->under_attack) {
+        /* is the hash under attack? */
+        FIO_LOG_WARNING(
+            "(fio hash map) too many full collisions - under attack?");
+        set->under_attack = 1;
+      }
+      if (set->under_attack) {
+        *slot = (group << 4) | bit;
+        return pos;
+      }
+    }
+    const uint32_t available = fio_set_swiss_available(g->tag);
+    if (available && *slot == (uintptr_t)-1)
+      *slot = (group << 4) | __builtin_ctz(available);
+    /* an empty slot means the object was never pushed to the next group */
+    if (fio_set_swiss_match(g->tag, FIO_SET_SWISS_EMPTY))
+      return NULL;
+    group = (group + i) & mask;
+  }
+  return NULL;
+  (void)obj; /* in cases where FIO_SET_OBJ_COMPARE does nothing */
+}
+
+/* maps an ordered array position to an available map slot (rehashing) */
+FIO_FUNC inline void FIO_NAME(_swiss_place_)(FIO_NAME(s) * set,
+                                             uintptr_t index) {
+  const uint64_t mixed = FIO_NAME(_swiss_mix_)(set->ordered[index].hash);
+  const uintptr_t mask = (set->capa >> 4) - 1;
+  uintptr_t group = FIO_NAME(_swiss_group_)(set, mixed);
+  for (uintptr_t i = 1;; ++i) {
+    FIO_NAME(_map_s_) *g = set->map + group;
+    const uint32_t available = fio_set_swiss_available(g->tag);
+    if (available) {
+      const uint32_t bit = __builtin_ctz(available);
+      g->tag[bit] = FIO_NAME(_swiss_tag_)(mixed);
+      g->pos[bit] = (uint32_t)index;
+      return;
+    }
+    group = (group + i) & mask;
+  }
+}
+
+/* marks a map slot as available */
+FIO_FUNC inline void FIO_NAME(_swiss_clear_)(FIO_NAME(s) * set,
+                                             uintptr_t slot) {
+  FIO_NAME(_map_s_) *g = set->map + (slot >> 4);
+  /* probing never passed a group with empty slots, so it can stop here */
+  if (fio_set_swiss_match(g->tag, FIO_SET_SWISS_EMPTY)) {
+    g->tag[slot & 15] = FIO_SET_SWISS_EMPTY;
+    return;
+  }
+  g->tag[slot & 15] = FIO_SET_SWISS_REMOVED;
+  ++set->removed;
+}
+
+/* marks all map slots as empty, once the Set is empty */
+FIO_FUNC inline void FIO_NAME(_swiss_reset_)(FIO_NAME(s) * set) {
+  if (set->map)
+    memset(set->map, 0, FIO_SET_MAP_SIZE(set->capa));
+  set->removed = 0;
+}
+
+/* destroys an object located by `_swiss_seek_`, leaving a "hole" if needed */
+FIO_FUNC inline void FIO_NAME(_swiss_remove_)(FIO_NAME(s) * set,
+                                              FIO_NAME(_ordered_s_) * pos,
+                                              uintptr_t slot) {
+  FIO_SET_DESTROY(pos->obj);
+  --set->count;
+  pos->hash = FIO_SET_HASH_INVALID;
+  FIO_NAME(_swiss_clear_)(set, slot);
+  if (pos == set->pos + set->ordered - 1) {
+    /* removing last item inserted */
+    do {
+      --set->pos;
+    } while (set->pos && FIO_SET_HASH_COMPARE(set->ordered[set->pos - 1].hash,
+                                              FIO_SET_HASH_INVALID));
+  }
+  if (!set->count)
+    FIO_NAME(_swiss_reset_)(set);
+}
+
+/* returns the map slot referring to an ordered array position (or -1) */
+FIO_FUNC inline uintptr_t FIO_NAME(_swiss_slot_of_)(FIO_NAME(s) * set,
+                                                    uintptr_t index) {
+  const uint64_t mixed = FIO_NAME(_swiss_mix_)(set->ordered[index].hash);
+  const uint8_t tag = FIO_NAME(_swiss_tag_)(mixed);
+  const uintptr_t mask = (set->capa >> 4) - 1;
+  uintptr_t group = FIO_NAME(_swiss_group_)(set, mixed);
+  for (uintptr_t i = 1; i <= mask + 1; ++i) {
+    FIO_NAME(_map_s_) *g = set->map + group;
+    for (uint32_t match = fio_set_swiss_match(g->tag, tag); match;
+         match &= match - 1) {
+      const uint32_t bit = __builtin_ctz(match);
+      if (g->pos[bit] == index)
+        return (group << 4) | bit;
+    }
+    if (fio_set_swiss_match(g->tag, FIO_SET_SWISS_EMPTY))
+      break;
+    group = (group + i) & mask;
+  }
+  return (uintptr_t)-1;
+}
+
+#endif /* FIO_SET_SWISS */
 #undef FIO_SET_CUCKOO_STEPS
 
 /** Removes "holes" from the Set's internal Array - MUST re-hash afterwards.
@@ -5933,11 +6476,21 @@ FIO_FUNC inline void FIO_NAME(_compact_ordered_array_)(FIO_NAME(s) * set) {
 /** (Re)allocates the set's internal, invalidatint the mapping (must rehash) */
 FIO_FUNC inline void FIO_NAME(_reallocate_set_mem_)(FIO_NAME(s) * set) {
   const uintptr_t new_capa = 1ULL << set->used_bits;
-  FIO_SET_FREE(set->map, set->capa * sizeof(*set->map));
-  set->map = (FIO_NAME(_map_s_) *)FIO_SET_CALLOC(sizeof(*set->map), new_capa);
-  set->ordered = (FIO_NAME(_ordered_s_) *)FIO_SET_REALLOC(
-      set->ordered, (set->capa * sizeof(*set->ordered)),
-      (new_capa * sizeof(*set->ordered)), (set->pos * sizeof(*set->ordered)));
+  FIO_SET_FREE(set->map, FIO_SET_MAP_SIZE(set->capa));
+  set->map = (FIO_NAME(_map_s_) *)FIO_SET_CALLOC(
+      sizeof(*set->map), FIO_SET_MAP_SIZE(new_capa) / sizeof(*set->map));
+#if FIO_SET_SMALL
+  if (set->ordered == set->small) {
+    /* the inline array is full, move the objects to an allocated array */
+    set->ordered = (FIO_NAME(_ordered_s_) *)FIO_SET_REALLOC(
+        NULL, 0, (new_capa * sizeof(*set->ordered)), 0);
+    if (set->ordered)
+      memcpy(set->ordered, set->small, set->pos * sizeof(*set->ordered));
+  } else
+#endif
+    set->ordered = (FIO_NAME(_ordered_s_) *)FIO_SET_REALLOC(
+        set->ordered, (set->capa * sizeof(*set->ordered)),
+        (new_capa * sizeof(*set->ordered)), (set->pos * sizeof(*set->ordered)));
   if (!set->map || !set->ordered) {
     perror("FATAL ERROR: couldn't allocate memory for Set data");
     exit(errno);
@@ -5945,6 +6498,114 @@ FIO_FUNC inline void FIO_NAME(_reallocate_set_mem_)(FIO_NAME(s) * set) {
   set->capa = new_capa;
 }
 
+/* replaces an existing object (if `overwrite`), returning the stored object */
+FIO_FUNC inline FIO_SET_TYPE FIO_NAME(_overwrite_)(FIO_NAME(_ordered_s_) * pos,
+                                                   FIO_SET_TYPE obj,
+                                                   int overwrite,
+                                                   FIO_SET_OBJ_TYPE *old) {
+  if (!overwrite) {
+    FIO_SET_DESTROY(obj);
+    return pos->obj;
+  }
+#ifdef FIO_SET_KEY_TYPE
+  if (old) {
+    FIO_SET_OBJ_COPY((*old), pos->obj.obj);
+  }
+  /* no need to recreate the key object, just the value object */
+  FIO_SET_OBJ_DESTROY(pos->obj.obj);
+  FIO_SET_OBJ_COPY(pos->obj.obj, obj.obj);
+#else
+  if (old) {
+    FIO_SET_COPY((*old), pos->obj);
+  }
+  FIO_SET_DESTROY(pos->obj);
+  FIO_SET_COPY(pos->obj, obj);
+#endif
+  return pos->obj;
+}
+
+#if FIO_SET_SMALL
+
+/* tests if the Set's objects are stored in the inline array */
+FIO_FUNC inline int FIO_NAME(_is_small_)(FIO_NAME(s) * set) {
+  return set->ordered == set->small;
+}
+
+/* starts using the inline array if the Set was never allocated */
+FIO_FUNC inline int FIO_NAME(_small_init_)(FIO_NAME(s) * set) {
+  if (set->ordered)
+    return set->ordered == set->small;
+  set->ordered = set->small;
+  set->capa = FIO_SET_SMALL;
+  return 1;
+}
+
+/* a linear search of the inline array, testing the hash values first */
+FIO_FUNC inline FIO_NAME(_ordered_s_) *
+    FIO_NAME(_small_seek_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
+                           FIO_SET_TYPE obj) {
+  if (FIO_SET_HASH_COMPARE(hash_value, FIO_SET_HASH_INVALID))
+    hash_value = FIO_SET_HASH_FORCE;
+  FIO_NAME(_ordered_s_) *const end = set->small + set->pos;
+  for (FIO_NAME(_ordered_s_) *pos = set->small; pos < end; ++pos) {
+    if (FIO_SET_HASH_COMPARE(pos->hash, hash_value) &&
+        FIO_SET_COMPARE(pos->obj, obj))
+      return pos;
+  }
+  return NULL;
+  (void)obj; /* in cases where FIO_SET_OBJ_COMPARE does nothing */
+}
+
+/* destroys an object in the inline array, leaving a "hole" if needed */
+FIO_FUNC inline void FIO_NAME(_small_remove_)(FIO_NAME(s) * set,
+                                              FIO_NAME(_ordered_s_) * pos) {
+  FIO_SET_DESTROY(pos->obj);
+  --set->count;
+  pos->hash = FIO_SET_HASH_INVALID;
+  while (set->pos && FIO_SET_HASH_COMPARE(set->small[set->pos - 1].hash,
+                                          FIO_SET_HASH_INVALID))
+    --set->pos;
+}
+
+/**
+ * Inserts (or overwrites) an object while the Set uses the inline array.
+ *
+ * Returns the object's entry, or NULL if the Set was moved to allocated memory
+ * (the object wasn't inserted).
+ */
+FIO_FUNC inline FIO_NAME(_ordered_s_) *
+    FIO_NAME(_small_insert_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
+                             FIO_SET_TYPE obj, int overwrite,
+                             FIO_SET_OBJ_TYPE *old) {
+  if (!FIO_NAME(_small_init_)(set))
+    return NULL;
+  FIO_NAME(_ordered_s_) *pos = FIO_NAME(_small_seek_)(set, hash_value, obj);
+  if (pos) {
+    FIO_NAME(_overwrite_)(pos, obj, overwrite, old);
+    return pos;
+  }
+  if (set->pos == FIO_SET_SMALL)
+    FIO_NAME(_compact_ordered_array_)(set);
+  if (set->pos == FIO_SET_SMALL) {
+    /* grow beyond the inline array, the caller will insert the object */
+    set->used_bits = FIO_SET_MIN_BITS;
+    while ((1ULL << set->used_bits) <= FIO_SET_SMALL)
+      ++set->used_bits;
+    FIO_NAME(rehash)(set);
+    return NULL;
+  }
+  pos = set->small + set->pos;
+  pos->hash = hash_value;
+  FIO_SET_COPY(pos->obj, obj);
+  ++set->pos;
+  ++set->count;
+  return pos;
+}
+
+#endif /* FIO_SET_SMALL */
+
+#if !FIO_SET_SWISS
+
 /**
  * Inserts an object to the Set, rehashing if required, returning the new
  * object's pointer.
@@ -5958,6 +6619,14 @@ FIO_NAME(_insert_or_overwrite_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
                                 FIO_SET_OBJ_TYPE *old) {
   if (FIO_SET_HASH_COMPARE(hash_value, FIO_SET_HASH_INVALID))
     hash_value = FIO_SET_HASH_FORCE;
+#if FIO_SET_SMALL
+  {
+    FIO_NAME(_ordered_s_) *small =
+        FIO_NAME(_small_insert_)(set, hash_value, obj, overwrite, old);
+    if (small)
+      return small->obj;
+  }
+#endif
 
   /* automatic fragmentation protection */
   if (FIO_NAME(is_fragmented)(set))
@@ -6016,6 +6685,75 @@ FIO_NAME(_insert_or_overwrite_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
   return pos->pos->obj;
 }
 
+#else /* FIO_SET_SWISS */
+
+/**
+ * Inserts an object to the Set, rehashing if required, returning the new
+ * object's pointer.
+ *
+ * If the object already exists in the set, it will be destroyed and
+ * overwritten.
+ */
+FIO_FUNC inline FIO_SET_TYPE
+FIO_NAME(_insert_or_overwrite_)(FIO_NAME(s) * set, FIO_SET_HASH_TYPE hash_value,
+                                FIO_SET_TYPE obj, int overwrite,
+                                FIO_SET_OBJ_TYPE *old) {
+  if (FIO_SET_HASH_COMPARE(hash_value, FIO_SET_HASH_INVALID))
+    hash_value = FIO_SET_HASH_FORCE;
+#if FIO_SET_SMALL
+  {
+    FIO_NAME(_ordered_s_) *small =
+        FIO_NAME(_small_insert_)(set, hash_value, obj, overwrite, old);
+    if (small)
+      return small->obj;
+  }
+#endif
+
+  /* automatic fragmentation protection */
+  if (FIO_NAME(is_fragmented)(set))
+    FIO_NAME(rehash)(set);
+  /* automatic capacity validation (the map is never more than 7/8 full) */
+  else if (set->pos >= set->capa - (set->capa >> 3)) {
+    ++set->used_bits;
+    FIO_NAME(rehash)(set);
+  }
+  /* removed slots aren't empty, too many of them make misses probe too long */
+  else if (set->count + set->removed >= set->capa - (set->capa >> 3)) {
+    /* clearing them would leave little room, grow instead of rehashing often */
+    if (set->count >= (set->capa >> 1) + (set->capa >> 2))
+      ++set->used_bits;
+    FIO_NAME(rehash)(set);
+  }
+
+  /* locate future position */
+  uintptr_t slot;
+  FIO_NAME(_ordered_s_) *pos =
+      FIO_NAME(_swiss_seek_)(set, hash_value, obj, &slot);
+
+  if (pos) /* overwrite existing object */
+    return FIO_NAME(_overwrite_)(pos, obj, overwrite, old);
+
+  /* insert into new slot */
+  set->ordered[set->pos].hash = hash_value;
+  FIO_SET_COPY(set->ordered[set->pos].obj, obj);
+  ++set->pos;
+  ++set->count;
+  if (slot == (uintptr_t)-1) {
+    /* no available slot (attack mitigation?), rehashing places the object */
+    FIO_NAME(rehash)(set);
+  } else {
+    FIO_NAME(_map_s_) *g = set->map + (slot >> 4);
+    if (g->tag[slot & 15] == FIO_SET_SWISS_REMOVED)
+      --set->removed;
+    g->tag[slot & 15] =
+        FIO_NAME(_swiss_tag_)(FIO_NAME(_swiss_mix_)(hash_value));
+    g->pos[slot & 15] = (uint32_t)(set->pos - 1);
+  }
+  return set->ordered[set->pos - 1].obj;
+}
+
+#endif /* FIO_SET_SWISS */
+
 /* *****************************************************************************
 Set / Hash Map Implementation
 ***************************************************************************** */
@@ -6032,8 +6770,11 @@ FIO_FUNC void FIO_NAME_FREE()(FIO_NAME(s) * s) {
     }
   }
   /* free ordered array and hash mapping */
-  FIO_SET_FREE(s->map, s->capa * sizeof(*s->map));
-  FIO_SET_FREE(s->ordered, s->capa * sizeof(*s->ordered));
+  FIO_SET_FREE(s->map, FIO_SET_MAP_SIZE(s->capa));
+#if FIO_SET_SMALL
+  if (s->ordered != s->small)
+#endif
+    FIO_SET_FREE(s->ordered, s->capa * sizeof(*s->ordered));
   *s = (FIO_NAME(s)){.map = NULL};
 }
 
@@ -6049,14 +6790,29 @@ FIO_FUNC void FIO_NAME_FREE()(FIO_NAME(s) * s) {
 FIO_FUNC FIO_SET_OBJ_TYPE FIO_NAME(find)(FIO_NAME(s) * set,
                                          const FIO_SET_HASH_TYPE hash_value,
                                          FIO_SET_KEY_TYPE key) {
+#if FIO_SET_SMALL
+  if (FIO_NAME(_is_small_)(set)) {
+    FIO_NAME(_ordered_s_) *found =
+        FIO_NAME(_small_seek_)(set, hash_value, (FIO_SET_TYPE){.key = key});
+    if (found)
+      return found->obj.obj;
+  }
+#endif
+#if FIO_SET_SWISS
+  uintptr_t slot;
+  FIO_NAME(_ordered_s_) *pos = FIO_NAME(_swiss_seek_)(
+      set, hash_value, (FIO_SET_TYPE){.key = key}, &slot);
+  if (pos)
+    return pos->obj.obj;
+#else
   FIO_NAME(_map_s_) *pos =
       FIO_NAME(_find_map_pos_)(set, hash_value, (FIO_SET_TYPE){.key = key});
-  if (!pos || !pos->pos) {
-    FIO_SET_OBJ_TYPE empty;
-    memset(&empty, 0, sizeof(empty));
-    return empty;
-  }
-  return pos->pos->obj.obj;
+  if (pos && pos->pos)
+    return pos->pos->obj.obj;
+#endif
+  FIO_SET_OBJ_TYPE empty;
+  memset(&empty, 0, sizeof(empty));
+  return empty;
 }
 
 /**
@@ -6092,6 +6848,29 @@ FIO_FUNC inline int FIO_NAME(remove)(FIO_NAME(s) * set,
                                      const FIO_SET_HASH_TYPE hash_value,
                                      FIO_SET_KEY_TYPE key,
                                      FIO_SET_OBJ_TYPE *old) {
+#if FIO_SET_SMALL
+  if (FIO_NAME(_is_small_)(set)) {
+    FIO_NAME(_ordered_s_) *found =
+        FIO_NAME(_small_seek_)(set, hash_value, (FIO_SET_TYPE){.key = key});
+    if (!found)
+      return -1;
+    if (old)
+      FIO_SET_OBJ_COPY((*old), found->obj.obj);
+    FIO_NAME(_small_remove_)(set, found);
+    return 0;
+  }
+#endif
+#if FIO_SET_SWISS
+  uintptr_t slot;
+  FIO_NAME(_ordered_s_) *pos = FIO_NAME(_swiss_seek_)(
+      set, hash_value, (FIO_SET_TYPE){.key = key}, &slot);
+  if (!pos)
+    return -1;
+  if (old)
+    FIO_SET_OBJ_COPY((*old), pos->obj.obj);
+  FIO_NAME(_swiss_remove_)(set, pos, slot);
+  return 0;
+#else
   FIO_NAME(_map_s_) *pos =
       FIO_NAME(_find_map_pos_)(set, hash_value, (FIO_SET_TYPE){.key = key});
   if (!pos || !pos->pos)
@@ -6111,6 +6890,7 @@ FIO_FUNC inline int FIO_NAME(remove)(FIO_NAME(s) * set,
   }
   pos->pos = NULL; /* leave pos->hash set to mark "hole" */
   return 0;
+#endif
 }
 
 #else /* FIO_SET_KEY_TYPE */
@@ -6121,13 +6901,28 @@ FIO_FUNC inline int FIO_NAME(remove)(FIO_NAME(s) * set,
 FIO_FUNC FIO_SET_OBJ_TYPE FIO_NAME(find)(FIO_NAME(s) * set,
                                          const FIO_SET_HASH_TYPE hash_value,
                                          FIO_SET_OBJ_TYPE obj) {
-  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, hash_value, obj);
-  if (!pos || !pos->pos) {
-    FIO_SET_OBJ_TYPE empty;
-    memset(&empty, 0, sizeof(empty));
-    return empty;
+#if FIO_SET_SMALL
+  if (FIO_NAME(_is_small_)(set)) {
+    FIO_NAME(_ordered_s_) *found =
+        FIO_NAME(_small_seek_)(set, hash_value, obj);
+    if (found)
+      return found->obj;
   }
-  return pos->pos->obj;
+#endif
+#if FIO_SET_SWISS
+  uintptr_t slot;
+  FIO_NAME(_ordered_s_) *pos =
+      FIO_NAME(_swiss_seek_)(set, hash_value, obj, &slot);
+  if (pos)
+    return pos->obj;
+#else
+  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, hash_value, obj);
+  if (pos && pos->pos)
+    return pos->pos->obj;
+#endif
+  FIO_SET_OBJ_TYPE empty;
+  memset(&empty, 0, sizeof(empty));
+  return empty;
 }
 
 /**
@@ -6166,6 +6961,29 @@ FIO_FUNC int FIO_NAME(remove)(FIO_NAME(s) * set,
                               FIO_SET_OBJ_TYPE obj, FIO_SET_OBJ_TYPE *old) {
   if (FIO_SET_HASH_COMPARE(hash_value, FIO_SET_HASH_INVALID))
     return -1;
+#if FIO_SET_SMALL
+  if (FIO_NAME(_is_small_)(set)) {
+    FIO_NAME(_ordered_s_) *found =
+        FIO_NAME(_small_seek_)(set, hash_value, obj);
+    if (!found)
+      return -1;
+    if (old)
+      FIO_SET_COPY((*old), found->obj);
+    FIO_NAME(_small_remove_)(set, found);
+    return 0;
+  }
+#endif
+#if FIO_SET_SWISS
+  uintptr_t slot;
+  FIO_NAME(_ordered_s_) *found =
+      FIO_NAME(_swiss_seek_)(set, hash_value, obj, &slot);
+  if (!found)
+    return -1;
+  if (old)
+    FIO_SET_COPY((*old), found->obj);
+  FIO_NAME(_swiss_remove_)(set, found, slot);
+  return 0;
+#else
   FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_)(set, hash_value, obj);
   if (!pos || !pos->pos)
     return -1;
@@ -6184,6 +7002,7 @@ FIO_FUNC int FIO_NAME(remove)(FIO_NAME(s) * set,
   }
   pos->pos = NULL; /* leave pos->hash set to mark "hole" */
   return 0;
+#endif
 }
 
 #endif
@@ -6210,6 +7029,15 @@ FIO_FUNC inline FIO_SET_TYPE FIO_NAME(last)(FIO_NAME(s) * set) {
 FIO_FUNC void FIO_NAME(pop)(FIO_NAME(s) * set) {
   if (!set->ordered || !set->pos)
     return;
+#if FIO_SET_SWISS
+  const uintptr_t slot = set->map
+                             ? FIO_NAME(_swiss_slot_of_)(set, set->pos - 1)
+                             : (uintptr_t)-1;
+  if (slot != (uintptr_t)-1) {
+    FIO_NAME(_swiss_remove_)(set, set->ordered + set->pos - 1, slot);
+    return;
+  }
+#endif
   FIO_SET_DESTROY(set->ordered[set->pos - 1].obj);
   set->ordered[set->pos - 1].hash = FIO_SET_HASH_INVALID;
   --(set->count);
@@ -6241,7 +7069,11 @@ FIO_FUNC inline size_t FIO_NAME(capa_require)(FIO_NAME(s) * set,
                                               size_t min_capa) {
   if (min_capa <= FIO_NAME(capa)(set))
     return FIO_NAME(capa)(set);
-  set->used_bits = 2;
+#if FIO_SET_SMALL
+  if (min_capa <= FIO_SET_SMALL && FIO_NAME(_small_init_)(set))
+    return FIO_NAME(capa)(set);
+#endif
+  set->used_bits = FIO_SET_MIN_BITS;
   while (min_capa > (1ULL << set->used_bits)) {
     ++set->used_bits;
   }
@@ -6264,7 +7096,11 @@ FIO_FUNC inline size_t FIO_NAME(is_fragmented)(const FIO_NAME(s) * set) {
  */
 FIO_FUNC inline size_t FIO_NAME(compact)(FIO_NAME(s) * set) {
   FIO_NAME(_compact_ordered_array_)(set);
-  set->used_bits = 2;
+#if FIO_SET_SMALL
+  if (FIO_NAME(_is_small_)(set))
+    return FIO_NAME(capa)(set);
+#endif
+  set->used_bits = FIO_SET_MIN_BITS;
   while (set->count >= (1ULL << set->used_bits)) {
     ++set->used_bits;
   }
@@ -6274,6 +7110,26 @@ FIO_FUNC inline size_t FIO_NAME(compact)(FIO_NAME(s) * set) {
 
 /** Forces a rehashing of the Set. */
 FIO_FUNC void FIO_NAME(rehash)(FIO_NAME(s) * set) {
+#if FIO_SET_SMALL
+  if (FIO_NAME(_is_small_)(set) &&
+      (1ULL << set->used_bits) <= FIO_SET_SMALL) {
+    /* the objects remain in the inline array */
+    FIO_NAME(_compact_ordered_array_)(set);
+    return;
+  }
+#endif
+#if FIO_SET_SWISS
+  FIO_NAME(_compact_ordered_array_)(set);
+  if (set->used_bits < FIO_SET_MIN_BITS)
+    set->used_bits = FIO_SET_MIN_BITS;
+  /* the map is never more than 7/8 full */
+  while (set->pos > (1ULL << set->used_bits) - (1ULL << (set->used_bits - 3)))
+    ++set->used_bits;
+  FIO_NAME(_reallocate_set_mem_)(set);
+  set->removed = 0;
+  for (uintptr_t i = 0; i < set->pos; ++i)
+    FIO_NAME(_swiss_place_)(set, i);
+#else
   FIO_NAME(_compact_ordered_array_)(set);
   set->has_collisions = 0;
   uint8_t attempts = 0;
@@ -6302,6 +7158,7 @@ restart:
       mp->hash = pos->hash;
     }
   }
+#endif
 }
 
 #undef FIO_SET_OBJ_TYPE
@@ -6322,6 +7179,10 @@ restart:
 #undef FIO_SET_DESTROY
 #undef FIO_SET_MAX_MAP_SEEK
 #undef FIO_SET_MAX_MAP_FULL_COLLISIONS
+#undef FIO_SET_SWISS
+#undef FIO_SET_SMALL
+#undef FIO_SET_MAP_SIZE
+#undef FIO_SET_MIN_BITS
 #undef FIO_SET_REALLOC
 #undef FIO_SET_CALLOC
 #undef FIO_SET_FREE
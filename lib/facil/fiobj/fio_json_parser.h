@@ -26,6 +26,10 @@
 #include <stdio.h>
 #endif
 
+#if defined(__SSE2__) && (!defined(JSON_SIMD) || JSON_SIMD)
+#include <immintrin.h>
+#endif
+
 #if !defined(__GNUC__) && !defined(__clang__) && !defined(FIO_GNUC_BYPASS)
 #define __attribute__(...)
 #define __has_include(...) 0
@@ -40,18 +44,54 @@
 JSON API
 ***************************************************************************** */
 
-/* maximum allowed depth values max out at 32, since a bitmap is used */
-#if !defined(JSON_MAX_DEPTH) || JSON_MAX_DEPTH > 32
-#undef JSON_MAX_DEPTH
-#define JSON_MAX_DEPTH 32
+#ifndef JSON_MAX_DEPTH
+/**
+ * Limits JSON nesting, protecting against malicious payloads.
+ *
+ * The first 64 levels are tracked using a bitmap, deeper levels are tracked
+ * using a dynamically allocated stack.
+ */
+#define JSON_MAX_DEPTH 512
+#endif
+
+#ifndef JSON_SIMD
+/**
+ * If true (1), a vectorized structural index is used to skip white space and to
+ * seek the end of strings, 64 bytes at a time.
+ *
+ * Defaults to true when compiling for AVX2. The index can be forced on any
+ * SSE2 machine, but it isn't faster than the scalar parser without AVX2.
+ *
+ * The scalar parser is always used for short buffers and once a comment is
+ * encountered.
+ */
+#if defined(__AVX2__)
+#define JSON_SIMD 1
+#else
+#define JSON_SIMD 0
+#endif
+#endif
+
+#if JSON_SIMD && !defined(__SSE2__)
+#undef JSON_SIMD
+#define JSON_SIMD 0
+#endif
+
+#ifndef JSON_SIMD_MIN_LENGTH
+/** Buffers shorter than this length are always parsed by the scalar parser. */
+#define JSON_SIMD_MIN_LENGTH 128
 #endif
 
 /** The JSON parser type. Memory must be initialized to 0 before first uses. */
 typedef struct {
-  /** in dictionary flag. */
-  uint32_t dict;
+  /** in dictionary flags for the 64 innermost levels (bit 0 is the current). */
+  uint64_t dict;
+  /** in dictionary flags for deeper levels (allocated when required). */
+  uint64_t *deep;
+  /** the capacity of the `deep` stack (in 64 bit words). */
+  uint32_t deep_capa;
   /** level of nesting. */
-  uint8_t depth;
+  uint32_t depth;
   /** in dictionary waiting for key. */
   uint8_t key;
 } json_parser_s;
@@ -69,6 +109,15 @@ typedef struct {
 static size_t __attribute__((unused))
 fio_json_parse(json_parser_s *parser, const char *buffer, size_t length);
 
+/**
+ * Resets the parser, releasing any memory allocated for deep nesting.
+ *
+ * Memory is only allocated for nesting deeper than 64 levels and it's released
+ * automatically once a JSON object was parsed (or on error). Call this function
+ * when discarding a parser that stopped in the middle of a JSON object.
+ */
+static void __attribute__((unused)) fio_json_parser_free(json_parser_s *parser);
+
 /**
  * This function allows JSON formatted strings to be converted to native
  * strings.
@@ -275,6 +324,254 @@ static inline int seek2eos(uint8_t **buffer,
   return 0;
 }
 
+/* *****************************************************************************
+JSON Structural Index - finding tokens 64 bytes at a time
+***************************************************************************** */
+
+/*
+The index marks the tokens in every 64 byte block of the buffer as a bitmap:
+
+* Operators ('{', '}', '[', ']', ':') that aren't part of a String.
+* Both the opening and the closing (unescaped) quotes of every String.
+* The first byte of any other value (numbers, `true`, comments, etc').
+
+White space, commas and String contents are never marked, so the parser can
+jump from one token to the next and from a String's opening quote directly to
+it's closing quote.
+
+The index is computed lazily, one block at a time, carrying the String and
+escape state from one block to the next. Since comments might contain quotes,
+the index is abandoned once a comment is encountered.
+*/
+
+/** The structural index state. The index is disabled when `limit` is NULL. */
+typedef struct {
+  /** the first byte of the current block */
+  const uint8_t *block;
+  /** the end of the buffer */
+  const uint8_t *limit;
+  /** the tokens in the current block */
+  uint64_t tokens;
+  /** all bits are set if the previous block ended within a String */
+  uint64_t in_string;
+  /** 1 if the first byte of the current block is escaped */
+  uint64_t escaped;
+  /** 1 if the previous block ended with a value (non token) byte */
+  uint64_t value;
+} fio_json_index_s;
+
+#if JSON_SIMD
+
+/* sets every bit between pairs of set bits (including the first of each pair) */
+static inline uint64_t fio_json_prefix_xor(uint64_t x) {
+#if defined(__PCLMUL__)
+  return (uint64_t)_mm_cvtsi128_si64(_mm_clmulepi64_si128(
+      _mm_set_epi64x(0, (long long)x), _mm_set1_epi8((char)0xFF), 0));
+#else
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+#endif
+}
+
+/*
+Operators and separators are classified using a nibble lookup (AVX2), where `lo[c & 15] & hi[c >> 4]` is non-zero only for:
+
+* bit 0: '\t', '\n', '\r'      (separator)
+* bit 1: ' ', ','              (separator)
+* bit 2: ':'                   (operator)
+* bit 3: '[', ']', '{', '}'    (operator)
+*/
+#define JSON_SIMD_LO                                                           \
+  2, 0, 0, 0, 0, 0, 0, 0, 0, 1, 5, 8, 2, 9, 0, 0
+#define JSON_SIMD_HI                                                           \
+  1, 0, 2, 4, 0, 8, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0
+
+/* maps quotes and backslashes in a 64 byte block */
+static inline void fio_json_index_quotes(const uint8_t *b, uint64_t *quote,
+                                         uint64_t *backslash) {
+#if defined(__AVX2__)
+  const __m256i q = _mm256_set1_epi8('"');
+  const __m256i e = _mm256_set1_epi8('\\');
+  const __m256i v0 = _mm256_loadu_si256((const __m256i *)b);
+  const __m256i v1 = _mm256_loadu_si256((const __m256i *)(b + 32));
+  *quote = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, q)) |
+           ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, q))
+            << 32);
+  *backslash =
+      (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, e)) |
+      ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, e))
+       << 32);
+#else
+  const __m128i q = _mm_set1_epi8('"');
+  const __m128i e = _mm_set1_epi8('\\');
+  *quote = *backslash = 0;
+  for (size_t i = 0; i < 64; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(b + i));
+    *quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, q)) << i;
+    *backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, e))
+                  << i;
+  }
+#endif
+}
+
+/* maps operators and separators (white space and commas) in a 64 byte block */
+static inline void fio_json_index_ops(const uint8_t *b, uint64_t *op,
+                                      uint64_t *sep) {
+#if defined(__AVX2__)
+  const __m256i lo = _mm256_setr_epi8(JSON_SIMD_LO, JSON_SIMD_LO);
+  const __m256i hi = _mm256_setr_epi8(JSON_SIMD_HI, JSON_SIMD_HI);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i op_bits = _mm256_set1_epi8(0x0C);
+  const __m256i sep_bits = _mm256_set1_epi8(0x03);
+  const __m256i zero = _mm256_setzero_si256();
+  *op = *sep = 0;
+  for (size_t i = 0; i < 64; i += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i *)(b + i));
+    const __m256i c = _mm256_and_si256(
+        _mm256_shuffle_epi8(lo, v),
+        _mm256_shuffle_epi8(
+            hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+    *op |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(
+               _mm256_cmpeq_epi8(_mm256_and_si256(c, op_bits), zero))
+           << i;
+    *sep |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_and_si256(c, sep_bits), zero))
+            << i;
+  }
+#else
+  *op = *sep = 0;
+  for (size_t i = 0; i < 64; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(b + i));
+    /* ('[' | 0x20) == '{' and (']' | 0x20) == '}' */
+    const __m128i l = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    const __m128i o = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(l, _mm_set1_epi8('{')),
+                     _mm_cmpeq_epi8(l, _mm_set1_epi8('}'))),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+    const __m128i s = _mm_or_si128(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                     _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\r')))),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+    *op |= (uint64_t)(uint16_t)_mm_movemask_epi8(o) << i;
+    *sep |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << i;
+  }
+#endif
+}
+
+#undef JSON_SIMD_LO
+#undef JSON_SIMD_HI
+
+/* indexes the (64 byte) block starting at `i->block` */
+static inline void fio_json_index_block(fio_json_index_s *i) {
+  uint8_t tail[64];
+  const uint8_t *b = i->block;
+  if ((uintptr_t)(i->limit - b) < 64) {
+    /* pad the last block with white space */
+    memset(tail, ' ', 64);
+    memcpy(tail, b, (size_t)(i->limit - b));
+    b = tail;
+  }
+  uint64_t quote, backslash, op, sep;
+  fio_json_index_quotes(b, &quote, &backslash);
+  /* escaped bytes follow an odd sequence of backslashes */
+  if (backslash | i->escaped) {
+    const uint64_t even = 0x5555555555555555ULL;
+    backslash &= ~i->escaped;
+    const uint64_t follows = (backslash << 1) | i->escaped;
+    const uint64_t odd_starts = backslash & ~even & ~follows;
+    const uint64_t even_sequences = odd_starts + backslash;
+    i->escaped = (even_sequences < backslash);
+    quote &= ~((even ^ (even_sequences << 1)) & follows);
+  }
+  if (!quote && i->in_string) {
+    /* the whole block is a part of a String */
+    i->tokens = 0;
+    i->value = 0;
+    return;
+  }
+  fio_json_index_ops(b, &op, &sep);
+  /* String contents, from the opening quote up to the closing quote */
+  const uint64_t str = fio_json_prefix_xor(quote) ^ i->in_string;
+  i->in_string = (uint64_t)((int64_t)str >> 63);
+  /* values start after white space, commas, operators or Strings */
+  const uint64_t value = ~(str | quote | op | sep);
+  i->tokens = (op & ~str) | quote | (value & ~((value << 1) | i->value));
+  i->value = value >> 63;
+}
+
+/* initializes the index, unless the buffer is too short to benefit */
+static inline void fio_json_index_init(fio_json_index_s *i,
+                                       const uint8_t *buffer,
+                                       const uint8_t *limit) {
+  *i = (fio_json_index_s){.block = buffer};
+  if ((uintptr_t)(limit - buffer) < JSON_SIMD_MIN_LENGTH)
+    return;
+  i->limit = limit;
+  fio_json_index_block(i);
+}
+
+/* returns the first token at or after `pos`, or `limit` if none remain. */
+static inline uint8_t *fio_json_index_next(fio_json_index_s *i,
+                                           uint8_t *pos) {
+  while (pos >= i->block + 64 ||
+         !(i->tokens & (~(uint64_t)0 << (pos - i->block)))) {
+    i->block += 64;
+    if (i->block >= i->limit) {
+      pos = (uint8_t *)i->limit;
+      i->limit = NULL;
+      return pos;
+    }
+    fio_json_index_block(i);
+    if (pos < i->block)
+      pos = (uint8_t *)i->block;
+  }
+  return (uint8_t *)i->block +
+         __builtin_ctzll(i->tokens & (~(uint64_t)0 << (pos - i->block)));
+}
+
+#else /* JSON_SIMD */
+
+static inline void fio_json_index_init(fio_json_index_s *i,
+                                       const uint8_t *buffer,
+                                       const uint8_t *limit) {
+  *i = (fio_json_index_s){.block = buffer};
+  (void)limit;
+}
+
+static inline uint8_t *fio_json_index_next(fio_json_index_s *i,
+                                           uint8_t *pos) {
+  return pos;
+  (void)i;
+}
+
+#endif /* JSON_SIMD */
+
+/**
+ * Seeks the end of a String using the index (when available), see `seek2eos`.
+ */
+static inline int fio_json_index_seek2eos(fio_json_index_s *i,
+                                          uint8_t **buffer,
+                                          const uint8_t *const limit) {
+  if (i->limit) {
+    uint8_t *end = fio_json_index_next(i, *buffer);
+    if (end == limit)
+      return 0;
+    if (*end == '"') {
+      *buffer = end;
+      return 1;
+    }
+    i->limit = NULL; /* out of sync (shouldn't happen), stop using the index */
+  }
+  return seek2eos(buffer, limit);
+}
+
 /* *****************************************************************************
 JSON String to Numeral Helpers - allowing for stand-alone mode
 ***************************************************************************** */
@@ -299,6 +596,50 @@ double __attribute__((weak)) fio_atof(char **pstr) {
 
 #endif
 
+/* *****************************************************************************
+JSON Nesting - the in dictionary flag stack
+***************************************************************************** */
+
+/* enters a nesting level, spilling the outermost flag if the bitmap is full */
+static inline int fio_json_depth_push(json_parser_s *p, uint64_t is_dict) {
+  ++p->depth;
+  if (p->depth >= JSON_MAX_DEPTH)
+    return -1;
+  if (p->depth > 64) {
+    const size_t i = p->depth - 65;
+    if ((i >> 6) >= p->deep_capa) {
+      const uint32_t capa = p->deep_capa ? (p->deep_capa << 1) : 4;
+      uint64_t *tmp = (uint64_t *)realloc(p->deep, capa * sizeof(*tmp));
+      if (!tmp)
+        return -1;
+      p->deep = tmp;
+      p->deep_capa = capa;
+    }
+    if ((p->dict >> 63))
+      p->deep[i >> 6] |= ((uint64_t)1 << (i & 63));
+    else
+      p->deep[i >> 6] &= ~((uint64_t)1 << (i & 63));
+  }
+  p->dict = (p->dict << 1) | is_dict;
+  return 0;
+}
+
+/* leaves a nesting level, restoring any spilled flag */
+static inline void fio_json_depth_pop(json_parser_s *p) {
+  p->dict >>= 1;
+  if (p->depth > 64) {
+    const size_t i = p->depth - 65;
+    p->dict |= ((p->deep[i >> 6] >> (i & 63)) & 1) << 63;
+  }
+  --p->depth;
+}
+
+static void __attribute__((unused))
+fio_json_parser_free(json_parser_s *parser) {
+  free(parser->deep);
+  *parser = (json_parser_s){.dict = 0};
+}
+
 /* *****************************************************************************
 JSON Consumption (astract parsing)
 ***************************************************************************** */
@@ -313,7 +654,12 @@ fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
     return 0;
   uint8_t *pos = (uint8_t *)buffer;
   const uint8_t *limit = pos + length;
+  fio_json_index_s index;
+  fio_json_index_init(&index, pos, limit);
   do {
+    if (index.limit && JSON_SEPERATOR[*pos] && pos + 1 < limit &&
+        JSON_SEPERATOR[pos[1]])
+      pos = fio_json_index_next(&index, pos);
     while (pos < limit && JSON_SEPERATOR[*pos])
       ++pos;
     if (pos == limit)
@@ -321,7 +667,7 @@ fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
     switch (*pos) {
     case '"': {
       uint8_t *tmp = pos + 1;
-      if (seek2eos(&tmp, limit) == 0)
+      if (fio_json_index_seek2eos(&index, &tmp, limit) == 0)
         goto stop;
       if (parser->key) {
         uint8_t *key = tmp + 1;
@@ -350,10 +696,8 @@ fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
 #endif
         goto error;
       }
-      ++parser->depth;
-      if (parser->depth >= JSON_MAX_DEPTH)
+      if (fio_json_depth_push(parser, 1))
         goto error;
-      parser->dict = (parser->dict << 1) | 1;
       ++pos;
       if (fio_json_on_start_object(parser))
         goto error;
@@ -372,9 +716,8 @@ fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
 #endif
         fio_json_on_null(parser); /* append NULL and recuperate from error. */
       }
-      --parser->depth;
+      fio_json_depth_pop(parser);
       ++pos;
-      parser->dict = (parser->dict >> 1);
       fio_json_on_end_object(parser);
       break;
     case '[':
@@ -384,20 +727,17 @@ fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
 #endif
         goto error;
       }
-      ++parser->depth;
-      if (parser->depth >= JSON_MAX_DEPTH)
+      if (fio_json_depth_push(parser, 0))
         goto error;
       ++pos;
-      parser->dict = (parser->dict << 1);
       if (fio_json_on_start_array(parser))
         goto error;
       break;
     case ']':
-      if ((parser->dict & 1))
+      if ((parser->dict & 1) || !parser->depth)
         goto error;
-      --parser->depth;
+      fio_json_depth_pop(parser);
       ++pos;
-      parser->dict = (parser->dict >> 1);
       fio_json_on_end_array(parser);
       break;
     case 't':
@@ -458,11 +798,21 @@ fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
         double f = fio_atof((char **)&tmp);
         if (tmp > limit)
           goto stop;
-        if (!tmp || JSON_NUMERAL[*tmp])
+        if (!tmp || JSON_NUMERAL[*tmp]) {
+          /* an incomplete number (i.e. "1e") might end in the next chunk */
+          while (tmp && tmp < limit && JSON_NUMERAL[*tmp])
+            ++tmp;
+          if (tmp == limit)
+            goto stop;
           goto error;
+        }
+        if (tmp == limit && parser->depth)
+          goto stop; /* the number might continue in the next chunk */
         fio_json_on_float(parser, f);
         pos = tmp;
       } else {
+        if (tmp == limit && parser->depth)
+          goto stop; /* the number might continue in the next chunk */
         fio_json_on_number(parser, i);
         pos = tmp;
       }
@@ -470,6 +820,7 @@ fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
     }
     case '#': /* Ruby style comment */
     {
+      index.limit = NULL; /* comments might contain quotes */
       uint8_t *tmp = memchr(pos, '\n', (uintptr_t)(limit - pos));
       if (!tmp)
         goto stop;
@@ -478,11 +829,15 @@ fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
       ;
     }
     case '/': /* C style / Javascript style comment */
+      index.limit = NULL; /* comments might contain quotes */
+      if (pos + 1 >= limit)
+        goto stop;
       if (pos[1] == '*') {
         if (pos + 4 > limit)
           goto stop;
-        uint8_t *tmp = pos + 3; /* avoid this: /*/
+        uint8_t *tmp = pos + 2; /* avoid this: /*/
         do {
+          ++tmp;
           tmp = memchr(tmp, '/', (uintptr_t)(limit - tmp));
         } while (tmp && tmp[-1] != '*');
         if (!tmp)
@@ -500,15 +855,19 @@ fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
     default:
       goto error;
     }
+    parser->key = (parser->dict & 1);
     if (parser->depth == 0) {
+      if (parser->deep)
+        fio_json_parser_free(parser);
       fio_json_on_json(parser);
       goto stop;
     }
-    parser->key = (parser->dict & 1);
   } while (pos < limit);
 stop:
   return (size_t)((uintptr_t)pos - (uintptr_t)buffer);
 error:
+  if (parser->deep)
+    fio_json_parser_free(parser);
   fio_json_on_error(parser);
   return 0;
 }
@@ -13,6 +13,8 @@ License: MIT
   fio_realloc2((ptr), (size), (valid_data_length))
 #define FIO_SET_FREE(ptr, size) fio_free((ptr))
 
+#define FIO_SET_SWISS 1 /* lookups dominate (headers, params, JSON) */
+#define FIO_SET_SMALL FIOBJ_HASH_SMALL_CAPA
 #define FIO_SET_NAME fio_hash__
 #define FIO_SET_KEY_TYPE FIOBJ
 #define FIO_SET_KEY_COMPARE(o1, o2)                                            \
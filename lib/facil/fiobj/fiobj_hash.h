@@ -30,6 +30,16 @@ extern "C" {
 /* MUST be a power of 2 */
 #define HASH_INITIAL_CAPACITY 16
 
+#ifndef FIOBJ_HASH_SMALL_CAPA
+/**
+ * The number of key-value pairs stored within the Hash object itself (searched
+ * linearly), before a hash table is allocated. Most HTTP header Hashes fit.
+ *
+ * Set to 0 to always allocate a hash table.
+ */
+#define FIOBJ_HASH_SMALL_CAPA 16
+#endif
+
 /** attempts to rehash the hashmap. */
 void fiobj_hash_rehash(FIOBJ h);
 
@@ -15,6 +15,10 @@ License: MIT
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 /* *****************************************************************************
 JSON API
 ***************************************************************************** */
@@ -40,6 +44,7 @@ typedef struct {
   FIOBJ target;
   fio_json_stack_s stack;
   uint8_t is_hash;
+  uint8_t error;
 } fiobj_json_parser_s;
 
 /* *****************************************************************************
@@ -156,21 +161,82 @@ static void fio_json_on_error(json_parser_s *p) {
   fiobj_free((FIOBJ)fio_json_stack_get(&pr->stack, 0));
   fiobj_free(pr->key);
   fio_json_stack_free(&pr->stack);
-  *pr = (fiobj_json_parser_s){.top = FIOBJ_INVALID};
+  *pr = (fiobj_json_parser_s){.top = FIOBJ_INVALID, .error = 1};
 }
 
 /* *****************************************************************************
 JSON formatting
 ***************************************************************************** */
 
+/**
+ * Returns the length of the leading run of bytes that can be copied as is
+ * (bytes that aren't control characters, '"' or '\\').
+ *
+ * Tests 32 bytes at a time (AVX2), 16 bytes at a time (SSE2) or 8 bytes at a
+ * time (SWAR), so clean runs are copied in bulk.
+ */
+static inline size_t fiobj_json_clean_length(const uint8_t *src, size_t len) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i bslash = _mm256_set1_epi8('\\');
+    const __m256i ctrl = _mm256_set1_epi8(31);
+    for (; i + 32 <= len; i += 32) {
+      const __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+      const __m256i m = _mm256_or_si256(
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, quote),
+                          _mm256_cmpeq_epi8(v, bslash)),
+          _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl), ctrl));
+      const uint32_t bits = (uint32_t)_mm256_movemask_epi8(m);
+      if (bits)
+        return i + __builtin_ctz(bits);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(31);
+    for (; i + 16 <= len; i += 16) {
+      const __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+      const __m128i m = _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+          _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl));
+      const uint32_t bits = (uint32_t)_mm_movemask_epi8(m);
+      if (bits)
+        return i + __builtin_ctz(bits);
+    }
+  }
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ &&  \
+    (defined(__GNUC__) || defined(__clang__))
+  {
+    /* the first flagged byte is exact, later bytes might be false positives */
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+    for (; i + 8 <= len; i += 8) {
+      uint64_t v;
+      memcpy(&v, src + i, 8);
+      const uint64_t q = v ^ (ones * '"');
+      const uint64_t b = v ^ (ones * '\\');
+      const uint64_t bits = (((q - ones) & ~q) | ((b - ones) & ~b) |
+                             ((v - (ones * 32)) & ~v)) &
+                            highs;
+      if (bits)
+        return i + (__builtin_ctzll(bits) >> 3);
+    }
+  }
+#endif
+  while (i < len && src[i] > 31 && src[i] != '"' && src[i] != '\\')
+    ++i;
+  return i;
+}
+
 /** Writes a JSON friendly version of the src String */
 static void write_safe_str(FIOBJ dest, const FIOBJ str) {
   fio_str_info_s s = fiobj_obj2cstr(str);
   fio_str_info_s t = fiobj_obj2cstr(dest);
-  t.data[t.len] = '"';
-  t.len++;
-  fiobj_str_resize(dest, t.len);
-  t = fiobj_obj2cstr(dest);
   const uint8_t *restrict src = (const uint8_t *)s.data;
   size_t len = s.len;
   uint64_t end = t.len;
@@ -178,21 +244,17 @@ static void write_safe_str(FIOBJ dest, const FIOBJ str) {
   size_t added = 0;
   size_t capa = fiobj_str_capa(dest);
   if (capa <= end + s.len + 64) {
-    if (0) {
-      capa = (((capa >> 12) + 1) << 12) - 1;
-      capa = fiobj_str_capa_assert(dest, capa);
-    } else {
-      capa = fiobj_str_capa_assert(dest, (end + s.len + 64));
-    }
-    fio_str_info_s tmp = fiobj_obj2cstr(dest);
-    t = tmp;
+    capa = fiobj_str_capa_assert(dest, (end + s.len + 64));
+    t = fiobj_obj2cstr(dest);
   }
+  t.data[end++] = '"';
   while (len) {
     char *restrict writer = (char *)t.data;
-    while (len && src[0] > 32 && src[0] != '"' && src[0] != '\\') {
-      len--;
-      writer[end++] = *(src++);
-    }
+    const size_t clean = fiobj_json_clean_length(src, len);
+    memcpy(writer + end, src, clean);
+    end += clean;
+    src += clean;
+    len -= clean;
     if (!len)
       break;
     switch (src[0]) {
@@ -258,20 +320,58 @@ static void write_safe_str(FIOBJ dest, const FIOBJ str) {
   fiobj_str_resize(dest, end);
 }
 
-typedef struct {
+/* *****************************************************************************
+JSON Formatting (resumable)
+***************************************************************************** */
+
+/*
+ * The formatter keeps its own stack of (container, position) pairs, so the
+ * formatting can be stopped after any element and resumed later on (see
+ * `fiobj_obj2json_stream_next`).
+ */
+struct fiobj_obj2json_stream_s {
+  FIOBJ obj;
   FIOBJ dest;
-  FIOBJ parent;
-  fio_json_stack_s *stack;
-  uintptr_t count;
+  fio_json_stack_s stack;
+  uintptr_t pos;
+  size_t stop_at;
+  uint8_t is_hash;
   uint8_t pretty;
-} obj2json_data_s;
-
-static int fiobj_obj2json_task(FIOBJ o, void *data_) {
-  obj2json_data_s *data = data_;
-  uint8_t add_seperator = 1;
-  if (fiobj_hash_key_in_loop()) {
-    write_safe_str(data->dest, fiobj_hash_key_in_loop());
-    fiobj_str_write(data->dest, ":", 1);
+  uint8_t started;
+};
+
+/* writes an opening bracket and pushes the container to the stack */
+static inline void fiobj_obj2json_open(fiobj_obj2json_stream_s *s, FIOBJ o) {
+  if (FIOBJ_TYPE_IS(o, FIOBJ_T_HASH))
+    fiobj_str_write(s->dest, "{", 1);
+  else
+    fiobj_str_write(s->dest, "[", 1);
+  fio_json_stack_push(&s->stack, o);
+  fio_json_stack_push(&s->stack, (FIOBJ)0);
+}
+
+static int fiobj_obj2json_task(FIOBJ o, void *s_) {
+  fiobj_obj2json_stream_s *s = s_;
+  if (s->pos++) {
+    if (s->pretty) {
+      uintptr_t indent = fio_json_stack_count(&s->stack) - 1;
+      fio_str_info_s buf = fiobj_obj2cstr(s->dest);
+      fiobj_str_capa_assert(s->dest, buf.len + 2 + (indent * 2));
+      buf = fiobj_obj2cstr(s->dest);
+      buf.data[buf.len++] = ',';
+      buf.data[buf.len++] = '\n';
+      while (indent--) {
+        buf.data[buf.len++] = ' ';
+        buf.data[buf.len++] = ' ';
+      }
+      fiobj_str_resize(s->dest, buf.len);
+    } else {
+      fiobj_str_write(s->dest, ",", 1);
+    }
+  }
+  if (s->is_hash) {
+    write_safe_str(s->dest, fiobj_hash_key_in_loop());
+    fiobj_str_write(s->dest, ":", 1);
   }
   switch (FIOBJ_TYPE(o)) {
   case FIOBJ_T_NUMBER:
@@ -279,88 +379,65 @@ static int fiobj_obj2json_task(FIOBJ o, void *data_) {
   case FIOBJ_T_TRUE:
   case FIOBJ_T_FALSE:
   case FIOBJ_T_FLOAT:
-    fiobj_str_join(data->dest, o);
-    --data->count;
+    fiobj_str_join(s->dest, o);
     break;
 
   case FIOBJ_T_DATA:
   case FIOBJ_T_UNKNOWN:
   case FIOBJ_T_STRING:
-    write_safe_str(data->dest, o);
-    --data->count;
+    write_safe_str(s->dest, o);
     break;
 
   case FIOBJ_T_ARRAY:
-    --data->count;
-    fio_json_stack_push(data->stack, data->parent);
-    fio_json_stack_push(data->stack, (FIOBJ)data->count);
-    data->parent = o;
-    data->count = fiobj_ary_count(o);
-    fiobj_str_write(data->dest, "[", 1);
-    add_seperator = 0;
-    break;
-
   case FIOBJ_T_HASH:
-    --data->count;
-    fio_json_stack_push(data->stack, data->parent);
-    fio_json_stack_push(data->stack, (FIOBJ)data->count);
-    data->parent = o;
-    data->count = fiobj_hash_count(o);
-    fiobj_str_write(data->dest, "{", 1);
-    add_seperator = 0;
-    break;
+    /* stop iterating the parent, the nested container is formatted next */
+    fiobj_obj2json_open(s, o);
+    return -1;
   }
-  if (data->pretty) {
-    fiobj_str_capa_assert(data->dest,
-                          fiobj_obj2cstr(data->dest).len +
-                              (fio_json_stack_count(data->stack) * 5));
-    while (!data->count && data->parent) {
-      if (FIOBJ_TYPE_IS(data->parent, FIOBJ_T_HASH)) {
-        fiobj_str_write(data->dest, "}", 1);
-      } else {
-        fiobj_str_write(data->dest, "]", 1);
-      }
-      add_seperator = 1;
-      data->count = 0;
-      fio_json_stack_pop(data->stack, &data->count);
-      data->parent = FIOBJ_INVALID;
-      fio_json_stack_pop(data->stack, &data->parent);
-    }
+  if (fiobj_obj2cstr(s->dest).len >= s->stop_at)
+    return -1;
+  return 0;
+}
 
-    if (add_seperator && data->parent) {
-      fiobj_str_write(data->dest, ",\n", 2);
-      uintptr_t indent = fio_json_stack_count(data->stack) - 1;
-      fiobj_str_capa_assert(data->dest,
-                            fiobj_obj2cstr(data->dest).len + (indent * 2));
-      fio_str_info_s buf = fiobj_obj2cstr(data->dest);
-      while (indent--) {
-        buf.data[buf.len++] = ' ';
-        buf.data[buf.len++] = ' ';
-      }
-      fiobj_str_resize(data->dest, buf.len);
+/* formats until `stop_at` was reached, returns 1 if more data remains */
+static int fiobj_obj2json_format(fiobj_obj2json_stream_s *s) {
+  if (!s->started) {
+    s->started = 1;
+    if (!s->obj) {
+      fiobj_str_write(s->dest, "null", 4);
+      return 0;
     }
-  } else {
-    fiobj_str_capa_assert(data->dest,
-                          fiobj_obj2cstr(data->dest).len +
-                              (fio_json_stack_count(data->stack) << 1));
-    while (!data->count && data->parent) {
-      if (FIOBJ_TYPE_IS(data->parent, FIOBJ_T_HASH)) {
-        fiobj_str_write(data->dest, "}", 1);
-      } else {
-        fiobj_str_write(data->dest, "]", 1);
-      }
-      add_seperator = 1;
-      data->count = 0;
-      data->parent = FIOBJ_INVALID;
-      fio_json_stack_pop(data->stack, &data->count);
-      fio_json_stack_pop(data->stack, &data->parent);
+    switch (FIOBJ_TYPE(s->obj)) {
+    case FIOBJ_T_ARRAY:
+    case FIOBJ_T_HASH:
+      fiobj_obj2json_open(s, s->obj);
+      break;
+    default:
+      /* a single (primitive) value */
+      s->pos = 0;
+      s->is_hash = 0;
+      fiobj_obj2json_task(s->obj, s);
+      return 0;
     }
-
-    if (add_seperator && data->parent) {
-      fiobj_str_write(data->dest, ",", 1);
+  }
+  size_t count;
+  while ((count = fio_json_stack_count(&s->stack))) {
+    if (fiobj_obj2cstr(s->dest).len >= s->stop_at)
+      return 1;
+    FIOBJ parent = fio_json_stack_get(&s->stack, count - 2);
+    s->pos = (uintptr_t)fio_json_stack_get(&s->stack, count - 1);
+    s->is_hash = FIOBJ_TYPE_IS(parent, FIOBJ_T_HASH);
+    if (s->pos >= (s->is_hash ? fiobj_hash_count(parent)
+                              : fiobj_ary_count(parent))) {
+      /* the container is done */
+      fiobj_str_write(s->dest, (s->is_hash ? "}" : "]"), 1);
+      fio_json_stack_pop(&s->stack, NULL);
+      fio_json_stack_pop(&s->stack, NULL);
+      continue;
     }
+    s->pos = fiobj_each1(parent, s->pos, fiobj_obj2json_task, s);
+    fio_json_stack_set(&s->stack, count - 1, (FIOBJ)s->pos, NULL);
   }
-
   return 0;
 }
 
@@ -381,6 +458,7 @@ size_t fiobj_json2obj(FIOBJ *pobj, const void *data, size_t len) {
     fiobj_free(fio_json_stack_get(&p.stack, 0));
     p.top = FIOBJ_INVALID;
   }
+  fio_json_parser_free(&p.p);
   fio_json_stack_free(&p.stack);
   fiobj_free(p.key);
   *pobj = p.top;
@@ -404,6 +482,7 @@ size_t fiobj_hash_update_json(FIOBJ hash, const void *data, size_t len) {
     return 0;
   fiobj_json_parser_s p = {.top = FIOBJ_INVALID, .target = hash};
   size_t consumed = fio_json_parse(&p.p, data, len);
+  fio_json_parser_free(&p.p);
   fio_json_stack_free(&p.stack);
   fiobj_free(p.key);
   if (p.top != hash)
@@ -417,23 +496,14 @@ size_t fiobj_hash_update_json(FIOBJ hash, const void *data, size_t len) {
  */
 FIOBJ fiobj_obj2json2(FIOBJ dest, FIOBJ o, uint8_t pretty) {
   assert(dest && FIOBJ_TYPE_IS(dest, FIOBJ_T_STRING));
-  if (!o) {
-    fiobj_str_write(dest, "null", 4);
-    return 0;
-  }
-  fio_json_stack_s stack = FIO_ARY_INIT;
-  obj2json_data_s data = {
+  fiobj_obj2json_stream_s s = {
+      .obj = o,
       .dest = dest,
-      .stack = &stack,
+      .stop_at = (size_t)-1,
       .pretty = pretty,
-      .count = 1,
   };
-  if (!o || !FIOBJ_IS_ALLOCATED(o) || !FIOBJECT2VTBL(o)->each) {
-    fiobj_obj2json_task(o, &data);
-    return dest;
-  }
-  fiobj_each2(o, fiobj_obj2json_task, &data);
-  fio_json_stack_free(&stack);
+  fiobj_obj2json_format(&s);
+  fio_json_stack_free(&s.stack);
   return dest;
 }
 
@@ -442,11 +512,291 @@ FIOBJ fiobj_obj2json(FIOBJ obj, uint8_t pretty) {
   return fiobj_obj2json2(fiobj_str_buf(128), obj, pretty);
 }
 
+/* *****************************************************************************
+JSON Streaming API
+***************************************************************************** */
+
+struct fiobj_json_stream_s {
+  fiobj_json_parser_s p;
+  /* unconsumed data (an incomplete token), waiting for the next chunk */
+  FIOBJ buffer;
+  void (*on_json)(FIOBJ obj, void *udata);
+  void *udata;
+};
+
+/* discards any partially parsed object, resetting the parser */
+static void fiobj_json_stream_reset(fiobj_json_stream_s *s) {
+  if (s->p.p.depth)
+    fiobj_free((FIOBJ)fio_json_stack_get(&s->p.stack, 0));
+  else
+    fiobj_free(s->p.top);
+  fiobj_free(s->p.key);
+  fio_json_parser_free(&s->p.p);
+  fio_json_stack_free(&s->p.stack);
+  s->p = (fiobj_json_parser_s){.top = FIOBJ_INVALID};
+  fiobj_str_resize(s->buffer, 0);
+}
+
+/** Creates an incremental (streaming) JSON parser. */
+fiobj_json_stream_s *
+fiobj_json_stream_new(void (*on_json)(FIOBJ obj, void *udata), void *udata) {
+  if (!on_json)
+    return NULL;
+  fiobj_json_stream_s *s = fio_malloc(sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  *s = (fiobj_json_stream_s){
+      .p = {.top = FIOBJ_INVALID},
+      .buffer = fiobj_str_buf(0),
+      .on_json = on_json,
+      .udata = udata,
+  };
+  return s;
+}
+
+/* parses a chunk, `last` marks the end of the stream (see `finish`) */
+static int fiobj_json_stream_parse(fiobj_json_stream_s *s, const void *data,
+                                   size_t len, uint8_t last) {
+  fio_str_info_s buf = fiobj_obj2cstr(s->buffer);
+  if (buf.len) {
+    fiobj_str_write(s->buffer, data, len);
+    buf = fiobj_obj2cstr(s->buffer);
+  } else if (len && (JSON_SEPERATOR[((uint8_t *)data)[len - 1]] ||
+                     ((char *)data)[len - 1] == '"' ||
+                     ((char *)data)[len - 1] == '}' ||
+                     ((char *)data)[len - 1] == ']')) {
+    /* Numbers can't overflow the chunk, so it's safe to parse in place */
+    buf = (fio_str_info_s){.data = (char *)data, .len = len};
+  } else {
+    fiobj_str_write(s->buffer, data, len);
+    buf = fiobj_obj2cstr(s->buffer);
+  }
+  size_t pos = 0;
+  while (pos < buf.len) {
+    size_t consumed =
+        fio_json_parse(&s->p.p, buf.data + pos, (buf.len - pos));
+    if (s->p.error) {
+      fiobj_json_stream_reset(s);
+      return -1;
+    }
+    if (s->p.p.depth || !s->p.top) {
+      /* whitespace or an incomplete object */
+      pos += consumed;
+      break;
+    }
+    if (!last && pos + consumed == buf.len &&
+        (FIOBJ_TYPE(s->p.top) == FIOBJ_T_NUMBER ||
+         FIOBJ_TYPE(s->p.top) == FIOBJ_T_FLOAT)) {
+      /* a top level number might continue in the next chunk */
+      fiobj_free(s->p.top);
+      s->p.top = FIOBJ_INVALID;
+      break;
+    }
+    pos += consumed;
+    FIOBJ o = s->p.top;
+    s->p.top = FIOBJ_INVALID;
+    s->on_json(o, s->udata);
+  }
+  /* keep the unconsumed tail for the next chunk */
+  if (buf.data == fiobj_obj2cstr(s->buffer).data) {
+    if (pos) {
+      memmove(buf.data, buf.data + pos, buf.len - pos);
+      fiobj_str_resize(s->buffer, buf.len - pos);
+    }
+  } else if (pos < buf.len) {
+    fiobj_str_write(s->buffer, buf.data + pos, buf.len - pos);
+  }
+  return 0;
+}
+
+/** Feeds a chunk of JSON data to the parser. */
+int fiobj_json_stream_feed(fiobj_json_stream_s *s, const void *data,
+                           size_t len) {
+  if (!s)
+    return -1;
+  return fiobj_json_stream_parse(s, data, len, 0);
+}
+
+/** Marks the end of the stream, parsing any data that was held back. */
+int fiobj_json_stream_finish(fiobj_json_stream_s *s) {
+  if (!s)
+    return -1;
+  if (fiobj_json_stream_parse(s, NULL, 0, 1))
+    return -1;
+  if (s->p.p.depth || fiobj_obj2cstr(s->buffer).len) {
+    /* the stream ended within an object (or a token) */
+    fiobj_json_stream_reset(s);
+    return -1;
+  }
+  return 0;
+}
+
+/** Frees the parser along with any partially parsed object. */
+void fiobj_json_stream_free(fiobj_json_stream_s *s) {
+  if (!s)
+    return;
+  fiobj_json_stream_reset(s);
+  fiobj_free(s->buffer);
+  fio_free(s);
+}
+
+/* *****************************************************************************
+JSON Streaming Formatter
+***************************************************************************** */
+
+/** Creates a resumable JSON formatter for `obj`. */
+fiobj_obj2json_stream_s *fiobj_obj2json_stream_new(FIOBJ obj, uint8_t pretty) {
+  fiobj_obj2json_stream_s *s = fio_malloc(sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  *s = (fiobj_obj2json_stream_s){
+      .obj = fiobj_dup(obj),
+      .pretty = pretty,
+  };
+  return s;
+}
+
+/** Appends the next (roughly) `limit` bytes of JSON data to `dest`. */
+int fiobj_obj2json_stream_next(fiobj_obj2json_stream_s *s, FIOBJ dest,
+                               size_t limit) {
+  assert(dest && FIOBJ_TYPE_IS(dest, FIOBJ_T_STRING));
+  if (!s)
+    return 0;
+  if (!limit)
+    limit = JSON_SEND_CHUNK_SIZE;
+  s->dest = dest;
+  s->stop_at = fiobj_obj2cstr(dest).len + limit;
+  return fiobj_obj2json_format(s);
+}
+
+/** Frees the formatter, releasing the formatted object. */
+void fiobj_obj2json_stream_free(fiobj_obj2json_stream_s *s) {
+  if (!s)
+    return;
+  fiobj_free(s->obj);
+  fio_json_stack_free(&s->stack);
+  fio_free(s);
+}
+
+/* *****************************************************************************
+Sending JSON
+***************************************************************************** */
+
+typedef struct {
+  fiobj_obj2json_stream_s json;
+  intptr_t uuid;
+  /* the number of chunks waiting to be sent */
+  size_t pending;
+  fio_lock_i lock;
+  /* formatting waits for `pending` to drop */
+  uint8_t paused;
+  /* no more chunks will be sent */
+  uint8_t done;
+} fiobj_json_send_s;
+
+/*
+ * A chunk's header, written at the beginning of the String's buffer (before
+ * the JSON data), so the sender is found once the chunk was sent.
+ */
+typedef struct {
+  fiobj_json_send_s *s;
+  FIOBJ str;
+} fiobj_json_send_chunk_s;
+
+static void fiobj_json_send_destroy(fiobj_json_send_s *s) {
+  fiobj_free(s->json.obj);
+  fio_json_stack_free(&s->json.stack);
+  fio_free(s);
+}
+
+static void fiobj_json_send_task(void *s_, void *ignr);
+
+/* called by the IO reactor once a chunk was sent (or the connection lost) */
+static void fiobj_json_send_on_sent(void *buffer) {
+  fiobj_json_send_chunk_s c;
+  memcpy(&c, buffer, sizeof(c));
+  fiobj_json_send_s *s = c.s;
+  fiobj_free(c.str); /* releases `buffer` */
+  uint8_t resume = 0;
+  uint8_t destroy = 0;
+  fio_lock(&s->lock);
+  --s->pending;
+  if (s->paused && s->pending <= (JSON_SEND_PENDING_LIMIT >> 1)) {
+    s->paused = 0;
+    resume = 1;
+  }
+  destroy = (s->done && !s->pending);
+  fio_unlock(&s->lock);
+  if (resume)
+    fio_defer(fiobj_json_send_task, s, NULL);
+  if (destroy)
+    fiobj_json_send_destroy(s);
+}
+
+/* formats and sends chunks until done or until too many chunks are pending */
+static void fiobj_json_send_task(void *s_, void *ignr) {
+  fiobj_json_send_s *s = s_;
+  int more = 1;
+  while (more && fio_is_valid(s->uuid)) {
+    FIOBJ str = fiobj_str_buf(sizeof(fiobj_json_send_chunk_s) +
+                              JSON_SEND_CHUNK_SIZE);
+    fiobj_json_send_chunk_s c = {.s = s, .str = str};
+    fiobj_str_write(str, (char *)&c, sizeof(c));
+    more = fiobj_obj2json_stream_next(&s->json, str, JSON_SEND_CHUNK_SIZE);
+    fio_str_info_s data = fiobj_obj2cstr(str);
+    fio_lock(&s->lock);
+    ++s->pending;
+    fio_unlock(&s->lock);
+    fio_write2(s->uuid, .data.buffer = data.data, .offset = sizeof(c),
+               .length = data.len - sizeof(c),
+               .after.dealloc = fiobj_json_send_on_sent);
+    if (!more)
+      break;
+    fio_lock(&s->lock);
+    if (s->pending >= JSON_SEND_PENDING_LIMIT) {
+      /* resumed by `fiobj_json_send_on_sent` */
+      s->paused = 1;
+      fio_unlock(&s->lock);
+      return;
+    }
+    fio_unlock(&s->lock);
+  }
+  uint8_t destroy;
+  fio_lock(&s->lock);
+  s->done = 1;
+  destroy = !s->pending;
+  fio_unlock(&s->lock);
+  if (destroy)
+    fiobj_json_send_destroy(s);
+  (void)ignr;
+}
+
+/** Formats `obj` as JSON, sending it through `uuid` in fixed size chunks. */
+int fiobj_obj2json_send(intptr_t uuid, FIOBJ obj, uint8_t pretty) {
+  if (!fio_is_valid(uuid))
+    return -1;
+  fiobj_json_send_s *s = fio_malloc(sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  *s = (fiobj_json_send_s){
+      .json =
+          {
+              .obj = fiobj_dup(obj),
+              .pretty = pretty,
+          },
+      .uuid = uuid,
+      .lock = FIO_LOCK_INIT,
+  };
+  fiobj_json_send_task(s, NULL);
+  return 0;
+}
+
 /* *****************************************************************************
 Test
 ***************************************************************************** */
 
 #if DEBUG
+static void fiobj_test_json_on_stream(FIOBJ obj, void *results) {
+  fiobj_ary_push((FIOBJ)results, obj);
+}
+
 void fiobj_test_json(void) {
   fprintf(stderr, "=== Testing JSON parser (simple test)\n");
 #define TEST_ASSERT(cond, ...)                                                 \
@@ -617,6 +967,111 @@ void fiobj_test_json(void) {
   fiobj_free(o);
   fiobj_free(tmp);
   fprintf(stderr, "* passed.\n");
+
+  fprintf(stderr, "=== Testing JSON parsing (deep nesting)\n");
+  tmp = fiobj_str_buf((JSON_MAX_DEPTH << 3) + 16);
+  for (size_t i = 0; i < JSON_MAX_DEPTH - 1; ++i) {
+    if ((i % 3))
+      fiobj_str_write(tmp, "[", 1);
+    else
+      fiobj_str_write(tmp, "{\"a\":", 5);
+  }
+  fiobj_str_write(tmp, "1", 1);
+  for (size_t i = JSON_MAX_DEPTH - 1; i--;) {
+    if ((i % 3))
+      fiobj_str_write(tmp, "]", 1);
+    else
+      fiobj_str_write(tmp, "}", 1);
+  }
+  TEST_ASSERT(fiobj_json2obj(&o, fiobj_obj2cstr(tmp).data,
+                             fiobj_obj2cstr(tmp).len) ==
+                  fiobj_obj2cstr(tmp).len,
+              "JSON nested %d levels deep failed to parse!\n",
+              JSON_MAX_DEPTH - 1);
+  {
+    FIOBJ tmp2 = fiobj_obj2json(o, 0);
+    TEST_ASSERT(!strcmp(fiobj_obj2cstr(tmp2).data, fiobj_obj2cstr(tmp).data),
+                "JSON nested round-trip error!\n");
+    fiobj_free(tmp2);
+  }
+  fiobj_free(o);
+  fiobj_str_resize(tmp, 0);
+  for (size_t i = 0; i < JSON_MAX_DEPTH; ++i)
+    fiobj_str_write(tmp, "[", 1);
+  for (size_t i = 0; i < JSON_MAX_DEPTH; ++i)
+    fiobj_str_write(tmp, "]", 1);
+  TEST_ASSERT(!fiobj_json2obj(&o, fiobj_obj2cstr(tmp).data,
+                              fiobj_obj2cstr(tmp).len) &&
+                  !o,
+              "JSON nesting limit (%d) ignored!\n", JSON_MAX_DEPTH);
+  fiobj_free(tmp);
+  fprintf(stderr, "* passed.\n");
+
+  fprintf(stderr, "=== Testing JSON streaming (byte by byte)\n");
+  {
+    const char ndjson[] = "{\"id\":1,\"list\":[12.5,-3e2,\"a \\\"b\\\"\"]}\n"
+                          "[true,false,null]\n"
+                          "\"string\"\n"
+                          "1234\n";
+    FIOBJ results = fiobj_ary_new();
+    fiobj_json_stream_s *stream =
+        fiobj_json_stream_new(fiobj_test_json_on_stream, (void *)results);
+    for (size_t i = 0; i < sizeof(ndjson) - 1; ++i) {
+      TEST_ASSERT(!fiobj_json_stream_feed(stream, ndjson + i, 1),
+                  "JSON stream error at byte %zu\n", i);
+    }
+    TEST_ASSERT(fiobj_ary_count(results) == 4,
+                "JSON stream object count error (%zu)\n",
+                fiobj_ary_count(results));
+    tmp = fiobj_str_buf(sizeof(ndjson));
+    for (size_t i = 0; i < 4; ++i) {
+      fiobj_obj2json2(tmp, fiobj_ary_index(results, i), 0);
+      fiobj_str_write(tmp, "\n", 1);
+    }
+    TEST_ASSERT(!strcmp(fiobj_obj2cstr(tmp).data,
+                        "{\"id\":1,\"list\":[12.5,-300.0,\"a \\\"b\\\"\"]}\n"
+                        "[true,false,null]\n"
+                        "\"string\"\n"
+                        "1234\n"),
+                "JSON stream data error:\n%s\n", fiobj_obj2cstr(tmp).data);
+    fiobj_free(tmp);
+    TEST_ASSERT(fiobj_json_stream_feed(stream, "[1,}", 4) == -1,
+                "JSON stream error wasn't reported!\n");
+    TEST_ASSERT(!fiobj_json_stream_feed(stream, "[1,[2]]", 7) &&
+                    fiobj_ary_count(results) == 5,
+                "JSON stream didn't recover after an error!\n");
+    TEST_ASSERT(!fiobj_json_stream_feed(stream, "42", 2) &&
+                    fiobj_ary_count(results) == 5,
+                "JSON stream didn't hold back a trailing number!\n");
+    TEST_ASSERT(!fiobj_json_stream_finish(stream) &&
+                    fiobj_ary_count(results) == 6 &&
+                    fiobj_obj2num(fiobj_ary_index(results, 5)) == 42,
+                "JSON stream didn't finish with a trailing number!\n");
+    fiobj_json_stream_feed(stream, "{\"partial\":[", 12);
+    TEST_ASSERT(fiobj_json_stream_finish(stream) == -1 &&
+                    fiobj_ary_count(results) == 6,
+                "JSON stream finished within an object!\n");
+    fiobj_json_stream_feed(stream, "{\"partial\":[", 12);
+    fiobj_json_stream_free(stream);
+    for (uint8_t pretty = 0; pretty < 2; ++pretty) {
+      /* the formatter can stop after any element */
+      FIOBJ expected = fiobj_obj2json(results, pretty);
+      fiobj_obj2json_stream_s *formatter =
+          fiobj_obj2json_stream_new(results, pretty);
+      tmp = fiobj_str_buf(1);
+      size_t rounds = 1;
+      while (fiobj_obj2json_stream_next(formatter, tmp, 1))
+        ++rounds;
+      fiobj_obj2json_stream_free(formatter);
+      TEST_ASSERT(rounds > 10 && fiobj_iseq(tmp, expected),
+                  "JSON formatter chunking error (%zu rounds):\n%s\n", rounds,
+                  fiobj_obj2cstr(tmp).data);
+      fiobj_free(tmp);
+      fiobj_free(expected);
+    }
+    fiobj_free(results);
+  }
+  fprintf(stderr, "* passed.\n");
 }
 
 #endif
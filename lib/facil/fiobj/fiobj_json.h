@@ -20,10 +20,25 @@ extern "C" {
 JSON API
 ***************************************************************************** */
 
-/** Limit JSON nesting, 32 is the limit to accomodate a 32 bit type. */
-#if !defined(JSON_MAX_DEPTH) || JSON_MAX_DEPTH > 32
-#undef JSON_MAX_DEPTH
-#define JSON_MAX_DEPTH 32
+/** Limits JSON nesting, protecting against malicious payloads. */
+#ifndef JSON_MAX_DEPTH
+#define JSON_MAX_DEPTH 512
+#endif
+
+/**
+ * The size of the chunks used when streaming JSON data (see
+ * `fiobj_obj2json_send`).
+ */
+#ifndef JSON_SEND_CHUNK_SIZE
+#define JSON_SEND_CHUNK_SIZE 16384
+#endif
+
+/**
+ * The number of JSON chunks (per `fiobj_obj2json_send` call) that can wait in
+ * the outgoing queue before formatting pauses.
+ */
+#ifndef JSON_SEND_PENDING_LIMIT
+#define JSON_SEND_PENDING_LIMIT 4
 #endif
 
 /**
@@ -57,6 +72,101 @@ FIOBJ fiobj_obj2json(FIOBJ, uint8_t pretty);
  */
 FIOBJ fiobj_obj2json2(FIOBJ dest, FIOBJ object, uint8_t pretty);
 
+/* *****************************************************************************
+JSON Streaming API
+***************************************************************************** */
+
+/** An incremental JSON parser, see `fiobj_json_stream_new`. */
+typedef struct fiobj_json_stream_s fiobj_json_stream_s;
+
+/**
+ * Creates an incremental (streaming) JSON parser.
+ *
+ * Data is fed to the parser in chunks of any size, using
+ * `fiobj_json_stream_feed`. The `on_json` callback is called for every top
+ * level JSON object as soon as it's complete, so a stream of concatenated (or
+ * new-line delimited) JSON objects can be parsed as it arrives.
+ *
+ * The `on_json` callback owns the object and should call `fiobj_free`.
+ *
+ * Remember to `fiobj_json_stream_free`.
+ */
+fiobj_json_stream_s *
+fiobj_json_stream_new(void (*on_json)(FIOBJ obj, void *udata), void *udata);
+
+/**
+ * Feeds a chunk of JSON data to the parser, calling the `on_json` callback for
+ * every object completed by the chunk.
+ *
+ * Partially parsed objects are kept between calls. Only an incomplete token at
+ * the end of a chunk (i.e., part of a String) is copied, to be parsed once the
+ * next chunk arrives. A top level number at the end of a chunk is held back
+ * (see `fiobj_json_stream_finish`).
+ *
+ * Returns 0 on success. On a JSON parsing error, -1 is returned and the parser
+ * is reset, discarding any partial object and buffered data.
+ */
+int fiobj_json_stream_feed(fiobj_json_stream_s *parser, const void *data,
+                           size_t len);
+
+/**
+ * Marks the end of the stream, calling the `on_json` callback for a top level
+ * number that was held back (a number might continue in the next chunk).
+ *
+ * Returns 0 on success. If the stream ended within an object, -1 is returned
+ * and the partial object is discarded. The parser can be used for a new stream.
+ */
+int fiobj_json_stream_finish(fiobj_json_stream_s *parser);
+
+/** Frees the parser along with any partially parsed object. */
+void fiobj_json_stream_free(fiobj_json_stream_s *parser);
+
+/** A resumable JSON formatter, see `fiobj_obj2json_stream_new`. */
+typedef struct fiobj_obj2json_stream_s fiobj_obj2json_stream_s;
+
+/**
+ * Creates a resumable JSON formatter, so large objects can be formatted in
+ * chunks (see `fiobj_obj2json_stream_next`) instead of a single String.
+ *
+ * The formatter holds a reference to `obj` (`fiobj_dup`), but the object
+ * mustn't be edited until the formatter is freed.
+ *
+ * Remember to `fiobj_obj2json_stream_free`.
+ */
+fiobj_obj2json_stream_s *fiobj_obj2json_stream_new(FIOBJ obj, uint8_t pretty);
+
+/**
+ * Appends the next part of the JSON string to the `dest` String, stopping once
+ * at least `limit` bytes were written (or the JSON string is complete).
+ *
+ * Formatting stops between JSON elements, so a long String might exceed the
+ * limit. If `limit` is 0, `JSON_SEND_CHUNK_SIZE` is used.
+ *
+ * Returns 1 if more data remains and 0 once the JSON string is complete.
+ */
+int fiobj_obj2json_stream_next(fiobj_obj2json_stream_s *formatter, FIOBJ dest,
+                               size_t limit);
+
+/** Frees the formatter, releasing the object. */
+void fiobj_obj2json_stream_free(fiobj_obj2json_stream_s *formatter);
+
+/**
+ * Formats `obj` as JSON, sending it through the `uuid` connection in
+ * `JSON_SEND_CHUNK_SIZE` chunks, without materializing the whole JSON string.
+ *
+ * The first chunk is sent immediately. Formatting pauses while
+ * `JSON_SEND_PENDING_LIMIT` chunks are waiting to be sent and resumes (using
+ * `fio_defer`) once the client has read some of the data, so memory usage
+ * stays bounded regardless of the object's size.
+ *
+ * The function holds a reference to `obj` (`fiobj_dup`), but the object
+ * mustn't be edited until the JSON was sent. No other data should be written
+ * to the connection until then.
+ *
+ * Returns -1 if the connection is invalid and 0 otherwise.
+ */
+int fiobj_obj2json_send(intptr_t uuid, FIOBJ obj, uint8_t pretty);
+
 #if DEBUG
 void fiobj_test_json(void);
 #endif
@@ -2,6 +2,11 @@
 Copyright: Boaz Segev, 2018-2019
 License: MIT
 */
+#include <fiobject.h>
+
+/* names are hashed once, when the template is loaded */
+#define MUSTACHE_HASH_FN(name, len) fiobj_hash_string((name), (len))
+
 #define INCLUDE_MUSTACHE_IMPLEMENTATION 1
 #include <mustache_parser.h>
 
@@ -10,6 +15,9 @@ License: MIT
 #include <fiobj_mustache.h>
 #include <fiobj_str.h>
 
+#include <dirent.h>
+#include <sys/stat.h>
+
 #ifndef FIO_IGNORE_MACRO
 /**
  * This is used internally to ignore macros that shadow functions (avoiding
@@ -73,25 +81,425 @@ FIOBJ fiobj_mustache_build(mustache_s *mustache, FIOBJ data) {
                                mustache, data);
 }
 
+/* *****************************************************************************
+Template Registry
+***************************************************************************** */
+
+#if FIOBJ_MUSTACHE_WATCH && defined(__linux__)
+#include <sys/inotify.h>
+#define FIOBJ_MUSTACHE_INOTIFY 1
+#else
+#define FIOBJ_MUSTACHE_INOTIFY 0
+#endif
+
+/* a registered template, freed once the registry and all renders are done */
+typedef struct {
+  mustache_s *mustache;
+  volatile uintptr_t ref;
+} fiobj_mustache_entry_s;
+
+static void fiobj_mustache_entry_free(fiobj_mustache_entry_s *e) {
+  if (fio_atomic_sub(&e->ref, 1))
+    return;
+  mustache_free(e->mustache);
+  free(e);
+}
+
+#define FIO_FORCE_MALLOC_TMP 1 /* templates aren't related to a request */
+#define FIO_SET_NAME fiobj_mustache_registry_set
+#define FIO_SET_KEY_TYPE FIOBJ
+#define FIO_SET_KEY_COMPARE(k1, k2) fiobj_iseq((k1), (k2))
+#define FIO_SET_KEY_COPY(dest, k) ((dest) = fiobj_dup((k)))
+#define FIO_SET_KEY_DESTROY(k) fiobj_free((k))
+#define FIO_SET_OBJ_TYPE fiobj_mustache_entry_s *
+#define FIO_SET_OBJ_DESTROY(o) fiobj_mustache_entry_free((o))
+#include <fio.h>
+
+#if FIOBJ_MUSTACHE_INOTIFY
+/* maps an inotify watch descriptor to the folder's path(s) (an Array) */
+#define FIO_FORCE_MALLOC_TMP 1
+#define FIO_SET_NAME fiobj_mustache_watch_set
+#define FIO_SET_OBJ_TYPE FIOBJ
+#define FIO_SET_OBJ_COMPARE(o1, o2) (1)
+#define FIO_SET_OBJ_COPY(dest, o) (dest) = fiobj_dup((o))
+#define FIO_SET_OBJ_DESTROY(o) fiobj_free((o))
+#include <fio.h>
+
+#define FIOBJ_MUSTACHE_WATCH_MASK                                              \
+  (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MODIFY | IN_MOVED_FROM |        \
+   IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+#endif
+
+/*
+ * The registry is per process, but templates loaded by the master process
+ * before forking are inherited by the workers (sharing the memory pages).
+ */
+static struct {
+  fio_lock_i lock;
+  fiobj_mustache_registry_set_s templates;
+#if FIOBJ_MUSTACHE_INOTIFY
+  uint8_t started;
+  intptr_t uuid; /* the inotify uuid, -1 when changes aren't watched */
+  fiobj_mustache_watch_set_s watches;
+#endif
+} fiobj_mustache_registry = {
+    .lock = FIO_LOCK_INIT,
+#if FIOBJ_MUSTACHE_INOTIFY
+    .uuid = -1,
+#endif
+};
+
+#if FIOBJ_MUSTACHE_INOTIFY
+
+/* watches the file's folder, a `mustache_each_file` task */
+static int fiobj_mustache_watch_file_unsafe(char const *filename, size_t len,
+                                            void *ignr_) {
+  /* the folder's path, including the trailing '/' (if any) */
+  size_t dir_len = len;
+  while (dir_len && filename[dir_len - 1] != '/')
+    --dir_len;
+  FIOBJ dir = fiobj_str_new(filename, dir_len);
+  int wd = inotify_add_watch(fio_uuid2fd(fiobj_mustache_registry.uuid),
+                             (dir_len ? fiobj_obj2cstr(dir).data : "."),
+                             FIOBJ_MUSTACHE_WATCH_MASK);
+  if (wd == -1) {
+    fiobj_free(dir);
+    return 0;
+  }
+  FIOBJ dirs = fiobj_mustache_watch_set_find(&fiobj_mustache_registry.watches,
+                                             (uint64_t)wd, FIOBJ_INVALID);
+  if (!dirs) {
+    dirs = fiobj_ary_new2(1);
+    fiobj_mustache_watch_set_insert(&fiobj_mustache_registry.watches,
+                                    (uint64_t)wd, dirs);
+    fiobj_free(dirs); /* the set owns the Array */
+  }
+  if (fiobj_ary_find(dirs, dir) == -1)
+    fiobj_ary_push(dirs, dir);
+  else
+    fiobj_free(dir);
+  return 0;
+  (void)ignr_;
+}
+
+/* a `mustache_each_file` task, stops once the file name is found */
+static int fiobj_mustache_file_is_eq(char const *filename, size_t len,
+                                     void *path_) {
+  fio_str_info_s *path = path_;
+  if (path->len == len && !memcmp(path->data, filename, len)) {
+    path->data = NULL; /* marks the file as found */
+    return -1;
+  }
+  return 0;
+}
+
+/* removes every template that loaded the file (a folder path + a file name) */
+static void fiobj_mustache_forget_unsafe(FIOBJ dir, const char *name,
+                                         size_t len) {
+  FIOBJ path = fiobj_str_tmp();
+  fio_str_info_s s = fiobj_obj2cstr(dir);
+  fiobj_str_write(path, s.data, s.len);
+  fiobj_str_write(path, name, len);
+  FIOBJ stale = FIOBJ_INVALID;
+  FIO_SET_FOR_LOOP(&fiobj_mustache_registry.templates, pos) {
+    if (!pos->hash)
+      continue;
+    s = fiobj_obj2cstr(path);
+    mustache_each_file(pos->obj.obj->mustache, fiobj_mustache_file_is_eq, &s);
+    if (s.data)
+      continue;
+    if (!stale)
+      stale = fiobj_ary_new();
+    fiobj_ary_push(stale, fiobj_dup(pos->obj.key));
+  }
+  if (!stale)
+    return;
+  for (size_t i = 0; i < fiobj_ary_count(stale); ++i) {
+    FIOBJ key = fiobj_ary_index(stale, i);
+    s = fiobj_obj2cstr(key);
+    fiobj_mustache_registry_set_remove(&fiobj_mustache_registry.templates,
+                                       fiobj_hash_string(s.data, s.len), key,
+                                       NULL);
+  }
+  fiobj_free(stale);
+}
+
+static void fiobj_mustache_watch_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  char buffer[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  while ((len = read(fio_uuid2fd(uuid), buffer, sizeof(buffer))) > 0) {
+    fio_lock(&fiobj_mustache_registry.lock);
+    for (char *pos = buffer; pos < buffer + len;) {
+      struct inotify_event *e = (struct inotify_event *)pos;
+      pos += sizeof(*e) + e->len;
+      if (e->mask &
+          (IN_Q_OVERFLOW | IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+        /* events were lost or a folder moved, start fresh */
+        fiobj_mustache_registry_set_free(&fiobj_mustache_registry.templates);
+        fiobj_mustache_watch_set_free(&fiobj_mustache_registry.watches);
+        continue;
+      }
+      if (!e->len)
+        continue;
+      FIOBJ dirs = fiobj_mustache_watch_set_find(
+          &fiobj_mustache_registry.watches, (uint64_t)e->wd, FIOBJ_INVALID);
+      if (!dirs)
+        continue;
+      const size_t name_len = strlen(e->name);
+      for (size_t i = 0; i < fiobj_ary_count(dirs); ++i) {
+        fiobj_mustache_forget_unsafe(fiobj_ary_index(dirs, i), e->name,
+                                     name_len);
+      }
+    }
+    fio_unlock(&fiobj_mustache_registry.lock);
+  }
+  (void)pr;
+}
+
+/* templates are kept, they just aren't watched any more */
+static void fiobj_mustache_watch_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  fio_lock(&fiobj_mustache_registry.lock);
+  if (fiobj_mustache_registry.uuid == uuid) {
+    fiobj_mustache_registry.uuid = -1;
+    fiobj_mustache_watch_set_free(&fiobj_mustache_registry.watches);
+  }
+  fio_unlock(&fiobj_mustache_registry.lock);
+  (void)pr;
+}
+
+static fio_protocol_s FIOBJ_MUSTACHE_WATCH_PROTOCOL = {
+    .on_data = fiobj_mustache_watch_on_data,
+    .on_close = fiobj_mustache_watch_on_close,
+};
+
+static void fiobj_mustache_watch_on_fork(void *ignr_);
+
+/* starts watching for file system changes (once per process) */
+static void fiobj_mustache_watch_start(void) {
+  static uint8_t forking_registered = 0;
+  fio_lock(&fiobj_mustache_registry.lock);
+  if (fiobj_mustache_registry.started) {
+    fio_unlock(&fiobj_mustache_registry.lock);
+    return;
+  }
+  fiobj_mustache_registry.started = 1;
+  if (!forking_registered) {
+    forking_registered = 1;
+    fio_state_callback_add(FIO_CALL_IN_CHILD, fiobj_mustache_watch_on_fork,
+                           NULL);
+  }
+  fio_unlock(&fiobj_mustache_registry.lock);
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd == -1) {
+    FIO_LOG_WARNING("(mustache) template changes aren't watched (inotify "
+                    "failed).");
+    return;
+  }
+  intptr_t uuid = fio_fd2uuid(fd);
+  fio_lock(&fiobj_mustache_registry.lock);
+  fiobj_mustache_registry.uuid = uuid;
+  /* watch any templates loaded so far (i.e., inherited from the master) */
+  FIO_SET_FOR_LOOP(&fiobj_mustache_registry.templates, pos) {
+    if (!pos->hash)
+      continue;
+    mustache_each_file(pos->obj.obj->mustache,
+                       fiobj_mustache_watch_file_unsafe, NULL);
+  }
+  fio_unlock(&fiobj_mustache_registry.lock);
+  fio_attach(uuid, &FIOBJ_MUSTACHE_WATCH_PROTOCOL);
+}
+
+/* workers keep the master's templates, but watch for changes on their own */
+static void fiobj_mustache_watch_on_fork(void *ignr_) {
+  fio_lock(&fiobj_mustache_registry.lock);
+  intptr_t uuid = fiobj_mustache_registry.uuid;
+  fiobj_mustache_registry.uuid = -1;
+  fiobj_mustache_registry.started = 0;
+  fiobj_mustache_watch_set_free(&fiobj_mustache_registry.watches);
+  fio_unlock(&fiobj_mustache_registry.lock);
+  if (uuid != -1)
+    fio_force_close(uuid);
+  fiobj_mustache_watch_start();
+  (void)ignr_;
+}
+
+#endif /* FIOBJ_MUSTACHE_INOTIFY */
+
+/* loads and registers a template, returns it (with a reference) or NULL */
+static fiobj_mustache_entry_s *
+fiobj_mustache_registry_add(fio_str_info_s filename, uint64_t hash) {
+#if FIOBJ_MUSTACHE_INOTIFY
+  if (!fiobj_mustache_registry.started)
+    fiobj_mustache_watch_start();
+#endif
+  mustache_s *m = fiobj_mustache_load(filename);
+  if (!m)
+    return NULL;
+  fiobj_mustache_entry_s *e = malloc(sizeof(*e));
+  FIO_ASSERT_ALLOC(e);
+  *e = (fiobj_mustache_entry_s){.mustache = m, .ref = 2}; /* registry + us */
+  FIOBJ key = fiobj_str_new(filename.data, filename.len);
+  fio_lock(&fiobj_mustache_registry.lock);
+  fiobj_mustache_entry_s *old = fiobj_mustache_registry_set_find(
+      &fiobj_mustache_registry.templates, hash, key);
+  if (old) {
+    /* another thread loaded the template first */
+    fio_atomic_add(&old->ref, 1);
+  } else {
+#if FIOBJ_MUSTACHE_INOTIFY
+    if (fiobj_mustache_registry.uuid != -1)
+      mustache_each_file(m, fiobj_mustache_watch_file_unsafe, NULL);
+#endif
+    fiobj_mustache_registry_set_insert(&fiobj_mustache_registry.templates,
+                                       hash, key, e, NULL);
+  }
+  fio_unlock(&fiobj_mustache_registry.lock);
+  fiobj_free(key);
+  if (old) {
+    mustache_free(m);
+    free(e);
+    return old;
+  }
+  return e;
+}
+
+/* returns a registered template (with a reference), loading it if missing */
+static fiobj_mustache_entry_s *
+fiobj_mustache_registry_get(fio_str_info_s filename) {
+  if (!filename.data || !filename.len)
+    return NULL;
+  const uint64_t hash = fiobj_hash_string(filename.data, filename.len);
+  FIOBJ key = fiobj_str_tmp();
+  fiobj_str_write(key, filename.data, filename.len);
+  fio_lock(&fiobj_mustache_registry.lock);
+  fiobj_mustache_entry_s *e = fiobj_mustache_registry_set_find(
+      &fiobj_mustache_registry.templates, hash, key);
+  if (e)
+    fio_atomic_add(&e->ref, 1);
+  fio_unlock(&fiobj_mustache_registry.lock);
+  if (e)
+    return e;
+  return fiobj_mustache_registry_add(filename, hash);
+}
+
+/* loads every ".mustache" file in the folder (`path`) and its sub-folders */
+static int fiobj_mustache_preload_folder(FIOBJ path) {
+  fio_str_info_s s = fiobj_obj2cstr(path);
+  DIR *dir = opendir(s.data);
+  if (!dir)
+    return -1;
+  if (s.data[s.len - 1] != '/')
+    fiobj_str_write(path, "/", 1);
+  const size_t base = fiobj_obj2cstr(path).len;
+  int ret = 0;
+  struct dirent *d;
+  while ((d = readdir(dir))) {
+    if (d->d_name[0] == '.') /* hidden files, "." and ".." */
+      continue;
+    const size_t len = strlen(d->d_name);
+    fiobj_str_resize(path, base);
+    fiobj_str_write(path, d->d_name, len);
+    struct stat st;
+    if (lstat(fiobj_obj2cstr(path).data, &st))
+      continue;
+    if (S_ISDIR(st.st_mode)) {
+      if (fiobj_mustache_preload_folder(path))
+        ret = -1;
+      continue;
+    }
+    if (len <= 9 || memcmp(d->d_name + len - 9, ".mustache", 9))
+      continue;
+    fiobj_mustache_entry_s *e =
+        fiobj_mustache_registry_get(fiobj_obj2cstr(path));
+    if (!e) {
+      FIO_LOG_ERROR("(mustache) couldn't load template %s",
+                    fiobj_obj2cstr(path).data);
+      ret = -1;
+      continue;
+    }
+    fiobj_mustache_entry_free(e);
+  }
+  closedir(dir);
+  return ret;
+}
+
+/**
+ * Loads (and compiles) the template into the process-wide template registry,
+ * so it can be rendered using `fiobj_mustache_render`.
+ *
+ * If `filename` is a folder, every `.mustache` file in the folder (and its
+ * sub-folders) is loaded.
+ */
+int fiobj_mustache_preload(fio_str_info_s filename) {
+  if (!filename.data || !filename.len)
+    return -1;
+  FIOBJ path = fiobj_str_new(filename.data, filename.len);
+  struct stat st;
+  int ret = -1;
+  if (stat(fiobj_obj2cstr(path).data, &st) || !S_ISDIR(st.st_mode)) {
+    /* a file (possibly named without the ".mustache" extension) */
+    fiobj_mustache_entry_s *e =
+        fiobj_mustache_registry_get(fiobj_obj2cstr(path));
+    if (e) {
+      fiobj_mustache_entry_free(e);
+      ret = 0;
+    }
+  } else {
+    ret = fiobj_mustache_preload_folder(path);
+  }
+  fiobj_free(path);
+  return ret;
+}
+
+/**
+ * Renders the template registered for `filename` (loading it, on first use),
+ * returning a new FIOBJ String.
+ */
+FIOBJ fiobj_mustache_render(fio_str_info_s filename, FIOBJ data) {
+  fiobj_mustache_entry_s *e = fiobj_mustache_registry_get(filename);
+  if (!e)
+    return FIOBJ_INVALID;
+  FIOBJ dest = fiobj_mustache_build(e->mustache, data);
+  fiobj_mustache_entry_free(e);
+  return dest;
+}
+
+/**
+ * Renders the template registered for `filename` (loading it, on first use),
+ * into an existing FIOBJ String (`dest`'s end).
+ */
+FIOBJ fiobj_mustache_render2(FIOBJ dest, fio_str_info_s filename, FIOBJ data) {
+  fiobj_mustache_entry_s *e = fiobj_mustache_registry_get(filename);
+  if (!e)
+    return FIOBJ_INVALID;
+  dest = fiobj_mustache_build2(dest, e->mustache, data);
+  fiobj_mustache_entry_free(e);
+  return dest;
+}
+
+/** Removes all the templates from the template registry. */
+void fiobj_mustache_registry_clear(void) {
+  fio_lock(&fiobj_mustache_registry.lock);
+  fiobj_mustache_registry_set_free(&fiobj_mustache_registry.templates);
+  fio_unlock(&fiobj_mustache_registry.lock);
+}
+
 /* *****************************************************************************
 Mustache Callbacks
 ***************************************************************************** */
 
-static inline FIOBJ fiobj_mustache_find_obj_absolute(FIOBJ parent, FIOBJ key) {
+static inline FIOBJ fiobj_mustache_find_obj_absolute(FIOBJ parent,
+                                                     uint64_t hash) {
   if (!FIOBJ_TYPE_IS(parent, FIOBJ_T_HASH))
     return FIOBJ_INVALID;
-  FIOBJ o = FIOBJ_INVALID;
-  o = fiobj_hash_get(parent, key);
-  return o;
+  return fiobj_hash_get2(parent, hash);
 }
 
 static inline FIOBJ fiobj_mustache_find_obj_tree(mustache_section_s *section,
-                                                 const char *name,
-                                                 uint32_t name_len) {
-  FIOBJ key = fiobj_str_tmp();
-  fiobj_str_write(key, name, name_len);
+                                                 uint64_t hash) {
   do {
-    FIOBJ tmp = fiobj_mustache_find_obj_absolute((FIOBJ)section->udata2, key);
+    FIOBJ tmp = fiobj_mustache_find_obj_absolute((FIOBJ)section->udata2, hash);
     if (tmp != FIOBJ_INVALID) {
       return tmp;
     }
@@ -99,43 +507,41 @@ static inline FIOBJ fiobj_mustache_find_obj_tree(mustache_section_s *section,
   return FIOBJ_INVALID;
 }
 
+/*
+ * Names (and their dot notation segments) are pre-hashed when the template is
+ * loaded, `hash` lists the whole name's hash followed by pairs of segment /
+ * remaining name hashes (see `mustache_section_name_hash`).
+ */
 static inline FIOBJ fiobj_mustache_find_obj(mustache_section_s *section,
                                             const char *name,
                                             uint32_t name_len) {
-  FIOBJ tmp = fiobj_mustache_find_obj_tree(section, name, name_len);
+  const uint64_t *hash = mustache_section_name_hash(section);
+  FIOBJ tmp = fiobj_mustache_find_obj_tree(section, hash[0]);
   if (tmp != FIOBJ_INVALID)
     return tmp;
   /* interpolate sections... */
-  uint32_t dot = 0;
-  while (dot < name_len && name[dot] != '.')
-    ++dot;
-  if (dot == name_len)
+  const char *dot = memchr(name, '.', name_len);
+  if (!dot)
     return FIOBJ_INVALID;
-  tmp = fiobj_mustache_find_obj_tree(section, name, dot);
+  tmp = fiobj_mustache_find_obj_tree(section, hash[1]);
   if (!tmp) {
     return FIOBJ_INVALID;
   }
-  ++dot;
+  hash += 2;
   for (;;) {
-    FIOBJ key = fiobj_str_tmp();
-    fiobj_str_write(key, name + dot, name_len - dot);
-    FIOBJ obj = fiobj_mustache_find_obj_absolute(tmp, key);
+    FIOBJ obj = fiobj_mustache_find_obj_absolute(tmp, hash[0]);
     if (obj != FIOBJ_INVALID)
       return obj;
-    name += dot;
-    name_len -= dot;
-    dot = 0;
-    while (dot < name_len && name[dot] != '.')
-      ++dot;
-    if (dot == name_len) {
+    name_len -= (dot + 1) - name;
+    name = dot + 1;
+    dot = memchr(name, '.', name_len);
+    if (!dot) {
       return FIOBJ_INVALID;
     }
-    key = fiobj_str_tmp();
-    fiobj_str_write(key, name, dot);
-    tmp = fiobj_mustache_find_obj_absolute(tmp, key);
+    tmp = fiobj_mustache_find_obj_absolute(tmp, hash[1]);
     if (tmp == FIOBJ_INVALID)
       return FIOBJ_INVALID;
-    ++dot;
+    hash += 2;
   }
 }
 
@@ -301,8 +707,47 @@ void fiobj_mustache_test(void) {
   fiobj_free(data);
   TEST_ASSERT(key, "fiobj_mustache_build failed!\n");
   fprintf(stderr, "%s\n", fiobj_obj2cstr(key).data);
+  TEST_ASSERT(!strcmp(fiobj_obj2cstr(key).data,
+                      "* Users:\r\n"
+                      "0. User 0 (User&#32;0)\r\n"
+                      "1. User 1 (User&#32;1)\r\n"
+                      "2. User 2 (User&#32;2)\r\n"
+                      "3. User 3 (User&#32;3)\r\n"
+                      "Nested: dot notation success."),
+              "fiobj_mustache_build output error!\n");
   fiobj_free(key);
   fiobj_mustache_free(m);
+
+  /* template registry (a template with a partial) */
+  char const *partial_name = "mustache_test_partial.mustache";
+  mustache_save2file(template_name, "Hello {{> mustache_test_partial}}!", 34);
+  mustache_save2file(partial_name, "{{name}}", 8);
+  data = fiobj_hash_new();
+  key = fiobj_str_new("name", 4);
+  fiobj_hash_set(data, key, fiobj_str_new("World", 5));
+  fiobj_free(key);
+  TEST_ASSERT(
+      !fiobj_mustache_preload((fio_str_info_s){.data = (char *)template_name,
+                                               .len = strlen(template_name)}),
+      "fiobj_mustache_preload failed.\n");
+  unlink(template_name);
+  unlink(partial_name);
+  /* rendered from the registry, even though the files were removed */
+  key = fiobj_mustache_render((fio_str_info_s){.data = (char *)template_name,
+                                               .len = strlen(template_name)},
+                              data);
+  TEST_ASSERT(key && !strcmp(fiobj_obj2cstr(key).data, "Hello World!"),
+              "fiobj_mustache_render output error!\n");
+  fiobj_str_resize(key, 0);
+  fiobj_mustache_registry_clear();
+  TEST_ASSERT(!fiobj_mustache_render2(
+                  key,
+                  (fio_str_info_s){.data = (char *)template_name,
+                                   .len = strlen(template_name)},
+                  data),
+              "fiobj_mustache_registry_clear failed!\n");
+  fiobj_free(key);
+  fiobj_free(data);
 }
 
 #endif
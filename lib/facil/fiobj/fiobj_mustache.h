@@ -9,6 +9,22 @@ License: MIT
 
 #include <mustache_parser.h>
 
+#ifndef FIOBJ_MUSTACHE_WATCH
+/**
+ * When true, templates in the template registry (see `fiobj_mustache_render`)
+ * are invalidated once their files (or their partials' files) change, so the
+ * next render reloads them.
+ *
+ * This is meant for development, requires inotify (Linux) and is disabled on
+ * other systems. Defaults to true for DEBUG builds.
+ */
+#if DEBUG
+#define FIOBJ_MUSTACHE_WATCH 1
+#else
+#define FIOBJ_MUSTACHE_WATCH 0
+#endif
+#endif
+
 /**
  * Loads a mustache template, converting it into an opaque instruction array.
  *
@@ -51,10 +67,57 @@ FIOBJ fiobj_mustache_build(mustache_s *mustache, FIOBJ data);
  * Renders a template into an existing FIOBJ String (`dest`'s end), using the
  * information in the `data` object.
  *
+ * Names are hashed when the template is loaded, so rendering into a reused
+ * `dest` String doesn't allocate memory once `dest` is large enough.
+ *
  * Returns FIOBJ_INVALID if an error occurred and a FIOBJ String on success.
  */
 FIOBJ fiobj_mustache_build2(FIOBJ dest, mustache_s *mustache, FIOBJ data);
 
+/* *****************************************************************************
+Template Registry
+***************************************************************************** */
+
+/**
+ * Loads (and compiles) the template into the process-wide template registry,
+ * so it can be rendered using `fiobj_mustache_render`.
+ *
+ * If `filename` is a folder, every `.mustache` file in the folder (and its
+ * sub-folders) is loaded, registered using its path (i.e.,
+ * "views/index.mustache").
+ *
+ * Call this before `fio_start`, so templates are compiled once, by the master
+ * process, and the worker processes share the memory (copy-on-write).
+ *
+ * Returns -1 on error (some templates might have been loaded) and 0 on success.
+ */
+int fiobj_mustache_preload(fio_str_info_s filename);
+
+/**
+ * Renders the template registered for `filename` (loading it, on first use),
+ * returning a new FIOBJ String.
+ *
+ * The template's file name is the registry key, and it's used as is - the same
+ * template, named differently (i.e., "./index.mustache"), is loaded again.
+ *
+ * Returns FIOBJ_INVALID if an error occurred and a FIOBJ String on success.
+ */
+FIOBJ fiobj_mustache_render(fio_str_info_s filename, FIOBJ data);
+
+/**
+ * Renders the template registered for `filename` (loading it, on first use),
+ * into an existing FIOBJ String (`dest`'s end).
+ *
+ * Returns FIOBJ_INVALID if an error occurred and a FIOBJ String on success.
+ */
+FIOBJ fiobj_mustache_render2(FIOBJ dest, fio_str_info_s filename, FIOBJ data);
+
+/**
+ * Removes all the templates from the template registry (templates that are
+ * being rendered are freed once rendering is complete).
+ */
+void fiobj_mustache_registry_clear(void);
+
 #if DEBUG
 void fiobj_mustache_test(void);
 #endif
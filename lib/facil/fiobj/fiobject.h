@@ -270,7 +270,8 @@ FIO_INLINE size_t fiobj_type_is(FIOBJ o, fiobj_type_enum type) {
   switch (type) {
   case FIOBJ_T_NUMBER:
     return (o & FIOBJECT_NUMBER_FLAG) ||
-           ((fiobj_type_enum *)o)[0] == FIOBJ_T_NUMBER;
+           (FIOBJ_IS_ALLOCATED(o) &&
+            ((fiobj_type_enum *)FIOBJ2PTR(o))[0] == FIOBJ_T_NUMBER);
   case FIOBJ_T_NULL:
     return !o || o == fiobj_null();
   case FIOBJ_T_TRUE:
@@ -59,6 +59,12 @@ Compile Time Behavior Flags
 #define MUSTACHE_NESTING_LIMIT 82
 #endif
 
+/*
+ * If `MUSTACHE_HASH_FN(name, len)` is defined (returning a `uint64_t`), names
+ * are hashed when the template is loaded and the callbacks can use
+ * `mustache_section_name_hash` instead of hashing the names on every call.
+ */
+
 /* *****************************************************************************
 Mustache API Argument types
 ***************************************************************************** */
@@ -122,6 +128,18 @@ inline MUSTACHE_FUNC void mustache_free(mustache_s *mustache) {
   free(mustache);
 }
 
+/**
+ * Calls `task` with the name of every file the template was loaded from (the
+ * root template followed by any partial templates), stopping early if `task`
+ * returns -1.
+ *
+ * File names are NUL terminated. Returns the number of files visited.
+ */
+MUSTACHE_FUNC size_t mustache_each_file(mustache_s *mustache,
+                                        int (*task)(char const *filename,
+                                                    size_t len, void *udata),
+                                        void *udata);
+
 /** Arguments for the `mustache_build` function. */
 typedef struct {
   /** The parsed template (an instruction collection). */
@@ -206,6 +224,22 @@ static inline int mustache_write_text(mustache_section_s *section, char *text,
 static inline const char *mustache_section_text(mustache_section_s *section,
                                                 size_t *p_len);
 
+/**
+ * Returns the hash values computed (using `MUSTACHE_HASH_FN`) when the template
+ * was loaded for the `name` passed to the current callback
+ * (`mustache_on_arg`, `mustache_on_section_test` or
+ * `mustache_on_section_start`).
+ *
+ * The first value is the hash of the whole name. For dot notation names, the
+ * whole name's hash is followed by the hash of the first segment and the hash
+ * of the rest of the name, then the second segment and the rest of the name,
+ * etc'. i.e., for "a.b.c" the values are: "a.b.c", "a", "b.c", "b", "c".
+ *
+ * Returns NULL if `MUSTACHE_HASH_FN` wasn't defined.
+ */
+static inline const uint64_t *
+mustache_section_name_hash(mustache_section_s *section);
+
 /* *****************************************************************************
 Client Callbacks - MUST be implemented by the including file
 ***************************************************************************** */
@@ -341,6 +375,8 @@ typedef struct mustache__instruction_s {
     uint16_t name_len;
     /** The offset between the name and the content (left / right by type). */
     uint16_t offset;
+    /** The position of the name's hash values (see `MUSTACHE_HASH_FN`). */
+    uint32_t name_hash;
   } data;
 } mustache__instruction_s;
 
@@ -377,6 +413,9 @@ typedef struct {
   mustache_error_en *err;
   char *data;
   char *path;
+  uint64_t *hash;
+  uint32_t hash_len;
+  uint32_t hash_capa;
   uint32_t i_capa;
   uint32_t data_len;
   uint32_t padding;
@@ -406,6 +445,11 @@ Callbacks Helper Implementation
 #define MUSTACH2DATA(mustache)                                                 \
   (char *)(MUSTACH2INSTRUCTIONS((mustache)) +                                  \
            (mustache)->u.read_only.intruction_count)
+/* the hash values are placed (aligned) after the data segment */
+#define MUSTACH2HASH(mustache)                                                 \
+  ((uint64_t *)(((uintptr_t)MUSTACH2DATA((mustache)) +                         \
+                 (mustache)->u.read_only.data_length + 7) &                    \
+                ~(uintptr_t)7))
 #define MUSTACHE_OBJECT_OFFSET(type, member, ptr)                              \
   ((type *)((uintptr_t)(ptr) - (uintptr_t)(&(((type *)0)->member))))
 
@@ -478,6 +522,22 @@ error:
   return NULL;
 }
 
+/**
+ * Returns the hash values computed when the template was loaded for the `name`
+ * passed to the current callback.
+ */
+static inline const uint64_t *
+mustache_section_name_hash(mustache_section_s *section) {
+#ifdef MUSTACHE_HASH_FN
+  mustache__builder_stack_s *s = mustache___section2stack(section);
+  return MUSTACH2HASH(s->data) +
+         MUSTACH2INSTRUCTIONS(s->data)[s->pos].data.name_hash;
+#else
+  return NULL;
+  (void)section;
+#endif
+}
+
 /**
  * used internally to write escaped text rather than clear text.
  */
@@ -653,17 +713,17 @@ typedef struct {
 static inline size_t
 mustache__data_segment_write(uint8_t *dest, mustache__data_segment_s data) {
   dest[0] = 0xFF & data.inst_start;
-  dest[1] = 0xFF & (data.inst_start >> 1);
-  dest[2] = 0xFF & (data.inst_start >> 2);
-  dest[3] = 0xFF & (data.inst_start >> 3);
+  dest[1] = 0xFF & (data.inst_start >> 8);
+  dest[2] = 0xFF & (data.inst_start >> 16);
+  dest[3] = 0xFF & (data.inst_start >> 24);
   dest[4] = 0xFF & data.next;
-  dest[5] = 0xFF & (data.next >> 1);
-  dest[6] = 0xFF & (data.next >> 2);
-  dest[7] = 0xFF & (data.next >> 3);
+  dest[5] = 0xFF & (data.next >> 8);
+  dest[6] = 0xFF & (data.next >> 16);
+  dest[7] = 0xFF & (data.next >> 24);
   dest[8] = 0xFF & data.filename_len;
-  dest[9] = 0xFF & (data.filename_len >> 1);
+  dest[9] = 0xFF & (data.filename_len >> 8);
   dest[10] = 0xFF & data.path_len;
-  dest[11] = 0xFF & (data.path_len >> 1);
+  dest[11] = 0xFF & (data.path_len >> 8);
   if (data.filename_len)
     memcpy(dest + 12, data.filename, data.filename_len);
   (dest + 12)[data.filename_len] = 0;
@@ -679,12 +739,12 @@ static inline mustache__data_segment_s
 mustache__data_segment_read(uint8_t *data) {
   mustache__data_segment_s s = {
       .filename = (char *)(data + 12),
-      .inst_start = ((uint32_t)data[0] | ((uint32_t)data[1] << 1) |
-                     ((uint32_t)data[2] << 2) | ((uint32_t)data[3] << 3)),
-      .next = ((uint32_t)data[4] | ((uint32_t)data[5] << 1) |
-               ((uint32_t)data[6] << 2) | ((uint32_t)data[7] << 3)),
-      .filename_len = ((uint16_t)data[8] | ((uint16_t)data[9] << 1)),
-      .path_len = ((uint16_t)data[10] | ((uint16_t)data[11] << 1)),
+      .inst_start = ((uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+                     ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24)),
+      .next = ((uint32_t)data[4] | ((uint32_t)data[5] << 8) |
+               ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 24)),
+      .filename_len = ((uint16_t)data[8] | ((uint16_t)data[9] << 8)),
+      .path_len = ((uint16_t)data[10] | ((uint16_t)data[11] << 8)),
   };
   return s;
 }
@@ -774,6 +834,37 @@ static inline int mustache__push_text_instruction(mustache__loader_stack_s *s,
          });
 }
 
+/* pre-hashes a name (and any dot notation segments), returns the position */
+static inline uint32_t mustache__hash_name(mustache__loader_stack_s *s,
+                                           const char *name, uint32_t len) {
+#ifdef MUSTACHE_HASH_FN
+  const uint32_t pos = s->hash_len;
+  uint32_t count = 1;
+  for (uint32_t i = 0; i < len; ++i)
+    count += (name[i] == '.') << 1;
+  if (s->hash_capa < s->hash_len + count) {
+    s->hash_capa = (s->hash_len + count + 32) & (~(uint32_t)31);
+    s->hash = realloc(s->hash, sizeof(*s->hash) * s->hash_capa);
+    MUSTACHE_ASSERT(s->hash, "failed to allocate memory for mustache hashes");
+  }
+  s->hash[s->hash_len++] = MUSTACHE_HASH_FN(name, len);
+  const char *dot;
+  while ((dot = memchr(name, '.', len))) {
+    const uint32_t seg = (uint32_t)(dot - name);
+    s->hash[s->hash_len++] = MUSTACHE_HASH_FN(name, seg);
+    name += seg + 1;
+    len -= seg + 1;
+    s->hash[s->hash_len++] = MUSTACHE_HASH_FN(name, len);
+  }
+  return pos;
+#else
+  return 0;
+  (void)s;
+  (void)name;
+  (void)len;
+#endif
+}
+
 /*
  * Returns the instruction's position if the template is already existing.
  *
@@ -781,13 +872,13 @@ static inline int mustache__push_text_instruction(mustache__loader_stack_s *s,
  */
 static inline uint32_t mustache__file_is_loaded(mustache__loader_stack_s *s,
                                                 char *name, size_t name_len) {
-  char *data = s->data;
-  const char *end = data + s->m->u.read_only.data_length;
-  while (data < end) {
-    mustache__data_segment_s seg = mustache__data_segment_read((uint8_t *)data);
+  uint32_t pos = 0;
+  while (pos < s->m->u.read_only.data_length) {
+    mustache__data_segment_s seg =
+        mustache__data_segment_read((uint8_t *)s->data + pos);
     if (seg.filename_len == name_len && !memcmp(seg.filename, name, name_len))
       return seg.inst_start;
-    data += seg.next;
+    pos = seg.next; /* the position is absolute */
   }
   return (uint32_t)-1;
 }
@@ -1170,6 +1261,9 @@ MUSTACHE_FUNC mustache_s *(mustache_load)(mustache_load_args_s args) {
   s.path = NULL;
   s.data = NULL;
   s.data_len = 0;
+  s.hash = NULL;
+  s.hash_len = 0;
+  s.hash_capa = 0;
   s.i = NULL;
   s.i_capa = 32;
   s.index = 0;
@@ -1342,6 +1436,7 @@ MUSTACHE_FUNC mustache_s *(mustache_load)(mustache_load_args_s args) {
                         .name_pos = beg - s.data,
                         .name_len = end - beg,
                         .offset = s.stack[s.index].data_pos - (beg - s.data),
+                        .name_hash = mustache__hash_name(&s, beg, end - beg),
                     }})) {
           goto error;
         }
@@ -1469,7 +1564,11 @@ MUSTACHE_FUNC mustache_s *(mustache_load)(mustache_load_args_s args) {
             &s, (mustache__instruction_s){
                     .instruction = (flag ? MUSTACHE_WRITE_ARG
                                          : MUSTACHE_WRITE_ARG_UNESCAPED),
-                    .data = {.name_pos = beg - s.data, .name_len = end - beg}});
+                    .data = {
+                        .name_pos = beg - s.data,
+                        .name_len = end - beg,
+                        .name_hash = mustache__hash_name(&s, beg, end - beg),
+                    }});
         break;
       }
     }
@@ -1512,14 +1611,19 @@ MUSTACHE_FUNC mustache_s *(mustache_load)(mustache_load_args_s args) {
     --s.index;
   }
 
-  s.m = realloc(s.m, sizeof(*s.m) +
-                         (sizeof(*s.i) * s.m->u.read_only.intruction_count) +
-                         s.data_len);
+  s.m = realloc(s.m, ((sizeof(*s.m) +
+                        (sizeof(*s.i) * s.m->u.read_only.intruction_count) +
+                        s.data_len + 7) &
+                       (~(size_t)7)) +
+                          (sizeof(*s.hash) * s.hash_len));
   MUSTACHE_ASSERT(s.m,
                   "failed to allocate memory for consolidated mustache data");
   memcpy(MUSTACH2DATA(s.m), s.data, s.data_len);
+  if (s.hash_len)
+    memcpy(MUSTACH2HASH(s.m), s.hash, sizeof(*s.hash) * s.hash_len);
   free(s.data);
   free(s.path);
+  free(s.hash);
 
   *args.err = MUSTACHE_OK;
   return s.m;
@@ -1527,15 +1631,42 @@ MUSTACHE_FUNC mustache_s *(mustache_load)(mustache_load_args_s args) {
 error:
   free(s.data);
   free(s.path);
+  free(s.hash);
   free(s.m);
   return NULL;
 }
 
+MUSTACHE_FUNC size_t mustache_each_file(mustache_s *mustache,
+                                        int (*task)(char const *filename,
+                                                    size_t len, void *udata),
+                                        void *udata) {
+  if (!mustache || !task)
+    return 0;
+  char *const data = MUSTACH2DATA(mustache);
+  size_t count = 0;
+  uint32_t pos = 0;
+  while (pos < mustache->u.read_only.data_length) {
+    mustache__data_segment_s seg =
+        mustache__data_segment_read((uint8_t *)data + pos);
+    /* segments are stored in order, anything else is corrupt data */
+    if (seg.next <= pos)
+      break;
+    pos = seg.next;
+    if (!seg.filename_len)
+      continue;
+    ++count;
+    if (task(seg.filename, seg.filename_len, udata) == -1)
+      break;
+  }
+  return count;
+}
+
 #endif /* INCLUDE_MUSTACHE_IMPLEMENTATION */
 
 #undef MUSTACHE_FUNC
 #undef MUSTACH2INSTRUCTIONS
 #undef MUSTACH2DATA
+#undef MUSTACH2HASH
 #undef MUSTACHE_OBJECT_OFFSET
 #undef MUSTACHE_IGNORE_WHITESPACE
 
@@ -5,6 +5,7 @@ License: MIT
 Feel free to copy, use and enjoy according to the license provided.
 */
 
+#define FIO_INCLUDE_LINKED_LIST
 #include <fio.h>
 
 #include <http1.h>
@@ -14,6 +15,7 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <fcntl.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -57,6 +59,9 @@ fio_tls_alpn_add(void *tls, const char *protocol_name,
 }
 #pragma weak fio_tls_alpn_add
 
+/** Returns a number identifying the TLS object's configuration (0 if NULL). */
+uintptr_t fio_tls_id(void *tls);
+
 /* *****************************************************************************
 Small Helpers
 ***************************************************************************** */
@@ -176,7 +181,10 @@ int http_set_header(http_s *r, FIOBJ name, FIOBJ value) {
 int http_set_header2(http_s *r, fio_str_info_s n, fio_str_info_s v) {
   if (HTTP_INVALID_HANDLE(r) || !n.data || !n.len || (v.data && !v.len))
     return -1;
-  FIOBJ tmp = fiobj_str_new(n.data, n.len);
+  FIOBJ tmp = http_header_name_interned(n.data, n.len);
+  if (tmp)
+    return http_set_header(r, tmp, fiobj_str_new(v.data, v.len));
+  tmp = fiobj_str_new(n.data, n.len);
   int ret = http_set_header(r, tmp, fiobj_str_new(v.data, v.len));
   fiobj_free(tmp);
   return ret;
@@ -277,98 +285,1472 @@ int http_set_cookie(http_s *h, http_cookie_args_s cookie) {
       fiobj_str_join(tmp, c);
       fiobj_free(c);
     }
-    return 0;
-  }
-
-  if (capa <= len + 40) {
-    capa = len + 40;
-    fiobj_str_capa_assert(c, capa);
-    t = fiobj_obj2cstr(c);
+    return 0;
+  }
+
+  if (capa <= len + 40) {
+    capa = len + 40;
+    fiobj_str_capa_assert(c, capa);
+    t = fiobj_obj2cstr(c);
+  }
+  if (cookie.max_age) {
+    memcpy(t.data + len, "Max-Age=", 8);
+    len += 8;
+    len += fio_ltoa(t.data + len, cookie.max_age, 10);
+    t.data[len++] = ';';
+    t.data[len++] = ' ';
+  }
+  fiobj_str_resize(c, len);
+
+  if (cookie.domain && cookie.domain_len) {
+    fiobj_str_write(c, "domain=", 7);
+    fiobj_str_write(c, cookie.domain, cookie.domain_len);
+    fiobj_str_write(c, ";", 1);
+    t.data[len++] = ' ';
+  }
+  if (cookie.path && cookie.path_len) {
+    fiobj_str_write(c, "path=", 5);
+    fiobj_str_write(c, cookie.path, cookie.path_len);
+    fiobj_str_write(c, ";", 1);
+    t.data[len++] = ' ';
+  }
+  if (cookie.http_only) {
+    fiobj_str_write(c, "HttpOnly;", 9);
+  }
+  if (cookie.secure) {
+    fiobj_str_write(c, "secure;", 7);
+  }
+  set_header_add(h->private_data.out_headers, HTTP_HEADER_SET_COOKIE, c);
+  return 0;
+}
+#define http_set_cookie(http__req__, ...)                                      \
+  http_set_cookie((http__req__), (http_cookie_args_s){__VA_ARGS__})
+
+/**
+ * Sends the response headers and body.
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_body(http_s *r, void *data, uintptr_t length) {
+  if (HTTP_INVALID_HANDLE(r))
+    return -1;
+  if (!length || !data) {
+    http_finish(r);
+    return 0;
+  }
+  FIOBJ compressed = FIOBJ_INVALID;
+  if (http_settings(r)->compress &&
+      (compressed = http_compress______internal(r, data, length))) {
+    fio_str_info_s c = fiobj_obj2cstr(compressed);
+    data = c.data;
+    length = c.len;
+  }
+  add_content_length(r, length);
+  // add_content_type(r);
+  add_date(r);
+  int ret = ((http_vtable_s *)r->private_data.vtbl)
+                ->http_send_body(r, data, length);
+  fiobj_free(compressed);
+  return ret;
+}
+/**
+ * Sends the response headers and the specified file (the response's body).
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_sendfile(http_s *r, int fd, uintptr_t length, uintptr_t offset) {
+  if (HTTP_INVALID_HANDLE(r)) {
+    close(fd);
+    return -1;
+  };
+  add_content_length(r, length);
+  add_content_type(r);
+  add_date(r);
+  return ((http_vtable_s *)r->private_data.vtbl)
+      ->http_sendfile(r, fd, length, offset);
+}
+
+/* *****************************************************************************
+Static Files (open file descriptors and precomputed headers)
+***************************************************************************** */
+
+#if HTTP_SENDFILE_CACHE_LIMIT && defined(__linux__)
+#define HTTP_SENDFILE_CACHE 1
+#else
+#define HTTP_SENDFILE_CACHE 0
+#endif
+
+#if HTTP_STATIC_MANIFEST_LIMIT && defined(__linux__)
+#define HTTP_STATIC_MANIFEST 1
+#else
+#define HTTP_STATIC_MANIFEST 0
+#endif
+
+#if HTTP_SENDFILE_CACHE || HTTP_STATIC_MANIFEST
+#include <sys/inotify.h>
+#define HTTP_FILE_WATCH 1
+#else
+#define HTTP_FILE_WATCH 0
+#endif
+
+/* an open file (or its gzip variant) and the headers derived from its data */
+typedef struct {
+  int fd;
+  struct stat stat;
+  FIOBJ etag;
+  FIOBJ last_modified;
+  FIOBJ mime;
+} http_file_s;
+
+/* closes the file and releases any headers the object still owns */
+static void http_file_close(http_file_s *f) {
+  if (f->fd != -1)
+    close(f->fd);
+  fiobj_free(f->etag);
+  fiobj_free(f->last_modified);
+  fiobj_free(f->mime);
+  *f = (http_file_s){.fd = -1};
+}
+
+/**
+ * Opens a regular file and computes its headers.
+ *
+ * Returns -1 on error, `errno` is ENOENT (or ENOTDIR) if the file is missing.
+ */
+static int http_file_open(http_file_s *f, fio_str_info_s name, uint8_t is_gz) {
+  *f = (http_file_s){.fd = -1};
+  if (stat(name.data, &f->stat))
+    return -1;
+  if (!(S_ISREG(f->stat.st_mode) || S_ISLNK(f->stat.st_mode))) {
+    errno = EISDIR; /* not a file, but it isn't missing either */
+    return -1;
+  }
+  f->fd = open(name.data, O_RDONLY);
+  if (f->fd == -1) {
+    FIO_LOG_ERROR("(HTTP) couldn't open file %s!\n", name.data);
+    perror("     ");
+    return -1;
+  }
+  /* last-modified */
+  f->last_modified = fiobj_str_buf(32);
+  fiobj_str_resize(f->last_modified,
+                   http_time2str(fiobj_obj2cstr(f->last_modified).data,
+                                 f->stat.st_mtime));
+  /* etag */
+  uint64_t etag = (uint64_t)f->stat.st_size;
+  etag ^= (uint64_t)f->stat.st_mtime;
+  etag = fiobj_hash_string(&etag, sizeof(uint64_t));
+  f->etag = fiobj_str_buf(32);
+  fiobj_str_resize(f->etag, fio_base64_encode(fiobj_obj2cstr(f->etag).data,
+                                              (void *)&etag, sizeof(uint64_t)));
+  /* mime-type (for a gzip variant, the type of the uncompressed data) */
+  uintptr_t pos;
+  if (is_gz) {
+    pos = name.len - 4;
+    while (pos && name.data[pos] != '.')
+      pos--;
+    pos++; /* assuming, but that's fine. */
+    f->mime = http_mimetype_find(name.data + pos, name.len - pos - 3);
+  } else {
+    pos = name.len - 1;
+    while (pos && name.data[pos] != '.')
+      pos--;
+    pos++; /* assuming, but that's fine. */
+    f->mime = http_mimetype_find(name.data + pos, name.len - pos);
+  }
+  return 0;
+}
+
+/* opens the file (or its gzip variant) without using the cache */
+static int http_file_open2(http_file_s *f, FIOBJ filename, uint8_t allow_gz,
+                           uint8_t *is_gz) {
+  fio_str_info_s s = fiobj_obj2cstr(filename);
+  *is_gz = 0;
+  if (allow_gz && (s.len < 3 || s.data[s.len - 3] != '.' ||
+                   s.data[s.len - 2] != 'g' || s.data[s.len - 1] != 'z')) {
+    fiobj_str_write(filename, ".gz", 3);
+    int ret = http_file_open(f, fiobj_obj2cstr(filename), 1);
+    fiobj_str_resize(filename, s.len);
+    if (!ret) {
+      *is_gz = 1;
+      return 0;
+    }
+  }
+  return http_file_open(f, fiobj_obj2cstr(filename), 0);
+}
+
+/* *****************************************************************************
+File System Watcher (a single `inotify` instance, shared by all the caches)
+***************************************************************************** */
+
+#if HTTP_FILE_WATCH
+
+/* maps an inotify watch descriptor to the folder's path(s) (an Array) */
+#define FIO_FORCE_MALLOC_TMP 1
+#define FIO_SET_NAME http_file_watch_set
+#define FIO_SET_OBJ_TYPE FIOBJ
+#define FIO_SET_OBJ_COMPARE(o1, o2) (1)
+#define FIO_SET_OBJ_COPY(dest, o) (dest) = fiobj_dup((o))
+#define FIO_SET_OBJ_DESTROY(o) fiobj_free((o))
+#include <fio.h>
+
+/* the folder paths that are already watched */
+#define FIO_FORCE_MALLOC_TMP 1
+#define FIO_SET_NAME http_file_watch_path_set
+#define FIO_SET_OBJ_TYPE FIOBJ
+#define FIO_SET_OBJ_COMPARE(o1, o2) fiobj_iseq((o1), (o2))
+#define FIO_SET_OBJ_COPY(dest, o) (dest) = fiobj_dup((o))
+#define FIO_SET_OBJ_DESTROY(o) fiobj_free((o))
+#include <fio.h>
+
+#define HTTP_FILE_WATCH_MASK                                                   \
+  (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MODIFY |            \
+   IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+/*
+ * The static file cache and the `public_folder` manifests share a per process
+ * watcher. Folder paths end with a '/' (an empty path is the working folder).
+ *
+ * Events are reported to both using the folder's path and the entry's name
+ * (an empty name for the folder itself). A NULL folder path means that events
+ * were lost (or that the watcher was closed).
+ */
+static struct {
+  fio_lock_i lock;
+  uint8_t started;
+  intptr_t uuid; /* the inotify uuid, -1 when unavailable */
+  http_file_watch_set_s watches;
+  http_file_watch_path_set_s paths;
+} http_file_watch = {.lock = FIO_LOCK_INIT, .uuid = -1};
+
+static void http_file_cache_on_event(fio_str_info_s dir, fio_str_info_s name,
+                                     uint32_t mask);
+static void http_manifest_on_event(fio_str_info_s dir, fio_str_info_s name,
+                                   uint32_t mask);
+
+static inline uint64_t http_file_watch_hash(FIOBJ path) {
+  fio_str_info_s s = fiobj_obj2cstr(path);
+  return FIO_HASH_FN(s.data, s.len, 0, 0);
+}
+
+static void http_file_watch_clear_unsafe(void) {
+  http_file_watch_set_free(&http_file_watch.watches);
+  http_file_watch_path_set_free(&http_file_watch.paths);
+}
+
+static void http_file_watch_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  char buffer[4096]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  while ((len = read(fio_uuid2fd(uuid), buffer, sizeof(buffer))) > 0) {
+    for (char *pos = buffer; pos < buffer + len;) {
+      struct inotify_event *e = (struct inotify_event *)pos;
+      pos += sizeof(*e) + e->len;
+      fio_str_info_s name = {.data = e->name,
+                             .len = (e->len ? strlen(e->name) : 0)};
+      if (e->mask & IN_Q_OVERFLOW) {
+        http_file_cache_on_event((fio_str_info_s){.data = NULL}, name,
+                                 e->mask);
+        http_manifest_on_event((fio_str_info_s){.data = NULL}, name, e->mask);
+        continue;
+      }
+      /* copy the folder paths, they might be updated by other threads */
+      FIOBJ dirs = FIOBJ_INVALID;
+      fio_lock(&http_file_watch.lock);
+      FIOBJ found = http_file_watch_set_find(&http_file_watch.watches,
+                                             (uint64_t)e->wd, FIOBJ_INVALID);
+      if (found) {
+        dirs = fiobj_ary_new2(fiobj_ary_count(found));
+        for (size_t i = 0; i < fiobj_ary_count(found); ++i) {
+          FIOBJ dir = fiobj_ary_index(found, i);
+          fiobj_ary_push(dirs, fiobj_dup(dir));
+          if (e->mask & IN_IGNORED)
+            http_file_watch_path_set_remove(&http_file_watch.paths,
+                                            http_file_watch_hash(dir), dir,
+                                            NULL);
+        }
+        if (e->mask & IN_IGNORED)
+          http_file_watch_set_remove(&http_file_watch.watches, (uint64_t)e->wd,
+                                     FIOBJ_INVALID, NULL);
+      }
+      fio_unlock(&http_file_watch.lock);
+      for (size_t i = 0; i < fiobj_ary_count(dirs); ++i) {
+        fio_str_info_s dir = fiobj_obj2cstr(fiobj_ary_index(dirs, i));
+        http_file_cache_on_event(dir, name, e->mask);
+        http_manifest_on_event(dir, name, e->mask);
+      }
+      fiobj_free(dirs);
+    }
+  }
+  (void)pr;
+}
+
+static void http_file_watch_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  fio_lock(&http_file_watch.lock);
+  if (http_file_watch.uuid != uuid) {
+    fio_unlock(&http_file_watch.lock);
+    return;
+  }
+  http_file_watch.uuid = -1;
+  http_file_watch_clear_unsafe();
+  fio_unlock(&http_file_watch.lock);
+  http_file_cache_on_event((fio_str_info_s){.data = NULL},
+                           (fio_str_info_s){.data = NULL}, 0);
+  http_manifest_on_event((fio_str_info_s){.data = NULL},
+                         (fio_str_info_s){.data = NULL}, 0);
+  (void)pr;
+}
+
+static fio_protocol_s HTTP_FILE_WATCH_PROTOCOL = {
+    .on_data = http_file_watch_on_data,
+    .on_close = http_file_watch_on_close,
+};
+
+/* starts watching for file system changes (once per process) */
+static void http_file_watch_start(void) {
+  fio_lock(&http_file_watch.lock);
+  if (http_file_watch.started) {
+    fio_unlock(&http_file_watch.lock);
+    return;
+  }
+  http_file_watch.started = 1;
+  fio_unlock(&http_file_watch.lock);
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd == -1) {
+    FIO_LOG_WARNING("(HTTP) static file caches unavailable (inotify failed).");
+    return;
+  }
+  intptr_t uuid = fio_fd2uuid(fd);
+  fio_lock(&http_file_watch.lock);
+  http_file_watch.uuid = uuid;
+  fio_unlock(&http_file_watch.lock);
+  fio_attach(uuid, &HTTP_FILE_WATCH_PROTOCOL);
+}
+
+/**
+ * Watches a folder (the path ends with a '/' or is empty), unless it's already
+ * watched.
+ *
+ * Returns -1 on error (`errno` is set by `inotify_add_watch`).
+ */
+static int http_file_watch_add(fio_str_info_s dir) {
+  FIOBJ path = fiobj_str_new(dir.data, dir.len);
+  const uint64_t hash = http_file_watch_hash(path);
+  fio_lock(&http_file_watch.lock);
+  const intptr_t uuid = http_file_watch.uuid;
+  FIOBJ found =
+      http_file_watch_path_set_find(&http_file_watch.paths, hash, path);
+  fio_unlock(&http_file_watch.lock);
+  if (uuid == -1 || found) {
+    fiobj_free(path);
+    if (uuid == -1)
+      errno = EBADF;
+    return (found ? 0 : -1);
+  }
+  int wd = inotify_add_watch(fio_uuid2fd(uuid),
+                             (dir.len ? fiobj_obj2cstr(path).data : "."),
+                             HTTP_FILE_WATCH_MASK);
+  if (wd == -1) {
+    fiobj_free(path);
+    return -1;
+  }
+  fio_lock(&http_file_watch.lock);
+  if (http_file_watch.uuid == uuid) {
+    FIOBJ dirs = http_file_watch_set_find(&http_file_watch.watches,
+                                          (uint64_t)wd, FIOBJ_INVALID);
+    if (!dirs) {
+      dirs = fiobj_ary_new2(1);
+      http_file_watch_set_insert(&http_file_watch.watches, (uint64_t)wd, dirs);
+      fiobj_free(dirs); /* the set owns the Array */
+    }
+    if (fiobj_ary_find(dirs, path) == -1) {
+      fiobj_ary_push(dirs, fiobj_dup(path));
+      http_file_watch_path_set_insert(&http_file_watch.paths, hash, path);
+    }
+  }
+  fio_unlock(&http_file_watch.lock);
+  fiobj_free(path);
+  return 0;
+}
+
+/* called by the worker processes - the watcher (if any) belongs to the parent */
+void http_file_watch_on_fork(void *ignr_) {
+  fio_lock(&http_file_watch.lock);
+  intptr_t uuid = http_file_watch.uuid;
+  http_file_watch.uuid = -1;
+  http_file_watch.started = 0;
+  http_file_watch_clear_unsafe();
+  fio_unlock(&http_file_watch.lock);
+  if (uuid != -1)
+    fio_force_close(uuid);
+  (void)ignr_;
+}
+
+#else
+
+void http_file_watch_on_fork(void *ignr_) { (void)ignr_; }
+
+#endif /* HTTP_FILE_WATCH */
+
+/* *****************************************************************************
+Static File Cache (open files, their headers and missing files)
+***************************************************************************** */
+
+#if HTTP_SENDFILE_CACHE
+
+/* a cached file and its (optional) gzip variant (`gz.fd == -1` if missing) */
+typedef struct {
+  http_file_s file;
+  http_file_s gz;
+} http_file_cache_s;
+
+static void http_file_cache_free(http_file_cache_s *c) {
+  http_file_close(&c->file);
+  http_file_close(&c->gz);
+  free(c);
+}
+
+#define FIO_FORCE_MALLOC_TMP 1 /* cache lifetime isn't related to a request */
+#define FIO_SET_NAME http_file_cache_set
+#define FIO_SET_KEY_TYPE FIOBJ
+#define FIO_SET_KEY_COMPARE(k1, k2) fiobj_iseq((k1), (k2))
+#define FIO_SET_KEY_COPY(dest, k) ((dest) = fiobj_dup((k)))
+#define FIO_SET_KEY_DESTROY(k) fiobj_free((k))
+#define FIO_SET_OBJ_TYPE http_file_cache_s *
+#define FIO_SET_OBJ_DESTROY(o) http_file_cache_free((o))
+#include <fio.h>
+
+/* the names of missing files */
+#define FIO_FORCE_MALLOC_TMP 1
+#define FIO_SET_NAME http_file_missing_set
+#define FIO_SET_OBJ_TYPE FIOBJ
+#define FIO_SET_OBJ_COMPARE(o1, o2) fiobj_iseq((o1), (o2))
+#define FIO_SET_OBJ_COPY(dest, o) (dest) = fiobj_dup((o))
+#define FIO_SET_OBJ_DESTROY(o) fiobj_free((o))
+#include <fio.h>
+
+/*
+ * The cache is per process (file descriptors aren't shared).
+ *
+ * Missing files are kept in a separate set with it's own limit, so requests
+ * for missing files can't push open files out of the cache.
+ */
+static struct {
+  fio_lock_i lock;
+  http_file_cache_set_s files;
+  http_file_missing_set_s missing;
+} http_file_cache = {.lock = FIO_LOCK_INIT};
+
+/* tests if a key is the path or a file below it (when the path is a folder) */
+static inline int http_file_cache_is_below(fio_str_info_s k,
+                                           fio_str_info_s path) {
+  const uint8_t is_dir = !path.len || path.data[path.len - 1] == '/';
+  return k.len >= path.len && !memcmp(k.data, path.data, path.len) &&
+         (k.len == path.len || is_dir || k.data[path.len] == '/');
+}
+
+/* removes the entry for a path and the entries of any files below it */
+static void http_file_cache_forget_unsafe(fio_str_info_s path) {
+  FIO_SET_FOR_LOOP(&http_file_cache.files, pos) {
+    if (!pos->hash ||
+        !http_file_cache_is_below(fiobj_obj2cstr(pos->obj.key), path))
+      continue;
+    http_file_cache_set_remove(&http_file_cache.files, pos->hash,
+                               pos->obj.key, NULL);
+  }
+  FIO_SET_FOR_LOOP(&http_file_cache.missing, pos) {
+    if (!pos->hash || !http_file_cache_is_below(fiobj_obj2cstr(pos->obj), path))
+      continue;
+    http_file_missing_set_remove(&http_file_cache.missing, pos->hash, pos->obj,
+                                 NULL);
+  }
+}
+
+/* a file system event (see `http_file_watch_on_data`) */
+static void http_file_cache_on_event(fio_str_info_s dir, fio_str_info_s name,
+                                     uint32_t mask) {
+  fio_lock(&http_file_cache.lock);
+  if (!dir.data) {
+    /* events were lost (or the watcher was closed), start fresh */
+    http_file_cache_set_free(&http_file_cache.files);
+    http_file_missing_set_free(&http_file_cache.missing);
+    goto finish;
+  }
+  if (!name.len) {
+    /* the folder itself was removed or moved */
+    http_file_cache_forget_unsafe(dir);
+    goto finish;
+  }
+  FIOBJ key = fiobj_str_tmp();
+  fiobj_str_write(key, dir.data, dir.len);
+  /* a gzip variant's entry is stored using the uncompressed file's name */
+  if (name.len > 3 && name.data[name.len - 3] == '.' &&
+      name.data[name.len - 2] == 'g' && name.data[name.len - 1] == 'z')
+    name.len -= 3;
+  fiobj_str_write(key, name.data, name.len);
+  fio_str_info_s k = fiobj_obj2cstr(key);
+  if (mask & IN_ISDIR) {
+    /* includes files that were missing because the folder was missing */
+    http_file_cache_forget_unsafe(k);
+  } else {
+    const uint64_t hash = FIO_HASH_FN(k.data, k.len, 0, 0);
+    http_file_cache_set_remove(&http_file_cache.files, hash, key, NULL);
+    http_file_missing_set_remove(&http_file_cache.missing, hash, key, NULL);
+  }
+finish:
+  fio_unlock(&http_file_cache.lock);
+  (void)mask;
+}
+
+/* tests if an `open` / `stat` error means the file is missing */
+static inline int http_file_is_missing(int err) {
+  return err == ENOENT || err == ENOTDIR;
+}
+
+/**
+ * Watches the file's folder and caches the file, returns -1 on error.
+ *
+ * Missing files (ENOENT) are remembered in a separate (bounded) set, so a
+ * request for a file that doesn't exist costs no file system lookups. Other
+ * errors (i.e., EMFILE or EACCES) aren't cached. If the folder is missing, the
+ * closest existing parent folder is watched instead.
+ */
+static int http_file_cache_add(FIOBJ filename, uint64_t hash) {
+  fio_str_info_s s = fiobj_obj2cstr(filename);
+  /* the folder's path, including the trailing '/' (if any) */
+  size_t dir_len = s.len;
+  while (dir_len && s.data[dir_len - 1] != '/')
+    --dir_len;
+  /* watch before opening the file, so no update is missed */
+  size_t watched = dir_len;
+  while (http_file_watch_add((fio_str_info_s){.data = s.data, .len = watched})) {
+    if (!watched || !http_file_is_missing(errno))
+      return -1;
+    /* the folder is missing, so is the file (watch the parent folder) */
+    --watched;
+    while (watched && s.data[watched - 1] != '/')
+      --watched;
+  }
+
+  http_file_cache_s *c = NULL;
+  if (watched == dir_len) {
+    c = malloc(sizeof(*c));
+    FIO_ASSERT_ALLOC(c);
+    c->gz = (http_file_s){.fd = -1};
+    if (s.len < 3 || s.data[s.len - 3] != '.' || s.data[s.len - 2] != 'g' ||
+        s.data[s.len - 1] != 'z') {
+      fiobj_str_write(filename, ".gz", 3);
+      int ret = http_file_open(&c->gz, fiobj_obj2cstr(filename), 1);
+      const int err = errno;
+      fiobj_str_resize(filename, s.len);
+      s = fiobj_obj2cstr(filename);
+      if (ret && !http_file_is_missing(err)) {
+        /* the gzip variant might exist, don't cache a partial entry */
+        http_file_close(&c->gz);
+        free(c);
+        return -1;
+      }
+    }
+    if (http_file_open(&c->file, fiobj_obj2cstr(filename), 0)) {
+      const int err = errno;
+      const uint8_t only_gz = (c->gz.fd != -1);
+      http_file_cache_free(c);
+      /* a gzip variant alone is served without the cache */
+      if (only_gz || !http_file_is_missing(err))
+        return -1;
+      c = NULL;
+    }
+  }
+
+  FIOBJ key = fiobj_str_new(s.data, s.len);
+  fio_lock(&http_file_cache.lock);
+  if (c) {
+    /* evict the oldest file when the cache is full */
+    if (http_file_cache_set_count(&http_file_cache.files) >=
+        HTTP_SENDFILE_CACHE_LIMIT) {
+      FIO_SET_FOR_LOOP(&http_file_cache.files, pos) {
+        if (!pos->hash)
+          continue;
+        http_file_cache_set_remove(&http_file_cache.files, pos->hash,
+                                   pos->obj.key, NULL);
+        break;
+      }
+    }
+    http_file_cache_set_insert(&http_file_cache.files, hash, key, c, NULL);
+    http_file_missing_set_remove(&http_file_cache.missing, hash, key, NULL);
+  } else {
+    /* evict the oldest missing file, open files aren't affected */
+    if (http_file_missing_set_count(&http_file_cache.missing) >=
+        HTTP_SENDFILE_MISSING_LIMIT) {
+      FIO_SET_FOR_LOOP(&http_file_cache.missing, pos) {
+        if (!pos->hash)
+          continue;
+        http_file_missing_set_remove(&http_file_cache.missing, pos->hash,
+                                     pos->obj, NULL);
+        break;
+      }
+    }
+    if (HTTP_SENDFILE_MISSING_LIMIT)
+      http_file_missing_set_insert(&http_file_cache.missing, hash, key);
+  }
+  fio_unlock(&http_file_cache.lock);
+  fiobj_free(key);
+  return (c || HTTP_SENDFILE_MISSING_LIMIT) ? 0 : -1;
+}
+
+/**
+ * Copies a cached file's data.
+ *
+ * Returns -1 if the file isn't cached and -2 if it's known to be missing.
+ */
+static int http_file_cache_find(http_file_s *dest, FIOBJ filename,
+                                uint64_t hash, uint8_t allow_gz,
+                                uint8_t *is_gz) {
+  int ret = -1;
+  fio_lock(&http_file_cache.lock);
+  http_file_cache_s *c =
+      http_file_cache_set_find(&http_file_cache.files, hash, filename);
+  if (!c) {
+    if (http_file_missing_set_find(&http_file_cache.missing, hash, filename))
+      ret = -2;
+  } else {
+    http_file_s *f = (allow_gz && c->gz.fd != -1) ? &c->gz : &c->file;
+    *dest = (http_file_s){
+        .fd = dup(f->fd),
+        .stat = f->stat,
+        .etag = fiobj_dup(f->etag),
+        .last_modified = fiobj_dup(f->last_modified),
+        .mime = fiobj_dup(f->mime),
+    };
+    *is_gz = (f == &c->gz);
+    ret = 0;
+  }
+  fio_unlock(&http_file_cache.lock);
+  if (!ret && dest->fd == -1) {
+    http_file_close(dest);
+    ret = -1;
+  }
+  return ret;
+}
+
+#elif HTTP_FILE_WATCH
+
+static void http_file_cache_on_event(fio_str_info_s dir, fio_str_info_s name,
+                                     uint32_t mask) {
+  (void)dir;
+  (void)name;
+  (void)mask;
+}
+
+#endif /* HTTP_SENDFILE_CACHE */
+
+/**
+ * Opens a file (or its gzip variant), returning it's data and headers.
+ *
+ * When the cache is available, hot files cost no file system lookups.
+ */
+static int http_file_fetch(http_file_s *dest, FIOBJ filename, uint8_t allow_gz,
+                           uint8_t *is_gz) {
+#if HTTP_SENDFILE_CACHE
+  if (!http_file_watch.started)
+    http_file_watch_start();
+  if (http_file_watch.uuid != -1) {
+    fio_str_info_s s = fiobj_obj2cstr(filename);
+    const uint64_t hash = FIO_HASH_FN(s.data, s.len, 0, 0);
+    int ret = http_file_cache_find(dest, filename, hash, allow_gz, is_gz);
+    if (ret == -1 && !http_file_cache_add(filename, hash))
+      ret = http_file_cache_find(dest, filename, hash, allow_gz, is_gz);
+    if (ret != -1)
+      return (ret ? -1 : 0);
+  }
+#endif
+  return http_file_open2(dest, filename, allow_gz, is_gz);
+}
+
+static inline int http_test_encoded_path(const char *mem, size_t len) {
+  const char *pos = NULL;
+  const char *end = mem + len;
+  while (mem < end && (pos = memchr(mem, '/', (size_t)len))) {
+    len = end - pos;
+    mem = pos + 1;
+    if (pos[1] == '/')
+      return -1;
+    if (len > 3 && pos[1] == '.' && pos[2] == '.' && pos[3] == '/')
+      return -1;
+  }
+  return 0;
+}
+
+/* *****************************************************************************
+Static File Manifest (the `public_folder` index and small files in memory)
+***************************************************************************** */
+
+#if HTTP_STATIC_MANIFEST
+#include <dirent.h>
+
+/* folders nested deeper than this aren't indexed (i.e., symbolic link loops) */
+#define HTTP_STATIC_MANIFEST_DEPTH 32
+
+/* a file's headers and (optionally) its data, `file.etag == 0` if missing */
+typedef struct {
+  http_file_s file; /* the file isn't kept open (`fd == -1`) */
+  FIOBJ data;       /* the file's data, if it's kept in memory */
+} http_asset_file_s;
+
+/* a static file and its (optional) gzip variant */
+typedef struct {
+  http_asset_file_s file;
+  http_asset_file_s gz;
+  size_t generation;
+} http_asset_s;
+
+/* the file data kept in memory (by all manifests) */
+static size_t http_static_inline_total;
+
+static void http_asset_file_close(http_asset_file_s *f) {
+  if (f->data) {
+    fio_atomic_sub(&http_static_inline_total,
+                   (size_t)fiobj_obj2cstr(f->data).len);
+    fiobj_free(f->data);
+  }
+  http_file_close(&f->file);
+  f->data = FIOBJ_INVALID;
+}
+
+static void http_asset_free(http_asset_s *a) {
+  http_asset_file_close(&a->file);
+  http_asset_file_close(&a->gz);
+  free(a);
+}
+
+#define FIO_FORCE_MALLOC_TMP 1 /* manifest lifetime isn't related to a request */
+#define FIO_SET_NAME http_manifest_set
+#define FIO_SET_KEY_TYPE FIOBJ
+#define FIO_SET_KEY_COMPARE(k1, k2) fiobj_iseq((k1), (k2))
+#define FIO_SET_KEY_COPY(dest, k) ((dest) = fiobj_dup((k)))
+#define FIO_SET_KEY_DESTROY(k) fiobj_free((k))
+#define FIO_SET_OBJ_TYPE http_asset_s *
+#define FIO_SET_OBJ_DESTROY(o) http_asset_free((o))
+#include <fio.h>
+
+/*
+ * The manifest is built before the server starts (so the workers share the
+ * memory) and each process watches the folder for changes once it starts.
+ *
+ * Keys are URL paths ("/index.html"), the file's name is `folder` + key.
+ */
+struct http_manifest_s {
+  fio_ls_embd_s node; /* a node in the list of watched manifests */
+  fio_lock_i lock;
+  volatile uint8_t watching; /* the manifest is up to date */
+  uint8_t started;           /* protected by the `http_manifests` lock */
+  uint8_t complete;          /* a missing key is a missing file */
+  size_t ref;       /* the settings and the list of watched manifests */
+  size_t generation;
+  http_manifest_set_s files;
+  size_t folder_len;
+  char folder[];
+};
+
+/* the manifests watched by this process (see `http_file_watch`) */
+static struct {
+  fio_lock_i lock;
+  fio_ls_embd_s list;
+} http_manifests = {
+    .lock = FIO_LOCK_INIT,
+    .list = FIO_LS_INIT(http_manifests.list),
+};
+
+static inline int http_manifest_is_gz(fio_str_info_s s) {
+  return s.len > 3 && s.data[s.len - 3] == '.' && s.data[s.len - 2] == 'g' &&
+         s.data[s.len - 1] == 'z';
+}
+
+static inline uint64_t http_manifest_hash(FIOBJ key) {
+  fio_str_info_s s = fiobj_obj2cstr(key);
+  return FIO_HASH_FN(s.data, s.len, 0, 0);
+}
+
+/* the file's name (`folder` + key), written to a temporary String */
+static FIOBJ http_manifest_filename(http_manifest_s *m, fio_str_info_s key,
+                                    uint8_t add_gz) {
+  FIOBJ name = fiobj_str_buf(m->folder_len + key.len + 4);
+  fiobj_str_write(name, m->folder, m->folder_len);
+  fiobj_str_write(name, key.data, key.len);
+  if (add_gz)
+    fiobj_str_write(name, ".gz", 3);
+  return name;
+}
+
+/* loads a file's headers and, if it's small, it's data */
+static void http_asset_file_load(http_asset_file_s *f, FIOBJ filename,
+                                 uint8_t is_gz) {
+  *f = (http_asset_file_s){.data = FIOBJ_INVALID};
+  if (http_file_open(&f->file, fiobj_obj2cstr(filename), is_gz)) {
+    http_file_close(&f->file);
+    return;
+  }
+  const size_t size = (size_t)f->file.stat.st_size;
+  if (size <= HTTP_STATIC_INLINE_LIMIT &&
+      fio_atomic_add(&http_static_inline_total, size) <=
+          HTTP_STATIC_INLINE_TOTAL) {
+    f->data = fiobj_str_buf(size);
+    fio_str_info_s s = fiobj_obj2cstr(f->data);
+    size_t pos = 0;
+    while (pos < size) {
+      ssize_t r = pread(f->file.fd, s.data + pos, size - pos, pos);
+      if (r <= 0)
+        break;
+      pos += r;
+    }
+    if (pos == size) {
+      fiobj_str_resize(f->data, size);
+    } else {
+      /* the file changed while reading, it will be served from the disk */
+      fiobj_free(f->data);
+      f->data = FIOBJ_INVALID;
+      fio_atomic_sub(&http_static_inline_total, size);
+    }
+  } else if (size <= HTTP_STATIC_INLINE_LIMIT) {
+    fio_atomic_sub(&http_static_inline_total, size);
+  }
+  close(f->file.fd);
+  f->file.fd = -1;
+}
+
+/* tests a (possibly missing) file's `stat` data against the asset's data */
+static inline int http_asset_file_is_eq(http_asset_file_s *f, int missing,
+                                        struct stat *st) {
+  if (!f->file.etag)
+    return missing;
+  return !missing && f->file.stat.st_size == st->st_size &&
+         f->file.stat.st_mtime == st->st_mtime &&
+         f->file.stat.st_ino == st->st_ino;
+}
+
+/**
+ * Updates the key's entry (the file and its gzip variant), loading the files
+ * only if they changed (or if `force` is set).
+ */
+static void http_manifest_refresh(http_manifest_s *m, FIOBJ key,
+                                  uint8_t force) {
+  fio_str_info_s k = fiobj_obj2cstr(key);
+  const uint8_t has_gz = !http_manifest_is_gz(k);
+  const uint64_t hash = http_manifest_hash(key);
+  FIOBJ name = http_manifest_filename(m, k, 0);
+  FIOBJ gz_name = has_gz ? http_manifest_filename(m, k, 1) : FIOBJ_INVALID;
+  struct stat st, gz_st;
+  int missing = stat(fiobj_obj2cstr(name).data, &st) || !S_ISREG(st.st_mode);
+  int gz_missing = !has_gz || stat(fiobj_obj2cstr(gz_name).data, &gz_st) ||
+                   !S_ISREG(gz_st.st_mode);
+  if (missing && gz_missing) {
+    fio_lock(&m->lock);
+    http_manifest_set_remove(&m->files, hash, key, NULL);
+    fio_unlock(&m->lock);
+    goto finish;
+  }
+  if (!force) {
+    fio_lock(&m->lock);
+    http_asset_s *a = http_manifest_set_find(&m->files, hash, key);
+    if (a && http_asset_file_is_eq(&a->file, missing, &st) &&
+        http_asset_file_is_eq(&a->gz, gz_missing, &gz_st)) {
+      a->generation = m->generation;
+      fio_unlock(&m->lock);
+      goto finish;
+    }
+    fio_unlock(&m->lock);
+  }
+  {
+    http_asset_s *a = malloc(sizeof(*a));
+    FIO_ASSERT_ALLOC(a);
+    *a = (http_asset_s){.file.file.fd = -1, .gz.file.fd = -1};
+    if (!missing)
+      http_asset_file_load(&a->file, name, 0);
+    if (!gz_missing)
+      http_asset_file_load(&a->gz, gz_name, 1);
+    if (!a->file.file.etag && !a->gz.file.etag) {
+      /* the files were removed since we tested for them */
+      http_asset_free(a);
+      fio_lock(&m->lock);
+      http_manifest_set_remove(&m->files, hash, key, NULL);
+      fio_unlock(&m->lock);
+      goto finish;
+    }
+    fio_lock(&m->lock);
+    a->generation = m->generation;
+    if (http_manifest_set_count(&m->files) >= HTTP_STATIC_MANIFEST_LIMIT &&
+        !http_manifest_set_find(&m->files, hash, key)) {
+      /* too many files, missing keys will require a file system lookup */
+      m->complete = 0;
+      fio_unlock(&m->lock);
+      http_asset_free(a);
+      goto finish;
+    }
+    http_manifest_set_insert(&m->files, hash, key, a, NULL);
+    fio_unlock(&m->lock);
+  }
+finish:
+  fiobj_free(name);
+  fiobj_free(gz_name);
+}
+
+/* indexes a folder (the key ends with a '/') and its sub-folders */
+static void http_manifest_scan(http_manifest_s *m, FIOBJ dir_key,
+                               size_t depth) {
+  fio_str_info_s k = fiobj_obj2cstr(dir_key);
+  FIOBJ path = http_manifest_filename(m, k, 0);
+  DIR *dir = opendir(fiobj_obj2cstr(path).data);
+  if (!dir) {
+    if (depth == 0)
+      m->complete = 0;
+    fiobj_free(path);
+    return;
+  }
+  /* watch before reading the folder, so no update is missed */
+  http_file_watch_add(fiobj_obj2cstr(path));
+  struct dirent *e;
+  while ((e = readdir(dir))) {
+    if (e->d_name[0] == '.' &&
+        (!e->d_name[1] || (e->d_name[1] == '.' && !e->d_name[2])))
+      continue;
+    fio_str_info_s n = {.data = e->d_name, .len = strlen(e->d_name)};
+    struct stat st;
+    fiobj_str_write(path, n.data, n.len);
+    int err = stat(fiobj_obj2cstr(path).data, &st);
+    fiobj_str_resize(path, m->folder_len + k.len);
+    if (err)
+      continue;
+    FIOBJ key = fiobj_str_buf(k.len + n.len + 1);
+    fiobj_str_write(key, k.data, k.len);
+    fiobj_str_write(key, n.data, n.len);
+    if (S_ISDIR(st.st_mode)) {
+      if (depth < HTTP_STATIC_MANIFEST_DEPTH) {
+        fiobj_str_write(key, "/", 1);
+        http_manifest_scan(m, key, depth + 1);
+      }
+    } else if (S_ISREG(st.st_mode)) {
+      http_manifest_refresh(m, key, 0);
+      if (http_manifest_is_gz(n)) {
+        /* a gzip variant may exist without the uncompressed file */
+        fiobj_str_resize(key, k.len + n.len - 3);
+        http_manifest_refresh(m, key, 0);
+      }
+    }
+    fiobj_free(key);
+  }
+  closedir(dir);
+  fiobj_free(path);
+}
+
+/*
+ * Indexes a folder (the key ends with a '/') and its sub-folders, removing any
+ * entries under the folder that no longer exist.
+ *
+ * The file system is accessed without holding the manifest's lock. Scans may
+ * overlap, so only entries older than this scan are removed.
+ */
+static void http_manifest_rescan(http_manifest_s *m, fio_str_info_s dir) {
+  size_t depth = 0;
+  for (size_t i = 1; i < dir.len; ++i)
+    depth += (dir.data[i] == '/');
+  if (depth > HTTP_STATIC_MANIFEST_DEPTH)
+    return;
+  FIOBJ key = fiobj_str_new(dir.data, dir.len);
+  fio_lock(&m->lock);
+  const size_t generation = ++m->generation;
+  if (!depth)
+    m->complete = 1;
+  fio_unlock(&m->lock);
+  http_manifest_scan(m, key, depth);
+  fiobj_free(key);
+  fio_lock(&m->lock);
+  FIO_SET_FOR_LOOP(&m->files, pos) {
+    if (!pos->hash || pos->obj.obj->generation >= generation)
+      continue;
+    fio_str_info_s k = fiobj_obj2cstr(pos->obj.key);
+    if (k.len < dir.len || memcmp(k.data, dir.data, dir.len))
+      continue;
+    http_manifest_set_remove(&m->files, pos->hash, pos->obj.key, NULL);
+  }
+  fio_unlock(&m->lock);
+}
+
+/* indexes the whole folder, removing any entries that no longer exist */
+static inline void http_manifest_scan_all(http_manifest_s *m) {
+  http_manifest_rescan(m, (fio_str_info_s){.data = (char *)"/", .len = 1});
+}
+
+static void http_manifest_release(http_manifest_s *m) {
+  if (fio_atomic_sub(&m->ref, 1))
+    return;
+  http_manifest_set_free(&m->files);
+  free(m);
+}
+
+/* stops watching the manifest, the lock must be held */
+static void http_manifest_unwatch_unsafe(http_manifest_s *m) {
+  m->watching = 0;
+  if (!fio_ls_embd_any(&m->node))
+    return;
+  fio_ls_embd_remove(&m->node);
+  http_manifest_release(m);
+}
+
+/* updates a manifest following a file system event */
+static void http_manifest_on_event1(http_manifest_s *m, fio_str_info_s dir,
+                                    fio_str_info_s name, uint32_t mask) {
+  if (mask & IN_IGNORED)
+    return;
+  if (!dir.data) {
+    /* events were lost, start fresh */
+    http_manifest_scan_all(m);
+    return;
+  }
+  /* the folder's key (the folder's path is `folder` + key) */
+  if (dir.len <= m->folder_len || memcmp(dir.data, m->folder, m->folder_len) ||
+      dir.data[m->folder_len] != '/')
+    return;
+  fio_str_info_s d = {.data = dir.data + m->folder_len,
+                      .len = dir.len - m->folder_len};
+  if (!name.len) {
+    /* the folder itself changed (i.e., it was moved), index it again */
+    http_manifest_rescan(m, d);
+    return;
+  }
+  FIOBJ key = fiobj_str_buf(d.len + name.len + 1);
+  fiobj_str_write(key, d.data, d.len);
+  fiobj_str_write(key, name.data, name.len);
+  if ((mask & IN_ISDIR) &&
+      (mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) {
+    /* a sub-folder was added or removed, only it's entries are affected */
+    fiobj_str_write(key, "/", 1);
+    http_manifest_rescan(m, fiobj_obj2cstr(key));
+    fiobj_free(key);
+    return;
+  }
+  http_manifest_refresh(m, key, 1);
+  if (http_manifest_is_gz(name)) {
+    fiobj_str_resize(key, d.len + name.len - 3);
+    http_manifest_refresh(m, key, 1);
+  }
+  fiobj_free(key);
+}
+
+/*
+ * A file system event (see `http_file_watch_on_data`).
+ *
+ * The manifests are collected (and referenced) while holding the lock, but the
+ * file system is accessed only after the lock is released.
+ */
+static void http_manifest_on_event(fio_str_info_s dir, fio_str_info_s name,
+                                   uint32_t mask) {
+  http_manifest_s *stack[8];
+  http_manifest_s **list = stack;
+  size_t count = 0;
+  fio_lock(&http_manifests.lock);
+  if (!dir.data && !mask) {
+    /* the watcher was closed */
+    while (fio_ls_embd_any(&http_manifests.list))
+      http_manifest_unwatch_unsafe(FIO_LS_EMBD_OBJ(
+          http_manifest_s, node, http_manifests.list.next));
+    fio_unlock(&http_manifests.lock);
+    return;
+  }
+  FIO_LS_EMBD_FOR(&http_manifests.list, node) { ++count; }
+  if (count > sizeof(stack) / sizeof(stack[0])) {
+    list = malloc(sizeof(*list) * count);
+    FIO_ASSERT_ALLOC(list);
+  }
+  count = 0;
+  FIO_LS_EMBD_FOR(&http_manifests.list, node) {
+    list[count] = FIO_LS_EMBD_OBJ(http_manifest_s, node, node);
+    fio_atomic_add(&list[count]->ref, 1);
+    ++count;
+  }
+  fio_unlock(&http_manifests.lock);
+  for (size_t i = 0; i < count; ++i) {
+    http_manifest_on_event1(list[i], dir, name, mask);
+    http_manifest_release(list[i]);
+  }
+  if (list != stack)
+    free(list);
+}
+
+/*
+ * Starts watching for file system changes (once per process), called by each
+ * serving process before requests are handled (see `http_manifest_new`).
+ */
+static void http_manifest_start(void *m_) {
+  http_manifest_s *m = m_;
+  http_file_watch_start();
+  /* requests are served from the manifest only after the folder was scanned */
+  fio_lock(&http_manifests.lock);
+  if (m->started || http_file_watch.uuid == -1) {
+    m->started = 1;
+    fio_unlock(&http_manifests.lock);
+    return;
+  }
+  m->started = 1;
+  fio_atomic_add(&m->ref, 1);
+  fio_ls_embd_push(&http_manifests.list, &m->node);
+  fio_unlock(&http_manifests.lock);
+  /* the folder might have changed since the manifest was built */
+  http_manifest_scan_all(m);
+  /* unless the watcher was closed (or the manifest freed) meanwhile */
+  fio_lock(&http_manifests.lock);
+  m->watching = fio_ls_embd_any(&m->node);
+  fio_unlock(&http_manifests.lock);
+}
+
+/* starts a manifest created while the server is running */
+static void http_manifest_start_task(void *m_, void *ignr_) {
+  http_manifest_start(m_);
+  http_manifest_release(m_);
+  (void)ignr_;
+}
+
+/* called by the worker processes - the parent's watcher was closed */
+static void http_manifest_on_fork(void *m_) {
+  http_manifest_s *m = m_;
+  fio_lock(&http_manifests.lock);
+  http_manifest_unwatch_unsafe(m);
+  m->started = 0;
+  fio_unlock(&http_manifests.lock);
+}
+
+/**
+ * Creates a manifest of the `public_folder`'s files (see `http_settings_new`).
+ *
+ * Returns NULL if a manifest isn't available (i.e., too many files).
+ */
+http_manifest_s *http_manifest_new(const char *folder, size_t len) {
+  while (len > 1 && folder[len - 1] == '/')
+    --len;
+  http_manifest_s *m = malloc(sizeof(*m) + len + 1);
+  FIO_ASSERT_ALLOC(m);
+  *m = (http_manifest_s){
+      .node = FIO_LS_INIT(m->node),
+      .lock = FIO_LOCK_INIT,
+      .ref = 1,
+      .folder_len = len,
+  };
+  memcpy(m->folder, folder, len);
+  m->folder[len] = 0;
+  http_manifest_scan_all(m);
+  if (!m->complete) {
+    if (http_manifest_set_count(&m->files) >= HTTP_STATIC_MANIFEST_LIMIT)
+      FIO_LOG_WARNING("(HTTP) %s has too many files for the static file "
+                      "manifest (HTTP_STATIC_MANIFEST_LIMIT).",
+                      m->folder);
+    http_manifest_release(m);
+    return NULL;
+  }
+  fio_state_callback_add(FIO_CALL_IN_CHILD, http_manifest_on_fork, m);
+  if (fio_is_running()) {
+    fio_atomic_add(&m->ref, 1);
+    fio_defer(http_manifest_start_task, m, NULL);
+  } else {
+    fio_state_callback_add(FIO_CALL_ON_START, http_manifest_start, m);
+  }
+  return m;
+}
+
+/** Frees the manifest (a reference may be held by the file system watcher). */
+void http_manifest_free(http_manifest_s *m) {
+  if (!m)
+    return;
+  fio_state_callback_remove(FIO_CALL_IN_CHILD, http_manifest_on_fork, m);
+  fio_state_callback_remove(FIO_CALL_ON_START, http_manifest_start, m);
+  fio_lock(&http_manifests.lock);
+  m->started = 1; /* a pending start is ignored */
+  http_manifest_unwatch_unsafe(m);
+  fio_unlock(&http_manifests.lock);
+  http_manifest_release(m);
+}
+
+/**
+ * Serves a static file from the `public_folder`, possibly from memory.
+ *
+ * Returns -1 (no file system access) if the path isn't a static file.
+ */
+int http_static_serve______internal(http_s *h, http_settings_s *settings) {
+  http_manifest_s *m = http_settings2data(settings)->manifest;
+  fio_str_info_s path = fiobj_obj2cstr(h->path);
+  if (!m || !m->watching || memchr(path.data, '%', path.len))
+    goto sendfile;
+  static uint64_t accept_enc_hash = 0;
+  if (!accept_enc_hash)
+    accept_enc_hash = fiobj_hash_string("accept-encoding", 15);
+  static uint64_t range_hash = 0;
+  if (!range_hash)
+    range_hash = fiobj_hash_string("range", 5);
+
+  FIOBJ key = h->path;
+  if (path.len && path.data[path.len - 1] == '/') {
+    key = fiobj_str_tmp();
+    fiobj_str_write(key, path.data, path.len);
+    fiobj_str_write(key, "index.html", 10);
+  }
+  uint8_t allow_gz = 0;
+  {
+    FIOBJ tmp = fiobj_hash_get2(h->headers, accept_enc_hash);
+    if (tmp) {
+      fio_str_info_s ac_str = fiobj_obj2cstr(tmp);
+      allow_gz = (ac_str.data && strstr(ac_str.data, "gzip"));
+    }
   }
-  if (cookie.max_age) {
-    memcpy(t.data + len, "Max-Age=", 8);
-    len += 8;
-    len += fio_ltoa(t.data + len, cookie.max_age, 10);
-    t.data[len++] = ';';
-    t.data[len++] = ' ';
+  http_asset_file_s f;
+  uint8_t is_gz;
+  fio_lock(&m->lock);
+  http_asset_s *a =
+      http_manifest_set_find(&m->files, http_manifest_hash(key), key);
+  if (!a) {
+    const uint8_t complete = m->complete;
+    fio_unlock(&m->lock);
+    if (complete)
+      return -1;
+    goto sendfile;
   }
-  fiobj_str_resize(c, len);
-
-  if (cookie.domain && cookie.domain_len) {
-    fiobj_str_write(c, "domain=", 7);
-    fiobj_str_write(c, cookie.domain, cookie.domain_len);
-    fiobj_str_write(c, ";", 1);
-    t.data[len++] = ' ';
+  is_gz = (allow_gz && a->gz.file.etag);
+  f = is_gz ? a->gz : a->file;
+  if (!f.file.etag) {
+    /* only a gzip variant exists and the client can't accept it */
+    fio_unlock(&m->lock);
+    return -1;
   }
-  if (cookie.path && cookie.path_len) {
-    fiobj_str_write(c, "path=", 5);
-    fiobj_str_write(c, cookie.path, cookie.path_len);
-    fiobj_str_write(c, ";", 1);
-    t.data[len++] = ' ';
+  if (!f.data) {
+    fio_unlock(&m->lock);
+    goto sendfile;
   }
-  if (cookie.http_only) {
-    fiobj_str_write(c, "HttpOnly;", 9);
+  fiobj_dup(f.data);
+  fiobj_dup(f.file.etag);
+  fiobj_dup(f.file.last_modified);
+  fiobj_dup(f.file.mime);
+  fio_unlock(&m->lock);
+
+  /* ranges and methods other than GET / HEAD are rare, leave them be */
+  fio_str_info_s method = fiobj_obj2cstr(h->method);
+  uint8_t is_head = 0;
+  if (fiobj_hash_get2(h->headers, range_hash))
+    goto sendfile_unref;
+  if (method.len == 4 && !strncasecmp("head", method.data, 4))
+    is_head = 1;
+  else if (method.len != 3 || strncasecmp("get", method.data, 3))
+    goto sendfile_unref;
+
+  http_set_header(h, HTTP_HEADER_LAST_MODIFIED, f.file.last_modified);
+  http_set_header(h, HTTP_HEADER_CACHE_CONTROL, fiobj_dup(HTTP_HVALUE_MAX_AGE));
+  http_set_header(h, HTTP_HEADER_ETAG, f.file.etag);
+  {
+    static uint64_t none_match_hash = 0;
+    if (!none_match_hash)
+      none_match_hash = fiobj_hash_string("if-none-match", 13);
+    FIOBJ tmp2 = fiobj_hash_get2(h->headers, none_match_hash);
+    if (tmp2 && fiobj_iseq(tmp2, f.file.etag)) {
+      fiobj_free(f.data);
+      fiobj_free(f.file.mime);
+      h->status = 304;
+      http_finish(h);
+      return 0;
+    }
   }
-  if (cookie.secure) {
-    fiobj_str_write(c, "secure;", 7);
+  http_set_header(h, HTTP_HEADER_ACCEPT_RANGES, fiobj_dup(HTTP_HVALUE_BYTES));
+  if (is_gz)
+    http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
+                    fiobj_dup(HTTP_HVALUE_GZIP));
+  if (f.file.mime)
+    http_set_header(h, HTTP_HEADER_CONTENT_TYPE, f.file.mime);
+  fio_str_info_s data = fiobj_obj2cstr(f.data);
+  if (is_head || !data.len) {
+    fiobj_free(f.data);
+    http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(data.len));
+    http_finish(h);
+    return 0;
   }
-  set_header_add(h->private_data.out_headers, HTTP_HEADER_SET_COOKIE, c);
+  /* the data is static, so it isn't compressed again (see `http_sendfile`) */
+  add_content_length(h, data.len);
+  add_date(h);
+  ((http_vtable_s *)h->private_data.vtbl)->http_send_body(h, data.data, data.len);
+  fiobj_free(f.data);
   return 0;
+
+sendfile_unref:
+  fiobj_free(f.data);
+  fiobj_free(f.file.etag);
+  fiobj_free(f.file.last_modified);
+  fiobj_free(f.file.mime);
+sendfile:
+  return http_sendfile2(h, settings->public_folder,
+                        settings->public_folder_length, path.data, path.len);
+}
+
+#else
+
+#if HTTP_FILE_WATCH
+static void http_manifest_on_event(fio_str_info_s dir, fio_str_info_s name,
+                                   uint32_t mask) {
+  (void)dir;
+  (void)name;
+  (void)mask;
+}
+#endif
+
+http_manifest_s *http_manifest_new(const char *folder, size_t len) {
+  return NULL;
+  (void)folder;
+  (void)len;
+}
+
+void http_manifest_free(http_manifest_s *m) { (void)m; }
+
+int http_static_serve______internal(http_s *h, http_settings_s *settings) {
+  fio_str_info_s path = fiobj_obj2cstr(h->path);
+  return http_sendfile2(h, settings->public_folder,
+                        settings->public_folder_length, path.data, path.len);
+}
+
+#endif /* HTTP_STATIC_MANIFEST */
+
+/* *****************************************************************************
+Byte Ranges (RFC 7233)
+***************************************************************************** */
+
+/* parses a decimal number, saturating instead of overflowing */
+static inline int http_range_num(char **pos, char *end, uint64_t *n) {
+  char *start = *pos;
+  *n = 0;
+  while (*pos < end && **pos >= '0' && **pos <= '9') {
+    if (*n < (UINT64_MAX / 10) - 10)
+      *n = (*n * 10) + (**pos - '0');
+    ++(*pos);
+  }
+  return *pos == start;
 }
-#define http_set_cookie(http__req__, ...)                                      \
-  http_set_cookie((http__req__), (http_cookie_args_s){__VA_ARGS__})
 
 /**
- * Sends the response headers and body.
+ * Parses a `range` header value into sorted and coalesced `ranges`.
  *
- * Returns -1 on error and 0 on success.
- *
- * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ * Returns the number of satisfiable ranges, 0 if the header should be ignored
+ * (invalid or too many ranges) and -1 if none of the ranges is satisfiable.
  */
-int http_send_body(http_s *r, void *data, uintptr_t length) {
-  if (HTTP_INVALID_HANDLE(r))
-    return -1;
-  if (!length || !data) {
-    http_finish(r);
+static int http_range_parse(http_range_s *ranges, fio_str_info_s value,
+                            uint64_t size) {
+  if (!value.data || value.len < 6 || strncasecmp(value.data, "bytes=", 6))
+    return 0;
+  char *pos = value.data + 6;
+  char *end = value.data + value.len;
+  size_t specs = 0;
+  int count = 0;
+  while (pos < end) {
+    uint64_t first, last = UINT64_MAX;
+    while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+      ++pos;
+    if (pos == end)
+      break;
+    if (++specs > HTTP_RANGE_LIMIT)
+      return 0;
+    if (*pos == '-') {
+      /* a suffix range - the last N bytes */
+      ++pos;
+      if (http_range_num(&pos, end, &first))
+        return 0;
+      if (!first || !size)
+        goto next;
+      first = (first < size) ? size - first : 0;
+    } else {
+      if (http_range_num(&pos, end, &first) || pos == end || *pos != '-')
+        return 0;
+      ++pos;
+      if (pos < end && *pos >= '0' && *pos <= '9') {
+        http_range_num(&pos, end, &last);
+        if (last < first)
+          return 0;
+      }
+      if (first >= size)
+        goto next;
+    }
+    if (last >= size)
+      last = size - 1;
+    ranges[count++] = (http_range_s){.offset = first,
+                                     .length = last - first + 1};
+  next:
+    while (pos < end && (*pos == ' ' || *pos == '\t'))
+      ++pos;
+    if (pos < end && *pos != ',')
+      return 0;
+  }
+  if (!specs)
     return 0;
+  if (!count)
+    return -1;
+  /* sort by offset (insertion sort, there are very few ranges) */
+  for (int i = 1; i < count; ++i) {
+    http_range_s tmp = ranges[i];
+    int j = i;
+    for (; j > 0 && ranges[j - 1].offset > tmp.offset; --j)
+      ranges[j] = ranges[j - 1];
+    ranges[j] = tmp;
   }
-  add_content_length(r, length);
-  // add_content_type(r);
-  add_date(r);
-  return ((http_vtable_s *)r->private_data.vtbl)
-      ->http_send_body(r, data, length);
+  /* coalesce overlapping and adjacent ranges */
+  int last = 0;
+  for (int i = 1; i < count; ++i) {
+    uintptr_t last_end = ranges[last].offset + ranges[last].length;
+    if (ranges[i].offset <= last_end) {
+      if (ranges[i].offset + ranges[i].length > last_end)
+        ranges[last].length = ranges[i].offset + ranges[i].length -
+                              ranges[last].offset;
+      continue;
+    }
+    ranges[++last] = ranges[i];
+  }
+  return last + 1;
 }
+
 /**
- * Sends the response headers and the specified file (the response's body).
- *
- * Returns -1 on error and 0 on success.
+ * Prepares the `multipart/byteranges` boundary strings (`count + 1` strings)
+ * and sets the response's `content-type`.
  *
- * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ * Returns the length of the response's body.
  */
-int http_sendfile(http_s *r, int fd, uintptr_t length, uintptr_t offset) {
-  if (HTTP_INVALID_HANDLE(r)) {
-    close(fd);
-    return -1;
-  };
-  add_content_length(r, length);
-  add_content_type(r);
-  add_date(r);
-  return ((http_vtable_s *)r->private_data.vtbl)
-      ->http_sendfile(r, fd, length, offset);
-}
-
-static inline int http_test_encoded_path(const char *mem, size_t len) {
-  const char *pos = NULL;
-  const char *end = mem + len;
-  while (mem < end && (pos = memchr(mem, '/', (size_t)len))) {
-    len = end - pos;
-    mem = pos + 1;
-    if (pos[1] == '/')
-      return -1;
-    if (len > 3 && pos[1] == '.' && pos[2] == '.' && pos[3] == '/')
-      return -1;
+static uintptr_t http_range_parts(http_s *h, FIOBJ *parts,
+                                  http_range_s *ranges, size_t count,
+                                  FIOBJ mime, uint64_t size) {
+  char boundary[17];
+  {
+    uint64_t r = fio_rand64();
+    for (size_t i = 0; i < 16; ++i) {
+      boundary[i] = "0123456789abcdef"[r & 15];
+      r >>= 4;
+    }
+    boundary[16] = 0;
   }
-  return 0;
+  fio_str_info_s m = fiobj_obj2cstr(mime);
+  uintptr_t total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    parts[i] = fiobj_str_buf(96 + m.len);
+    if (m.len)
+      fiobj_str_printf(parts[i], "\r\n--%s\r\ncontent-type:%s", boundary,
+                       m.data);
+    else
+      fiobj_str_printf(parts[i], "\r\n--%s", boundary);
+    fiobj_str_printf(parts[i], "\r\ncontent-range:bytes %llu-%llu/%llu\r\n\r\n",
+                     (unsigned long long)ranges[i].offset,
+                     (unsigned long long)(ranges[i].offset + ranges[i].length -
+                                          1),
+                     (unsigned long long)size);
+    total += fiobj_obj2cstr(parts[i]).len + ranges[i].length;
+  }
+  parts[count] = fiobj_str_buf(24);
+  fiobj_str_printf(parts[count], "\r\n--%s--\r\n", boundary);
+  total += fiobj_obj2cstr(parts[count]).len;
+  FIOBJ ctype = fiobj_str_buf(48);
+  fiobj_str_printf(ctype, "multipart/byteranges; boundary=%s", boundary);
+  http_set_header(h, HTTP_HEADER_CONTENT_TYPE, ctype);
+  return total;
 }
 
 /**
@@ -426,51 +1808,28 @@ int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
   }
   /* test for file existance  */
 
-  int file = -1;
+  http_file_s file;
   uint8_t is_gz = 0;
-
-  fio_str_info_s s = fiobj_obj2cstr(filename);
+  uint8_t allow_gz = 0;
   {
     FIOBJ tmp = fiobj_hash_get2(h->headers, accept_enc_hash);
-    if (!tmp)
-      goto no_gzip_support;
-    fio_str_info_s ac_str = fiobj_obj2cstr(tmp);
-    if (!ac_str.data || !strstr(ac_str.data, "gzip"))
-      goto no_gzip_support;
-    if (s.data[s.len - 3] != '.' || s.data[s.len - 2] != 'g' ||
-        s.data[s.len - 1] != 'z') {
-      fiobj_str_write(filename, ".gz", 3);
-      s = fiobj_obj2cstr(filename);
-      if (!stat(s.data, &file_data) &&
-          (S_ISREG(file_data.st_mode) || S_ISLNK(file_data.st_mode))) {
-        is_gz = 1;
-        goto found_file;
-      }
-      fiobj_str_resize(filename, s.len - 3);
+    if (tmp) {
+      fio_str_info_s ac_str = fiobj_obj2cstr(tmp);
+      allow_gz = (ac_str.data && strstr(ac_str.data, "gzip"));
     }
   }
-no_gzip_support:
-  if (stat(s.data, &file_data) ||
-      !(S_ISREG(file_data.st_mode) || S_ISLNK(file_data.st_mode)))
+  if (http_file_fetch(&file, filename, allow_gz, &is_gz))
     return -1;
-found_file:
+  file_data = file.stat;
   /* set last-modified */
-  {
-    FIOBJ tmp = fiobj_str_buf(32);
-    fiobj_str_resize(
-        tmp, http_time2str(fiobj_obj2cstr(tmp).data, file_data.st_mtime));
-    http_set_header(h, HTTP_HEADER_LAST_MODIFIED, tmp);
-  }
+  FIOBJ last_modified = file.last_modified;
+  http_set_header(h, HTTP_HEADER_LAST_MODIFIED, last_modified);
+  file.last_modified = FIOBJ_INVALID;
   /* set cache-control */
   http_set_header(h, HTTP_HEADER_CACHE_CONTROL, fiobj_dup(HTTP_HVALUE_MAX_AGE));
   /* set & test etag */
-  uint64_t etag = (uint64_t)file_data.st_size;
-  etag ^= (uint64_t)file_data.st_mtime;
-  etag = fiobj_hash_string(&etag, sizeof(uint64_t));
-  FIOBJ etag_str = fiobj_str_buf(32);
-  fiobj_str_resize(etag_str,
-                   fio_base64_encode(fiobj_obj2cstr(etag_str).data,
-                                     (void *)&etag, sizeof(uint64_t)));
+  FIOBJ etag_str = file.etag;
+  file.etag = FIOBJ_INVALID;
   /* set */
   http_set_header(h, HTTP_HEADER_ETAG, etag_str);
   /* test */
@@ -480,81 +1839,74 @@ found_file:
       none_match_hash = fiobj_hash_string("if-none-match", 13);
     FIOBJ tmp2 = fiobj_hash_get2(h->headers, none_match_hash);
     if (tmp2 && fiobj_iseq(tmp2, etag_str)) {
+      http_file_close(&file);
       h->status = 304;
       http_finish(h);
       return 0;
     }
   }
-  /* handle range requests */
-  int64_t offset = 0;
-  int64_t length = file_data.st_size;
+  /* handle range requests (RFC 7233) */
+  uintptr_t offset = 0;
+  uintptr_t length = file_data.st_size;
+  http_range_s ranges[HTTP_RANGE_LIMIT];
+  FIOBJ parts[HTTP_RANGE_LIMIT + 1];
+  int range_count = 0;
   {
-    static uint64_t ifrange_hash = 0;
-    if (!ifrange_hash)
-      ifrange_hash = fiobj_hash_string("if-range", 8);
-    FIOBJ tmp = fiobj_hash_get2(h->headers, ifrange_hash);
-    if (tmp && fiobj_iseq(tmp, etag_str)) {
-      fiobj_hash_delete2(h->headers, range_hash);
+    FIOBJ tmp = fiobj_hash_get2(h->headers, range_hash);
+    if (tmp) {
+      static uint64_t ifrange_hash = 0;
+      if (!ifrange_hash)
+        ifrange_hash = fiobj_hash_string("if-range", 8);
+      FIOBJ validator = fiobj_hash_get2(h->headers, ifrange_hash);
+      if (validator && !fiobj_iseq(validator, etag_str) &&
+          !fiobj_iseq(validator, last_modified))
+        tmp = FIOBJ_INVALID; /* the file changed, send all of it */
+      if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY))
+        tmp = fiobj_ary_index(tmp, 0);
+      if (tmp)
+        range_count = http_range_parse(ranges, fiobj_obj2cstr(tmp),
+                                       file_data.st_size);
+    }
+  }
+  if (range_count < 0) {
+    /* none of the ranges can be satisfied */
+    http_file_close(&file);
+    FIOBJ cranges = fiobj_str_buf(32);
+    fiobj_str_printf(cranges, "bytes */%llu",
+                     (unsigned long long)file_data.st_size);
+    http_set_header(h, HTTP_HEADER_CONTENT_RANGE, cranges);
+    h->status = 416;
+    http_finish(h);
+    return 0;
+  }
+  if (range_count) {
+    h->status = 206;
+    if (range_count == 1) {
+      offset = ranges[0].offset;
+      length = ranges[0].length;
+      FIOBJ cranges = fiobj_str_buf(64);
+      fiobj_str_printf(cranges, "bytes %llu-%llu/%llu",
+                       (unsigned long long)offset,
+                       (unsigned long long)(offset + length - 1),
+                       (unsigned long long)file_data.st_size);
+      http_set_header(h, HTTP_HEADER_CONTENT_RANGE, cranges);
     } else {
-      tmp = fiobj_hash_get2(h->headers, range_hash);
-      if (tmp) {
-        /* range ahead... */
-        if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY))
-          tmp = fiobj_ary_index(tmp, 0);
-        fio_str_info_s range = fiobj_obj2cstr(tmp);
-        if (!range.data || memcmp("bytes=", range.data, 6))
-          goto open_file;
-        char *pos = range.data + 6;
-        int64_t start_at = 0, end_at = 0;
-        start_at = fio_atol(&pos);
-        if (start_at >= file_data.st_size)
-          goto open_file;
-        if (start_at >= 0) {
-          pos++;
-          end_at = fio_atol(&pos);
-          if (end_at <= 0)
-            goto open_file;
-        }
-        /* we ignore multimple ranges, only responding with the first range. */
-        if (start_at < 0) {
-          if (0 - start_at < file_data.st_size) {
-            offset = file_data.st_size - start_at;
-            length = 0 - start_at;
-          }
-        } else if (end_at) {
-          offset = start_at;
-          length = end_at - start_at + 1;
-          if (length + start_at > file_data.st_size || length <= 0)
-            length = length - start_at;
-        } else {
-          offset = start_at;
-          length = length - start_at;
-        }
-        h->status = 206;
-
-        {
-          FIOBJ cranges = fiobj_str_buf(1);
-          fiobj_str_printf(cranges, "bytes %lu-%lu/%lu",
-                           (unsigned long)start_at,
-                           (unsigned long)(start_at + length - 1),
-                           (unsigned long)file_data.st_size);
-          http_set_header(h, HTTP_HEADER_CONTENT_RANGE, cranges);
-        }
-        http_set_header(h, HTTP_HEADER_ACCEPT_RANGES,
-                        fiobj_dup(HTTP_HVALUE_BYTES));
-      }
+      length = http_range_parts(h, parts, ranges, range_count, file.mime,
+                                file_data.st_size);
     }
   }
+  http_set_header(h, HTTP_HEADER_ACCEPT_RANGES, fiobj_dup(HTTP_HVALUE_BYTES));
   /* test for an OPTIONS request or invalid methods */
-  s = fiobj_obj2cstr(h->method);
+  fio_str_info_s s = fiobj_obj2cstr(h->method);
   switch (s.len) {
   case 7:
     if (!strncasecmp("options", s.data, 7)) {
+      http_file_close(&file);
       http_set_header2(h, (fio_str_info_s){.data = (char *)"allow", .len = 5},
                        (fio_str_info_s){.data = (char *)"GET, HEAD", .len = 9});
       h->status = 200;
       http_finish(h);
-      return 0;
+      goto free_parts;
     }
     break;
   case 3:
@@ -563,47 +1915,43 @@ found_file:
     break;
   case 4:
     if (!strncasecmp("head", s.data, 4)) {
+      http_file_close(&file);
       http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(length));
       http_finish(h);
-      return 0;
+      goto free_parts;
     }
     break;
   }
+  http_file_close(&file);
   http_send_error(h, 403);
-  return 0;
+  goto free_parts;
 open_file:
-  s = fiobj_obj2cstr(filename);
-  file = open(s.data, O_RDONLY);
-  if (file == -1) {
-    FIO_LOG_ERROR("(HTTP) couldn't open file %s!\n", s.data);
-    perror("     ");
-    http_send_error(h, 500);
+  if (is_gz) {
+    http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
+                    fiobj_dup(HTTP_HVALUE_GZIP));
+  }
+  if (range_count > 1) {
+    /* multipart/byteranges - the boundaries alternate with the file's ranges */
+    const int fd = file.fd;
+    file.fd = -1;
+    http_file_close(&file);
+    add_content_length(h, length);
+    add_date(h);
+    ((http_vtable_s *)h->private_data.vtbl)
+        ->http_sendfile_ranges(h, fd, ranges, parts, range_count);
     return 0;
   }
-  {
-    FIOBJ tmp = 0;
-    uintptr_t pos = 0;
-    if (is_gz) {
-      http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
-                      fiobj_dup(HTTP_HVALUE_GZIP));
-
-      pos = s.len - 4;
-      while (pos && s.data[pos] != '.')
-        pos--;
-      pos++; /* assuming, but that's fine. */
-      tmp = http_mimetype_find(s.data + pos, s.len - pos - 3);
-
-    } else {
-      pos = s.len - 1;
-      while (pos && s.data[pos] != '.')
-        pos--;
-      pos++; /* assuming, but that's fine. */
-      tmp = http_mimetype_find(s.data + pos, s.len - pos);
-    }
-    if (tmp)
-      http_set_header(h, HTTP_HEADER_CONTENT_TYPE, tmp);
+  if (file.mime) {
+    http_set_header(h, HTTP_HEADER_CONTENT_TYPE, file.mime);
+    file.mime = FIOBJ_INVALID;
+  }
+  http_sendfile(h, file.fd, length, offset);
+  return 0;
+free_parts:
+  if (range_count > 1) {
+    for (int i = 0; i <= range_count; ++i)
+      fiobj_free(parts[i]);
   }
-  http_sendfile(h, file, length, offset);
   return 0;
 }
 
@@ -657,6 +2005,125 @@ void http_finish(http_s *r) {
   add_date(r);
   ((http_vtable_s *)r->private_data.vtbl)->http_finish(r);
 }
+
+/**
+ * Sends the response headers (on the first call) and streams `data` as part of
+ * the response's body.
+ *
+ * Returns -1 on error, 0 on success and 1 if the client is slow.
+ */
+int http_stream(http_s *h, void *data, uintptr_t length,
+                void (*dealloc)(void *)) {
+  if (HTTP_INVALID_HANDLE(h) ||
+      !((http_vtable_s *)h->private_data.vtbl)->http_stream) {
+    if (dealloc && data)
+      dealloc(data);
+    return -1;
+  }
+  add_date(h);
+  return ((http_vtable_s *)h->private_data.vtbl)
+      ->http_stream(h, data, length, dealloc);
+}
+
+/**
+ * Schedules `task` to be called once the streamed data was sent to the client.
+ */
+void http_stream_wait(http_s *h, void (*task)(http_s *h),
+                      void (*fallback)(void *udata)) {
+  if (HTTP_INVALID_HANDLE(h) ||
+      !((http_vtable_s *)h->private_data.vtbl)->http_stream_wait) {
+    if (fallback)
+      fallback(h ? h->udata : NULL);
+    return;
+  }
+  ((http_vtable_s *)h->private_data.vtbl)->http_stream_wait(h, task, fallback);
+}
+
+/**
+ * Completes a streamed response.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+void http_stream_finish(http_s *h) { http_finish(h); }
+
+typedef struct {
+  fiobj_obj2json_stream_s *json;
+  /* the next chunk, formatted while the previous one is being sent */
+  FIOBJ chunk;
+  void *udata;
+  uint8_t more;
+} http_json_s;
+
+static void http_send_json_free(void *s_) {
+  http_json_s *s = s_;
+  fiobj_obj2json_stream_free(s->json);
+  fiobj_free(s->chunk);
+  fio_free(s);
+}
+
+static void http_send_json_task(http_s *h) {
+  http_json_s *s = h->udata;
+  h->udata = s->udata;
+  for (;;) {
+    fio_str_info_s data = fiobj_obj2cstr(s->chunk);
+    int ret = http_stream(h, data.data, data.len, NULL);
+    if (ret == -1) {
+      http_send_json_free(s);
+      return;
+    }
+    if (!s->more) {
+      http_send_json_free(s);
+      http_stream_finish(h);
+      return;
+    }
+    fiobj_str_resize(s->chunk, 0);
+    s->more =
+        fiobj_obj2json_stream_next(s->json, s->chunk, JSON_SEND_CHUNK_SIZE);
+    if (ret == 1) {
+      /* slow client, resume once the data was sent */
+      s->udata = h->udata;
+      h->udata = s;
+      http_stream_wait(h, http_send_json_task, http_send_json_free);
+      return;
+    }
+  }
+}
+
+/**
+ * Sends `obj` as a JSON response, formatting the JSON in chunks.
+ */
+int http_send_json(http_s *h, FIOBJ obj) {
+  if (HTTP_INVALID_HANDLE(h))
+    return -1;
+  if (!fiobj_hash_get(h->private_data.out_headers, HTTP_HEADER_CONTENT_TYPE))
+    http_set_header(h, HTTP_HEADER_CONTENT_TYPE,
+                    http_mimetype_find((char *)"json", 4));
+  http_json_s *s = fio_malloc(sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  *s = (http_json_s){
+      .json = fiobj_obj2json_stream_new(obj, 0),
+      .chunk = fiobj_str_buf(JSON_SEND_CHUNK_SIZE),
+  };
+  s->more = fiobj_obj2json_stream_next(s->json, s->chunk, JSON_SEND_CHUNK_SIZE);
+  if (s->more && !((http_vtable_s *)h->private_data.vtbl)->http_stream) {
+    /* streaming isn't supported, the whole JSON is sent as a single body */
+    while (fiobj_obj2json_stream_next(s->json, s->chunk, JSON_SEND_CHUNK_SIZE))
+      ;
+    s->more = 0;
+  }
+  if (!s->more) {
+    /* small objects are sent as a single response (with a content-length) */
+    fio_str_info_s data = fiobj_obj2cstr(s->chunk);
+    int ret = http_send_body(h, data.data, data.len);
+    http_send_json_free(s);
+    return ret;
+  }
+  s->udata = h->udata;
+  h->udata = s;
+  http_send_json_task(h);
+  return 0;
+}
+
 /**
  * Pushes a data response when supported (HTTP/2 only).
  *
@@ -808,8 +2275,15 @@ static void http_on_upgrade_fallback(http_s *h, char *p, size_t i) {
 }
 static void http_on_response_fallback(http_s *h) { http_send_error(h, 400); }
 
+/* returns NULL if the router couldn't be built */
 static http_settings_s *http_settings_new(http_settings_s arg_settings) {
   /* TODO: improve locality by unifying malloc to a single call */
+  if (arg_settings.router && http_router_build(arg_settings.router)) {
+    FIO_LOG_ERROR("(HTTP) couldn't build the router.");
+    /* release the reference taken by `http_router_build` */
+    http_router_free(arg_settings.router);
+    return NULL;
+  }
   if (!arg_settings.on_request)
     arg_settings.on_request = http_on_request_fallback;
   if (!arg_settings.on_response)
@@ -835,7 +2309,10 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
       arg_settings.max_clients -= HTTP_BUSY_UNLESS_HAS_FDS;
   }
 
-  http_settings_s *settings = malloc(sizeof(*settings) + sizeof(void *));
+  http_settings_s *settings =
+      malloc(sizeof(*settings) + sizeof(http_settings_data_s));
+  FIO_ASSERT_ALLOC(settings);
+  *http_settings2data(settings) = (http_settings_data_s){.on_close = NULL};
   *settings = arg_settings;
 
   if (settings->public_folder) {
@@ -859,11 +2336,30 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
       ((uint8_t *)settings->public_folder)[settings->public_folder_length] = 0;
     }
   }
+  if (settings->metrics_path) {
+    const size_t len = strlen(settings->metrics_path);
+    char *tmp = malloc(len + 1);
+    FIO_ASSERT_ALLOC(tmp);
+    memcpy(tmp, settings->metrics_path, len + 1);
+    settings->metrics_path = tmp;
+    http_settings2data(settings)->metrics_path_len = len;
+    http_metrics_start();
+  }
+#if !HAVE_ZLIB && !HAVE_BROTLI
+  if (settings->compress) {
+    FIO_LOG_WARNING("(HTTP) compression requires zlib or Brotli (HAVE_ZLIB / "
+                    "HAVE_BROTLI), responses won't be compressed.");
+    settings->compress = 0;
+  }
+#endif
   return settings;
 }
 
 static void http_settings_free(http_settings_s *s) {
+  http_manifest_free(http_settings2data(s)->manifest);
+  http_router_free(s->router);
   free((void *)s->public_folder);
+  free((void *)s->metrics_path);
   free(s);
 }
 /* *****************************************************************************
@@ -922,7 +2418,15 @@ intptr_t http_listen(const char *port, const char *binding,
   }
 
   http_settings_s *settings = http_settings_new(arg_settings);
+  if (!settings) {
+    if (arg_settings.on_finish)
+      arg_settings.on_finish(&arg_settings);
+    return -1;
+  }
   settings->is_client = 0;
+  if (settings->public_folder)
+    http_settings2data(settings)->manifest = http_manifest_new(
+        settings->public_folder, settings->public_folder_length);
   if (settings->tls) {
     fio_tls_alpn_add(settings->tls, "http/1.1", http_on_server_protocol_http1,
                      NULL, NULL);
@@ -959,12 +2463,14 @@ HTTP client connections
 static void http_on_close_client(intptr_t uuid, fio_protocol_s *protocol) {
   http_fio_protocol_s *p = (http_fio_protocol_s *)protocol;
   http_settings_s *set = p->settings;
-  void (**original)(intptr_t, fio_protocol_s *) =
-      (void (**)(intptr_t, fio_protocol_s *))(set + 1);
+  http_settings_data_s *client = http_settings2data(set);
   if (set->on_finish)
     set->on_finish(set);
 
-  original[0](uuid, protocol);
+  client->on_close(uuid, protocol);
+  fiobj_free(client->origin);
+  fiobj_free(client->address);
+  fiobj_free(client->port);
   http_settings_free(set);
 }
 
@@ -982,12 +2488,9 @@ static void http_on_open_client_http1(intptr_t uuid, void *set_,
     fio_close(uuid);
     return;
   }
-  { /* store the original on_close at the end of the struct, we wrap it. */
-    void (**original)(intptr_t, fio_protocol_s *) =
-        (void (**)(intptr_t, fio_protocol_s *))(set + 1);
-    *original = pr->on_close;
-    pr->on_close = http_on_close_client;
-  }
+  /* store the original on_close after the settings struct, we wrap it. */
+  http_settings2data(set)->on_close = pr->on_close;
+  pr->on_close = http_on_close_client;
   h->private_data.flag = (uintptr_t)pr;
   h->private_data.vtbl = http1_vtable();
   http_on_open_client_perform(set);
@@ -1006,10 +2509,171 @@ static void http_on_client_failed(intptr_t uuid, void *set_) {
   fio_free(h);
   if (set->on_finish)
     set->on_finish(set);
+  fiobj_free(http_settings2data(set)->origin);
+  fiobj_free(http_settings2data(set)->address);
+  fiobj_free(http_settings2data(set)->port);
   http_settings_free(set);
   (void)uuid;
 }
 
+/* *****************************************************************************
+HTTP client connection pool (idle keep-alive connections, per process)
+***************************************************************************** */
+
+/* an idle client connection, waiting for the next `http_connect` */
+typedef struct {
+  fio_protocol_s protocol;
+  fio_ls_embd_s node;
+  intptr_t uuid;
+  FIOBJ origin;
+} http_client_idle_s;
+
+/* the most recently parked connection is the list's head (`prev`) */
+static struct {
+  fio_lock_i lock;
+  size_t count;
+  fio_ls_embd_s idle;
+} http_client_pool = {.lock = FIO_LOCK_INIT,
+                      .idle = FIO_LS_INIT(http_client_pool.idle)};
+
+static void http_client_idle_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  char buf[64];
+  if (fio_read(uuid, buf, sizeof(buf)) > 0)
+    fio_close(uuid); /* unexpected data, the connection can't be reused */
+  (void)pr;
+}
+
+static void http_client_idle_ping(intptr_t uuid, fio_protocol_s *pr) {
+  fio_close(uuid); /* idle timeout */
+  (void)pr;
+}
+
+static void http_client_idle_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  http_client_idle_s *c = (http_client_idle_s *)pr;
+  fio_lock(&http_client_pool.lock);
+  if (fio_ls_embd_remove(&c->node))
+    --http_client_pool.count;
+  fio_unlock(&http_client_pool.lock);
+  fiobj_free(c->origin);
+  fio_free(c);
+  (void)uuid;
+}
+
+/**
+ * Parks an idle client connection once the response was handled, calling the
+ * `http_connect` call's `on_finish` (the connection was detached from it).
+ */
+void http_client_park______internal(intptr_t uuid, http_settings_s *set) {
+  http_settings_data_s *client = http_settings2data(set);
+  if (!client->origin)
+    return;
+  size_t per_origin = 0;
+  intptr_t evict = -1;
+  http_client_idle_s *c = fio_malloc(sizeof(*c));
+  FIO_ASSERT_ALLOC(c);
+  *c = (http_client_idle_s){
+      .protocol =
+          {
+              .on_data = http_client_idle_on_data,
+              .on_close = http_client_idle_on_close,
+              .ping = http_client_idle_ping,
+          },
+      .node = FIO_LS_INIT(c->node),
+      .uuid = uuid,
+      .origin = fiobj_dup(client->origin),
+  };
+  fio_lock(&http_client_pool.lock);
+  FIO_LS_EMBD_FOR(&http_client_pool.idle, pos) {
+    if (fiobj_iseq(FIO_LS_EMBD_OBJ(http_client_idle_s, node, pos)->origin,
+                   client->origin))
+      ++per_origin;
+  }
+  if (per_origin >= HTTP_CLIENT_POOL_ORIGIN_LIMIT) {
+    /* too many idle connections to this origin */
+    fio_unlock(&http_client_pool.lock);
+    fiobj_free(c->origin);
+    fio_free(c);
+    fio_close(uuid);
+    return;
+  }
+  if (http_client_pool.count >= HTTP_CLIENT_POOL_LIMIT) {
+    /* the pool is full, make room by evicting the oldest connection */
+    http_client_idle_s *old = FIO_LS_EMBD_OBJ(
+        http_client_idle_s, node, fio_ls_embd_shift(&http_client_pool.idle));
+    --http_client_pool.count;
+    evict = old->uuid;
+  }
+  /* attach within the lock, `on_close` is deferred (it can't free `c` yet) */
+  fio_timeout_set(uuid, HTTP_CLIENT_POOL_TIMEOUT);
+  fio_attach(uuid, &c->protocol); /* the HTTP/1.1 protocol is closed */
+  fio_ls_embd_push(&http_client_pool.idle, &c->node);
+  ++http_client_pool.count;
+  fio_unlock(&http_client_pool.lock);
+  if (evict != -1)
+    fio_close(evict);
+}
+
+/*
+ * Returns true if the idle connection is still open and quiet.
+ *
+ * Data that wasn't read (by `http_client_idle_on_data`) is never a sign of
+ * life. Over TLS it's most likely the server's `close_notify` alert.
+ */
+static int http_client_idle_is_healthy(intptr_t uuid) {
+  if (fio_is_closed(uuid))
+    return 0; /* stale (the fd might have been reused) or closing */
+  char tmp;
+  ssize_t r = recv(fio_uuid2fd(uuid), &tmp, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (r >= 0)
+    return 0; /* closed by the server, or unexpected data */
+  return (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/* takes an idle connection to the origin, returning -1 if none is available */
+static intptr_t http_client_pool_take(FIOBJ origin) {
+  for (;;) {
+    intptr_t uuid = -1;
+    fio_lock(&http_client_pool.lock);
+    for (fio_ls_embd_s *pos = http_client_pool.idle.prev;
+         pos != &http_client_pool.idle; pos = pos->prev) {
+      http_client_idle_s *c = FIO_LS_EMBD_OBJ(http_client_idle_s, node, pos);
+      if (fiobj_iseq(c->origin, origin)) {
+        /* once removed, `c` is freed by `on_close` (when it's replaced) */
+        fio_ls_embd_remove(pos);
+        --http_client_pool.count;
+        uuid = c->uuid;
+        break;
+      }
+    }
+    fio_unlock(&http_client_pool.lock);
+    if (uuid == -1 || http_client_idle_is_healthy(uuid))
+      return uuid;
+    fio_close(uuid);
+  }
+}
+
+/* attaches the request to a pooled connection (the idle protocol is locked) */
+static void http_client_reuse_task(intptr_t uuid, fio_protocol_s *pr,
+                                   void *set) {
+  http_on_open_client(uuid, set);
+  (void)pr;
+}
+
+/* the pooled connection was closed before the request could use it */
+static void http_client_reuse_fallback(intptr_t uuid, void *set_) {
+  http_settings_s *set = set_;
+  http_settings_data_s *client = http_settings2data(set);
+  if (!fio_is_running()) {
+    http_on_client_failed(uuid, set);
+    return;
+  }
+  /* connect again, `on_fail` is called if this fails as well */
+  fio_connect(.address = fiobj_obj2cstr(client->address).data,
+              .port = client->port ? fiobj_obj2cstr(client->port).data : NULL,
+              .on_fail = http_on_client_failed,
+              .on_connect = http_on_open_client, .udata = set, .tls = set->tls);
+}
+
 intptr_t http_connect__(void); /* sublime text marker */
 /**
  * Connects to an HTTP server as a client.
@@ -1109,7 +2773,14 @@ intptr_t http_connect FIO_IGNORE_MACRO(const char *url,
   if (!arg_settings.timeout)
     arg_settings.timeout = 30;
   http_settings_s *settings = http_settings_new(arg_settings);
+  if (!settings) {
+    if (a != unix_address)
+      fio_free(a);
+    fio_free(p);
+    goto on_error;
+  }
   settings->is_client = 1;
+  settings->compress = 0; /* requests aren't compressed */
   // if (settings->tls) {
   //   fio_tls_alpn_add(settings->tls, "http/1.1", http_on_open_client_http1,
   //                     NULL, NULL);
@@ -1131,6 +2802,25 @@ intptr_t http_connect FIO_IGNORE_MACRO(const char *url,
     http_set_header2(h, (fio_str_info_s){.data = (char *)"host", .len = 4},
                      (fio_str_info_s){.data = host, .len = h_len});
   intptr_t ret;
+  if (!is_websocket && HTTP_CLIENT_POOL_LIMIT) {
+    /* the pool key: (host, port, tls settings) */
+    FIOBJ origin = fiobj_str_buf(len + 32);
+    fiobj_str_printf(origin, "%lu|%s:%s",
+                     (unsigned long)fio_tls_id(arg_settings.tls), a,
+                     p ? p : "");
+    http_settings2data(settings)->origin = origin;
+    ret = http_client_pool_take(origin);
+    if (ret != -1) {
+      /* the connection might still close, keep what's needed to reconnect */
+      http_settings2data(settings)->address = fiobj_str_new(a, strlen(a));
+      if (p)
+        http_settings2data(settings)->port = fiobj_str_new(p, strlen(p));
+      fio_defer_io_task(ret, .type = FIO_PR_LOCK_TASK,
+                        .task = http_client_reuse_task, .udata = settings,
+                        .fallback = http_client_reuse_fallback);
+      goto finish;
+    }
+  }
   if (is_websocket) {
     /* force HTTP/1.1 */
     ret = fio_connect(.address = a, .port = p, .on_fail = http_on_client_failed,
@@ -1144,6 +2834,7 @@ intptr_t http_connect FIO_IGNORE_MACRO(const char *url,
                       .tls = arg_settings.tls);
     (void)0;
   }
+finish:
   if (a != unix_address)
     fio_free(a);
   fio_free(p);
@@ -2023,8 +3714,21 @@ FIOBJ http_req2str(http_s *h) {
   return w.dest;
 }
 
+/* appends to a log line, truncating the data if there isn't enough room */
+static inline void http_log_append(char *dest, size_t *pos, size_t limit,
+                                   const char *src, size_t len) {
+  if (*pos + len > limit)
+    len = limit - *pos;
+  memcpy(dest + *pos, src, len);
+  *pos += len;
+}
+
 void http_write_log(http_s *h) {
-  FIOBJ l = fiobj_str_buf(128);
+  /* the line is composed on the stack and written by the (async) logger */
+  char buf[FIO_LOG_LENGTH_LIMIT];
+  /* leave room for the status, length and duration */
+  const size_t limit = sizeof(buf) - 160;
+  size_t len = 0;
 
   intptr_t bytes_sent = fiobj_obj2num(fiobj_hash_get2(
       h->private_data.out_headers, fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH)));
@@ -2036,50 +3740,41 @@ void http_write_log(http_s *h) {
   {
     // TODO Guess IP address from headers (forwarded) where possible
     fio_str_info_s peer = fio_peer_addr(http2protocol(h)->uuid);
-    fiobj_str_write(l, peer.data, peer.len);
-  }
-  fio_str_info_s buff = fiobj_obj2cstr(l);
-
-  if (buff.len == 0) {
-    memcpy(buff.data, "[unknown]", 9);
-    buff.len = 9;
+    if (peer.len)
+      http_log_append(buf, &len, limit, peer.data, peer.len);
+    else
+      http_log_append(buf, &len, limit, "[unknown]", 9);
   }
-  memcpy(buff.data + buff.len, " - - [", 6);
-  buff.len += 6;
-  fiobj_str_resize(l, buff.len);
+  http_log_append(buf, &len, limit, " - - [", 6);
+  /* the date is cached per thread (no locking) */
+  len += http_time2str(buf + len, fio_last_tick().tv_sec);
+  http_log_append(buf, &len, limit, "] \"", 3);
   {
-    FIOBJ date;
-    fio_lock(&date_lock);
-    date = fiobj_dup(current_date);
-    fio_unlock(&date_lock);
-    fiobj_str_join(l, current_date);
-    fiobj_free(date);
-  }
-  fiobj_str_write(l, "] \"", 3);
-  fiobj_str_join(l, h->method);
-  fiobj_str_write(l, " ", 1);
-  fiobj_str_join(l, h->path);
-  fiobj_str_write(l, " ", 1);
-  fiobj_str_join(l, h->version);
-  fiobj_str_write(l, "\" ", 2);
+    fio_str_info_s t = fiobj_obj2cstr(h->method);
+    http_log_append(buf, &len, limit, t.data, t.len);
+    http_log_append(buf, &len, limit, " ", 1);
+    t = fiobj_obj2cstr(h->path);
+    http_log_append(buf, &len, limit, t.data, t.len);
+    http_log_append(buf, &len, limit, " ", 1);
+    t = fiobj_obj2cstr(h->version);
+    http_log_append(buf, &len, limit, t.data, t.len);
+  }
+  http_log_append(buf, &len, sizeof(buf), "\" ", 2);
+  len += fio_ltoa(buf + len, h->status, 10);
   if (bytes_sent > 0) {
-    fiobj_str_write_i(l, h->status);
-    fiobj_str_write(l, " ", 1);
-    fiobj_str_write_i(l, bytes_sent);
-    fiobj_str_write(l, "b ", 2);
+    buf[len++] = ' ';
+    len += fio_ltoa(buf + len, bytes_sent, 10);
+    http_log_append(buf, &len, sizeof(buf), "b ", 2);
   } else {
-    fiobj_str_join(l, fiobj_num_tmp(h->status));
-    fiobj_str_write(l, " -- ", 4);
+    http_log_append(buf, &len, sizeof(buf), " -- ", 4);
   }
 
   bytes_sent = ((end.tv_sec - start.tv_sec) * 1000) +
                ((end.tv_nsec - start.tv_nsec) / 1000000);
-  fiobj_str_write_i(l, bytes_sent);
-  fiobj_str_write(l, "ms\r\n", 4);
+  len += fio_ltoa(buf + len, bytes_sent, 10);
+  http_log_append(buf, &len, sizeof(buf), "ms\r\n", 4);
 
-  buff = fiobj_obj2cstr(l);
-  fwrite(buff.data, 1, buff.len, stderr);
-  fiobj_free(l);
+  fio_log_write(buf, len);
 }
 
 /**
@@ -2690,5 +4385,15 @@ void http_tests(void) {
   FIO_ASSERT(html_mime,
              "HTML mime-type not found! Mime-Type registry invalid!\n");
   fiobj_free(html_mime);
+  FIO_ASSERT(http_header_name_interned("host", 4) == HTTP_HEADER_HOST,
+             "Interned header name should reuse the existing constant!\n");
+  FIOBJ ua = http_header_name_interned("user-agent", 10);
+  FIO_ASSERT(ua && fiobj_obj2hash(ua) == fiobj_hash_string("user-agent", 10),
+             "Interned header name missing or hash error!\n");
+  FIO_ASSERT(!http_header_name_interned("user-agenx", 10) &&
+                 !http_header_name_interned("Host", 4) &&
+                 !http_header_name_interned("x", 1),
+             "Unknown header names shouldn't be interned!\n");
+  http_router_test();
 }
 #endif
@@ -42,6 +42,135 @@ Compile Time Settings
 #define HTTP_MAX_HEADER_LENGTH 8192
 #endif
 
+#ifndef HTTP_SENDFILE_CACHE_LIMIT
+/**
+ * The number of files `http_sendfile2` keeps open (per process), along with
+ * their metadata and precomputed headers. Set to 0 to disable the cache.
+ *
+ * The cache requires `inotify` (Linux) and is disabled on other systems.
+ */
+#define HTTP_SENDFILE_CACHE_LIMIT 256
+#endif
+
+#ifndef HTTP_SENDFILE_MISSING_LIMIT
+/**
+ * The number of missing files `http_sendfile2` remembers (per process), so
+ * requests for missing files cost no file system lookups. Missing files are
+ * tracked separately and never evict open files from the cache.
+ *
+ * Requires the file cache (see `HTTP_SENDFILE_CACHE_LIMIT`).
+ */
+#define HTTP_SENDFILE_MISSING_LIMIT 256
+#endif
+
+#ifndef HTTP_STATIC_MANIFEST_LIMIT
+/**
+ * The maximum number of files in a `public_folder` manifest. The manifest is
+ * built before the server starts and answers static file lookups with a hash
+ * lookup, so dynamic routes cost no file system access.
+ *
+ * Folders with more files aren't indexed (`http_sendfile2` is used instead).
+ * Set to 0 to disable the manifest.
+ *
+ * The manifest requires `inotify` (Linux) and is disabled on other systems.
+ */
+#define HTTP_STATIC_MANIFEST_LIMIT 16384
+#endif
+
+#ifndef HTTP_STATIC_INLINE_LIMIT
+/**
+ * Files (and gzip variants) up to this size are kept in memory by the
+ * `public_folder` manifest and served without opening the file.
+ */
+#define HTTP_STATIC_INLINE_LIMIT (16 * 1024)
+#endif
+
+#ifndef HTTP_STATIC_INLINE_TOTAL
+/**
+ * The total amount of file data (per process) the `public_folder` manifests
+ * keep in memory. Once exhausted, files are served using `sendfile`.
+ */
+#define HTTP_STATIC_INLINE_TOTAL (32 * 1024 * 1024)
+#endif
+
+#ifndef HTTP_RANGE_LIMIT
+/**
+ * The maximum number of byte ranges `http_sendfile2` will honor for a single
+ * request. Requests with more ranges are answered with the whole file.
+ */
+#define HTTP_RANGE_LIMIT 16
+#endif
+
+#ifndef HTTP_STREAM_PENDING_LIMIT
+/**
+ * The number of outgoing packets (per connection) after which `http_stream`
+ * reports a slow client, so the handler can wait before streaming more data.
+ */
+#define HTTP_STREAM_PENDING_LIMIT 32
+#endif
+
+#ifndef HTTP_CLIENT_POOL_LIMIT
+/**
+ * The number of idle HTTP/1.1 client connections (per process) kept open for
+ * reuse by future `http_connect` calls to the same origin (host, port and TLS
+ * settings, see `fio_tls_id`). Set to 0 to disable the connection pool.
+ */
+#define HTTP_CLIENT_POOL_LIMIT 64
+#endif
+
+#ifndef HTTP_CLIENT_POOL_ORIGIN_LIMIT
+/** The number of idle client connections (per process) kept for each origin. */
+#define HTTP_CLIENT_POOL_ORIGIN_LIMIT 8
+#endif
+
+#ifndef HTTP_CLIENT_POOL_TIMEOUT
+/** The number of seconds an idle client connection is kept in the pool. */
+#define HTTP_CLIENT_POOL_TIMEOUT 15
+#endif
+
+#ifndef HTTP_METRICS_INTERVAL
+/**
+ * The interval (in milliseconds) at which worker processes share their latency
+ * metrics, so any worker can serve the metrics of the whole cluster.
+ */
+#define HTTP_METRICS_INTERVAL 2000
+#endif
+
+#ifndef HTTP_COMPRESS_MIN_SIZE
+/**
+ * Responses smaller than this number of bytes aren't compressed (see the
+ * `compress` setting).
+ */
+#define HTTP_COMPRESS_MIN_SIZE 1024
+#endif
+
+#ifndef HTTP_COMPRESS_CACHE_LIMIT
+/**
+ * The number of compressed responses kept (per process), so identical
+ * responses are compressed only once. Set to 0 to disable the cache.
+ *
+ * Responses are identified by their ETag header (if any, scoped by the host
+ * and path) or their content. A copy of the uncompressed body is kept and
+ * compared on every cache hit.
+ */
+#define HTTP_COMPRESS_CACHE_LIMIT 64
+#endif
+
+#ifndef HTTP_COMPRESS_CACHE_MAX_SIZE
+/** Responses larger than this number of bytes aren't cached once compressed. */
+#define HTTP_COMPRESS_CACHE_MAX_SIZE (1024 * 256)
+#endif
+
+#ifndef HTTP_COMPRESS_GZIP_LEVEL
+/** The zlib compression level used for `gzip` responses (1-9). */
+#define HTTP_COMPRESS_GZIP_LEVEL 6
+#endif
+
+#ifndef HTTP_COMPRESS_BROTLI_QUALITY
+/** The Brotli quality used for `br` responses (0-11). */
+#define HTTP_COMPRESS_BROTLI_QUALITY 5
+#endif
+
 #ifndef FIO_HTTP_EXACT_LOGGING
 /**
  * By default, facil.io logs the HTTP request cycle using a fuzzy starting point
@@ -61,6 +190,9 @@ Compile Time Settings
 /** the `http_listen settings, see details in the struct definition. */
 typedef struct http_settings_s http_settings_s;
 
+/** A request router, see `http_router_new` for details. */
+typedef struct http_router_s http_router_s;
+
 /* *****************************************************************************
 The Request / Response type and functions
 ***************************************************************************** */
@@ -243,6 +375,65 @@ int http_send_error(http_s *h, size_t error_code);
  */
 void http_finish(http_s *h);
 
+/**
+ * Sends the response headers (on the first call) and streams `data` as part of
+ * the response's body, so a response can be sent while it's being produced.
+ *
+ * Unless a `content-length` header was set, HTTP/1.1 responses use the
+ * `chunked` transfer encoding (HTTP/1.0 connections are closed once the
+ * response is complete).
+ *
+ * If `dealloc` is NULL, the data is copied. Otherwise the data isn't copied and
+ * `dealloc(data)` will be called once the data was sent (or on error).
+ *
+ * Returns -1 on error, 0 on success and 1 if the data was scheduled but the
+ * client is slow (more than `HTTP_STREAM_PENDING_LIMIT` packets are waiting to
+ * be sent). When 1 is returned, use `http_stream_wait` before streaming more.
+ *
+ * Once the `on_request` callback returns, `http_stream` should only be called
+ * from within a `http_stream_wait` (or `http_resume`) task.
+ *
+ * The response MUST be completed using `http_stream_finish`.
+ */
+int http_stream(http_s *h, void *data, uintptr_t length,
+                void (*dealloc)(void *));
+
+/**
+ * Schedules `task` to be called once the streamed data was sent to the client.
+ *
+ * If the connection is lost, `fallback` (if any) is called with `h->udata`.
+ */
+void http_stream_wait(http_s *h, void (*task)(http_s *h),
+                      void (*fallback)(void *udata));
+
+/**
+ * Completes a streamed response.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+void http_stream_finish(http_s *h);
+
+/**
+ * Sends `obj` as a JSON response (setting the `content-type` header, unless
+ * already set).
+ *
+ * Small objects are sent using `http_send_body`. Larger objects are formatted
+ * in `JSON_SEND_CHUNK_SIZE` chunks and streamed (see `http_stream`), so the
+ * first bytes are sent early and memory usage stays bounded, regardless of the
+ * object's size.
+ *
+ * If the connection doesn't support `http_stream`, the whole JSON is formatted
+ * and sent using `http_send_body`.
+ *
+ * The function holds a reference to `obj` (`fiobj_dup`), but the object
+ * mustn't be edited until the response was sent.
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_json(http_s *h, FIOBJ obj);
+
 /**
  * Pushes a data response when supported (HTTP/2 only).
  *
@@ -372,12 +563,40 @@ struct http_settings_s {
   intptr_t max_clients;
   /** SSL/TLS support. */
   void *tls;
-  /** reserved for future use. */
-  intptr_t reserved1;
-  /** reserved for future use. */
-  intptr_t reserved2;
-  /** reserved for future use. */
-  intptr_t reserved3;
+  /**
+   * (optional) Streams request bodies to the handler instead of buffering them.
+   *
+   * When set, `on_request` is called as soon as the headers of a request with
+   * a body were received (`h->body` remains empty). The body is then passed to
+   * `on_body_chunk` as it arrives, followed by a final call where `data` is
+   * NULL and `len` is 0. The response can be sent at any time - any body data
+   * received after the response was sent is discarded.
+   *
+   * Call `http_pause` from within `on_request` or `on_body_chunk` to stop
+   * receiving body data. Once `http_resume` was called, body data will be
+   * passed to `on_body_chunk` again.
+   *
+   * Requests without a body are handled as usual (no `on_body_chunk` calls).
+   *
+   * Note: `Expect: 100-continue` requests are answered with a `100 Continue`
+   *       before the body is received, unless the body is too big.
+   */
+  void (*on_body_chunk)(http_s *h, char *data, size_t len);
+  /**
+   * (optional) Routes requests to handlers according to their method and path.
+   *
+   * Requests that don't match any route are handled as usual (static files
+   * and `on_request`). See `http_router_new` for details.
+   */
+  http_router_s *router;
+  /**
+   * (optional) The path of a Prometheus metrics endpoint (i.e., "/metrics").
+   *
+   * When set, request latency histograms are collected (queue wait, handler
+   * time, response drain time and the handler time per route) and served at
+   * this path, aggregated across all worker processes. See `http_send_metrics`.
+   */
+  const char *metrics_path;
   /**
    * The maximum websocket message size/buffer (in bytes) for Websocket
    * connections. Defaults to ~250KB.
@@ -401,6 +620,17 @@ struct http_settings_s {
   uint8_t ws_timeout;
   /** Logging flag - set to TRUE to log HTTP requests. */
   uint8_t log;
+  /**
+   * Compression flag - set to TRUE to compress dynamic responses (sent using
+   * `http_send_body`) for clients that accept `gzip` or `br` encoding.
+   *
+   * Only textual content types (i.e., `text/html`, `application/json`) longer
+   * than `HTTP_COMPRESS_MIN_SIZE` are compressed.
+   *
+   * Requires the zlib library (`HAVE_ZLIB`) and / or the Brotli library
+   * (`HAVE_BROTLI`).
+   */
+  uint8_t compress;
   /** a read only flag set automatically to indicate the protocol's mode. */
   uint8_t is_client;
 };
@@ -420,6 +650,58 @@ intptr_t http_listen(const char *port, const char *binding,
 #define http_listen(port, binding, ...)                                        \
   http_listen((port), (binding), (struct http_settings_s){__VA_ARGS__})
 
+/**
+ * Creates a new (empty) request router, to be set as the `router` in the
+ * `http_listen` settings.
+ *
+ * Routes are compiled into a radix tree when `http_listen` is called. After
+ * that, the router is read-only and no more routes can be added.
+ *
+ * Once the router was passed to `http_listen`, it's safe to call
+ * `http_router_free` (the router is freed when no longer in use).
+ */
+http_router_s *http_router_new(void);
+
+/**
+ * Adds a route to the router.
+ *
+ * `method` is the HTTP method (i.e., "GET") or NULL for any method. `HEAD`
+ * requests are routed to `GET` handlers unless a `HEAD` route exists.
+ *
+ * `path` must start with a `/` and may contain parameters:
+ *
+ * * `:name` segments match a single path segment (i.e., `/users/:id`).
+ *
+ * * A trailing `*name` segment matches the rest of the path (the `*` must
+ *   follow a `/`).
+ *
+ * Captured values are added to `h->params` (as Strings) before the `handler`
+ * is called. Static segments take precedence over parameters, which take
+ * precedence over wildcards.
+ *
+ * Returns -1 on error (i.e., when the router was already passed to
+ * `http_listen`) and 0 on success.
+ */
+int http_router_add(http_router_s *router, const char *method,
+                    const char *path, void (*handler)(http_s *h));
+
+/** Frees the router (or releases the caller's reference). */
+void http_router_free(http_router_s *router);
+
+/**
+ * Sends the request latency metrics (of all the worker processes) using the
+ * Prometheus text format.
+ *
+ * Metrics are collected only when a listener's `metrics_path` is set, this
+ * function allows the metrics to be served by a route (i.e., behind an
+ * authentication test).
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_metrics(http_s *h);
+
 /**
  * Connects to an HTTP server as a client.
  *
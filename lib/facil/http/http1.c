@@ -22,15 +22,37 @@ typedef struct http1pr_s {
   http_fio_protocol_s p;
   http1_parser_s parser;
   http_s request;
+  uint8_t *buf; /* points to `buf_inline` or to a larger read-ahead buffer */
   uintptr_t buf_len;
+  uintptr_t buf_capa;
   uintptr_t max_header_size;
   uintptr_t header_size;
+  FIOBJ stream_pending; /* streamed body data received while paused */
+  uint64_t drain_at;    /* metrics: when an unsent response was sent (µs) */
+  void (*stream_on_ready)(http_s *h);       /* `http_stream_wait` task */
+  void (*stream_fallback)(void *udata);     /* `http_stream_wait` fallback */
+  uint32_t pipeline;    /* requests per `on_data` event (adaptive) */
   uint8_t close;
   uint8_t is_client;
   uint8_t stop;
-  uint8_t buf[];
+  uint8_t paused;      /* the number of pending `http_resume` calls */
+  uint8_t streaming;   /* the request's body is streamed to the handler */
+  uint8_t stream_done; /* the body ended while the handler was paused */
+  uint8_t stream_out;  /* response streaming: 1 = identity, 2+ = chunked */
+  uint8_t buf_inline[];
 } http1pr_s;
 
+/* the initial pipelining depth, also used as the minimal depth */
+#define HTTP1_PIPELINE_MIN 8
+
+#if HTTP1_PIPELINE_LIMIT < HTTP1_PIPELINE_MIN ||                               \
+    HTTP1_PIPELINE_LIMIT > 0x7FFFFFFF
+#error HTTP1_PIPELINE_LIMIT must be between 8 and 2^31 - 1
+#endif
+
+/* streamed chunks up to this length are merged with the chunk header */
+#define HTTP1_STREAM_COPY_LIMIT 4096
+
 struct http_vtable_s HTTP1_VTABLE; /* initialized later on */
 
 /* *****************************************************************************
@@ -51,10 +73,15 @@ static fio_str_info_s http1pr_status2str(uintptr_t status);
 static inline void http1_after_finish(http_s *h) {
   http1pr_s *p = handle2pr(h);
   p->stop = p->stop & (~1UL);
+  if (http_metrics_enabled && !p->is_client && !p->drain_at)
+    p->drain_at = http_metrics_now();
   if (h != &p->request) {
     http_s_destroy(h, 0);
     fio_free(h);
   } else {
+    p->stream_out = 0;
+    p->stream_on_ready = NULL;
+    p->stream_fallback = NULL;
     http_s_clear(h, p->p.settings->log);
   }
   if (p->close)
@@ -219,8 +246,80 @@ static int http1_sendfile(http_s *h, int fd, uintptr_t length,
   return 0;
 }
 
+/** Should send existing headers and the file's ranges (multipart) */
+static int http1_sendfile_ranges(http_s *h, int fd, http_range_s *ranges,
+                                 FIOBJ *parts, size_t count) {
+  const intptr_t uuid = handle2pr(h)->p.uuid;
+  size_t i = 0;
+  /* the last range sent directly from the file closes the file */
+  size_t closer = count;
+  FIOBJ packet = headers2str(h, 0);
+  if (!packet)
+    goto error;
+  for (size_t j = 0; j < count; ++j) {
+    if (ranges[j].length >= HTTP_MAX_HEADER_LENGTH)
+      closer = j;
+  }
+  for (; i < count; ++i) {
+    fiobj_str_join(packet, parts[i]);
+    fiobj_free(parts[i]);
+    parts[i] = FIOBJ_INVALID;
+    if (ranges[i].length < HTTP_MAX_HEADER_LENGTH) {
+      /* optimize away small ranges, copying them after the boundary */
+      fio_str_info_s s = fiobj_obj2cstr(packet);
+      fiobj_str_capa_assert(packet, s.len + ranges[i].length);
+      s = fiobj_obj2cstr(packet);
+      ssize_t r = pread(fd, s.data + s.len, ranges[i].length, ranges[i].offset);
+      if (r != (ssize_t)ranges[i].length)
+        goto read_error;
+      fiobj_str_resize(packet, s.len + r);
+      continue;
+    }
+    fiobj_send_free(uuid, packet);
+    fio_write2(uuid, .data.fd = fd, .length = ranges[i].length,
+               .offset = ranges[i].offset, .is_fd = 1,
+               .after.dealloc = (i == closer ? NULL : FIO_DEALLOC_NOOP));
+    packet = fiobj_str_buf(128);
+  }
+  fiobj_str_join(packet, parts[count]);
+  fiobj_free(parts[count]);
+  fiobj_send_free(uuid, packet);
+  if (closer == count)
+    close(fd);
+  http1_after_finish(h);
+  return 0;
+
+read_error:
+  /* the response can't be completed, drop the queued parts */
+  fiobj_free(packet);
+  fio_force_close(uuid);
+  if (i < closer)
+    close(fd);
+  for (; i <= count; ++i)
+    fiobj_free(parts[i]);
+  return -1;
+error:
+  close(fd);
+  for (i = 0; i <= count; ++i)
+    fiobj_free(parts[i]);
+  http1_after_finish(h);
+  return -1;
+}
+
 /** Should send existing headers or complete streaming */
 static void htt1p_finish(http_s *h) {
+  http1pr_s *p = handle2pr(h);
+  if (p->stream_out && h == &p->request) {
+    /* complete a streamed response */
+    if (p->stream_out == 3)
+      fio_write(p->p.uuid, "\r\n0\r\n\r\n", 7);
+    else if (p->stream_out == 2)
+      fio_write(p->p.uuid, "0\r\n\r\n", 5);
+    http1_after_finish(h);
+    if (!p->stop)
+      fio_force_event(p->p.uuid, FIO_EVENT_ON_DATA); /* pipelined requests */
+    return;
+  }
   FIOBJ packet = headers2str(h, 0);
   if (packet)
     fiobj_send_free((handle2pr(h)->p.uuid), packet);
@@ -229,6 +328,133 @@ static void htt1p_finish(http_s *h) {
   }
   http1_after_finish(h);
 }
+
+/* returns true if the request's version is HTTP/1.1 (supports chunked TE) */
+static inline int http1_is_version_11(http_s *h) {
+  fio_str_info_s t = fiobj_obj2cstr(h->version);
+  return (t.len > 7 && t.data && t.data[5] == '1' && t.data[6] == '.' &&
+          t.data[7] == '1');
+}
+
+/** Should send existing headers and data and prepare for streaming */
+static int http1_stream(http_s *h, void *data, uintptr_t length,
+                        void (*dealloc)(void *)) {
+  http1pr_s *p = handle2pr(h);
+  FIOBJ packet = FIOBJ_INVALID;
+  char prefix[32];
+  size_t prefix_len = 0;
+  if (p->is_client || h != &p->request)
+    goto error; /* only server responses are streamed */
+  if (!p->stream_out) {
+    /* the first call sends the headers */
+    if (fiobj_hash_get(h->private_data.out_headers,
+                       HTTP_HEADER_CONTENT_LENGTH)) {
+      p->stream_out = 1;
+    } else if (http1_is_version_11(h)) {
+      http_set_header(h, HTTP_HEADER_TRANSFER_ENCODING,
+                      fiobj_dup(HTTP_HVALUE_CHUNKED));
+      p->stream_out = 2;
+    } else {
+      /* HTTP/1.0 - the end of the body is marked by closing the connection */
+      http_set_header(h, HTTP_HEADER_CONNECTION, fiobj_dup(HTTP_HVALUE_CLOSE));
+      p->stream_out = 1;
+    }
+    packet = headers2str(
+        h, sizeof(prefix) + (length <= HTTP1_STREAM_COPY_LIMIT ? length : 0));
+    if (!packet) {
+      p->stream_out = 0;
+      goto error;
+    }
+    /* the response outlives `on_request` (unless the body is still read) */
+    if (!p->streaming)
+      p->stop |= 1;
+  }
+  if (!data)
+    length = 0;
+  if (length && p->stream_out >= 2) {
+    /* the previous chunk's CRLF is sent along with the next chunk's header */
+    if (p->stream_out == 3) {
+      prefix[0] = '\r';
+      prefix[1] = '\n';
+      prefix_len = 2;
+    }
+    {
+      /* the chunk's length in hex (`fio_ltoa` adds a `0x` prefix) */
+      size_t digits = 1;
+      while (digits < sizeof(uintptr_t) * 2 && (length >> (digits << 2)))
+        ++digits;
+      while (digits) {
+        --digits;
+        prefix[prefix_len++] =
+            "0123456789ABCDEF"[(length >> (digits << 2)) & 15];
+      }
+    }
+    prefix[prefix_len++] = '\r';
+    prefix[prefix_len++] = '\n';
+    p->stream_out = 3;
+  }
+  if (length <= HTTP1_STREAM_COPY_LIMIT) {
+    /* small chunks are merged with the chunk header into a single packet */
+    if (packet || length) {
+      if (!packet)
+        packet = fiobj_str_buf(prefix_len + length);
+      fiobj_str_write(packet, prefix, prefix_len);
+      fiobj_str_write(packet, data, length);
+      fiobj_send_free(p->p.uuid, packet);
+    }
+    if (dealloc && data)
+      dealloc(data);
+  } else {
+    /* the chunk header and the payload are sent as separate packets */
+    if (packet) {
+      fiobj_str_write(packet, prefix, prefix_len);
+      fiobj_send_free(p->p.uuid, packet);
+    } else {
+      fio_write(p->p.uuid, prefix, prefix_len);
+    }
+    if (dealloc)
+      fio_write2(p->p.uuid, .data.buffer = data, .length = length,
+                 .after.dealloc = dealloc);
+    else
+      fio_write(p->p.uuid, data, length);
+  }
+  return (fio_pending(p->p.uuid) > HTTP_STREAM_PENDING_LIMIT);
+error:
+  if (dealloc && data)
+    dealloc(data);
+  return -1;
+}
+
+/* runs the `http_stream_wait` task within the protocol's lock */
+static void http1_stream_wait_task(intptr_t uuid, fio_protocol_s *pr,
+                                   void *ignr) {
+  http1pr_s *p = (http1pr_s *)pr;
+  void (*task)(http_s *h) = p->stream_on_ready;
+  p->stream_on_ready = NULL;
+  p->stream_fallback = NULL;
+  if (task && p->stream_out)
+    task(&p->request);
+  (void)uuid;
+  (void)ignr;
+}
+
+/** Should call `task` once the streamed data was (mostly) sent. */
+static void http1_stream_wait(http_s *h, void (*task)(http_s *h),
+                              void (*fallback)(void *udata)) {
+  http1pr_s *p = handle2pr(h);
+  if (!p->stream_out || h != &p->request) {
+    if (fallback)
+      fallback(h->udata);
+    return;
+  }
+  p->stream_on_ready = task;
+  p->stream_fallback = fallback;
+  if (fio_pending(p->p.uuid) <= (HTTP_STREAM_PENDING_LIMIT >> 1))
+    fio_defer_io_task(p->p.uuid, .type = FIO_PR_LOCK_TASK,
+                      .task = http1_stream_wait_task);
+  else
+    fio_force_event(p->p.uuid, FIO_EVENT_ON_READY); /* wait for the flush */
+}
 /** Push for data - unsupported. */
 static int http1_push_data(http_s *h, void *data, uintptr_t length,
                            FIOBJ mime_type) {
@@ -251,15 +477,25 @@ static int http1_push_file(http_s *h, FIOBJ filename, FIOBJ mime_type) {
  */
 static void http1_on_pause(http_s *h, http_fio_protocol_s *pr) {
   ((http1pr_s *)pr)->stop = 1;
+  ++((http1pr_s *)pr)->paused;
   fio_suspend(pr->uuid);
   (void)h;
 }
 
+static void http1_stream_resume(http1pr_s *p);
+
 /**
  * called after the resume task had completed.
  */
 static void http1_on_resume(http_s *h, http_fio_protocol_s *pr) {
-  if (!((http1pr_s *)pr)->stop) {
+  http1pr_s *p = (http1pr_s *)pr;
+  --p->paused;
+  if (p->streaming && !p->paused) {
+    /* the handler is ready for more body data (the response isn't done) */
+    p->stop &= ~1UL;
+    http1_stream_resume(p);
+  }
+  if (!p->stop) {
     fio_force_event(pr->uuid, FIO_EVENT_ON_DATA);
   }
   (void)h;
@@ -529,6 +765,9 @@ Virtual Table Decleration
 struct http_vtable_s HTTP1_VTABLE = {
     .http_send_body = http1_send_body,
     .http_sendfile = http1_sendfile,
+    .http_sendfile_ranges = http1_sendfile_ranges,
+    .http_stream = http1_stream,
+    .http_stream_wait = http1_stream_wait,
     .http_finish = htt1p_finish,
     .http_push_data = http1_push_data,
     .http_push_file = http1_push_file,
@@ -543,6 +782,56 @@ struct http_vtable_s HTTP1_VTABLE = {
 
 void *http1_vtable(void) { return (void *)&HTTP1_VTABLE; }
 
+/* *****************************************************************************
+Streamed Request Bodies
+***************************************************************************** */
+
+/* the body was fully received, signals the handler and finishes up */
+static void http1_stream_end(http1pr_s *p) {
+  p->streaming = 0;
+  if (!p->request.method)
+    return; /* the response was already sent */
+  p->p.settings->on_body_chunk(&p->request, NULL, 0);
+  if (!p->request.method)
+    return;
+  if (p->stream_out)
+    p->stop |= 1; /* the response is still being streamed */
+  else if (!p->stop)
+    http_finish(&p->request);
+}
+
+/* passes a body chunk to the handler (or stores it while paused) */
+static void http1_stream_chunk(http1pr_s *p, char *data, size_t len) {
+  if (!p->request.method)
+    return; /* the response was sent, the rest of the body is discarded */
+  if (p->paused || p->stream_pending) {
+    if (!p->stream_pending)
+      p->stream_pending = fiobj_str_buf(len);
+    fiobj_str_write(p->stream_pending, data, len);
+    return;
+  }
+  p->p.settings->on_body_chunk(&p->request, data, len);
+}
+
+/* delivers any body data (and end of body) received while paused */
+static void http1_stream_resume(http1pr_s *p) {
+  if (p->stream_pending) {
+    FIOBJ pending = p->stream_pending;
+    p->stream_pending = FIOBJ_INVALID;
+    if (p->request.method) {
+      fio_str_info_s s = fiobj_obj2cstr(pending);
+      p->p.settings->on_body_chunk(&p->request, s.data, s.len);
+    }
+    fiobj_free(pending);
+    if (p->paused)
+      return; /* paused again */
+  }
+  if (p->stream_done) {
+    p->stream_done = 0;
+    http1_stream_end(p);
+  }
+}
+
 /* *****************************************************************************
 Parser Callbacks
 ***************************************************************************** */
@@ -550,19 +839,56 @@ Parser Callbacks
 /** called when a request was received. */
 static int http1_on_request(http1_parser_s *parser) {
   http1pr_s *p = parser2http(parser);
+  if (p->streaming) {
+    /* the handler was already called, signal the end of the body */
+    if (p->paused)
+      p->stream_done = 1;
+    else
+      http1_stream_end(p);
+    h1_reset(p);
+    return fio_is_closed(p->p.uuid);
+  }
   http_on_request_handler______internal(&http1_pr2handle(p), p->p.settings);
   if (p->request.method && !p->stop)
     http_finish(&p->request);
   h1_reset(p);
   return fio_is_closed(p->p.uuid);
 }
+/* returns true if the connection can be reused after this response */
+static int http1_client_keep_alive(http_s *h) {
+  static uint64_t connection_hash;
+  if (!connection_hash)
+    connection_hash = fiobj_hash_string("connection", 10);
+  if (h->status < 200 || !http1_is_version_11(h) ||
+      fiobj_hash_get(h->headers, HTTP_HEADER_UPGRADE))
+    return 0;
+  fio_str_info_s t =
+      fiobj_obj2cstr(fiobj_hash_get2(h->headers, connection_hash));
+  return !(t.len && (t.data[0] == 'c' || t.data[0] == 'C'));
+}
+
+/* moves an idle client connection to the connection pool */
+static void http1_client_park_task(intptr_t uuid, fio_protocol_s *pr,
+                                   void *udata) {
+  http1pr_s *p = (http1pr_s *)pr;
+  if (pr != udata || p->buf_len || p->stop || p->close)
+    return; /* the protocol was replaced or the server sent more data */
+  http_client_park______internal(uuid, p->p.settings);
+}
+
 /** called when a response was received. */
 static int http1_on_response(http1_parser_s *parser) {
   http1pr_s *p = parser2http(parser);
+  const int keep_alive = http1_client_keep_alive(&p->request);
   http_on_response_handler______internal(&http1_pr2handle(p), p->p.settings);
   if (p->request.status_str && !p->stop)
     http_finish(&p->request);
   h1_reset(p);
+  if (keep_alive && !p->stop && !fio_is_closed(p->p.uuid)) {
+    /* the request is complete, the connection can be pooled */
+    fio_defer_io_task(p->p.uuid, .type = FIO_PR_LOCK_TASK,
+                      .task = http1_client_park_task, .udata = p);
+  }
   return fio_is_closed(p->p.uuid);
 }
 /** called when a request method is parsed. */
@@ -635,22 +961,70 @@ static int http1_on_header(http1_parser_s *parser, char *name, size_t name_len,
     http_send_error(&http1_pr2handle(parser2http(parser)), 413);
     return -1;
   }
-  sym = fiobj_str_new(name, name_len);
   obj = fiobj_str_new(data, data_len);
+  /* common header names are shared, avoiding allocations and hashing */
+  sym = http_header_name_interned(name, name_len);
+  if (sym) {
+    set_header_add(http1_pr2handle(parser2http(parser)).headers, sym, obj);
+    return 0;
+  }
+  sym = fiobj_str_new(name, name_len);
   set_header_add(http1_pr2handle(parser2http(parser)).headers, sym, obj);
   fiobj_free(sym);
   return 0;
 }
+/* answers `expect: 100-continue`, the client waits before sending the body */
+static void http1_expect_continue(http1pr_s *p) {
+  static uint64_t expect_hash;
+  if (!expect_hash)
+    expect_hash = fiobj_hash_string("expect", 6);
+  FIOBJ expect = fiobj_hash_get2(p->request.headers, expect_hash);
+  if (!expect || !FIOBJ_TYPE_IS(expect, FIOBJ_T_STRING))
+    return;
+  fio_str_info_s s = fiobj_obj2cstr(expect);
+  if (s.len != 12 || strncasecmp(s.data, "100-continue", 12) ||
+      !http1_is_version_11(&p->request))
+    return;
+  fio_write(p->p.uuid, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+}
+
+/** called when all the headers were parsed (before any body chunk). */
+static int http1_on_headers_complete(http1_parser_s *parser) {
+  http1pr_s *p = parser2http(parser);
+  if (p->is_client || (parser->state.content_length <= 0 &&
+                       !(parser->state.reserved & HTTP1_P_FLAG_CHUNKED)))
+    return 0; /* no request body */
+  if (parser->state.content_length >
+      (ssize_t)p->p.settings->max_body_size) {
+    http_send_error(&p->request, 413);
+    return -1;
+  }
+  http1_expect_continue(p);
+  if (p->p.settings->on_body_chunk) {
+    /* let the handler route the request before the body is received */
+    p->streaming = 1;
+    http_on_request_handler______internal(&p->request, p->p.settings);
+  }
+  return 0;
+}
+
 /** called when a body chunk is parsed. */
 static int http1_on_body_chunk(http1_parser_s *parser, char *data,
                                size_t data_len) {
+  http1pr_s *p = parser2http(parser);
   if (parser->state.content_length >
           (ssize_t)parser2http(parser)->p.settings->max_body_size ||
       parser->state.read >
           (ssize_t)parser2http(parser)->p.settings->max_body_size) {
-    http_send_error(&http1_pr2handle(parser2http(parser)), 413);
+    /* a streamed request might have a response (or a paused handler) */
+    if (!p->streaming || (p->request.method && !p->paused))
+      http_send_error(&http1_pr2handle(parser2http(parser)), 413);
     return -1; /* test every time, in case of chunked data */
   }
+  if (p->p.settings->on_body_chunk && !p->is_client) {
+    http1_stream_chunk(p, data, data_len);
+    return 0;
+  }
   if (!parser->state.read) {
     if (parser->state.content_length > 0 &&
         parser->state.content_length <= HTTP_MAX_HEADER_LENGTH) {
@@ -676,26 +1050,60 @@ static int http1_on_error(http1_parser_s *parser) {
 Connection Callbacks
 ***************************************************************************** */
 
+/* resizes the read buffer according to the observed client behavior */
+static inline void http1_adjust_buffer(http1pr_s *p, size_t available,
+                                       size_t consumed, size_t count) {
+  if (available == p->buf_capa && count > 1 &&
+      p->buf_capa < HTTP1_READ_BUFFER_LIMIT) {
+    /* a pipelining client filled the buffer, read ahead `pipeline` requests */
+    size_t capa = (consumed / count) * p->pipeline;
+    capa = (capa + 4095) & (~(size_t)4095);
+    if (capa > HTTP1_READ_BUFFER_LIMIT)
+      capa = HTTP1_READ_BUFFER_LIMIT;
+    if (capa <= p->buf_capa)
+      return;
+    uint8_t *tmp;
+    if (p->buf == p->buf_inline) {
+      tmp = fio_malloc(capa);
+      if (tmp && p->buf_len)
+        memcpy(tmp, p->buf, p->buf_len);
+    } else {
+      tmp = fio_realloc2(p->buf, capa, p->buf_len);
+    }
+    if (!tmp)
+      return;
+    p->buf = tmp;
+    p->buf_capa = capa;
+  } else if (!p->buf_len && p->buf != p->buf_inline &&
+             available < (HTTP_MAX_HEADER_LENGTH >> 1)) {
+    /* the client stopped pipelining, release the read-ahead buffer */
+    fio_free(p->buf);
+    p->buf = p->buf_inline;
+    p->buf_capa = HTTP_MAX_HEADER_LENGTH;
+  }
+}
+
 static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
-  if (fio_pending(uuid) > 4) {
+  /* the allowed output backlog grows with the pipelining depth */
+  if (fio_pending(uuid) > (size_t)(p->pipeline >> 1)) {
     goto throttle;
   }
   ssize_t i = 0;
   size_t org_len = p->buf_len;
-  int pipeline_limit = 8;
+  size_t count = 0;
   if (!p->buf_len)
     return;
   do {
     i = http1_parse(&p->parser, p->buf + (org_len - p->buf_len), p->buf_len);
     p->buf_len -= i;
-    --pipeline_limit;
-  } while (i && p->buf_len && pipeline_limit && !p->stop);
+    ++count;
+  } while (i && p->buf_len && count < p->pipeline && !p->stop);
 
   if (p->buf_len && org_len != p->buf_len) {
     memmove(p->buf, p->buf + (org_len - p->buf_len), p->buf_len);
   }
 
-  if (p->buf_len == HTTP_MAX_HEADER_LENGTH) {
+  if (!i && p->buf_len >= HTTP_MAX_HEADER_LENGTH) {
     /* no room to read... parser not consuming data */
     if (p->request.method)
       http_send_error(&p->request, 413);
@@ -705,7 +1113,16 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
     }
   }
 
-  if (!pipeline_limit) {
+  if (p->stop & 2)
+    return; /* hijacked / upgraded, the buffer might still be in use */
+  http1_adjust_buffer(p, org_len, org_len - p->buf_len, count);
+
+  if (count == p->pipeline) {
+    /* the client is pipelining, handle more requests per event */
+    if (p->pipeline < HTTP1_PIPELINE_LIMIT)
+      p->pipeline = (p->pipeline > (HTTP1_PIPELINE_LIMIT >> 1))
+                        ? HTTP1_PIPELINE_LIMIT
+                        : (p->pipeline << 1);
     fio_force_event(uuid, FIO_EVENT_ON_DATA);
   }
   return;
@@ -713,6 +1130,8 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
 throttle:
   /* throttle busy clients (slowloris) */
   p->stop |= 4;
+  if (p->pipeline > HTTP1_PIPELINE_MIN)
+    p->pipeline >>= 1;
   fio_suspend(uuid);
   FIO_LOG_DEBUG("(HTTP/1,1) throttling client at %.*s",
                 (int)fio_peer_addr(uuid).len, fio_peer_addr(uuid).data);
@@ -726,9 +1145,8 @@ static void http1_on_data(intptr_t uuid, fio_protocol_s *protocol) {
     return;
   }
   ssize_t i = 0;
-  if (HTTP_MAX_HEADER_LENGTH - p->buf_len)
-    i = fio_read(uuid, p->buf + p->buf_len,
-                 HTTP_MAX_HEADER_LENGTH - p->buf_len);
+  if (p->buf_capa - p->buf_len)
+    i = fio_read(uuid, p->buf + p->buf_len, p->buf_capa - p->buf_len);
   if (i > 0) {
     p->buf_len += i;
   }
@@ -745,6 +1163,16 @@ static void http1_on_close(intptr_t uuid, fio_protocol_s *protocol) {
 static void http1_on_ready(intptr_t uuid, fio_protocol_s *protocol) {
   /* resume slow clients from suspension */
   http1pr_s *p = (http1pr_s *)protocol;
+  if (p->drain_at && !fio_pending(uuid)) {
+    /* all the responses were written to the socket */
+    http_metrics_add(HTTP_METRICS_DRAIN, p->drain_at);
+    p->drain_at = 0;
+  }
+  if (p->stream_on_ready) {
+    /* the streamed data was sent, let the handler stream more */
+    fio_defer_io_task(uuid, .type = FIO_PR_LOCK_TASK,
+                      .task = http1_stream_wait_task);
+  }
   if (p->stop & 4) {
     p->stop ^= 4; /* flip back the bit, so it's zero */
     fio_force_event(uuid, FIO_EVENT_ON_DATA);
@@ -757,7 +1185,7 @@ static void http1_on_data_first_time(intptr_t uuid, fio_protocol_s *protocol) {
   http1pr_s *p = (http1pr_s *)protocol;
   ssize_t i;
 
-  i = fio_read(uuid, p->buf + p->buf_len, HTTP_MAX_HEADER_LENGTH - p->buf_len);
+  i = fio_read(uuid, p->buf + p->buf_len, p->buf_capa - p->buf_len);
 
   if (i <= 0)
     return;
@@ -797,7 +1225,10 @@ fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
           },
       .p.uuid = uuid,
       .p.settings = settings,
+      .buf = p->buf_inline,
+      .buf_capa = HTTP_MAX_HEADER_LENGTH,
       .max_header_size = settings->max_header_size,
+      .pipeline = HTTP1_PIPELINE_MIN,
       .is_client = settings->is_client,
   };
   http_s_new(&p->request, &p->p, &HTTP1_VTABLE);
@@ -816,7 +1247,12 @@ fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
 void http1_destroy(fio_protocol_s *pr) {
   http1pr_s *p = (http1pr_s *)pr;
   http1_pr2handle(p).status = 0;
+  if (p->stream_fallback)
+    p->stream_fallback(p->request.udata);
   http_s_destroy(&http1_pr2handle(p), 0);
+  fiobj_free(p->stream_pending);
+  if (p->buf != p->buf_inline)
+    fio_free(p->buf);
   fio_free(p);
   // FIO_LOG_DEBUG("Deallocated HTTP/1.1 protocol at. %p", (void *)p);
 }
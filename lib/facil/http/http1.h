@@ -15,6 +15,23 @@ License: MIT
 #define HTTP1_READ_BUFFER (8 * 1024) /* ~8kb */
 #endif
 
+#ifndef HTTP1_READ_BUFFER_LIMIT
+/**
+ * The maximal size of a connection's read buffer. Pipelining clients get a
+ * larger read buffer (up to this limit), sized by the observed request length.
+ */
+#define HTTP1_READ_BUFFER_LIMIT (64 * 1024) /* ~64kb */
+#endif
+
+#ifndef HTTP1_PIPELINE_LIMIT
+/**
+ * The maximal number of pipelined requests handled per `on_data` event. The
+ * per-connection depth starts at 8 and adapts to the client's behavior (the
+ * limit must be between 8 and 2^31 - 1).
+ */
+#define HTTP1_PIPELINE_LIMIT 256
+#endif
+
 /** Creates an HTTP1 protocol object and handles any unread data in the buffer
  * (if any). */
 fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
@@ -0,0 +1,436 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include <http_internal.h>
+
+#include <pthread.h>
+#include <string.h>
+
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+#if HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+/* the supported content encodings, in order of preference */
+typedef enum {
+  HTTP_ENCODING_IDENTITY = 0,
+  HTTP_ENCODING_GZIP = 1,
+  HTTP_ENCODING_BROTLI = 2,
+} http_encoding_e;
+
+/* *****************************************************************************
+Negotiation
+***************************************************************************** */
+
+/* returns true if responses of this type are worth compressing */
+static int http_compress_mime_test(fio_str_info_s t) {
+  if (!t.data || !t.len)
+    return 0;
+  char *end = memchr(t.data, ';', t.len);
+  if (end)
+    t.len = end - t.data;
+  if (t.len > 5 && !strncasecmp(t.data, "text/", 5))
+    return 1;
+  static const struct {
+    const char *str;
+    size_t len;
+  } types[] = {{"json", 4}, {"javascript", 10}, {"xml", 3}, {"wasm", 4}};
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+    for (size_t pos = 0; pos + types[i].len <= t.len; ++pos) {
+      if (!strncasecmp(t.data + pos, types[i].str, types[i].len))
+        return 1;
+    }
+  }
+  return 0;
+}
+
+/* returns the preferred encoding accepted by the client */
+static http_encoding_e http_compress_negotiate(fio_str_info_s accept) {
+  http_encoding_e ret = HTTP_ENCODING_IDENTITY;
+  const char *pos = accept.data;
+  const char *end = accept.data + accept.len;
+  while (pos < end) {
+    /* a token, its (optional) parameters and a comma */
+    while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == ','))
+      ++pos;
+    const char *token = pos;
+    while (pos < end && *pos != ',' && *pos != ';' && *pos != ' ')
+      ++pos;
+    const size_t token_len = pos - token;
+    uint8_t refused = 0;
+    while (pos < end && *pos != ',') {
+      if ((*pos == 'q' || *pos == 'Q') && pos + 2 < end && pos[1] == '=') {
+        /* q=0, q=0.0, q=0.00 and q=0.000 refuse the encoding */
+        const char *q = pos + 2;
+        refused = (*q == '0');
+        for (++q; refused && q < end && *q != ',' && *q != ' ' && *q != ';';
+             ++q)
+          refused = (*q == '.' || *q == '0');
+      }
+      ++pos;
+    }
+    if (refused)
+      continue;
+#if HAVE_BROTLI
+    if (token_len == 2 && !strncasecmp(token, "br", 2))
+      ret = HTTP_ENCODING_BROTLI;
+#endif
+#if HAVE_ZLIB
+    if (token_len == 4 && !strncasecmp(token, "gzip", 4) &&
+        ret < HTTP_ENCODING_GZIP)
+      ret = HTTP_ENCODING_GZIP;
+#endif
+    (void)token_len;
+  }
+  return ret;
+}
+
+/* *****************************************************************************
+Compression (reusable per-thread contexts)
+***************************************************************************** */
+
+#if HAVE_ZLIB
+static pthread_key_t http_gzip_key;
+static pthread_once_t http_gzip_once = PTHREAD_ONCE_INIT;
+
+static void http_gzip_free(void *s) {
+  deflateEnd(s);
+  free(s);
+}
+
+static void http_gzip_key_init(void) {
+  pthread_key_create(&http_gzip_key, http_gzip_free);
+}
+
+/* returns the thread's deflate stream, ready for a new gzip member */
+static z_stream *http_gzip_stream(void) {
+  pthread_once(&http_gzip_once, http_gzip_key_init);
+  z_stream *s = pthread_getspecific(http_gzip_key);
+  if (s) {
+    deflateReset(s);
+    return s;
+  }
+  s = calloc(1, sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  /* window bits + 16 selects the gzip wrapper */
+  if (deflateInit2(s, HTTP_COMPRESS_GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    free(s);
+    return NULL;
+  }
+  pthread_setspecific(http_gzip_key, s);
+  return s;
+}
+
+static FIOBJ http_gzip(void *data, uintptr_t length) {
+  z_stream *s = http_gzip_stream();
+  if (!s || length > UINT32_MAX)
+    return FIOBJ_INVALID;
+  FIOBJ out = fiobj_str_buf(deflateBound(s, length));
+  fio_str_info_s o = fiobj_obj2cstr(out);
+  s->next_in = data;
+  s->avail_in = length;
+  s->next_out = (Bytef *)o.data;
+  s->avail_out = o.capa;
+  if (deflate(s, Z_FINISH) != Z_STREAM_END) {
+    fiobj_free(out);
+    return FIOBJ_INVALID;
+  }
+  fiobj_str_resize(out, s->total_out);
+  return out;
+}
+#endif
+
+#if HAVE_BROTLI
+/* the one-shot encoder, Brotli has no API for resetting an encoder instance */
+static FIOBJ http_brotli(void *data, uintptr_t length) {
+  size_t len = BrotliEncoderMaxCompressedSize(length);
+  if (!len)
+    return FIOBJ_INVALID;
+  FIOBJ out = fiobj_str_buf(len);
+  if (!BrotliEncoderCompress(HTTP_COMPRESS_BROTLI_QUALITY,
+                             BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, length,
+                             data, &len,
+                             (uint8_t *)fiobj_obj2cstr(out).data)) {
+    fiobj_free(out);
+    return FIOBJ_INVALID;
+  }
+  fiobj_str_resize(out, len);
+  return out;
+}
+#endif
+
+static FIOBJ http_compress_data(http_encoding_e encoding, void *data,
+                                uintptr_t length) {
+  switch (encoding) {
+#if HAVE_ZLIB
+  case HTTP_ENCODING_GZIP:
+    return http_gzip(data, length);
+#endif
+#if HAVE_BROTLI
+  case HTTP_ENCODING_BROTLI:
+    return http_brotli(data, length);
+#endif
+  default:
+    (void)data;
+    (void)length;
+    return FIOBJ_INVALID;
+  }
+}
+
+/* *****************************************************************************
+Compressed Response Cache (LRU)
+***************************************************************************** */
+
+#if HTTP_COMPRESS_CACHE_LIMIT && (HAVE_ZLIB || HAVE_BROTLI)
+#define HTTP_COMPRESS_CACHE 1
+
+/*
+ * Identifies a response body: a keyed hash of its ETag (scoped by the request's
+ * host, path and query) or of its data, the body's length and its encoding.
+ */
+typedef struct {
+  uint64_t id;
+  uintptr_t length;
+  uintptr_t encoding;
+} http_compress_key_s;
+
+/* a compressed body and a copy of the original body (compared on every hit) */
+typedef struct {
+  FIOBJ original;
+  FIOBJ compressed;
+} http_compress_entry_s;
+
+#define FIO_FORCE_MALLOC_TMP 1 /* cache lifetime isn't related to a request */
+#define FIO_SET_NAME http_compress_cache_set
+#define FIO_SET_KEY_TYPE http_compress_key_s
+#define FIO_SET_KEY_COMPARE(k1, k2)                                            \
+  ((k1).id == (k2).id && (k1).length == (k2).length &&                         \
+   (k1).encoding == (k2).encoding)
+#define FIO_SET_OBJ_TYPE http_compress_entry_s
+#define FIO_SET_OBJ_COPY(dest, o)                                              \
+  ((dest) = (http_compress_entry_s){.original = fiobj_dup((o).original),       \
+                                    .compressed = fiobj_dup((o).compressed)})
+#define FIO_SET_OBJ_DESTROY(o)                                                 \
+  (fiobj_free((o).original), fiobj_free((o).compressed))
+#include <fio.h>
+
+/*
+ * The set's order is the insertion order, hits are moved to the end.
+ *
+ * The hashing key is random (per process), so collisions can't be crafted.
+ */
+static struct {
+  fio_lock_i lock;
+  uint64_t seed;
+  http_compress_cache_set_s set;
+} http_compress_cache = {.lock = FIO_LOCK_INIT};
+
+/* hashes data using the process's (random) key */
+static inline uint64_t http_compress_hash(const void *data, size_t len,
+                                          uint64_t id) {
+  return fio_risky_hash(data, len, http_compress_cache.seed ^ id);
+}
+
+/* returns the cached compressed body, only if the original body matches */
+static FIOBJ http_compress_cache_get(http_compress_key_s key, void *data) {
+  const uint64_t hash = key.id ^ key.encoding;
+  fio_lock(&http_compress_cache.lock);
+  http_compress_entry_s e = http_compress_cache_set_find(
+      &http_compress_cache.set, hash, key);
+  FIOBJ ret = FIOBJ_INVALID;
+  if (e.compressed &&
+      !memcmp(fiobj_obj2cstr(e.original).data, data, key.length)) {
+    ret = fiobj_dup(e.compressed);
+    /* mark as recently used */
+    e.original = fiobj_dup(e.original);
+    e.compressed = fiobj_dup(e.compressed);
+    http_compress_cache_set_remove(&http_compress_cache.set, hash, key, NULL);
+    http_compress_cache_set_insert(&http_compress_cache.set, hash, key, e,
+                                   NULL);
+    fiobj_free(e.original);
+    fiobj_free(e.compressed);
+  }
+  fio_unlock(&http_compress_cache.lock);
+  return ret;
+}
+
+static void http_compress_cache_add(http_compress_key_s key, void *data,
+                                    FIOBJ body) {
+  const uint64_t hash = key.id ^ key.encoding;
+  http_compress_entry_s e = {
+      .original = fiobj_str_new(data, key.length),
+      .compressed = body,
+  };
+  fio_lock(&http_compress_cache.lock);
+  /* evict the least recently used entry when the cache is full */
+  if (http_compress_cache_set_count(&http_compress_cache.set) >=
+      HTTP_COMPRESS_CACHE_LIMIT) {
+    FIO_SET_FOR_LOOP(&http_compress_cache.set, pos) {
+      if (!pos->hash)
+        continue;
+      http_compress_cache_set_remove(&http_compress_cache.set, pos->hash,
+                                     pos->obj.key, NULL);
+      break;
+    }
+  }
+  /* replaces any existing entry (i.e., a different body using the same key) */
+  http_compress_cache_set_insert(&http_compress_cache.set, hash, key, e, NULL);
+  fio_unlock(&http_compress_cache.lock);
+  fiobj_free(e.original);
+}
+
+static void http_compress_cache_clear(void *ignr_) {
+  fio_lock(&http_compress_cache.lock);
+  http_compress_cache_set_free(&http_compress_cache.set);
+  fio_unlock(&http_compress_cache.lock);
+  (void)ignr_;
+}
+
+static __attribute__((constructor)) void http_compress_constructor(void) {
+  http_compress_cache.seed = fio_rand64();
+  fio_state_callback_add(FIO_CALL_AT_EXIT, http_compress_cache_clear, NULL);
+}
+
+#else
+#define HTTP_COMPRESS_CACHE 0
+#endif
+
+/* *****************************************************************************
+The Compression Stage
+***************************************************************************** */
+
+/* tests if a `vary` header value lists `accept-encoding` */
+static int http_compress_vary_lists(FIOBJ vary) {
+  fio_str_info_s s = fiobj_obj2cstr(vary);
+  for (size_t i = 0; i + 15 <= s.len; ++i) {
+    if (!strncasecmp(s.data + i, "accept-encoding", 15))
+      return 1;
+  }
+  return 0;
+}
+
+/* sets `vary: accept-encoding` unless the header already lists it */
+static void http_compress_vary(http_s *h) {
+  static uint64_t vary_hash;
+  if (!vary_hash)
+    vary_hash = fiobj_hash_string("vary", 4);
+  FIOBJ vary = fiobj_hash_get2(h->private_data.out_headers, vary_hash);
+  if (FIOBJ_TYPE_IS(vary, FIOBJ_T_ARRAY)) {
+    /* multiple `vary` headers, adding one more is the same as a list */
+    for (size_t i = 0; i < fiobj_ary_count(vary); ++i) {
+      if (http_compress_vary_lists(fiobj_ary_index(vary, i)))
+        return;
+    }
+  } else if (vary) {
+    if (http_compress_vary_lists(vary))
+      return;
+    /* the value might be shared (or frozen), so a new String replaces it */
+    fio_str_info_s old = fiobj_obj2cstr(vary);
+    FIOBJ tmp = fiobj_str_buf(old.len + 17);
+    fiobj_str_write(tmp, old.data, old.len);
+    fiobj_str_write(tmp, ", accept-encoding", 17);
+    fiobj_hash_delete2(h->private_data.out_headers, vary_hash);
+    http_set_header2(h, (fio_str_info_s){.data = (char *)"vary", .len = 4},
+                     fiobj_obj2cstr(tmp));
+    fiobj_free(tmp);
+    return;
+  }
+  http_set_header2(h, (fio_str_info_s){.data = (char *)"vary", .len = 4},
+                   (fio_str_info_s){.data = (char *)"accept-encoding",
+                                    .len = 15});
+}
+
+/**
+ * Compresses a response body, if the client, the response's status and the
+ * response's content type allow for compression.
+ *
+ * Returns the compressed body (updating the headers) or FIOBJ_INVALID.
+ */
+FIOBJ http_compress______internal(http_s *h, void *data, uintptr_t length) {
+  static uint64_t accept_enc_hash;
+  if (!accept_enc_hash)
+    accept_enc_hash = fiobj_hash_string("accept-encoding", 15);
+  if (length < HTTP_COMPRESS_MIN_SIZE || h->status < 200 ||
+      h->status == 204 || h->status == 206 || h->status == 304)
+    return FIOBJ_INVALID;
+  FIOBJ out = h->private_data.out_headers;
+  if (fiobj_hash_get2(out, fiobj_obj2hash(HTTP_HEADER_CONTENT_ENCODING)) ||
+      !http_compress_mime_test(fiobj_obj2cstr(
+          fiobj_hash_get2(out, fiobj_obj2hash(HTTP_HEADER_CONTENT_TYPE)))))
+    return FIOBJ_INVALID;
+  {
+    fio_str_info_s cc = fiobj_obj2cstr(
+        fiobj_hash_get2(out, fiobj_obj2hash(HTTP_HEADER_CACHE_CONTROL)));
+    for (size_t i = 0; i + 12 <= cc.len; ++i) {
+      if (!strncasecmp(cc.data + i, "no-transform", 12))
+        return FIOBJ_INVALID;
+    }
+  }
+  /* the response depends on the `accept-encoding` header from here on */
+  http_compress_vary(h);
+  FIOBJ accept = fiobj_hash_get2(h->headers, accept_enc_hash);
+  if (!accept || !FIOBJ_TYPE_IS(accept, FIOBJ_T_STRING))
+    return FIOBJ_INVALID;
+  http_encoding_e encoding = http_compress_negotiate(fiobj_obj2cstr(accept));
+  if (encoding == HTTP_ENCODING_IDENTITY)
+    return FIOBJ_INVALID;
+
+  FIOBJ etag = fiobj_hash_get2(out, fiobj_obj2hash(HTTP_HEADER_ETAG));
+  FIOBJ body = FIOBJ_INVALID;
+#if HTTP_COMPRESS_CACHE
+  http_compress_key_s key = {.length = length, .encoding = encoding};
+  const uint8_t cache = (length <= HTTP_COMPRESS_CACHE_MAX_SIZE);
+  if (cache) {
+    if (etag) {
+      /* the same ETag might be used by different resources (or hosts) */
+      fio_str_info_s s = fiobj_obj2cstr(fiobj_hash_get2(
+          h->headers, fiobj_obj2hash(HTTP_HEADER_HOST)));
+      key.id = http_compress_hash(s.data, s.len, 1);
+      s = fiobj_obj2cstr(h->path);
+      key.id = http_compress_hash(s.data, s.len, key.id);
+      s = fiobj_obj2cstr(h->query);
+      key.id = http_compress_hash(s.data, s.len, key.id);
+      s = fiobj_obj2cstr(etag);
+      key.id = http_compress_hash(s.data, s.len, key.id);
+    } else {
+      key.id = http_compress_hash(data, length, 0);
+    }
+    body = http_compress_cache_get(key, data);
+  }
+  if (!body) {
+    body = http_compress_data(encoding, data, length);
+    if (!body || fiobj_obj2cstr(body).len >= length)
+      goto not_worth_it;
+    if (cache)
+      http_compress_cache_add(key, data, body);
+  }
+#else
+  body = http_compress_data(encoding, data, length);
+  if (!body || fiobj_obj2cstr(body).len >= length)
+    goto not_worth_it;
+#endif
+
+  fiobj_hash_set(out, HTTP_HEADER_CONTENT_ENCODING,
+                 encoding == HTTP_ENCODING_GZIP ? fiobj_dup(HTTP_HVALUE_GZIP)
+                                                : fiobj_str_new("br", 2));
+  if (etag && FIOBJ_TYPE_IS(etag, FIOBJ_T_STRING)) {
+    /* the compressed body is a different representation (weak ETag) */
+    fio_str_info_s s = fiobj_obj2cstr(etag);
+    if (s.len < 2 || s.data[0] != 'W' || s.data[1] != '/') {
+      FIOBJ weak = fiobj_str_buf(s.len + 2);
+      fiobj_str_write(weak, "W/", 2);
+      fiobj_str_write(weak, s.data, s.len);
+      fiobj_hash_set(out, HTTP_HEADER_ETAG, weak);
+    }
+  }
+  return body;
+not_worth_it:
+  fiobj_free(body);
+  return FIOBJ_INVALID;
+}
@@ -13,9 +13,9 @@ Internal Request / Response Handlers
 ***************************************************************************** */
 
 static uint64_t http_upgrade_hash = 0;
-/** Use this function to handle HTTP requests.*/
-void http_on_request_handler______internal(http_s *h,
-                                           http_settings_s *settings) {
+/* routes the request to the correct handler */
+static inline void http_on_request_dispatch(http_s *h,
+                                            http_settings_s *settings) {
   if (!http_upgrade_hash)
     http_upgrade_hash = fiobj_hash_string("upgrade", 7);
   h->udata = settings->udata;
@@ -42,14 +42,19 @@ void http_on_request_handler______internal(http_s *h,
           fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_ACCEPT)),
           HTTP_HVALUE_SSE_MIME))
     goto eventsource;
-  if (settings->public_folder) {
-    fio_str_info_s path_str = fiobj_obj2cstr(h->path);
-    if (!http_sendfile2(h, settings->public_folder,
-                        settings->public_folder_length, path_str.data,
-                        path_str.len)) {
+  if (settings->metrics_path) {
+    fio_str_info_s path = fiobj_obj2cstr(h->path);
+    if (path.len == http_settings2data(settings)->metrics_path_len &&
+        !memcmp(path.data, settings->metrics_path, path.len)) {
+      http_send_metrics(h);
       return;
     }
   }
+  if (settings->router && !http_router_route(settings->router, h))
+    return;
+  if (settings->public_folder &&
+      !http_static_serve______internal(h, settings))
+    return;
   settings->on_request(h);
   return;
 
@@ -74,6 +79,20 @@ missing_host:
   return;
 }
 
+/** Use this function to handle HTTP requests.*/
+void http_on_request_handler______internal(http_s *h,
+                                           http_settings_s *settings) {
+  if (!http_metrics_enabled) {
+    http_on_request_dispatch(h, settings);
+    return;
+  }
+  /* `h` might be invalid once the handler returns */
+  const uint64_t start = http_metrics_add(
+      HTTP_METRICS_QUEUE, http_metrics_ts2us(h->received_at));
+  http_on_request_dispatch(h, settings);
+  http_metrics_add(HTTP_METRICS_HANDLER, start);
+}
+
 void http_on_response_handler______internal(http_s *h,
                                             http_settings_s *settings) {
   if (!http_upgrade_hash)
@@ -124,10 +143,12 @@ FIOBJ HTTP_HEADER_HOST;
 FIOBJ HTTP_HEADER_LAST_MODIFIED;
 FIOBJ HTTP_HEADER_ORIGIN;
 FIOBJ HTTP_HEADER_SET_COOKIE;
+FIOBJ HTTP_HEADER_TRANSFER_ENCODING;
 FIOBJ HTTP_HEADER_UPGRADE;
 FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 FIOBJ HTTP_HEADER_WS_SEC_KEY;
 FIOBJ HTTP_HVALUE_BYTES;
+FIOBJ HTTP_HVALUE_CHUNKED;
 FIOBJ HTTP_HVALUE_CLOSE;
 FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
 FIOBJ HTTP_HVALUE_GZIP;
@@ -140,10 +161,169 @@ FIOBJ HTTP_HVALUE_WS_SEC_VERSION;
 FIOBJ HTTP_HVALUE_WS_UPGRADE;
 FIOBJ HTTP_HVALUE_WS_VERSION;
 
+/* *****************************************************************************
+Interned header names
+***************************************************************************** */
+
+/*
+ * A perfect hash for the (lowercase) header names listed below, using the
+ * length and 3 characters. Adding a name might require new multipliers (the
+ * table's initialization will fail if a collision occurs).
+ */
+#define HTTP_HEADER_NAME_HASH(name, len)                                       \
+  (((len)*7 + (uint8_t)(name)[0] * 20 + (uint8_t)(name)[(len)-1] * 6 +        \
+    (uint8_t)(name)[(len)-2]) &                                                \
+   255)
+
+static FIOBJ http_header_names[256];
+
+/**
+ * Returns the interned (frozen and pre-hashed) header name object matching the
+ * lowercase `name`, or FIOBJ_INVALID if the header name isn't a common one.
+ *
+ * The object is owned by the HTTP library (`fiobj_dup` to keep it).
+ */
+FIOBJ http_header_name_interned(const char *name, size_t len) {
+  if (len < 2)
+    return FIOBJ_INVALID;
+  FIOBJ n = http_header_names[HTTP_HEADER_NAME_HASH(name, len)];
+  if (!n)
+    return FIOBJ_INVALID;
+  fio_str_info_s s = fiobj_obj2cstr(n);
+  if (s.len != len || memcmp(s.data, name, len))
+    return FIOBJ_INVALID;
+  return n;
+}
+
+static void http_header_names_add(FIOBJ name) {
+  fio_str_info_s s = fiobj_obj2cstr(name);
+  FIOBJ *pos = http_header_names + HTTP_HEADER_NAME_HASH(s.data, s.len);
+  if (*pos) {
+    FIO_ASSERT(fiobj_iseq(*pos, name),
+               "(HTTP) header name hash collision (%s vs. %s)", s.data,
+               fiobj_obj2cstr(*pos).data);
+    fiobj_free(name);
+    return;
+  }
+  fiobj_str_freeze(name);
+  fiobj_obj2hash(name);
+  *pos = name;
+}
+
+static void http_header_names_init(void) {
+  static const char *names[] = {"accept",
+                                "accept-charset",
+                                "accept-encoding",
+                                "accept-language",
+                                "accept-ranges",
+                                "access-control-request-headers",
+                                "access-control-request-method",
+                                "age",
+                                "authorization",
+                                "cache-control",
+                                "connection",
+                                "content-disposition",
+                                "content-encoding",
+                                "content-language",
+                                "content-length",
+                                "content-location",
+                                "content-range",
+                                "content-type",
+                                "cookie",
+                                "date",
+                                "dnt",
+                                "etag",
+                                "expect",
+                                "expires",
+                                "forwarded",
+                                "from",
+                                "host",
+                                "if-match",
+                                "if-modified-since",
+                                "if-none-match",
+                                "if-range",
+                                "if-unmodified-since",
+                                "keep-alive",
+                                "last-modified",
+                                "link",
+                                "location",
+                                "origin",
+                                "pragma",
+                                "proxy-authorization",
+                                "range",
+                                "referer",
+                                "retry-after",
+                                "sec-fetch-dest",
+                                "sec-fetch-mode",
+                                "sec-fetch-site",
+                                "sec-fetch-user",
+                                "sec-websocket-accept",
+                                "sec-websocket-extensions",
+                                "sec-websocket-key",
+                                "sec-websocket-protocol",
+                                "sec-websocket-version",
+                                "server",
+                                "set-cookie",
+                                "strict-transport-security",
+                                "te",
+                                "trailer",
+                                "transfer-encoding",
+                                "upgrade",
+                                "upgrade-insecure-requests",
+                                "user-agent",
+                                "vary",
+                                "via",
+                                "www-authenticate",
+                                "x-forwarded-for",
+                                "x-forwarded-host",
+                                "x-forwarded-proto",
+                                "x-real-ip",
+                                "x-request-id",
+                                "x-requested-with",
+                                NULL};
+  /* existing header name constants are shared (rather than duplicated) */
+  http_header_names_add(fiobj_dup(HTTP_HEADER_ACCEPT));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_ACCEPT_RANGES));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_CACHE_CONTROL));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_CONNECTION));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_CONTENT_ENCODING));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_CONTENT_LENGTH));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_CONTENT_RANGE));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_CONTENT_TYPE));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_COOKIE));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_DATE));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_ETAG));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_HOST));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_LAST_MODIFIED));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_ORIGIN));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_SET_COOKIE));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_TRANSFER_ENCODING));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_UPGRADE));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_WS_SEC_CLIENT_KEY));
+  http_header_names_add(fiobj_dup(HTTP_HEADER_WS_SEC_KEY));
+  http_header_names_add(fiobj_dup(HTTP_HVALUE_WS_SEC_VERSION));
+  for (size_t i = 0; names[i]; ++i) {
+    http_header_names_add(fiobj_str_new(names[i], strlen(names[i])));
+  }
+}
+
+static void http_header_names_clear(void) {
+  for (size_t i = 0; i < 256; ++i) {
+    fiobj_free(http_header_names[i]);
+    http_header_names[i] = FIOBJ_INVALID;
+  }
+}
+
+/* *****************************************************************************
+Library state callbacks
+***************************************************************************** */
+
 static void http_lib_init(void *ignr_);
 static void http_lib_cleanup(void *ignr_);
+void http_file_watch_on_fork(void *ignr_);
 static __attribute__((constructor)) void http_lib_constructor(void) {
   fio_state_callback_add(FIO_CALL_ON_INITIALIZE, http_lib_init, NULL);
+  fio_state_callback_add(FIO_CALL_IN_CHILD, http_file_watch_on_fork, NULL);
   fio_state_callback_add(FIO_CALL_AT_EXIT, http_lib_cleanup, NULL);
 }
 
@@ -152,6 +332,7 @@ void http_mimetype_stats(void);
 static void http_lib_cleanup(void *ignr_) {
   (void)ignr_;
   http_mimetype_clear();
+  http_header_names_clear();
 #define HTTPLIB_RESET(x)                                                       \
   fiobj_free(x);                                                               \
   x = FIOBJ_INVALID;
@@ -170,10 +351,12 @@ static void http_lib_cleanup(void *ignr_) {
   HTTPLIB_RESET(HTTP_HEADER_LAST_MODIFIED);
   HTTPLIB_RESET(HTTP_HEADER_ORIGIN);
   HTTPLIB_RESET(HTTP_HEADER_SET_COOKIE);
+  HTTPLIB_RESET(HTTP_HEADER_TRANSFER_ENCODING);
   HTTPLIB_RESET(HTTP_HEADER_UPGRADE);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_CLIENT_KEY);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_KEY);
   HTTPLIB_RESET(HTTP_HVALUE_BYTES);
+  HTTPLIB_RESET(HTTP_HVALUE_CHUNKED);
   HTTPLIB_RESET(HTTP_HVALUE_CLOSE);
   HTTPLIB_RESET(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
   HTTPLIB_RESET(HTTP_HVALUE_GZIP);
@@ -211,10 +394,12 @@ static void http_lib_init(void *ignr_) {
   HTTP_HEADER_LAST_MODIFIED = fiobj_str_new("last-modified", 13);
   HTTP_HEADER_ORIGIN = fiobj_str_new("origin", 6);
   HTTP_HEADER_SET_COOKIE = fiobj_str_new("set-cookie", 10);
+  HTTP_HEADER_TRANSFER_ENCODING = fiobj_str_new("transfer-encoding", 17);
   HTTP_HEADER_UPGRADE = fiobj_str_new("upgrade", 7);
   HTTP_HEADER_WS_SEC_CLIENT_KEY = fiobj_str_new("sec-websocket-key", 17);
   HTTP_HEADER_WS_SEC_KEY = fiobj_str_new("sec-websocket-accept", 20);
   HTTP_HVALUE_BYTES = fiobj_str_new("bytes", 5);
+  HTTP_HVALUE_CHUNKED = fiobj_str_new("chunked", 7);
   HTTP_HVALUE_CLOSE = fiobj_str_new("close", 5);
   HTTP_HVALUE_CONTENT_TYPE_DEFAULT =
       fiobj_str_new("application/octet-stream", 24);
@@ -242,10 +427,12 @@ static void http_lib_init(void *ignr_) {
   fiobj_obj2hash(HTTP_HEADER_LAST_MODIFIED);
   fiobj_obj2hash(HTTP_HEADER_ORIGIN);
   fiobj_obj2hash(HTTP_HEADER_SET_COOKIE);
+  fiobj_obj2hash(HTTP_HEADER_TRANSFER_ENCODING);
   fiobj_obj2hash(HTTP_HEADER_UPGRADE);
   fiobj_obj2hash(HTTP_HEADER_WS_SEC_CLIENT_KEY);
   fiobj_obj2hash(HTTP_HEADER_WS_SEC_KEY);
   fiobj_obj2hash(HTTP_HVALUE_BYTES);
+  fiobj_obj2hash(HTTP_HVALUE_CHUNKED);
   fiobj_obj2hash(HTTP_HVALUE_CLOSE);
   fiobj_obj2hash(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
   fiobj_obj2hash(HTTP_HVALUE_GZIP);
@@ -258,6 +445,8 @@ static void http_lib_init(void *ignr_) {
   fiobj_obj2hash(HTTP_HVALUE_WS_UPGRADE);
   fiobj_obj2hash(HTTP_HVALUE_WS_VERSION);
 
+  http_header_names_init();
+
 #define REGISTER_MIME(ext, type)                                               \
   http_mimetype_register((char *)ext, sizeof(ext) - 1,                         \
                          fiobj_str_new((char *)type, sizeof(type) - 1))
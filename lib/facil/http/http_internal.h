@@ -25,14 +25,31 @@ Types
 typedef struct http_fio_protocol_s http_fio_protocol_s;
 typedef struct http_vtable_s http_vtable_s;
 
+/** a byte range of a file (see `http_sendfile_ranges`) */
+typedef struct {
+  uintptr_t offset;
+  uintptr_t length;
+} http_range_s;
+
 struct http_vtable_s {
   /** Should send existing headers and data */
   int (*const http_send_body)(http_s *h, void *data, uintptr_t length);
   /** Should send existing headers and file */
   int (*const http_sendfile)(http_s *h, int fd, uintptr_t length,
                              uintptr_t offset);
+  /**
+   * Should send existing headers and the file's ranges, each range preceded by
+   * the matching `parts` string and followed by `parts[count]`. MUST free the
+   * `parts` strings and close the file.
+   */
+  int (*const http_sendfile_ranges)(http_s *h, int fd, http_range_s *ranges,
+                                    FIOBJ *parts, size_t count);
   /** Should send existing headers and data and prepare for streaming */
-  int (*const http_stream)(http_s *h, void *data, uintptr_t length);
+  int (*const http_stream)(http_s *h, void *data, uintptr_t length,
+                           void (*dealloc)(void *));
+  /** Should call `task` once the streamed data was (mostly) sent. */
+  void (*const http_stream_wait)(http_s *h, void (*task)(http_s *h),
+                                 void (*fallback)(void *udata));
   /** Should send existing headers or complete streaming */
   void (*const http_finish)(http_s *h);
   /** Push for data. */
@@ -71,9 +88,11 @@ Constants that shouldn't be accessed by the users (`fiobj_dup` required).
 ***************************************************************************** */
 
 extern FIOBJ HTTP_HEADER_ACCEPT_RANGES;
+extern FIOBJ HTTP_HEADER_TRANSFER_ENCODING;
 extern FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 extern FIOBJ HTTP_HEADER_WS_SEC_KEY;
 extern FIOBJ HTTP_HVALUE_BYTES;
+extern FIOBJ HTTP_HVALUE_CHUNKED;
 extern FIOBJ HTTP_HVALUE_CLOSE;
 extern FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
 extern FIOBJ HTTP_HVALUE_GZIP;
@@ -86,6 +105,14 @@ extern FIOBJ HTTP_HVALUE_WS_SEC_VERSION;
 extern FIOBJ HTTP_HVALUE_WS_UPGRADE;
 extern FIOBJ HTTP_HVALUE_WS_VERSION;
 
+/**
+ * Returns the interned (frozen and pre-hashed) header name object matching the
+ * lowercase `name`, or FIOBJ_INVALID if the header name isn't a common one.
+ *
+ * The object is owned by the HTTP library (`fiobj_dup` to keep it).
+ */
+FIOBJ http_header_name_interned(const char *name, size_t len);
+
 /* *****************************************************************************
 HTTP request/response object management
 ***************************************************************************** */
@@ -148,6 +175,146 @@ void http_on_response_handler______internal(http_s *h,
                                             http_settings_s *settings);
 int http_send_error2(size_t error, intptr_t uuid, http_settings_s *settings);
 
+/**
+ * Compresses a response body (if allowed), updating the response headers.
+ *
+ * Returns the compressed body or FIOBJ_INVALID (the body isn't compressed).
+ */
+FIOBJ http_compress______internal(http_s *h, void *data, uintptr_t length);
+
+/* *****************************************************************************
+Internal Settings Data
+***************************************************************************** */
+
+typedef struct http_manifest_s http_manifest_s;
+
+/* internal data, allocated after the settings (`http_settings_new`) */
+typedef struct {
+  /** client: the HTTP/1.1 protocol's `on_close`, wrapped by the client. */
+  void (*on_close)(intptr_t uuid, fio_protocol_s *protocol);
+  /** client: the pool's key - (host, port, TLS settings) - if pooled. */
+  FIOBJ origin;
+  /** client: the address and port, to connect if a pooled connection fails. */
+  FIOBJ address;
+  FIOBJ port;
+  /** server: the `public_folder` manifest (NULL if unavailable). */
+  http_manifest_s *manifest;
+  /** server: the length of the `metrics_path` string. */
+  size_t metrics_path_len;
+} http_settings_data_s;
+
+#define http_settings2data(settings)                                           \
+  ((http_settings_data_s *)((http_settings_s *)(settings) + 1))
+
+/* *****************************************************************************
+Client Connections
+***************************************************************************** */
+
+/**
+ * Parks an idle client connection in the connection pool (if possible), after
+ * a response was handled.
+ */
+void http_client_park______internal(intptr_t uuid, http_settings_s *settings);
+
+/* *****************************************************************************
+Latency Metrics
+***************************************************************************** */
+
+/* log-linear buckets: 8 sub-buckets for each power of 2, up to 2^32 µs */
+#define HTTP_HISTOGRAM_SUB_BITS 3
+#define HTTP_HISTOGRAM_BUCKETS                                                 \
+  ((32 - HTTP_HISTOGRAM_SUB_BITS + 1) << HTTP_HISTOGRAM_SUB_BITS)
+
+/* a latency histogram, values are in microseconds */
+typedef struct {
+  volatile uint64_t buckets[HTTP_HISTOGRAM_BUCKETS];
+  volatile uint64_t sum;
+} http_histogram_s;
+
+/* the request phases measured for every request (per thread histograms) */
+typedef enum {
+  HTTP_METRICS_QUEUE,   /* from `received_at` until the handler was called */
+  HTTP_METRICS_HANDLER, /* the time spent in the handler */
+  HTTP_METRICS_DRAIN,   /* from sending the response until it was written */
+  HTTP_METRICS_PHASES,
+} http_metrics_phase_e;
+
+/* set once a listener requested metrics (see `metrics_path`) */
+extern volatile uint8_t http_metrics_enabled;
+
+/* the current time, in microseconds */
+static inline uint64_t http_metrics_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_REALTIME, &t);
+  return ((uint64_t)t.tv_sec * 1000000) + ((uint64_t)t.tv_nsec / 1000);
+}
+
+/* converts a timestamp (i.e., `received_at`) to microseconds */
+static inline uint64_t http_metrics_ts2us(struct timespec t) {
+  return ((uint64_t)t.tv_sec * 1000000) + ((uint64_t)t.tv_nsec / 1000);
+}
+
+/** Starts collecting metrics (called by `http_settings_new`). */
+void http_metrics_start(void);
+
+/**
+ * Adds the time passed `since` (microseconds) to the calling thread's phase
+ * histogram (no locks or atomic operations). Returns the current time.
+ */
+uint64_t http_metrics_add(http_metrics_phase_e phase, uint64_t since);
+
+/** Adds a value to a shared histogram (atomic, lock free). */
+void http_histogram_add(http_histogram_s *h, uint64_t us);
+
+/**
+ * Registers a shared histogram as a metric, i.e. `name` is
+ * "http_route_handler_seconds" and `labels` is `method="GET",route="/"`.
+ */
+void http_metrics_register(const char *name, fio_str_info_s labels,
+                           http_histogram_s *h);
+
+/** Unregisters a shared histogram. */
+void http_metrics_unregister(http_histogram_s *h);
+
+/* *****************************************************************************
+Static Files
+***************************************************************************** */
+
+/**
+ * Creates a manifest of the `public_folder`'s files (see `http_settings_new`).
+ *
+ * Returns NULL if a manifest isn't available (i.e., too many files).
+ */
+http_manifest_s *http_manifest_new(const char *folder, size_t len);
+
+/** Frees the manifest (a reference may be held by the file system watcher). */
+void http_manifest_free(http_manifest_s *m);
+
+/**
+ * Serves a static file from the `public_folder`, possibly from memory.
+ *
+ * Returns -1 (no file system access) if the path isn't a static file.
+ */
+int http_static_serve______internal(http_s *h, http_settings_s *settings);
+
+/* *****************************************************************************
+Request Routing
+***************************************************************************** */
+
+/**
+ * Builds the router's tree, adding a reference (even on error). Returns -1 on
+ * error.
+ */
+int http_router_build(http_router_s *r);
+
+/** Routes the request. Returns -1 if no route matched the request. */
+int http_router_route(http_router_s *r, http_s *h);
+
+#if DEBUG
+/** Tests the request router (called by `http_tests`). */
+void http_router_test(void);
+#endif
+
 /* *****************************************************************************
 EventSource Support (SSE)
 ***************************************************************************** */
@@ -0,0 +1,461 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include <http_internal.h>
+
+#include <string.h>
+#include <unistd.h>
+
+/* the pub/sub filter used by worker processes to share their metrics */
+#define HTTP_METRICS_FILTER (-3)
+
+/* workers that stopped sharing their metrics are forgotten (microseconds) */
+#define HTTP_METRICS_PEER_TIMEOUT ((uint64_t)HTTP_METRICS_INTERVAL * 3000)
+
+volatile uint8_t http_metrics_enabled;
+
+/* *****************************************************************************
+Histograms
+***************************************************************************** */
+
+#define HTTP_HISTOGRAM_SUB (1 << HTTP_HISTOGRAM_SUB_BITS)
+
+/* returns the bucket for a value (values above 2^32 µs are clamped) */
+static inline size_t http_histogram_index(uint64_t us) {
+  if (us < HTTP_HISTOGRAM_SUB)
+    return (size_t)us;
+  if (us >> 32)
+    us = 0xFFFFFFFFULL;
+  const size_t msb = 63 - __builtin_clzll(us);
+  return ((msb - HTTP_HISTOGRAM_SUB_BITS + 1) << HTTP_HISTOGRAM_SUB_BITS) +
+         ((us >> (msb - HTTP_HISTOGRAM_SUB_BITS)) & (HTTP_HISTOGRAM_SUB - 1));
+}
+
+/* returns the bucket's upper bound (exclusive) */
+static inline uint64_t http_histogram_limit(size_t i) {
+  if (i < HTTP_HISTOGRAM_SUB)
+    return i + 1;
+  const size_t shift = (i >> HTTP_HISTOGRAM_SUB_BITS) - 1;
+  return ((uint64_t)(HTTP_HISTOGRAM_SUB + (i & (HTTP_HISTOGRAM_SUB - 1))) + 1)
+         << shift;
+}
+
+/** Adds a value to a shared histogram (atomic, lock free). */
+void http_histogram_add(http_histogram_s *h, uint64_t us) {
+  fio_atomic_add(h->buckets + http_histogram_index(us), 1);
+  fio_atomic_add(&h->sum, us);
+}
+
+static void http_histogram_merge(http_histogram_s *dest,
+                                 http_histogram_s *src) {
+  for (size_t i = 0; i < HTTP_HISTOGRAM_BUCKETS; ++i)
+    dest->buckets[i] += src->buckets[i];
+  dest->sum += src->sum;
+}
+
+/* *****************************************************************************
+Metrics Registry
+***************************************************************************** */
+
+/* each thread records the request phases without locks or atomic operations */
+typedef struct http_metrics_thread_s {
+  struct http_metrics_thread_s *next;
+  http_histogram_s phases[HTTP_METRICS_PHASES];
+} http_metrics_thread_s;
+
+/* a shared histogram (i.e., a route's handler time) */
+typedef struct {
+  FIOBJ key; /* "name{labels}" */
+  http_histogram_s *h;
+} http_metrics_series_s;
+
+/* a worker process' latest metrics */
+typedef struct {
+  FIOBJ data;
+  uint64_t received; /* `http_metrics_now` */
+} http_metrics_peer_s;
+
+/* the latest metrics of the other worker processes, by process id */
+#define FIO_FORCE_MALLOC_TMP 1
+#define FIO_SET_NAME http_metrics_peer_set
+#define FIO_SET_OBJ_TYPE http_metrics_peer_s
+#define FIO_SET_OBJ_COMPARE(o1, o2) (1)
+#define FIO_SET_OBJ_COPY(dest, o) ((dest) = (o), fiobj_dup((o).data))
+#define FIO_SET_OBJ_DESTROY(o) fiobj_free((o).data)
+#include <fio.h>
+
+/* metrics, aggregated by key (for the cluster's metrics) */
+#define FIO_FORCE_MALLOC_TMP 1
+#define FIO_SET_NAME http_metrics_agg_set
+#define FIO_SET_KEY_TYPE FIOBJ
+#define FIO_SET_KEY_COMPARE(k1, k2) fiobj_iseq((k1), (k2))
+#define FIO_SET_KEY_COPY(dest, k) ((dest) = fiobj_dup((k)))
+#define FIO_SET_KEY_DESTROY(k) fiobj_free((k))
+#define FIO_SET_OBJ_TYPE http_histogram_s *
+#define FIO_SET_OBJ_DESTROY(o) free((o))
+#include <fio.h>
+
+static struct {
+  fio_lock_i lock;
+  http_metrics_thread_s *threads;
+  http_metrics_series_s *series;
+  size_t count;
+  size_t capa;
+  http_metrics_peer_set_s peers;
+} http_metrics = {.lock = FIO_LOCK_INIT};
+
+static __thread http_metrics_thread_s *http_metrics_local;
+
+/* the phase histograms, in `http_metrics_phase_e` order */
+static const char *http_metrics_phase_names[] = {
+    "http_request_queue_seconds",
+    "http_request_handler_seconds",
+    "http_response_drain_seconds",
+};
+
+static http_metrics_thread_s *http_metrics_thread_new(void) {
+  http_metrics_thread_s *t = calloc(1, sizeof(*t));
+  FIO_ASSERT_ALLOC(t);
+  fio_lock(&http_metrics.lock);
+  t->next = http_metrics.threads;
+  http_metrics.threads = t;
+  fio_unlock(&http_metrics.lock);
+  http_metrics_local = t;
+  return t;
+}
+
+/**
+ * Adds the time passed `since` (microseconds) to the calling thread's phase
+ * histogram (no locks or atomic operations). Returns the current time.
+ */
+uint64_t http_metrics_add(http_metrics_phase_e phase, uint64_t since) {
+  const uint64_t now = http_metrics_now();
+  const uint64_t us = (now > since) ? now - since : 0;
+  http_metrics_thread_s *t = http_metrics_local;
+  if (!t)
+    t = http_metrics_thread_new();
+  ++t->phases[phase].buckets[http_histogram_index(us)];
+  t->phases[phase].sum += us;
+  return now;
+}
+
+/** Registers a shared histogram as a metric. */
+void http_metrics_register(const char *name, fio_str_info_s labels,
+                           http_histogram_s *h) {
+  FIOBJ key = fiobj_str_buf(strlen(name) + labels.len + 2);
+  fiobj_str_printf(key, "%s{%.*s}", name, (int)labels.len, labels.data);
+  fio_lock(&http_metrics.lock);
+  if (http_metrics.count == http_metrics.capa) {
+    http_metrics.capa = http_metrics.capa ? http_metrics.capa << 1 : 32;
+    http_metrics.series = realloc(
+        http_metrics.series, sizeof(*http_metrics.series) * http_metrics.capa);
+    FIO_ASSERT_ALLOC(http_metrics.series);
+  }
+  http_metrics.series[http_metrics.count++] =
+      (http_metrics_series_s){.key = key, .h = h};
+  fio_unlock(&http_metrics.lock);
+}
+
+/** Unregisters a shared histogram. */
+void http_metrics_unregister(http_histogram_s *h) {
+  fio_lock(&http_metrics.lock);
+  for (size_t i = 0; i < http_metrics.count; ++i) {
+    if (http_metrics.series[i].h != h)
+      continue;
+    fiobj_free(http_metrics.series[i].key);
+    http_metrics.series[i] = http_metrics.series[--http_metrics.count];
+    break;
+  }
+  if (!http_metrics.count) {
+    free(http_metrics.series);
+    http_metrics.series = NULL;
+    http_metrics.capa = 0;
+  }
+  fio_unlock(&http_metrics.lock);
+}
+
+/* returns the key's aggregated histogram, creating it if missing */
+static http_histogram_s *http_metrics_agg(http_metrics_agg_set_s *agg,
+                                          FIOBJ key) {
+  const uint64_t hash = fiobj_obj2hash(key);
+  http_histogram_s *h = http_metrics_agg_set_find(agg, hash, key);
+  if (!h) {
+    h = calloc(1, sizeof(*h));
+    FIO_ASSERT_ALLOC(h);
+    http_metrics_agg_set_insert(agg, hash, key, h, NULL);
+  }
+  return h;
+}
+
+/* aggregates the metrics collected by this process */
+static void http_metrics_collect(http_metrics_agg_set_s *agg) {
+  fio_lock(&http_metrics.lock);
+  for (size_t i = 0; i < HTTP_METRICS_PHASES; ++i) {
+    FIOBJ key = fiobj_str_buf(64);
+    fiobj_str_printf(key, "%s{}", http_metrics_phase_names[i]);
+    http_histogram_s *h = http_metrics_agg(agg, key);
+    fiobj_free(key);
+    for (http_metrics_thread_s *t = http_metrics.threads; t; t = t->next)
+      http_histogram_merge(h, t->phases + i);
+  }
+  for (size_t i = 0; i < http_metrics.count; ++i)
+    http_histogram_merge(http_metrics_agg(agg, http_metrics.series[i].key),
+                         http_metrics.series[i].h);
+  fio_unlock(&http_metrics.lock);
+}
+
+/* *****************************************************************************
+Sharing Metrics Between Worker Processes
+***************************************************************************** */
+
+/*
+ * A process' metrics are a process id followed by histograms:
+ * [u16 key length][key][u64 sum][u16 non-zero buckets]([u16 bucket][u64 n])*
+ */
+
+static void http_metrics_write(FIOBJ dest, void *data, size_t len) {
+  fiobj_str_write(dest, (char *)data, len);
+}
+
+static FIOBJ http_metrics_encode(http_metrics_agg_set_s *agg) {
+  FIOBJ msg = fiobj_str_buf(4096);
+  int32_t pid = (int32_t)getpid();
+  http_metrics_write(msg, &pid, sizeof(pid));
+  FIO_SET_FOR_LOOP(agg, pos) {
+    if (!pos->hash)
+      continue;
+    http_histogram_s *h = pos->obj.obj;
+    fio_str_info_s k = fiobj_obj2cstr(pos->obj.key);
+    uint16_t u16 = (uint16_t)k.len;
+    uint64_t u64 = h->sum;
+    http_metrics_write(msg, &u16, sizeof(u16));
+    http_metrics_write(msg, k.data, u16);
+    http_metrics_write(msg, &u64, sizeof(u64));
+    u16 = 0;
+    for (size_t i = 0; i < HTTP_HISTOGRAM_BUCKETS; ++i)
+      u16 += (h->buckets[i] != 0);
+    http_metrics_write(msg, &u16, sizeof(u16));
+    for (uint16_t i = 0; i < HTTP_HISTOGRAM_BUCKETS; ++i) {
+      if (!h->buckets[i])
+        continue;
+      u64 = h->buckets[i];
+      http_metrics_write(msg, &i, sizeof(i));
+      http_metrics_write(msg, &u64, sizeof(u64));
+    }
+  }
+  return msg;
+}
+
+/* adds a process' metrics to the aggregated metrics */
+static void http_metrics_decode(http_metrics_agg_set_s *agg, FIOBJ msg) {
+  fio_str_info_s s = fiobj_obj2cstr(msg);
+  const char *pos = s.data + sizeof(int32_t);
+  const char *end = s.data + s.len;
+  while (pos + sizeof(uint16_t) <= end) {
+    uint16_t u16, count;
+    uint64_t u64;
+    memcpy(&u16, pos, sizeof(u16));
+    pos += sizeof(u16);
+    if (pos + u16 + sizeof(u64) + sizeof(count) > end)
+      break;
+    FIOBJ key = fiobj_str_new(pos, u16);
+    pos += u16;
+    http_histogram_s *h = http_metrics_agg(agg, key);
+    fiobj_free(key); /* the aggregated metrics keep a reference */
+    memcpy(&u64, pos, sizeof(u64));
+    pos += sizeof(u64);
+    h->sum += u64;
+    memcpy(&count, pos, sizeof(count));
+    pos += sizeof(count);
+    if (pos + ((sizeof(u16) + sizeof(u64)) * count) > end)
+      break;
+    while (count--) {
+      memcpy(&u16, pos, sizeof(u16));
+      memcpy(&u64, pos + sizeof(u16), sizeof(u64));
+      pos += sizeof(u16) + sizeof(u64);
+      if (u16 < HTTP_HISTOGRAM_BUCKETS)
+        h->buckets[u16] += u64;
+    }
+  }
+}
+
+/* forgets workers that stopped sharing their metrics (i.e., they exited) */
+static void http_metrics_peers_expire(uint64_t now) {
+  FIO_SET_FOR_LOOP(&http_metrics.peers, pos) {
+    if (pos->hash && now > pos->obj.received + HTTP_METRICS_PEER_TIMEOUT)
+      http_metrics_peer_set_remove(&http_metrics.peers, pos->hash, pos->obj,
+                                   NULL);
+  }
+}
+
+static void http_metrics_on_message(fio_msg_s *msg) {
+  int32_t pid;
+  if (msg->msg.len < sizeof(pid))
+    return;
+  memcpy(&pid, msg->msg.data, sizeof(pid));
+  http_metrics_peer_s peer = {
+      .data = fiobj_str_new(msg->msg.data, msg->msg.len),
+      .received = http_metrics_now(),
+  };
+  fio_lock(&http_metrics.lock);
+  http_metrics_peers_expire(peer.received);
+  http_metrics_peer_set_overwrite(&http_metrics.peers, (uint64_t)pid, peer,
+                                  NULL);
+  fio_unlock(&http_metrics.lock);
+  fiobj_free(peer.data);
+}
+
+static void http_metrics_publish(void *ignr_) {
+  http_metrics_agg_set_s agg = FIO_SET_INIT;
+  http_metrics_collect(&agg);
+  FIOBJ msg = http_metrics_encode(&agg);
+  http_metrics_agg_set_free(&agg);
+  fio_publish(.engine = FIO_PUBSUB_SIBLINGS, .filter = HTTP_METRICS_FILTER,
+              .message = fiobj_obj2cstr(msg));
+  fiobj_free(msg);
+  (void)ignr_;
+}
+
+/* worker processes share their metrics (the root process doesn't serve) */
+static void http_metrics_on_start(void *ignr_) {
+  if (fio_is_master())
+    return;
+  fio_subscribe(.filter = HTTP_METRICS_FILTER,
+                .on_message = http_metrics_on_message);
+  fio_run_every(HTTP_METRICS_INTERVAL, 0, http_metrics_publish, NULL, NULL);
+  (void)ignr_;
+}
+
+/* frees the per-thread histograms and the workers' metrics */
+static void http_metrics_on_exit(void *ignr_) {
+  fio_lock(&http_metrics.lock);
+  http_metrics_thread_s *t = http_metrics.threads;
+  http_metrics.threads = NULL;
+  http_metrics_peer_set_free(&http_metrics.peers);
+  fio_unlock(&http_metrics.lock);
+  http_metrics_local = NULL; /* the other threads already exited */
+  while (t) {
+    http_metrics_thread_s *tmp = t;
+    t = t->next;
+    free(tmp);
+  }
+  (void)ignr_;
+}
+
+/** Starts collecting metrics (called by `http_settings_new`). */
+void http_metrics_start(void) {
+  if (fio_atomic_xchange(&http_metrics_enabled, 1))
+    return;
+  fio_state_callback_add(FIO_CALL_AT_EXIT, http_metrics_on_exit, NULL);
+  if (fio_is_running()) {
+    /* `http_listen` was called by a running server, ON_START already passed */
+    http_metrics_on_start(NULL);
+    return;
+  }
+  fio_state_callback_add(FIO_CALL_ON_START, http_metrics_on_start, NULL);
+}
+
+/* *****************************************************************************
+The Prometheus Text Format
+***************************************************************************** */
+
+/* the exported buckets (`le`), in microseconds */
+static const uint64_t http_metrics_bounds[] = {
+    100,     250,     500,      1000,     2500,     5000,
+    10000,   25000,   50000,    100000,   250000,   500000,
+    1000000, 2500000, 5000000,  10000000, 30000000, 60000000,
+};
+
+static void http_metrics_format(FIOBJ out, http_metrics_agg_set_s *agg,
+                                const char *name, const char *help) {
+  const size_t name_len = strlen(name);
+  uint8_t first = 1;
+  FIO_SET_FOR_LOOP(agg, pos) {
+    if (!pos->hash)
+      continue;
+    fio_str_info_s k = fiobj_obj2cstr(pos->obj.key);
+    if (k.len < name_len + 2 || memcmp(k.data, name, name_len) ||
+        k.data[name_len] != '{')
+      continue;
+    if (first) {
+      fiobj_str_printf(out, "# HELP %s %s\n# TYPE %s histogram\n", name, help,
+                       name);
+      first = 0;
+    }
+    /* the labels, without the curly brackets */
+    fio_str_info_s l = {.data = k.data + name_len + 1,
+                        .len = k.len - name_len - 2};
+    const char *sep = l.len ? "," : "";
+    http_histogram_s *h = pos->obj.obj;
+    uint64_t count = 0;
+    size_t i = 0;
+    for (size_t b = 0;
+         b < sizeof(http_metrics_bounds) / sizeof(http_metrics_bounds[0]);
+         ++b) {
+      for (; i < HTTP_HISTOGRAM_BUCKETS &&
+             http_histogram_limit(i) <= http_metrics_bounds[b] + 1;
+           ++i)
+        count += h->buckets[i];
+      fiobj_str_printf(out, "%s_bucket{%.*s%sle=\"%g\"} %llu\n", name,
+                       (int)l.len, l.data, sep,
+                       http_metrics_bounds[b] / 1000000.0,
+                       (unsigned long long)count);
+    }
+    for (; i < HTTP_HISTOGRAM_BUCKETS; ++i)
+      count += h->buckets[i];
+    fiobj_str_printf(out, "%s_bucket{%.*s%sle=\"+Inf\"} %llu\n", name,
+                     (int)l.len, l.data, sep, (unsigned long long)count);
+    if (l.len) {
+      fiobj_str_printf(out, "%s_sum{%.*s} %.6f\n%s_count{%.*s} %llu\n", name,
+                       (int)l.len, l.data, h->sum / 1000000.0, name,
+                       (int)l.len, l.data, (unsigned long long)count);
+    } else {
+      fiobj_str_printf(out, "%s_sum %.6f\n%s_count %llu\n", name,
+                       h->sum / 1000000.0, name, (unsigned long long)count);
+    }
+  }
+}
+
+/**
+ * Sends the request latency metrics (of all the worker processes) using the
+ * Prometheus text format.
+ */
+int http_send_metrics(http_s *h) {
+  if (HTTP_INVALID_HANDLE(h))
+    return -1;
+  http_metrics_agg_set_s agg = FIO_SET_INIT;
+  http_metrics_collect(&agg);
+  fio_lock(&http_metrics.lock);
+  http_metrics_peers_expire(http_metrics_now());
+  FIO_SET_FOR_LOOP(&http_metrics.peers, pos) {
+    if (pos->hash)
+      http_metrics_decode(&agg, pos->obj.data);
+  }
+  fio_unlock(&http_metrics.lock);
+  FIOBJ out = fiobj_str_buf(8192);
+  http_metrics_format(out, &agg, http_metrics_phase_names[HTTP_METRICS_QUEUE],
+                      "Time from receiving a request until its handler was "
+                      "called.");
+  http_metrics_format(out, &agg,
+                      http_metrics_phase_names[HTTP_METRICS_HANDLER],
+                      "Time spent in request handlers.");
+  http_metrics_format(out, &agg, http_metrics_phase_names[HTTP_METRICS_DRAIN],
+                      "Time from sending a response until it was written to "
+                      "the socket.");
+  http_metrics_format(out, &agg, "http_route_handler_seconds",
+                      "Time spent in a route's handler.");
+  http_metrics_agg_set_free(&agg);
+  http_set_header2(
+      h, (fio_str_info_s){.data = (char *)"content-type", .len = 12},
+      (fio_str_info_s){.data = (char *)"text/plain; version=0.0.4",
+                       .len = 25});
+  http_set_header(h, HTTP_HEADER_CACHE_CONTROL,
+                  fiobj_dup(HTTP_HVALUE_NO_CACHE));
+  fio_str_info_s s = fiobj_obj2cstr(out);
+  int ret = http_send_body(h, s.data, s.len);
+  fiobj_free(out);
+  return ret;
+}
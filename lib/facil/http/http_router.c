@@ -0,0 +1,607 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#include <http_internal.h>
+
+#include <string.h>
+
+/* *****************************************************************************
+Router Types
+***************************************************************************** */
+
+/* the maximum number of parameters captured by a single route */
+#define HTTP_ROUTER_MAX_PARAMS 32
+
+typedef struct http_router_node_s http_router_node_s;
+
+/* a route's handler, selected using the request method */
+typedef struct {
+  char *method; /* NULL for any method */
+  size_t method_len;
+  void (*handler)(http_s *h);
+  http_histogram_s *metrics; /* the route's handler time */
+} http_router_handler_s;
+
+/* a radix tree node */
+struct http_router_node_s {
+  char *prefix;                  /* the static bytes matched by this node */
+  http_router_node_s **children; /* static children */
+  uint8_t *indices;              /* the first byte of each static child */
+  http_router_node_s *param;     /* the `:name` child (if any) */
+  http_router_node_s *wildcard;  /* the `*name` child (if any) */
+  http_router_handler_s *handlers;
+  FIOBJ name; /* the parameter's name (param / wildcard nodes) */
+  uint32_t prefix_len;
+  uint16_t child_count;
+  uint16_t handler_count;
+};
+
+/* a route, as added by `http_router_add` */
+typedef struct {
+  char *method;
+  char *path;
+  void (*handler)(http_s *h);
+} http_router_route_s;
+
+struct http_router_s {
+  http_router_route_s *routes;
+  size_t count;
+  size_t capa;
+  http_router_node_s *root; /* set once the router was built */
+  http_histogram_s *metrics; /* a histogram per route (set with the root) */
+  volatile uintptr_t ref;
+};
+
+/* a captured parameter */
+typedef struct {
+  FIOBJ name;
+  const char *data;
+  size_t len;
+} http_router_capture_s;
+
+/* *****************************************************************************
+Tree Construction
+***************************************************************************** */
+
+static char *http_router_strdup(const char *str, size_t len) {
+  char *ret = malloc(len + 1);
+  FIO_ASSERT_ALLOC(ret);
+  memcpy(ret, str, len);
+  ret[len] = 0;
+  return ret;
+}
+
+static http_router_node_s *http_router_node_new(const char *prefix,
+                                                size_t len) {
+  http_router_node_s *n = calloc(1, sizeof(*n));
+  FIO_ASSERT_ALLOC(n);
+  if (len)
+    n->prefix = http_router_strdup(prefix, len);
+  n->prefix_len = len;
+  return n;
+}
+
+static void http_router_node_free(http_router_node_s *n) {
+  if (!n)
+    return;
+  for (size_t i = 0; i < n->child_count; ++i)
+    http_router_node_free(n->children[i]);
+  http_router_node_free(n->param);
+  http_router_node_free(n->wildcard);
+  for (size_t i = 0; i < n->handler_count; ++i)
+    free(n->handlers[i].method);
+  free(n->handlers);
+  free(n->children);
+  free(n->indices);
+  free(n->prefix);
+  fiobj_free(n->name);
+  free(n);
+}
+
+static void http_router_child_add(http_router_node_s *n,
+                                  http_router_node_s *child) {
+  n->children =
+      realloc(n->children, sizeof(*n->children) * (n->child_count + 1));
+  n->indices = realloc(n->indices, n->child_count + 1);
+  FIO_ASSERT_ALLOC(n->children && n->indices);
+  n->children[n->child_count] = child;
+  n->indices[n->child_count] = (uint8_t)child->prefix[0];
+  ++n->child_count;
+}
+
+/* inserts static bytes, splitting nodes as required, returns the last node */
+static http_router_node_s *http_router_insert_static(http_router_node_s *n,
+                                                     const char *s,
+                                                     size_t len) {
+  while (len) {
+    uint8_t *pos =
+        n->child_count ? memchr(n->indices, s[0], n->child_count) : NULL;
+    if (!pos) {
+      http_router_node_s *c = http_router_node_new(s, len);
+      http_router_child_add(n, c);
+      return c;
+    }
+    const size_t i = pos - n->indices;
+    http_router_node_s *c = n->children[i];
+    size_t common = 1;
+    while (common < len && common < c->prefix_len &&
+           s[common] == c->prefix[common])
+      ++common;
+    if (common < c->prefix_len) {
+      /* split the child, the shared prefix becomes the parent */
+      http_router_node_s *mid = http_router_node_new(c->prefix, common);
+      c->prefix_len -= common;
+      memmove(c->prefix, c->prefix + common, c->prefix_len + 1);
+      http_router_child_add(mid, c);
+      n->children[i] = mid;
+      c = mid;
+    }
+    n = c;
+    s += common;
+    len -= common;
+  }
+  return n;
+}
+
+/* inserts a route to the tree, returns -1 on conflict */
+static int http_router_insert(http_router_node_s *n, http_router_route_s *route,
+                              http_histogram_s *metrics) {
+  const char *p = route->path;
+  size_t len = strlen(p);
+  while (len) {
+    if ((*p == ':' || *p == '*') && p != route->path && p[-1] == '/') {
+      /* parameter (up to the next `/`) or wildcard (the rest of the path) */
+      size_t name_len = len;
+      if (*p == ':') {
+        char *end = memchr(p, '/', len);
+        if (end)
+          name_len = end - p;
+      }
+      http_router_node_s **target = (*p == ':') ? &n->param : &n->wildcard;
+      FIOBJ name = FIOBJ_INVALID;
+      if (name_len > 1) {
+        name = fiobj_str_new(p + 1, name_len - 1);
+        fiobj_obj2hash(name); /* cache the hash (read only after building) */
+      }
+      if (!*target) {
+        *target = http_router_node_new(NULL, 0);
+        (*target)->name = name;
+      } else if ((*target)->name != name &&
+                 (!(*target)->name || !name ||
+                  !fiobj_iseq((*target)->name, name))) {
+        FIO_LOG_ERROR("(HTTP router) parameter name conflict at %s",
+                      route->path);
+        fiobj_free(name);
+        return -1;
+      } else {
+        fiobj_free(name);
+      }
+      n = *target;
+      p += name_len;
+      len -= name_len;
+      continue;
+    }
+    /* static bytes, up to the next parameter (if any) */
+    size_t i = 1;
+    while (i < len && !((p[i] == ':' || p[i] == '*') && p[i - 1] == '/'))
+      ++i;
+    n = http_router_insert_static(n, p, i);
+    p += i;
+    len -= i;
+  }
+  const size_t method_len = route->method ? strlen(route->method) : 0;
+  for (size_t i = 0; i < n->handler_count; ++i) {
+    if (n->handlers[i].method_len == method_len &&
+        (!method_len ||
+         !strncasecmp(n->handlers[i].method, route->method, method_len))) {
+      FIO_LOG_ERROR("(HTTP router) duplicate route %s %s",
+                    route->method ? route->method : "(any)", route->path);
+      return -1;
+    }
+  }
+  n->handlers =
+      realloc(n->handlers, sizeof(*n->handlers) * (n->handler_count + 1));
+  FIO_ASSERT_ALLOC(n->handlers);
+  n->handlers[n->handler_count++] = (http_router_handler_s){
+      .method =
+          route->method ? http_router_strdup(route->method, method_len) : NULL,
+      .method_len = method_len,
+      .handler = route->handler,
+      .metrics = metrics,
+  };
+  return 0;
+}
+
+/* *****************************************************************************
+Routing
+***************************************************************************** */
+
+/* selects a node's handler according to the request method */
+static http_router_handler_s *http_router_handler(http_router_node_s *n,
+                                                  fio_str_info_s method) {
+  http_router_handler_s *any = NULL;
+  http_router_handler_s *get = NULL;
+  for (size_t i = 0; i < n->handler_count; ++i) {
+    if (!n->handlers[i].method) {
+      any = n->handlers + i;
+      continue;
+    }
+    if (n->handlers[i].method_len == method.len &&
+        !strncasecmp(n->handlers[i].method, method.data, method.len))
+      return n->handlers + i;
+    if (n->handlers[i].method_len == 3 &&
+        !strncasecmp(n->handlers[i].method, "GET", 3))
+      get = n->handlers + i;
+  }
+  if (!any && get && method.len == 4 && !strncasecmp(method.data, "HEAD", 4))
+    return get; /* HEAD requests are routed to GET handlers */
+  return any;
+}
+
+/* finds a handler, preferring static matches over parameters and wildcards */
+static http_router_handler_s *
+http_router_find(http_router_node_s *n, const char *p, size_t len,
+                 fio_str_info_s method, http_router_capture_s *caps,
+                 size_t *count) {
+  http_router_handler_s *handler;
+  if (n->prefix_len) {
+    if (len < n->prefix_len || memcmp(p, n->prefix, n->prefix_len))
+      return NULL;
+    p += n->prefix_len;
+    len -= n->prefix_len;
+  }
+  if (!len) {
+    if (n->handler_count && (handler = http_router_handler(n, method)))
+      return handler;
+  } else if (n->child_count) {
+    uint8_t *pos = memchr(n->indices, p[0], n->child_count);
+    if (pos && (handler = http_router_find(n->children[pos - n->indices], p,
+                                           len, method, caps, count)))
+      return handler;
+  }
+  if (len && n->param && *count < HTTP_ROUTER_MAX_PARAMS) {
+    const char *end = memchr(p, '/', len);
+    const size_t seg = end ? (size_t)(end - p) : len;
+    if (seg) {
+      caps[*count] = (http_router_capture_s){
+          .name = n->param->name, .data = p, .len = seg};
+      ++*count;
+      if ((handler = http_router_find(n->param, p + seg, len - seg, method,
+                                      caps, count)))
+        return handler;
+      --*count;
+    }
+  }
+  if (n->wildcard && *count < HTTP_ROUTER_MAX_PARAMS &&
+      (handler = http_router_handler(n->wildcard, method))) {
+    caps[*count] = (http_router_capture_s){
+        .name = n->wildcard->name, .data = p, .len = len};
+    ++*count;
+    return handler;
+  }
+  return NULL;
+}
+
+/**
+ * Routes the request, returning -1 if no route matched (the request wasn't
+ * handled).
+ */
+int http_router_route(http_router_s *r, http_s *h) {
+  if (!r->root)
+    return -1;
+  http_router_capture_s caps[HTTP_ROUTER_MAX_PARAMS];
+  size_t count = 0;
+  fio_str_info_s path = fiobj_obj2cstr(h->path);
+  http_router_handler_s *handler = http_router_find(
+      r->root, path.data, path.len, fiobj_obj2cstr(h->method), caps, &count);
+  if (!handler)
+    return -1;
+  if (count) {
+    if (!h->params)
+      h->params = fiobj_hash_new();
+    for (size_t i = 0; i < count; ++i) {
+      if (caps[i].name)
+        fiobj_hash_set(h->params, caps[i].name,
+                       fiobj_str_new(caps[i].data, caps[i].len));
+    }
+  }
+  if (!http_metrics_enabled) {
+    handler->handler(h);
+    return 0;
+  }
+  const uint64_t start = http_metrics_now();
+  handler->handler(h);
+  const uint64_t end = http_metrics_now();
+  http_histogram_add(handler->metrics, (end > start) ? end - start : 0);
+  return 0;
+}
+
+/* *****************************************************************************
+Router API
+***************************************************************************** */
+
+/* writes a Prometheus label value (escaping `\`, `"` and new lines) */
+static void http_router_label_write(FIOBJ dest, const char *str) {
+  for (const char *pos = str; *pos; ++pos) {
+    if (*pos == '\\' || *pos == '"')
+      fiobj_str_write(dest, "\\", 1);
+    if (*pos == '\n') {
+      fiobj_str_write(dest, "\\n", 2);
+      continue;
+    }
+    fiobj_str_write(dest, pos, 1);
+  }
+}
+
+/** Creates a new (empty) router. */
+http_router_s *http_router_new(void) {
+  http_router_s *r = calloc(1, sizeof(*r));
+  FIO_ASSERT_ALLOC(r);
+  r->ref = 1;
+  return r;
+}
+
+/** Adds a route to the router. Returns -1 on error. */
+int http_router_add(http_router_s *r, const char *method, const char *path,
+                    void (*handler)(http_s *h)) {
+  if (!r || !path || path[0] != '/' || !handler)
+    goto invalid;
+  if (r->root) {
+    FIO_LOG_ERROR("(HTTP router) routes can't be added after `http_listen`.");
+    return -1;
+  }
+  for (const char *p = path + 1; *p; ++p) {
+    if (p[-1] != '/')
+      continue;
+    if ((*p == ':' && (!p[1] || p[1] == '/')) ||
+        (*p == '*' && strchr(p, '/')))
+      goto invalid; /* unnamed parameter / wildcard isn't the last segment */
+  }
+  if (r->count == r->capa) {
+    r->capa = r->capa ? r->capa << 1 : 32;
+    r->routes = realloc(r->routes, sizeof(*r->routes) * r->capa);
+    FIO_ASSERT_ALLOC(r->routes);
+  }
+  r->routes[r->count++] = (http_router_route_s){
+      .method = method ? http_router_strdup(method, strlen(method)) : NULL,
+      .path = http_router_strdup(path, strlen(path)),
+      .handler = handler,
+  };
+  return 0;
+invalid:
+  FIO_LOG_ERROR("(HTTP router) invalid route %s", path ? path : "(NULL)");
+  return -1;
+}
+
+/**
+ * Builds the router's radix tree (called by `http_listen`), after which the
+ * router is read-only. Returns -1 on error.
+ *
+ * A reference is taken either way, released by `http_router_free`.
+ */
+int http_router_build(http_router_s *r) {
+  fio_atomic_add(&r->ref, 1);
+  if (r->root)
+    return 0;
+  http_router_node_s *root = http_router_node_new(NULL, 0);
+  http_histogram_s *metrics = calloc(r->count + 1, sizeof(*metrics));
+  FIO_ASSERT_ALLOC(metrics);
+  for (size_t i = 0; i < r->count; ++i) {
+    if (http_router_insert(root, r->routes + i, metrics + i)) {
+      http_router_node_free(root);
+      free(metrics);
+      return -1;
+    }
+  }
+  /* label each route's histogram (the method and the route's path) */
+  FIOBJ labels = fiobj_str_buf(128);
+  for (size_t i = 0; i < r->count; ++i) {
+    fiobj_str_resize(labels, 0);
+    fiobj_str_write(labels, "method=\"", 8);
+    http_router_label_write(labels, r->routes[i].method
+                                        ? r->routes[i].method
+                                        : "*");
+    fiobj_str_write(labels, "\",route=\"", 9);
+    http_router_label_write(labels, r->routes[i].path);
+    fiobj_str_write(labels, "\"", 1);
+    http_metrics_register("http_route_handler_seconds",
+                          fiobj_obj2cstr(labels), metrics + i);
+  }
+  fiobj_free(labels);
+  r->metrics = metrics;
+  r->root = root;
+  return 0;
+}
+
+/** Frees the router (once it's no longer used by any `http_listen`). */
+void http_router_free(http_router_s *r) {
+  if (!r || fio_atomic_sub(&r->ref, 1))
+    return;
+  http_router_node_free(r->root);
+  if (r->metrics) {
+    for (size_t i = 0; i < r->count; ++i)
+      http_metrics_unregister(r->metrics + i);
+    free(r->metrics);
+  }
+  for (size_t i = 0; i < r->count; ++i) {
+    free(r->routes[i].method);
+    free(r->routes[i].path);
+  }
+  free(r->routes);
+  free(r);
+}
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+#if DEBUG
+
+static int http_router_test_called;
+static void http_router_test_h1(http_s *h) {
+  http_router_test_called = 1;
+  (void)h;
+}
+static void http_router_test_h2(http_s *h) {
+  http_router_test_called = 2;
+  (void)h;
+}
+static void http_router_test_h3(http_s *h) {
+  http_router_test_called = 3;
+  (void)h;
+}
+static void http_router_test_h4(http_s *h) {
+  http_router_test_called = 4;
+  (void)h;
+}
+
+/* routes a request, returning the handler's number (0 if none matched) */
+static int http_router_test_route(http_router_s *r, const char *method,
+                                  const char *path, http_s *h) {
+  fiobj_free(h->params);
+  fiobj_free(h->method);
+  fiobj_free(h->path);
+  h->params = FIOBJ_INVALID;
+  h->method = fiobj_str_new(method, strlen(method));
+  h->path = fiobj_str_new(path, strlen(path));
+  http_router_test_called = 0;
+  if (http_router_route(r, h))
+    return 0;
+  FIO_ASSERT(http_router_test_called, "route matched without a handler");
+  return http_router_test_called;
+}
+
+/* tests a captured parameter's value (NULL for a missing parameter) */
+static void http_router_test_param(http_s *h, const char *name,
+                                   const char *expected) {
+  FIOBJ key = fiobj_str_new(name, strlen(name));
+  FIOBJ val = h->params ? fiobj_hash_get(h->params, key) : FIOBJ_INVALID;
+  fiobj_free(key);
+  if (!expected) {
+    FIO_ASSERT(!val, "parameter %s shouldn't be captured", name);
+    return;
+  }
+  FIO_ASSERT(val, "parameter %s missing", name);
+  fio_str_info_s s = fiobj_obj2cstr(val);
+  FIO_ASSERT(s.len == strlen(expected) && !memcmp(s.data, expected, s.len),
+             "parameter %s error (%.*s != %s)", name, (int)s.len, s.data,
+             expected);
+}
+
+/* tests that building the router fails */
+static void http_router_test_conflict(const char *path1, const char *path2) {
+  http_router_s *r = http_router_new();
+  FIO_ASSERT(!http_router_add(r, "GET", path1, http_router_test_h1) &&
+                 !http_router_add(r, "GET", path2, http_router_test_h2),
+             "couldn't add routes %s and %s", path1, path2);
+  FIO_ASSERT(http_router_build(r) == -1,
+             "conflicting routes %s and %s should fail the build", path1,
+             path2);
+  http_router_free(r); /* the build's reference */
+  http_router_free(r);
+}
+
+void http_router_test(void) {
+  fprintf(stderr, "=== Testing HTTP router\n");
+  http_s h = {.method = FIOBJ_INVALID};
+  http_router_s *r = http_router_new();
+  FIO_ASSERT(!http_router_add(r, "GET", "/users/:id", http_router_test_h1) &&
+                 !http_router_add(r, "GET", "/users/:id/posts/:post",
+                                  http_router_test_h2) &&
+                 !http_router_add(r, "GET", "/users/me", http_router_test_h3) &&
+                 !http_router_add(r, "GET", "/files/*path",
+                                  http_router_test_h1) &&
+                 !http_router_add(r, "GET", "/a/static/x",
+                                  http_router_test_h1) &&
+                 !http_router_add(r, "GET", "/a/:p/y", http_router_test_h2) &&
+                 !http_router_add(r, "GET", "/a/*rest", http_router_test_h3) &&
+                 !http_router_add(r, "HEAD", "/head", http_router_test_h1) &&
+                 !http_router_add(r, "GET", "/head", http_router_test_h2) &&
+                 !http_router_add(r, "POST", "/any", http_router_test_h1) &&
+                 !http_router_add(r, NULL, "/any", http_router_test_h4),
+             "couldn't add routes");
+  FIO_ASSERT(!http_router_build(r), "couldn't build router");
+  {
+    const int old_level = FIO_LOG_LEVEL;
+    FIO_LOG_LEVEL = FIO_LOG_LEVEL_NONE;
+    FIO_ASSERT(http_router_add(r, "GET", "/late", http_router_test_h1) == -1,
+               "routes shouldn't be added after the router was built");
+    FIO_LOG_LEVEL = old_level;
+  }
+
+  /* parameters */
+  FIO_ASSERT(http_router_test_route(r, "GET", "/users/42", &h) == 1,
+             "`:param` route error");
+  http_router_test_param(&h, "id", "42");
+  FIO_ASSERT(http_router_test_route(r, "GET", "/users/42/posts/7", &h) == 2,
+             "nested `:param` route error");
+  http_router_test_param(&h, "id", "42");
+  http_router_test_param(&h, "post", "7");
+  FIO_ASSERT(http_router_test_route(r, "GET", "/users/me", &h) == 3,
+             "static segments should take precedence over parameters");
+  http_router_test_param(&h, "id", NULL);
+  FIO_ASSERT(!http_router_test_route(r, "GET", "/users/", &h) &&
+                 !http_router_test_route(r, "GET", "/users/42/posts", &h),
+             "`:param` should match a single, non-empty, segment");
+
+  /* wildcards */
+  FIO_ASSERT(http_router_test_route(r, "GET", "/files/a/b/c.txt", &h) == 1,
+             "`*wildcard` route error");
+  http_router_test_param(&h, "path", "a/b/c.txt");
+
+  /* backtracking: static > param > wildcard */
+  FIO_ASSERT(http_router_test_route(r, "GET", "/a/static/x", &h) == 1,
+             "static route should be preferred");
+  http_router_test_param(&h, "p", NULL);
+  FIO_ASSERT(http_router_test_route(r, "GET", "/a/static/y", &h) == 2,
+             "router should backtrack from a static to a `:param` route");
+  http_router_test_param(&h, "p", "static");
+  FIO_ASSERT(http_router_test_route(r, "GET", "/a/static/z", &h) == 3,
+             "router should backtrack to a `*wildcard` route");
+  http_router_test_param(&h, "p", NULL);
+  http_router_test_param(&h, "rest", "static/z");
+
+  /* methods */
+  FIO_ASSERT(http_router_test_route(r, "HEAD", "/head", &h) == 1 &&
+                 http_router_test_route(r, "GET", "/head", &h) == 2,
+             "method routing error");
+  FIO_ASSERT(http_router_test_route(r, "HEAD", "/users/1", &h) == 1,
+             "HEAD requests should fall back to GET routes");
+  FIO_ASSERT(!http_router_test_route(r, "POST", "/users/1", &h),
+             "POST requests shouldn't be routed to GET routes");
+  FIO_ASSERT(http_router_test_route(r, "post", "/any", &h) == 1 &&
+                 http_router_test_route(r, "DELETE", "/any", &h) == 4,
+             "any-method route error");
+  fiobj_free(h.params);
+  fiobj_free(h.method);
+  fiobj_free(h.path);
+  http_router_free(r); /* the build's reference */
+  http_router_free(r);
+
+  const int old_level = FIO_LOG_LEVEL;
+  FIO_LOG_LEVEL = FIO_LOG_LEVEL_NONE;
+  /* duplicate and conflicting routes */
+  http_router_test_conflict("/x", "/x");
+  http_router_test_conflict("/u/:id", "/u/:name/x");
+  http_router_test_conflict("/f/*path", "/f/*rest");
+
+  /* invalid routes */
+  r = http_router_new();
+  FIO_ASSERT(http_router_add(r, "GET", "x", http_router_test_h1) == -1 &&
+                 http_router_add(r, "GET", "", http_router_test_h1) == -1 &&
+                 http_router_add(r, "GET", NULL, http_router_test_h1) == -1 &&
+                 http_router_add(r, "GET", "/x", NULL) == -1 &&
+                 http_router_add(r, "GET", "/a/:", http_router_test_h1) ==
+                     -1 &&
+                 http_router_add(r, "GET", "/:/a", http_router_test_h1) ==
+                     -1 &&
+                 http_router_add(r, "GET", "/a/*rest/b",
+                                 http_router_test_h1) == -1,
+             "invalid routes should be rejected");
+  FIO_LOG_LEVEL = old_level;
+  http_router_free(r);
+}
+
+#endif
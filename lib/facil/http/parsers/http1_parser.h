@@ -112,6 +112,8 @@ static int http1_on_version(http1_parser_s *parser, char *version, size_t len);
 /** called when a header is parsed. */
 static int http1_on_header(http1_parser_s *parser, char *name, size_t name_len,
                            char *data, size_t data_len);
+/** called when all the headers were parsed (before any body chunk). */
+static int http1_on_headers_complete(http1_parser_s *parser);
 /** called when a body chunk is parsed. */
 static int http1_on_body_chunk(http1_parser_s *parser, char *data,
                                size_t data_len);
@@ -824,7 +826,9 @@ re_eval:
       if (start >= stop)
         return HTTP1_CONSUMED; /* buffer ended on header line */
       if (*start == '\r' || *start == '\n') {
-        goto finished_headers; /* empty line, end of headers */
+        if (*start == '\r' && start + 1 >= stop)
+          return HTTP1_CONSUMED; /* buffer ended between the CR and the LF */
+        goto finished_headers;   /* empty line, end of headers */
       }
       end = start;
       if (!(eol_len = seek2eol(&end, stop)))
@@ -839,6 +843,8 @@ re_eval:
       ++start;
     end = start;
     parser->state.reserved |= HTTP1_P_FLAG_HEADER_COMPLETE;
+    if (http1_on_headers_complete(parser))
+      goto error;
   /* fallthrough */
   case (HTTP1_P_FLAG_HEADER_COMPLETE | HTTP1_P_FLAG_STATUS_LINE):
     /* request body */
@@ -11,6 +11,7 @@ Feel free to copy, use and enjoy according to the license provided.
  */
 #define H_FIO_TLS
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifndef FIO_TLS_PRINT_SECRET
@@ -18,6 +19,21 @@ Feel free to copy, use and enjoy according to the license provided.
 #define FIO_TLS_PRINT_SECRET 0
 #endif
 
+#ifndef FIO_TLS_TICKET_ROTATION
+/* the number of seconds between session ticket key rotations */
+#define FIO_TLS_TICKET_ROTATION 3600
+#endif
+
+#ifndef FIO_TLS_SESSION_CACHE_LIMIT
+/* the number of slots in the shared session cache (0 disables the cache) */
+#define FIO_TLS_SESSION_CACHE_LIMIT 0
+#endif
+
+#ifndef FIO_TLS_HANDSHAKE_THREADS
+/* the number of (per process) handshake threads (0 performs handshakes inline) */
+#define FIO_TLS_HANDSHAKE_THREADS 0
+#endif
+
 /** An opaque type used for the SSL/TLS functions. */
 typedef struct fio_tls_s fio_tls_s;
 
@@ -78,6 +94,18 @@ void fio_tls_alpn_add(fio_tls_s *tls, const char *protocol_name,
  */
 uintptr_t fio_tls_alpn_count(fio_tls_s *tls);
 
+/**
+ * Returns a number identifying the TLS object's current configuration.
+ *
+ * The number is unique within the process (it isn't reused, even after the
+ * TLS object was destroyed) and changes whenever certificates, ALPN protocols
+ * or trusted certificates are added. This allows connections to be grouped by
+ * the settings they were established with.
+ *
+ * Returns 0 if `tls` is NULL.
+ */
+uintptr_t fio_tls_id(fio_tls_s *tls);
+
 /**
  * Adds a certificate to the "trust" list, which automatically adds a peer
  * verification requirement.
@@ -113,6 +141,29 @@ void fio_tls_accept(intptr_t uuid, fio_tls_s *tls, void *udata);
  */
 void fio_tls_connect(intptr_t uuid, fio_tls_s *tls, void *udata);
 
+/** TLS session resumption statistics, shared by all worker processes. */
+typedef struct {
+  /** The number of completed server side handshakes (full and resumed). */
+  size_t handshakes;
+  /** The number of server side handshakes that resumed a previous session. */
+  size_t resumed;
+  /** The number of session cache lookups that found a session. */
+  size_t cache_hits;
+  /** The number of session cache lookups that failed to find a session. */
+  size_t cache_misses;
+} fio_tls_stats_s;
+
+/**
+ * Returns the session resumption statistics collected so far.
+ *
+ * Session ticket keys (and the optional session cache) are shared by all the
+ * worker processes, so the statistics reflect the whole cluster when the TLS
+ * object was created before calling `fio_start`.
+ *
+ * The resumption hit-rate is `resumed / handshakes`.
+ */
+fio_tls_stats_s fio_tls_stats(void);
+
 /**
  * Increase the reference count for the TLS object.
  *
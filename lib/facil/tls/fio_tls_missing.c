@@ -140,6 +140,7 @@ The SSL/TLS Context type
 /** An opaque type used for the SSL/TLS functions. */
 struct fio_tls_s {
   size_t ref;       /* Reference counter, to guards the ALPN registry */
+  uintptr_t id;     /* the configuration's identity (see `fio_tls_id`) */
   alpn_list_s alpn; /* ALPN is the name for the protocol selection extension */
 
   /*** the next two components could be optimized away with tweaking stuff ***/
@@ -232,7 +233,9 @@ static void fio_tls_destroy_context(fio_tls_s *tls) {
 
 /** Called when the library specific data for the context should be built */
 static void fio_tls_build_context(fio_tls_s *tls) {
+  static volatile uintptr_t last_id;
   fio_tls_destroy_context(tls);
+  tls->id = fio_atomic_add(&last_id, 1); /* the configuration changed */
   /* TODO: Library specific implementation */
 
   /* Certificates */
@@ -554,6 +557,14 @@ uintptr_t FIO_TLS_WEAK fio_tls_alpn_count(fio_tls_s *tls) {
   return tls ? alpn_list_count(&tls->alpn) : 0;
 }
 
+/**
+ * Returns a number identifying the TLS object's current configuration.
+ *
+ * The number is unique within the process and changes whenever certificates,
+ * ALPN protocols or trusted certificates are added. Returns 0 for NULL.
+ */
+uintptr_t FIO_TLS_WEAK fio_tls_id(fio_tls_s *tls) { return tls ? tls->id : 0; }
+
 /**
  * Adds a certificate to the "trust" list, which automatically adds a peer
  * verification requirement.
@@ -608,6 +619,13 @@ void FIO_TLS_WEAK fio_tls_connect(intptr_t uuid, fio_tls_s *tls, void *udata) {
   fio_tls_attach2uuid(uuid, tls, udata, 0);
 }
 
+/**
+ * Returns the session resumption statistics collected so far.
+ */
+fio_tls_stats_s FIO_TLS_WEAK fio_tls_stats(void) {
+  return (fio_tls_stats_s){.handshakes = 0};
+}
+
 /**
  * Increase the reference count for the TLS object.
  *
@@ -17,7 +17,19 @@ Feel free to copy, use and enjoy according to the license provided.
 #if HAVE_OPENSSL
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#if FIO_TLS_HANDSHAKE_THREADS
+#include <pthread.h>
+#endif
 
 #define REQUIRE_LIBRARY()
 #define FIO_TLS_WEAK
@@ -127,6 +139,7 @@ The SSL/TLS type
 /** An opaque type used for the SSL/TLS functions. */
 struct fio_tls_s {
   size_t ref;       /* Reference counter, to guards the ALPN registry */
+  uintptr_t id;     /* the configuration's identity (see `fio_tls_id`) */
   alpn_list_s alpn; /* ALPN is the name for the protocol selection extension */
 
   /*** the next two components could be optimized away with tweaking stuff ***/
@@ -289,20 +302,276 @@ static X509 *fio_tls_create_self_signed(char *server_name) {
   return cert;
 }
 
+/* *****************************************************************************
+Cross-Worker Session Resumption (shared ticket keys and session cache)
+
+The ticket keys and the (optional) session cache live in an anonymous shared
+memory mapping that is created before `fio_start` forks the workers. The root
+process rotates the keys, the workers only read them.
+***************************************************************************** */
+
+typedef struct {
+  unsigned char name[16];
+  unsigned char aes[32];
+  unsigned char hmac[32];
+} fio_tls_ticket_key_s;
+
+#define FIO_TLS_SESSION_SLOT_LENGTH 2048
+
+typedef struct {
+  fio_lock_i lock;
+  uint8_t id_len;
+  uint16_t len;
+  time_t expires;
+  unsigned char id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+  unsigned char data[FIO_TLS_SESSION_SLOT_LENGTH];
+} fio_tls_session_slot_s;
+
+typedef struct {
+  fio_lock_i lock;   /* protects the ticket keys */
+  size_t generation; /* the current key is `keys[generation & 1]` */
+  fio_tls_ticket_key_s keys[2];
+  fio_tls_stats_s stats;
+#if FIO_TLS_SESSION_CACHE_LIMIT
+  fio_tls_session_slot_s cache[FIO_TLS_SESSION_CACHE_LIMIT];
+#endif
+} fio_tls_shared_s;
+
+static fio_tls_shared_s *fio_tls_shared = NULL;
+
+static void fio_tls_ticket_key_generate(fio_tls_ticket_key_s *key) {
+  FIO_ASSERT(RAND_bytes((unsigned char *)key, sizeof(*key)) == 1,
+             "OpenSSL failed to generate a session ticket key.");
+}
+
+/* rotates the ticket keys, the previous key is kept for decryption */
+static void fio_tls_ticket_rotate(void *ignr_) {
+  if (!fio_tls_shared || !fio_is_master())
+    return;
+  fio_tls_ticket_key_s key;
+  fio_tls_ticket_key_generate(&key);
+  fio_lock(&fio_tls_shared->lock);
+  fio_tls_shared->keys[(fio_tls_shared->generation + 1) & 1] = key;
+  ++fio_tls_shared->generation;
+  fio_unlock(&fio_tls_shared->lock);
+  OPENSSL_cleanse(&key, sizeof(key));
+  FIO_LOG_DEBUG("(%d) rotated TLS session ticket keys.", (int)getpid());
+  (void)ignr_;
+}
+
+static void fio_tls_ticket_rotation_start(void *ignr_) {
+  fio_run_every(FIO_TLS_TICKET_ROTATION * 1000, 0, fio_tls_ticket_rotate, NULL,
+                NULL);
+  (void)ignr_;
+}
+
+static void fio_tls_shared_destroy(void *shared) {
+  OPENSSL_cleanse(((fio_tls_shared_s *)shared)->keys,
+                  sizeof(((fio_tls_shared_s *)shared)->keys));
+  munmap(shared, sizeof(fio_tls_shared_s));
+  fio_tls_shared = NULL;
+}
+
+static void fio_tls_shared_init(void) {
+  static fio_lock_i lock = FIO_LOCK_INIT;
+  if (fio_tls_shared)
+    return;
+  fio_lock(&lock);
+  if (fio_tls_shared)
+    goto finish;
+  /* anonymous mappings are zero initialized */
+  fio_tls_shared_s *shared =
+      mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  FIO_ASSERT(shared != MAP_FAILED,
+             "TLS failed to map shared memory for session resumption.");
+  fio_tls_ticket_key_generate(shared->keys);
+  fio_tls_ticket_key_generate(shared->keys + 1);
+  fio_tls_shared = shared;
+  if (!fio_is_worker())
+    fio_state_callback_add(FIO_CALL_PRE_START, fio_tls_ticket_rotation_start,
+                           NULL);
+  else
+    FIO_LOG_WARNING("(%d) TLS session data created after forking, session "
+                    "resumption will not be shared with other workers.",
+                    (int)getpid());
+  fio_state_callback_add(FIO_CALL_AT_EXIT, fio_tls_shared_destroy, shared);
+finish:
+  fio_unlock(&lock);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int fio_tls_ticket_key_cb(SSL *ssl, unsigned char key_name[16],
+                                 unsigned char *iv, EVP_CIPHER_CTX *cctx,
+                                 EVP_MAC_CTX *hctx, int enc)
+#else
+static int fio_tls_ticket_key_cb(SSL *ssl, unsigned char key_name[16],
+                                 unsigned char *iv, EVP_CIPHER_CTX *cctx,
+                                 HMAC_CTX *hctx, int enc)
+#endif
+{
+  fio_tls_ticket_key_s key;
+  int ret = 1;
+  fio_lock(&fio_tls_shared->lock);
+  if (enc) {
+    key = fio_tls_shared->keys[fio_tls_shared->generation & 1];
+  } else if (!memcmp(key_name,
+                     fio_tls_shared->keys[fio_tls_shared->generation & 1].name,
+                     16)) {
+    key = fio_tls_shared->keys[fio_tls_shared->generation & 1];
+  } else if (!memcmp(
+                 key_name,
+                 fio_tls_shared->keys[(fio_tls_shared->generation + 1) & 1].name,
+                 16)) {
+    /* previous key - accept the ticket, but issue a new one */
+    key = fio_tls_shared->keys[(fio_tls_shared->generation + 1) & 1];
+    ret = 2;
+  } else {
+    ret = 0;
+  }
+  fio_unlock(&fio_tls_shared->lock);
+  if (!ret)
+    return 0; /* unknown (expired) key, perform a full handshake */
+
+  if (enc) {
+    memcpy(key_name, key.name, 16);
+    if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1 ||
+        !EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key.aes, iv))
+      ret = -1;
+  } else if (!EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL, key.aes, iv)) {
+    ret = -1;
+  }
+  if (ret > 0) {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, key.hmac,
+                                          sizeof(key.hmac)),
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                                         (char *)"SHA256", 0),
+        OSSL_PARAM_construct_end(),
+    };
+    if (!EVP_MAC_CTX_set_params(hctx, params))
+      ret = -1;
+#else
+    if (!HMAC_Init_ex(hctx, key.hmac, sizeof(key.hmac), EVP_sha256(), NULL))
+      ret = -1;
+#endif
+  }
+  OPENSSL_cleanse(&key, sizeof(key));
+  return ret;
+  (void)ssl;
+}
+
+#if FIO_TLS_SESSION_CACHE_LIMIT
+static inline fio_tls_session_slot_s *
+fio_tls_session_slot(const unsigned char *id, unsigned int id_len) {
+  return fio_tls_shared->cache +
+         (fio_risky_hash(id, id_len, 0) % FIO_TLS_SESSION_CACHE_LIMIT);
+}
+
+static int fio_tls_session_new_cb(SSL *ssl, SSL_SESSION *session) {
+  unsigned int id_len = 0;
+  const unsigned char *id = SSL_SESSION_get_id(session, &id_len);
+  int len = i2d_SSL_SESSION(session, NULL);
+  if (!id_len || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH || len <= 0 ||
+      len > FIO_TLS_SESSION_SLOT_LENGTH)
+    return 0;
+  fio_tls_session_slot_s *slot = fio_tls_session_slot(id, id_len);
+  fio_lock(&slot->lock);
+  unsigned char *pos = slot->data;
+  i2d_SSL_SESSION(session, &pos);
+  memcpy(slot->id, id, id_len);
+  slot->id_len = (uint8_t)id_len;
+  slot->len = (uint16_t)len;
+  slot->expires = (time_t)SSL_SESSION_get_time(session) +
+                  (time_t)SSL_SESSION_get_timeout(session);
+  fio_unlock(&slot->lock);
+  return 0; /* we didn't keep a reference to the session object */
+  (void)ssl;
+}
+
+static SSL_SESSION *fio_tls_session_get_cb(SSL *ssl, const unsigned char *id,
+                                           int id_len, int *copy) {
+  SSL_SESSION *session = NULL;
+  *copy = 0;
+  if (id_len <= 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+    goto finish;
+  fio_tls_session_slot_s *slot = fio_tls_session_slot(id, id_len);
+  fio_lock(&slot->lock);
+  if (slot->id_len == id_len && !memcmp(slot->id, id, id_len) &&
+      slot->expires > fio_last_tick().tv_sec) {
+    const unsigned char *pos = slot->data;
+    session = d2i_SSL_SESSION(NULL, &pos, slot->len);
+  }
+  fio_unlock(&slot->lock);
+finish:
+  if (session)
+    fio_atomic_add(&fio_tls_shared->stats.cache_hits, 1);
+  else
+    fio_atomic_add(&fio_tls_shared->stats.cache_misses, 1);
+  return session;
+  (void)ssl;
+}
+
+static void fio_tls_session_remove_cb(SSL_CTX *ctx, SSL_SESSION *session) {
+  unsigned int id_len = 0;
+  const unsigned char *id = SSL_SESSION_get_id(session, &id_len);
+  if (!id_len || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+    return;
+  fio_tls_session_slot_s *slot = fio_tls_session_slot(id, id_len);
+  fio_lock(&slot->lock);
+  if (slot->id_len == id_len && !memcmp(slot->id, id, id_len))
+    slot->id_len = 0;
+  fio_unlock(&slot->lock);
+  (void)ctx;
+}
+#endif /* FIO_TLS_SESSION_CACHE_LIMIT */
+
 /* *****************************************************************************
 SSL/TLS Context (re)-building
 ***************************************************************************** */
 
-#define TLS_BUFFER_LENGTH (1 << 15)
+/* the maximal plaintext length of a TLS record */
+#define TLS_BUFFER_LENGTH (1 << 14)
+/* the record length used when a connection starts (fits a TCP segment) */
+#define TLS_SMALL_RECORD_LENGTH 1300
+/* the number of bytes sent before switching to full length records */
+#define TLS_SMALL_RECORD_LIMIT (1 << 16)
+/* the number of handshakes that might wait for a handshake thread */
+#define TLS_HANDSHAKE_QUEUE_LENGTH 1024
+
+/* handshake offloading states */
+enum {
+  FIO_TLS_HS_IDLE = 0, /* the handshake (if any) is performed inline */
+  FIO_TLS_HS_QUEUED,   /* a handshake thread owns the SSL object */
+  FIO_TLS_HS_DONE,     /* the handshake thread's result awaits the reactor */
+};
+
 typedef struct {
   SSL *ssl;
   fio_tls_s *tls;
   void *alpn_arg;
+  alpn_s *alpn_selected; /* set during the handshake, scheduled after it */
   intptr_t uuid;
+  size_t sent;   /* plaintext bytes passed to OpenSSL (record size tuning) */
+  size_t offset; /* the start of the buffered data */
+  size_t len;    /* the length of the buffered data */
   uint8_t is_server;
+  uint8_t is_closing;
   volatile uint8_t alpn_ok;
+  volatile uint8_t hs_state;  /* handshake offloading state */
+  volatile uint8_t is_closed; /* set by the cleanup callback */
+  fio_lock_i hs_lock;         /* held while a handshake thread uses the SSL */
+  int hs_result;              /* the offloaded handshake step's result */
+  int hs_errno;               /* the `errno` value for the offloaded result */
+  volatile size_t ref;        /* a queued handshake holds a reference */
+  unsigned char buffer[TLS_BUFFER_LENGTH]; /* plaintext coalescing buffer */
 } fio_tls_connection_s;
 
+#if FIO_TLS_HANDSHAKE_THREADS
+static void fio_tls_pool_init(void);
+#endif
+
 static void fio_tls_alpn_fallback(fio_tls_connection_s *c) {
   alpn_s *alpn = alpn_default(c->tls);
   if (!alpn || !alpn->on_selected)
@@ -318,9 +587,11 @@ static int fio_tls_alpn_selector_cb(SSL *ssl, const unsigned char **out,
                                     void *tls_) {
   fio_tls_s *tls = tls_;
   alpn_s *alpn;
-  /* TODO: select ALPN and call on_selected */
+  /*
+   * This might run on a handshake thread, so the selection is only recorded.
+   * `on_selected` is scheduled by the reactor once the handshake completes.
+   */
   fio_tls_connection_s *c = SSL_get_ex_data(ssl, 0);
-  c->alpn_ok = 1;
 
   if (alpn_list_count(&tls->alpn) == 0)
     return SSL_TLSEXT_ERR_NOACK;
@@ -335,12 +606,12 @@ static int fio_tls_alpn_selector_cb(SSL *ssl, const unsigned char **out,
     *out = (unsigned char *)info.data;
     *outlen = (unsigned char)info.len;
     FIO_LOG_DEBUG("TLS ALPN set to: %s for %p", info.data, (void *)c->uuid);
-    alpn_select(alpn, c->uuid, c->alpn_arg);
+    c->alpn_selected = alpn;
     return SSL_TLSEXT_ERR_OK;
   }
   /* set protocol to default protocol */
   alpn = alpn_default(tls);
-  alpn_select(alpn, c->uuid, c->alpn_arg);
+  c->alpn_selected = alpn;
   FIO_LOG_DEBUG(
       "TLS ALPN handshake failed, falling back on default (%s) for %p",
       fio_str_data(&alpn->name), (void *)c->uuid);
@@ -379,16 +650,40 @@ static int fio_tls_pem_passwd_cb(char *buf, int size, int rwflag,
 
 /** Called when the library specific data for the context should be built */
 static void fio_tls_build_context(fio_tls_s *tls) {
+  static volatile uintptr_t last_id;
   fio_tls_destroy_context(tls);
+  tls->id = fio_atomic_add(&last_id, 1); /* the configuration changed */
   /* TODO: Library specific implementation */
 
   /* create new context */
   tls->ctx = SSL_CTX_new(TLS_method());
-  SSL_CTX_set_mode(tls->ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+  SSL_CTX_set_mode(tls->ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                                 SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
   /* see: https://caniuse.com/#search=tls */
   SSL_CTX_set_min_proto_version(tls->ctx, TLS1_2_VERSION);
   SSL_CTX_set_options(tls->ctx, SSL_OP_NO_COMPRESSION);
 
+  /* share session resumption data with all the workers */
+  fio_tls_shared_init();
+#if FIO_TLS_HANDSHAKE_THREADS
+  fio_tls_pool_init();
+#endif
+  SSL_CTX_set_timeout(tls->ctx, FIO_TLS_TICKET_ROTATION);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  SSL_CTX_set_tlsext_ticket_key_evp_cb(tls->ctx, fio_tls_ticket_key_cb);
+#else
+  SSL_CTX_set_tlsext_ticket_key_cb(tls->ctx, fio_tls_ticket_key_cb);
+#endif
+#if FIO_TLS_SESSION_CACHE_LIMIT
+  SSL_CTX_set_session_id_context(tls->ctx, (const unsigned char *)"facil.io",
+                                 8);
+  SSL_CTX_set_session_cache_mode(tls->ctx, SSL_SESS_CACHE_SERVER |
+                                               SSL_SESS_CACHE_NO_INTERNAL);
+  SSL_CTX_sess_set_new_cb(tls->ctx, fio_tls_session_new_cb);
+  SSL_CTX_sess_set_get_cb(tls->ctx, fio_tls_session_get_cb);
+  SSL_CTX_sess_set_remove_cb(tls->ctx, fio_tls_session_remove_cb);
+#endif
+
   /* attach certificates */
   FIO_ARY_FOR(&tls->sni, pos) {
     fio_str_info_s keys[4] = {
@@ -512,6 +807,181 @@ static void fio_tls_build_context(fio_tls_s *tls) {
   FIO_LOG_DEBUG("(re)built TLS context for OpenSSL %p", (void *)tls);
 }
 
+/* *****************************************************************************
+SSL/TLS Handshake Threads
+***************************************************************************** */
+
+/* releases a connection reference, freeing the connection's resources */
+static void fio_tls_connection_free(fio_tls_connection_s *c) {
+  if (fio_atomic_sub(&c->ref, 1))
+    return;
+  if (!c->alpn_ok) {
+    alpn_select((c->alpn_selected ? c->alpn_selected : alpn_default(c->tls)),
+                -1, c->alpn_arg);
+  }
+  /* the socket is closed, don't let OpenSSL invalidate the (shared) session */
+  if (SSL_is_init_finished(c->ssl))
+    SSL_set_shutdown(c->ssl, SSL_RECEIVED_SHUTDOWN | SSL_SENT_SHUTDOWN);
+  SSL_free(c->ssl);
+  fio_tls_destroy(c->tls); /* manage reference count */
+  free(c);
+}
+
+/* performs a handshake step, returning -1 when done or the SSL error code */
+static int fio_tls_handshake_step(fio_tls_connection_s *c) {
+  int ri;
+  if (c->is_server) {
+    ri = SSL_accept(c->ssl);
+  } else {
+    ri = SSL_connect(c->ssl);
+  }
+  if (ri == 1)
+    return -1;
+  return SSL_get_error(c->ssl, ri);
+}
+
+#if FIO_TLS_HANDSHAKE_THREADS
+/*
+ * Handshake steps that have data waiting to be processed (and possibly a
+ * private key operation to perform) are handed to a per-process thread pool,
+ * so a burst of new connections doesn't stall established connections.
+ *
+ * When the queue is full (or the pool isn't running) the step is performed
+ * inline, as if the pool didn't exist.
+ */
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t start;
+  size_t count;
+  uint8_t active;
+  uint8_t initialized;
+  void *threads[FIO_TLS_HANDSHAKE_THREADS];
+  fio_tls_connection_s *queue[TLS_HANDSHAKE_QUEUE_LENGTH];
+} fio_tls_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* pops a connection from the queue, the lock must be held */
+static fio_tls_connection_s *fio_tls_pool_pop_unsafe(void) {
+  fio_tls_connection_s *c = fio_tls_pool.queue[fio_tls_pool.start];
+  fio_tls_pool.start = (fio_tls_pool.start + 1) % TLS_HANDSHAKE_QUEUE_LENGTH;
+  --fio_tls_pool.count;
+  return c;
+}
+
+static void *fio_tls_pool_thread(void *ignr_) {
+  pthread_mutex_lock(&fio_tls_pool.lock);
+  for (;;) {
+    while (fio_tls_pool.active && !fio_tls_pool.count)
+      pthread_cond_wait(&fio_tls_pool.cond, &fio_tls_pool.lock);
+    if (!fio_tls_pool.active)
+      break;
+    fio_tls_connection_s *c = fio_tls_pool_pop_unsafe();
+    pthread_mutex_unlock(&fio_tls_pool.lock);
+
+    fio_lock(&c->hs_lock);
+    if (!c->is_closed) {
+      errno = 0;
+      c->hs_result = fio_tls_handshake_step(c);
+      c->hs_errno = errno;
+      ERR_clear_error(); /* the error queue is thread specific */
+    }
+    fio_unlock(&c->hs_lock);
+    fio_atomic_xchange(&c->hs_state, FIO_TLS_HS_DONE);
+    /* the reactor completes the handshake (ALPN, hooks, protocol) */
+    fio_force_event(c->uuid, FIO_EVENT_ON_DATA);
+    fio_tls_connection_free(c);
+
+    pthread_mutex_lock(&fio_tls_pool.lock);
+  }
+  pthread_mutex_unlock(&fio_tls_pool.lock);
+  return NULL;
+  (void)ignr_;
+}
+
+/* queues a handshake step, returns -1 if the step should be performed inline */
+static int fio_tls_pool_push(fio_tls_connection_s *c) {
+  int ret = -1;
+  pthread_mutex_lock(&fio_tls_pool.lock);
+  if (fio_tls_pool.active && fio_tls_pool.count < TLS_HANDSHAKE_QUEUE_LENGTH) {
+    fio_atomic_add(&c->ref, 1);
+    c->hs_state = FIO_TLS_HS_QUEUED;
+    fio_tls_pool.queue[(fio_tls_pool.start + fio_tls_pool.count) %
+                       TLS_HANDSHAKE_QUEUE_LENGTH] = c;
+    ++fio_tls_pool.count;
+    pthread_cond_signal(&fio_tls_pool.cond);
+    ret = 0;
+  }
+  pthread_mutex_unlock(&fio_tls_pool.lock);
+  return ret;
+}
+
+static void fio_tls_pool_start(void *ignr_) {
+  pthread_mutex_lock(&fio_tls_pool.lock);
+  if (fio_tls_pool.active) {
+    pthread_mutex_unlock(&fio_tls_pool.lock);
+    return;
+  }
+  fio_tls_pool.active = 1;
+  fio_tls_pool.start = 0;
+  fio_tls_pool.count = 0;
+  pthread_mutex_unlock(&fio_tls_pool.lock);
+  for (size_t i = 0; i < FIO_TLS_HANDSHAKE_THREADS; ++i) {
+    fio_tls_pool.threads[i] = fio_thread_new(fio_tls_pool_thread, NULL);
+    if (!fio_tls_pool.threads[i])
+      FIO_LOG_ERROR("couldn't spawn TLS handshake thread.");
+  }
+  FIO_LOG_DEBUG("(%d) started %d TLS handshake threads", (int)getpid(),
+                (int)FIO_TLS_HANDSHAKE_THREADS);
+  (void)ignr_;
+}
+
+static void fio_tls_pool_stop(void *ignr_) {
+  pthread_mutex_lock(&fio_tls_pool.lock);
+  if (!fio_tls_pool.active) {
+    pthread_mutex_unlock(&fio_tls_pool.lock);
+    return;
+  }
+  fio_tls_pool.active = 0;
+  pthread_cond_broadcast(&fio_tls_pool.cond);
+  pthread_mutex_unlock(&fio_tls_pool.lock);
+  for (size_t i = 0; i < FIO_TLS_HANDSHAKE_THREADS; ++i) {
+    if (!fio_tls_pool.threads[i])
+      continue;
+    fio_thread_join(fio_tls_pool.threads[i]); /* also frees the thread */
+    fio_tls_pool.threads[i] = NULL;
+  }
+  /* release connections that were never handled */
+  while (fio_tls_pool.count) {
+    fio_tls_connection_s *c = fio_tls_pool_pop_unsafe();
+    fio_atomic_xchange(&c->hs_state, FIO_TLS_HS_IDLE);
+    fio_tls_connection_free(c);
+  }
+  (void)ignr_;
+}
+
+/* the threads run in every process that accepts connections */
+static void fio_tls_pool_init(void) {
+  pthread_mutex_lock(&fio_tls_pool.lock);
+  if (fio_tls_pool.initialized) {
+    pthread_mutex_unlock(&fio_tls_pool.lock);
+    return;
+  }
+  fio_tls_pool.initialized = 1;
+  pthread_mutex_unlock(&fio_tls_pool.lock);
+  fio_state_callback_add(FIO_CALL_ON_START, fio_tls_pool_start, NULL);
+  fio_state_callback_add(FIO_CALL_ON_FINISH, fio_tls_pool_stop, NULL);
+}
+
+/* tests (without blocking) if the peer sent data the handshake should process */
+static int fio_tls_has_input(intptr_t uuid) {
+  char tmp;
+  return recv(fio_uuid2fd(uuid), &tmp, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+#endif /* FIO_TLS_HANDSHAKE_THREADS */
+
 /* *****************************************************************************
 SSL/TLS RW Hooks
 ***************************************************************************** */
@@ -558,6 +1028,41 @@ static ssize_t fio_tls_read(intptr_t uuid, void *udata, void *buf,
   (void)uuid;
 }
 
+/* writes a single record's worth of data, behaves like `write` */
+static ssize_t fio_tls_write_record(fio_tls_connection_s *c, const void *buf,
+                                    size_t count) {
+  /* small records early on, so the first bytes can be decrypted quickly */
+  const size_t record = (c->sent < TLS_SMALL_RECORD_LIMIT)
+                            ? TLS_SMALL_RECORD_LENGTH
+                            : TLS_BUFFER_LENGTH;
+  if (count > record)
+    count = record;
+  ssize_t ret = SSL_write(c->ssl, buf, count);
+  if (ret > 0) {
+    c->sent += ret;
+    return ret;
+  }
+  ret = SSL_get_error(c->ssl, ret);
+  switch (ret) {
+  case SSL_ERROR_SSL: /* overflow */
+  case SSL_ERROR_ZERO_RETURN:
+    return 0;                      /* EOF */
+  case SSL_ERROR_NONE:             /* overflow */
+  case SSL_ERROR_WANT_CONNECT:     /* overflow */
+  case SSL_ERROR_WANT_ACCEPT:      /* overflow */
+  case SSL_ERROR_WANT_X509_LOOKUP: /* overflow */
+#ifdef SSL_ERROR_WANT_ASYNC
+  case SSL_ERROR_WANT_ASYNC: /* overflow */
+#endif
+  case SSL_ERROR_WANT_WRITE: /* overflow */
+  case SSL_ERROR_WANT_READ:
+  default:
+    break;
+  }
+  errno = EWOULDBLOCK;
+  return -1;
+}
+
 /**
  * When implemented, this function will be called to flush any data remaining
  * in the internal buffer.
@@ -569,9 +1074,26 @@ static ssize_t fio_tls_read(intptr_t uuid, void *udata, void *buf,
  * deadlock might occur.
  */
 static ssize_t fio_tls_flush(intptr_t uuid, void *udata) {
-  (void)uuid;
-  (void)udata;
+  fio_tls_connection_s *c = udata;
+  while (c->len) {
+    ssize_t ret = fio_tls_write_record(c, c->buffer + c->offset, c->len);
+    if (ret <= 0) {
+      if (ret < 0 && errno == EWOULDBLOCK)
+        return c->len;
+      errno = ECONNRESET;
+      return -1;
+    }
+    c->offset += ret;
+    c->len -= ret;
+  }
+  c->offset = 0;
+  if (c->is_closing) {
+    /* the close_notify alert must follow the buffered data */
+    c->is_closing = 0;
+    SSL_shutdown(c->ssl);
+  }
   return 0;
+  (void)uuid;
 }
 
 /**
@@ -587,29 +1109,32 @@ static ssize_t fio_tls_flush(intptr_t uuid, void *udata) {
 static ssize_t fio_tls_write(intptr_t uuid, void *udata, const void *buf,
                              size_t count) {
   fio_tls_connection_s *c = udata;
-  ssize_t ret = SSL_write(c->ssl, buf, count);
-  if (ret > 0)
-    return ret;
-  ret = SSL_get_error(c->ssl, ret);
-  switch (ret) {
-  case SSL_ERROR_SSL: /* overflow */
-  case SSL_ERROR_ZERO_RETURN:
-    return 0;                      /* EOF */
-  case SSL_ERROR_NONE:             /* overflow */
-  case SSL_ERROR_WANT_CONNECT:     /* overflow */
-  case SSL_ERROR_WANT_ACCEPT:      /* overflow */
-  case SSL_ERROR_WANT_X509_LOOKUP: /* overflow */
-#ifdef SSL_ERROR_WANT_ASYNC
-  case SSL_ERROR_WANT_ASYNC: /* overflow */
-#endif
-  case SSL_ERROR_WANT_WRITE: /* overflow */
-  case SSL_ERROR_WANT_READ:
-  default:
-    break;
+  if (c->offset + c->len == TLS_BUFFER_LENGTH) {
+    /* buffer is full, emit the buffered records before accepting more data */
+    ssize_t remaining = fio_tls_flush(uuid, udata);
+    if (remaining < 0)
+      return -1;
+    if (remaining) {
+      /* some records were sent, the copy below compacts the buffer */
+      if (c->len < TLS_BUFFER_LENGTH)
+        goto copy;
+      errno = EWOULDBLOCK;
+      return -1;
+    }
   }
-  errno = EWOULDBLOCK;
-  return -1;
-  (void)uuid;
+  /* an empty buffer and a full record - no need to copy the data */
+  if (!c->len && count >= TLS_BUFFER_LENGTH)
+    return fio_tls_write_record(c, buf, count);
+copy:
+  if (c->offset && c->len + count > TLS_BUFFER_LENGTH - c->offset) {
+    memmove(c->buffer, c->buffer + c->offset, c->len);
+    c->offset = 0;
+  }
+  if (count > TLS_BUFFER_LENGTH - (c->offset + c->len))
+    count = TLS_BUFFER_LENGTH - (c->offset + c->len);
+  memcpy(c->buffer + c->offset + c->len, buf, count);
+  c->len += count;
+  return count;
 }
 
 /**
@@ -623,22 +1148,23 @@ static ssize_t fio_tls_write(intptr_t uuid, void *udata, const void *buf,
  * */
 static ssize_t fio_tls_before_close(intptr_t uuid, void *udata) {
   fio_tls_connection_s *c = udata;
-  SSL_shutdown(c->ssl);
+  if (c->hs_state == FIO_TLS_HS_QUEUED)
+    return 0; /* a handshake thread owns the SSL object, nothing to flush */
+  c->is_closing = 1; /* `fio_tls_flush` will call SSL_shutdown */
+  fio_tls_flush(uuid, udata);
   return 1;
-  (void)uuid;
 }
 /**
  * Called to perform cleanup after the socket was closed.
  * */
 static void fio_tls_cleanup(void *udata) {
   fio_tls_connection_s *c = udata;
-  if (!c->alpn_ok) {
-    alpn_select(alpn_default(c->tls), -1, c->alpn_arg);
-  }
-  SSL_free(c->ssl);
+  /* wait for a handshake thread that might be using the (soon closed) fd */
+  fio_lock(&c->hs_lock);
+  c->is_closed = 1;
+  fio_unlock(&c->hs_lock);
   FIO_LOG_DEBUG("TLS cleanup for %p", (void *)c->uuid);
-  fio_tls_destroy(c->tls); /* manage reference count */
-  free(udata);
+  fio_tls_connection_free(c);
 }
 
 static fio_rw_hook_s FIO_TLS_HOOKS = {
@@ -652,13 +1178,24 @@ static fio_rw_hook_s FIO_TLS_HOOKS = {
 static size_t fio_tls_handshake(intptr_t uuid, void *udata) {
   fio_tls_connection_s *c = udata;
   int ri;
-  if (c->is_server) {
-    ri = SSL_accept(c->ssl);
-  } else {
-    ri = SSL_connect(c->ssl);
+#if FIO_TLS_HANDSHAKE_THREADS
+  switch (c->hs_state) {
+  case FIO_TLS_HS_QUEUED:
+    return 0;
+  case FIO_TLS_HS_DONE:
+    fio_atomic_xchange(&c->hs_state, FIO_TLS_HS_IDLE);
+    ri = c->hs_result;
+    errno = c->hs_errno;
+    break;
+  default:
+    if (fio_tls_has_input(uuid) && !fio_tls_pool_push(c))
+      return 0;
+    ri = fio_tls_handshake_step(c);
   }
-  if (ri != 1) {
-    ri = SSL_get_error(c->ssl, ri);
+#else
+  ri = fio_tls_handshake_step(c);
+#endif
+  if (ri != -1) {
     switch (ri) {
     case SSL_ERROR_NONE:
       // FIO_LOG_DEBUG("SSL_accept/SSL_connect %p state: SSL_ERROR_NONE",
@@ -722,10 +1259,18 @@ static size_t fio_tls_handshake(intptr_t uuid, void *udata) {
     fio_defer(fio_tls_delayed_close, (void *)uuid, NULL);
     return 0;
   }
+  if (c->is_server) {
+    fio_atomic_add(&fio_tls_shared->stats.handshakes, 1);
+    if (SSL_session_reused(c->ssl))
+      fio_atomic_add(&fio_tls_shared->stats.resumed, 1);
+  }
   if (!c->alpn_ok) {
     c->alpn_ok = 1;
     if (c->is_server) {
-      fio_tls_alpn_fallback(c);
+      if (c->alpn_selected)
+        alpn_select(c->alpn_selected, c->uuid, c->alpn_arg);
+      else
+        fio_tls_alpn_fallback(c);
     } else {
       const unsigned char *proto;
       unsigned int proto_len;
@@ -814,14 +1359,23 @@ static inline void fio_tls_attach2uuid(intptr_t uuid, fio_tls_s *tls,
   /* create SSL connection context from global context */
   fio_tls_connection_s *c = malloc(sizeof(*c));
   FIO_ASSERT_ALLOC(c);
-  *c = (fio_tls_connection_s){
-      .alpn_arg = udata,
-      .tls = tls,
-      .uuid = uuid,
-      .ssl = SSL_new(tls->ctx),
-      .is_server = is_server,
-      .alpn_ok = 0,
-  };
+  c->alpn_arg = udata;
+  c->tls = tls;
+  c->uuid = uuid;
+  c->ssl = SSL_new(tls->ctx);
+  c->sent = 0;
+  c->offset = 0;
+  c->len = 0;
+  c->is_server = is_server;
+  c->is_closing = 0;
+  c->alpn_ok = 0;
+  c->alpn_selected = NULL;
+  c->hs_state = FIO_TLS_HS_IDLE;
+  c->is_closed = 0;
+  c->hs_lock = FIO_LOCK_INIT;
+  c->hs_result = 0;
+  c->hs_errno = 0;
+  c->ref = 1;
   FIO_ASSERT_ALLOC(c->ssl);
   /* set facil.io data in the SSL object */
   SSL_set_ex_data(c->ssl, 0, (void *)c);
@@ -935,6 +1489,14 @@ uintptr_t FIO_TLS_WEAK fio_tls_alpn_count(fio_tls_s *tls) {
   return tls ? alpn_list_count(&tls->alpn) : 0;
 }
 
+/**
+ * Returns a number identifying the TLS object's current configuration.
+ *
+ * The number is unique within the process and changes whenever certificates,
+ * ALPN protocols or trusted certificates are added. Returns 0 for NULL.
+ */
+uintptr_t FIO_TLS_WEAK fio_tls_id(fio_tls_s *tls) { return tls ? tls->id : 0; }
+
 /**
  * Adds a certificate to the "trust" list, which automatically adds a peer
  * verification requirement.
@@ -989,6 +1551,18 @@ void FIO_TLS_WEAK fio_tls_connect(intptr_t uuid, fio_tls_s *tls, void *udata) {
   fio_tls_attach2uuid(uuid, tls, udata, 0);
 }
 
+/**
+ * Returns the session resumption statistics collected so far.
+ *
+ * The statistics are collected in shared memory, so they reflect all the
+ * worker processes.
+ */
+fio_tls_stats_s FIO_TLS_WEAK fio_tls_stats(void) {
+  if (!fio_tls_shared)
+    return (fio_tls_stats_s){.handshakes = 0};
+  return fio_tls_shared->stats;
+}
+
 /**
  * Increase the reference count for the TLS object.
  *
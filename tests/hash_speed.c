@@ -0,0 +1,226 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+This program benchmarks the hashing functions available to `FIO_HASH_FN`
+(SipHash 1-3 / 2-4, Risky Hash and the AES-NI based `fio_aes_hash`).
+
+For every key size, the time per hash and the throughput are printed. Short
+keys (header names, channel names, etc') are the common case for hash maps.
+
+The collision quality of each function is also tested:
+
+* Sequential keys ("key-0", "key-1", ...) are hashed and the number of full (64
+  bit) collisions is counted, as well as the number of bucket collisions when
+  using the low / high bits of the hash, compared with the number expected for
+  random values.
+
+* Avalanche: a single input bit is flipped and the probability of each output
+  bit changing is measured. The worst bias (distance from 50%) is printed.
+
+On x86_64 CPUs the AES-NI code path is detected at runtime. Compile with
+`-maes` (or `-march=native`) to use it unconditionally.
+
+use: make test/lib/hash_speed
+*/
+#include <fio.h>
+#include <fio_cli.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* *****************************************************************************
+Hashing functions (wrapped using the same keys)
+***************************************************************************** */
+
+typedef uint64_t (*hash_fn)(const void *data, size_t len);
+
+static uint64_t hash_siphash13(const void *data, size_t len) {
+  return fio_siphash13(data, len, FIO_HASH_SECRET_SEED64_1,
+                       FIO_HASH_SECRET_SEED64_2);
+}
+static uint64_t hash_siphash24(const void *data, size_t len) {
+  return fio_siphash24(data, len, FIO_HASH_SECRET_SEED64_1,
+                       FIO_HASH_SECRET_SEED64_2);
+}
+static uint64_t hash_risky(const void *data, size_t len) {
+  return fio_risky_hash(data, len, FIO_HASH_SECRET_SEED64_1);
+}
+static uint64_t hash_aes(const void *data, size_t len) {
+  return fio_aes_hash(data, len, FIO_HASH_SECRET_SEED64_1,
+                      FIO_HASH_SECRET_SEED64_2);
+}
+
+static struct {
+  hash_fn fn;
+  const char *name;
+} hash_funcs[] = {
+    {.fn = hash_siphash13, .name = "fio_siphash13"},
+    {.fn = hash_siphash24, .name = "fio_siphash24"},
+    {.fn = hash_risky, .name = "fio_risky_hash"},
+    {.fn = hash_aes, .name = "fio_aes_hash"},
+    {.fn = NULL, .name = NULL},
+};
+
+/* *****************************************************************************
+Speed
+***************************************************************************** */
+
+static double seconds_since(struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) +
+         ((end.tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+static void test_speed(hash_fn fn, const char *name, double limit) {
+  static const size_t sizes[] = {1,  3,  4,   7,   8,    12,   16, 24,
+                                 32, 48, 64, 128, 256, 1024, 8192, 0};
+  static uint8_t buffer[8192];
+  fio_rand_bytes(buffer, sizeof(buffer));
+  fprintf(stderr, "* %s:\n", name);
+  for (size_t i = 0; sizes[i]; ++i) {
+    const size_t len = sizes[i];
+    uint64_t hash = 0;
+    size_t cycles = 0;
+    struct timespec start;
+    double time = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    /* test in batches, until the time limit is reached */
+    do {
+      for (size_t j = 0; j < 4096; ++j) {
+        hash += fn(buffer, len);
+        __asm__ volatile("" ::: "memory");
+      }
+      cycles += 4096;
+      time = seconds_since(&start);
+    } while (time < limit);
+    fprintf(stderr, "\t%5zu bytes: %8.2f ns / hash %10.2f MB/s\n", len,
+            (time * 1000000000.0) / cycles,
+            ((double)len * cycles) / (time * 1024.0 * 1024.0));
+    buffer[0] ^= (uint8_t)hash;
+  }
+}
+
+/* *****************************************************************************
+Collisions and avalanche
+***************************************************************************** */
+
+static int cmp_u64(const void *a, const void *b) {
+  const uint64_t x = *(const uint64_t *)a;
+  const uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+/* counts the values that share a bucket with a previous value */
+static size_t bucket_collisions(uint64_t *hashes, size_t count, size_t bits,
+                                int high) {
+  uint8_t *buckets = calloc(1, (size_t)1 << bits);
+  FIO_ASSERT_ALLOC(buckets);
+  size_t collisions = 0;
+  for (size_t i = 0; i < count; ++i) {
+    const size_t b = (size_t)(high ? (hashes[i] >> (64 - bits))
+                                   : (hashes[i] & ((1ULL << bits) - 1)));
+    collisions += buckets[b];
+    buckets[b] = 1;
+  }
+  free(buckets);
+  return collisions;
+}
+
+static void test_collisions(hash_fn fn, const char *name, size_t count) {
+  const size_t bits = 20;
+  const double buckets = (double)(1ULL << bits);
+  const double expected =
+      count - buckets * (1.0 - pow(1.0 - 1.0 / buckets, (double)count));
+  uint64_t *hashes = malloc(sizeof(*hashes) * count);
+  FIO_ASSERT_ALLOC(hashes);
+  char key[32];
+  for (size_t i = 0; i < count; ++i) {
+    size_t len = (size_t)snprintf(key, sizeof(key), "key-%zu", i);
+    hashes[i] = fn(key, len);
+  }
+  const size_t low = bucket_collisions(hashes, count, bits, 0);
+  const size_t high = bucket_collisions(hashes, count, bits, 1);
+  qsort(hashes, count, sizeof(*hashes), cmp_u64);
+  size_t full = 0;
+  for (size_t i = 1; i < count; ++i)
+    full += (hashes[i] == hashes[i - 1]);
+  free(hashes);
+
+  /* avalanche: flip every input bit of random 4 / 16 / 64 byte keys */
+  const size_t lengths[] = {4, 16, 64};
+  const size_t samples = 1024;
+  double worst = 0;
+  for (size_t l = 0; l < 3; ++l) {
+    const size_t len = lengths[l];
+    size_t flips[64] = {0};
+    uint8_t data[64];
+    for (size_t s = 0; s < samples; ++s) {
+      fio_rand_bytes(data, len);
+      const uint64_t org = fn(data, len);
+      for (size_t bit = 0; bit < (len << 3); ++bit) {
+        data[bit >> 3] ^= (uint8_t)(1U << (bit & 7));
+        const uint64_t diff = org ^ fn(data, len);
+        data[bit >> 3] ^= (uint8_t)(1U << (bit & 7));
+        for (size_t o = 0; o < 64; ++o)
+          flips[o] += (diff >> o) & 1;
+      }
+    }
+    for (size_t o = 0; o < 64; ++o) {
+      const double p = (double)flips[o] / (double)(samples * (len << 3));
+      if (fabs(p - 0.5) > worst)
+        worst = fabs(p - 0.5);
+    }
+  }
+  fprintf(stderr,
+          "* %s:\n"
+          "\t%zu sequential keys, %zu full collisions\n"
+          "\t%zu bit buckets: %zu (low bits) / %zu (high bits) collisions "
+          "(%.0f expected)\n"
+          "\tavalanche worst bias: %.2f%%\n",
+          name, count, full, bits, low, high, expected, worst * 100.0);
+}
+
+/* *****************************************************************************
+Main
+***************************************************************************** */
+
+int main(int argc, char const *argv[]) {
+  fio_cli_start(
+      argc, argv, 0, 0,
+      "This program benchmarks the hashing functions available to "
+      "FIO_HASH_FN and tests their collision quality.",
+      FIO_CLI_STRING("-test -t test only the specified function (i.e., "
+                     "fio_aes_hash)."),
+      FIO_CLI_INT("-time -ms milliseconds per key size (default 100)."),
+      FIO_CLI_INT("-keys -n number of keys for collision tests (default "
+                  "1048576)."));
+  fio_cli_set_default("-ms", "100");
+  fio_cli_set_default("-n", "1048576");
+  const double limit = fio_cli_get_i("-ms") / 1000.0;
+  const size_t count = (size_t)fio_cli_get_i("-n");
+#if FIO_AES_HASH_NI
+  const int aes_ni = fio_aes_hash_ni_available();
+#else
+  const int aes_ni = 0;
+#endif
+  fprintf(stderr, "Hash function benchmark (AES-NI %s):\n",
+          (aes_ni ? "enabled" : "unavailable, using Risky Hash"));
+  for (size_t i = 0; hash_funcs[i].fn; ++i) {
+    if (fio_cli_get("-t") && strcmp(fio_cli_get("-t"), hash_funcs[i].name))
+      continue;
+    test_speed(hash_funcs[i].fn, hash_funcs[i].name, limit);
+  }
+  fprintf(stderr, "Collisions:\n");
+  for (size_t i = 0; hash_funcs[i].fn; ++i) {
+    if (fio_cli_get("-t") && strcmp(fio_cli_get("-t"), hash_funcs[i].name))
+      continue;
+    test_collisions(hash_funcs[i].fn, hash_funcs[i].name, count);
+  }
+  fio_cli_end();
+  return 0;
+}
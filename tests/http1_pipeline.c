@@ -0,0 +1,182 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+This program benchmarks the HTTP/1.1 pipelining performance.
+
+A local HTTP server is started and a client thread sends batches of pipelined
+requests over a number of keep-alive connections, counting the responses.
+
+use: make test/lib/http1_pipeline
+*/
+#include <fio.h>
+#include <fio_cli.h>
+#include <http.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RESPONSE_BODY "Hello World!"
+
+static void on_request(http_s *h) {
+  http_send_body(h, RESPONSE_BODY, sizeof(RESPONSE_BODY) - 1);
+}
+
+/* *****************************************************************************
+The client thread
+***************************************************************************** */
+
+/* counts responses, `tail` holds the bytes a match might be split over */
+static size_t count_responses(char *tail, size_t *tail_len, char *buf,
+                              size_t len) {
+  const size_t match_len = sizeof(RESPONSE_BODY) - 1;
+  size_t count = 0;
+  /* test matches that start in the previous read */
+  char seam[sizeof(RESPONSE_BODY) << 1];
+  const size_t seam_len = *tail_len + (len < match_len ? len : match_len - 1);
+  memcpy(seam, tail, *tail_len);
+  memcpy(seam + *tail_len, buf, seam_len - *tail_len);
+  for (size_t i = 0; i < *tail_len && i + match_len <= seam_len; ++i) {
+    if (!memcmp(seam + i, RESPONSE_BODY, match_len))
+      ++count;
+  }
+  for (char *pos = buf; (size_t)(pos - buf) + match_len <= len;) {
+    pos = memmem(pos, len - (pos - buf), RESPONSE_BODY, match_len);
+    if (!pos)
+      break;
+    ++count;
+    pos += match_len;
+  }
+  /* keep the last bytes, in case a match is split between reads */
+  *tail_len = seam_len < match_len - 1 ? seam_len : match_len - 1;
+  if (len >= *tail_len)
+    memcpy(tail, buf + len - *tail_len, *tail_len);
+  else
+    memcpy(tail, seam + seam_len - *tail_len, *tail_len);
+  return count;
+}
+
+static void *client_thread(void *port_) {
+  const char *port = port_;
+  const size_t connections = fio_cli_get_i("-c");
+  const size_t depth = fio_cli_get_i("-d");
+  const size_t rounds = fio_cli_get_i("-r");
+  const char request[] = "GET / HTTP/1.1\r\nHost: localhost\r\n"
+                         "User-Agent: facil.io pipelining benchmark\r\n\r\n";
+  char *batch = malloc((sizeof(request) - 1) * depth);
+  char *buf = malloc(1 << 16);
+  int *fds = calloc(sizeof(*fds), connections);
+  FIO_ASSERT_ALLOC(batch && buf && fds);
+  for (size_t i = 0; i < depth; ++i)
+    memcpy(batch + (i * (sizeof(request) - 1)), request, sizeof(request) - 1);
+
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(atoi(port)),
+      .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  for (size_t i = 0; i < connections; ++i) {
+    fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+    if (fds[i] == -1 ||
+        connect(fds[i], (struct sockaddr *)&addr, sizeof(addr))) {
+      perror("ERROR: couldn't connect to the benchmark server");
+      goto finish;
+    }
+  }
+
+  struct timespec start, end;
+  size_t total = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < connections; ++i) {
+      if (write(fds[i], batch, (sizeof(request) - 1) * depth) !=
+          (ssize_t)((sizeof(request) - 1) * depth)) {
+        perror("ERROR: couldn't send requests");
+        goto finish;
+      }
+    }
+    for (size_t i = 0; i < connections; ++i) {
+      char tail[sizeof(RESPONSE_BODY)];
+      size_t tail_len = 0;
+      size_t count = 0;
+      while (count < depth) {
+        ssize_t l = read(fds[i], buf, 1 << 16);
+        if (l <= 0) {
+          perror("ERROR: couldn't read responses");
+          goto finish;
+        }
+        count += count_responses(tail, &tail_len, buf, l);
+      }
+      total += count;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - start.tv_sec) +
+                   ((end.tv_nsec - start.tv_nsec) / 1000000000.0);
+  fprintf(stderr,
+          "* %zu connections X %zu pipelined requests X %zu rounds:\n"
+          "\t%zu responses in %.3f seconds (%.0f req/sec)\n",
+          connections, depth, rounds, total, seconds, total / seconds);
+
+finish:
+  for (size_t i = 0; i < connections; ++i) {
+    if (fds[i] > 0)
+      close(fds[i]);
+  }
+  free(fds);
+  free(buf);
+  free(batch);
+  fio_stop();
+  return NULL;
+}
+
+static void start_client(void *port) {
+  void *thr = fio_thread_new(client_thread, port);
+  if (!thr) {
+    FIO_LOG_ERROR("couldn't start client thread.");
+    fio_stop();
+    return;
+  }
+  fio_thread_free(thr);
+}
+
+/* *****************************************************************************
+Main
+***************************************************************************** */
+
+int main(int argc, char const *argv[]) {
+  fio_cli_start(argc, argv, 0, 0,
+                "This program benchmarks HTTP/1.1 pipelining performance "
+                "using a local server and a blocking client thread.",
+                FIO_CLI_INT("-port -p the port to listen to (default 3000)."),
+                FIO_CLI_INT("-threads -t server threads (default 1)."),
+                FIO_CLI_INT("-connections -c client connections (default 8)."),
+                FIO_CLI_INT("-depth -d requests per batch (default 128)."),
+                FIO_CLI_INT("-rounds -r batches per connection (default 500)."));
+  fio_cli_set_default("-p", "3000");
+  fio_cli_set_default("-t", "1");
+  fio_cli_set_default("-c", "8");
+  fio_cli_set_default("-d", "128");
+  fio_cli_set_default("-r", "500");
+  if (fio_cli_get_i("-c") < 1 || fio_cli_get_i("-d") < 1 ||
+      fio_cli_get_i("-r") < 1) {
+    FIO_LOG_ERROR("connections, depth and rounds must be positive.");
+    exit(-1);
+  }
+  if (http_listen(fio_cli_get("-p"), NULL, .on_request = on_request,
+                  .max_header_size = (1 << 14)) == -1) {
+    perror("ERROR: couldn't start the benchmark server");
+    exit(-1);
+  }
+  fio_state_callback_add(FIO_CALL_ON_START, start_client,
+                         (void *)fio_cli_get("-p"));
+  fio_start(.threads = fio_cli_get_i("-t"), .workers = 1);
+  fio_cli_end();
+  return 0;
+}
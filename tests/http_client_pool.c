@@ -0,0 +1,137 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+This program benchmarks `http_connect` with and without connection reuse.
+
+A local HTTP server is started and a number of concurrent clients perform
+sequential requests, each request using a new `http_connect` call. The first
+round sends `connection: close` (a new connection per request), the second
+round allows idle connections to be pooled and reused.
+
+use: make test/lib/http_client_pool
+*/
+#include <fio.h>
+#include <fio_cli.h>
+#include <http.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RESPONSE_BODY "Hello World!"
+
+static void on_request(http_s *h) {
+  http_send_body(h, RESPONSE_BODY, sizeof(RESPONSE_BODY) - 1);
+}
+
+/* *****************************************************************************
+The client
+***************************************************************************** */
+
+static struct {
+  char url[64];
+  size_t requests; /* requests per round */
+  size_t started;
+  size_t completed;
+  size_t failed;
+  uint8_t reuse;
+  struct timespec start;
+} bench;
+
+static void start_request(void);
+
+static double seconds_since(struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) +
+         ((end.tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+static void start_round(void *ignr_) {
+  bench.started = bench.completed = bench.failed = 0;
+  clock_gettime(CLOCK_MONOTONIC, &bench.start);
+  for (size_t i = 0; i < (size_t)fio_cli_get_i("-c"); ++i)
+    start_request();
+  (void)ignr_;
+}
+
+static void start_round_task(void *ignr1_, void *ignr2_) {
+  start_round(NULL);
+  (void)ignr1_;
+  (void)ignr2_;
+}
+
+static void on_response(http_s *h) {
+  if (h->status_str == FIOBJ_INVALID) {
+    /* the connection is ready, send the request */
+    if (!bench.reuse)
+      http_set_header2(
+          h, (fio_str_info_s){.data = (char *)"connection", .len = 10},
+          (fio_str_info_s){.data = (char *)"close", .len = 5});
+    http_finish(h);
+    return;
+  }
+  if (h->status != 200)
+    ++bench.failed;
+  if (fio_atomic_add(&bench.completed, 1) == bench.requests) {
+    double seconds = seconds_since(&bench.start);
+    fprintf(stderr,
+            "* %s:\n"
+            "\t%zu requests in %.3f seconds (%.0f req/sec, %zu failed)\n",
+            bench.reuse ? "reusing pooled connections"
+                        : "a new connection per request",
+            bench.requests, seconds, bench.requests / seconds, bench.failed);
+    if (bench.reuse) {
+      fio_stop();
+      return;
+    }
+    bench.reuse = 1;
+    fio_defer(start_round_task, NULL, NULL);
+    return;
+  }
+  start_request();
+}
+
+static void start_request(void) {
+  if (fio_atomic_add(&bench.started, 1) > bench.requests)
+    return;
+  if (http_connect(bench.url, NULL, .on_response = on_response) == -1) {
+    FIO_LOG_ERROR("couldn't connect to the benchmark server.");
+    fio_stop();
+  }
+}
+
+/* *****************************************************************************
+Main
+***************************************************************************** */
+
+int main(int argc, char const *argv[]) {
+  fio_cli_start(argc, argv, 0, 0,
+                "This program benchmarks HTTP client connection reuse "
+                "using a local server.",
+                FIO_CLI_INT("-port -p the port to listen to (default 3000)."),
+                FIO_CLI_INT("-threads -t server threads (default 1)."),
+                FIO_CLI_INT("-concurrency -c concurrent clients (default 4)."),
+                FIO_CLI_INT("-requests -r requests per round (default 20000)."));
+  fio_cli_set_default("-p", "3000");
+  fio_cli_set_default("-t", "1");
+  fio_cli_set_default("-c", "4");
+  fio_cli_set_default("-r", "20000");
+  if (fio_cli_get_i("-c") < 1 || fio_cli_get_i("-r") < 1) {
+    FIO_LOG_ERROR("concurrency and requests must be positive.");
+    exit(-1);
+  }
+  bench.requests = fio_cli_get_i("-r");
+  snprintf(bench.url, sizeof(bench.url), "http://127.0.0.1:%s/",
+           fio_cli_get("-p"));
+  if (http_listen(fio_cli_get("-p"), NULL, .on_request = on_request) == -1) {
+    perror("ERROR: couldn't start the benchmark server");
+    exit(-1);
+  }
+  fio_state_callback_add(FIO_CALL_ON_START, start_round, NULL);
+  fio_start(.threads = fio_cli_get_i("-t"), .workers = 1);
+  fio_cli_end();
+  return 0;
+}
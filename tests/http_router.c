@@ -0,0 +1,159 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+This program benchmarks the HTTP request router.
+
+A router with a large number of routes is built and requests are routed
+directly (without a network layer), comparing the radix tree lookup with a
+linear scan over the same routes.
+
+use: make test/lib/http_router
+*/
+#include <fio.h>
+#include <fio_cli.h>
+#include <http.h>
+#include <http_internal.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static size_t handled;
+static void on_route(http_s *h) {
+  ++handled;
+  (void)h;
+}
+
+static double seconds_since(struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) +
+         ((end.tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+/* *****************************************************************************
+A linear scan (the naive alternative)
+***************************************************************************** */
+
+/* matches a path against a route pattern, segment by segment */
+static int linear_match(const char *pattern, const char *path, size_t len) {
+  const char *end = path + len;
+  while (*pattern && path < end) {
+    if (*pattern == ':') {
+      while (*pattern && *pattern != '/')
+        ++pattern;
+      while (path < end && *path != '/')
+        ++path;
+      continue;
+    }
+    if (*pattern != *path)
+      return 0;
+    ++pattern;
+    ++path;
+  }
+  return !*pattern && path == end;
+}
+
+/* *****************************************************************************
+Main
+***************************************************************************** */
+
+int main(int argc, char const *argv[]) {
+  fio_cli_start(argc, argv, 0, 0,
+                "This program benchmarks the HTTP request router.",
+                FIO_CLI_INT("-routes -r resources to route (default 1024)."),
+                FIO_CLI_INT("-lookups -l lookups to perform (default 2000000)."));
+  fio_cli_set_default("-r", "1024");
+  fio_cli_set_default("-l", "2000000");
+  const size_t resources = fio_cli_get_i("-r");
+  const size_t lookups = fio_cli_get_i("-l");
+  if (resources < 1 || lookups < 1) {
+    FIO_LOG_ERROR("routes and lookups must be positive.");
+    exit(-1);
+  }
+
+  /* each resource adds 3 routes */
+  char **patterns = malloc(sizeof(*patterns) * resources * 3);
+  char **paths = malloc(sizeof(*paths) * resources);
+  FIO_ASSERT_ALLOC(patterns && paths);
+  http_router_s *router = http_router_new();
+  for (size_t i = 0; i < resources; ++i) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "/api/v1/res%zu/:id/items", i);
+    patterns[i * 3] = strdup(buf);
+    snprintf(buf, sizeof(buf), "/api/v1/res%zu/:id", i);
+    patterns[(i * 3) + 1] = strdup(buf);
+    snprintf(buf, sizeof(buf), "/api/v1/res%zu", i);
+    patterns[(i * 3) + 2] = strdup(buf);
+    snprintf(buf, sizeof(buf), "/api/v1/res%zu/%zu/items", i, i * 7);
+    paths[i] = strdup(buf);
+    for (size_t j = 0; j < 3; ++j) {
+      FIO_ASSERT(!http_router_add(router, "GET", patterns[(i * 3) + j],
+                                  on_route),
+                 "couldn't add route");
+    }
+  }
+  FIO_ASSERT(!http_router_build(router), "couldn't build router");
+
+  http_s h = {.method = fiobj_str_new("GET", 3)};
+  FIOBJ *path_objs = malloc(sizeof(*path_objs) * resources);
+  FIO_ASSERT_ALLOC(path_objs);
+  for (size_t i = 0; i < resources; ++i)
+    path_objs[i] = fiobj_str_new(paths[i], strlen(paths[i]));
+
+  /* radix tree */
+  struct timespec start;
+  handled = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < lookups; ++i) {
+    h.path = path_objs[(i * 7919) % resources];
+    http_router_route(router, &h);
+    fiobj_free(h.params);
+    h.params = FIOBJ_INVALID;
+  }
+  double seconds = seconds_since(&start);
+  FIO_ASSERT(handled == lookups, "router missed routes (%zu/%zu)", handled,
+             lookups);
+  fprintf(stderr,
+          "* radix tree, %zu routes:\n"
+          "\t%zu lookups in %.3f seconds (%.0f lookups/sec)\n",
+          resources * 3, lookups, seconds, lookups / seconds);
+
+  /* linear scan (fewer lookups, it's slow) */
+  const size_t linear_lookups = lookups / 100 ? lookups / 100 : 1;
+  handled = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < linear_lookups; ++i) {
+    fio_str_info_s path =
+        fiobj_obj2cstr(path_objs[(i * 7919) % resources]);
+    for (size_t j = 0; j < resources * 3; ++j) {
+      if (linear_match(patterns[j], path.data, path.len)) {
+        on_route(&h);
+        break;
+      }
+    }
+  }
+  seconds = seconds_since(&start);
+  FIO_ASSERT(handled == linear_lookups, "linear scan missed routes");
+  fprintf(stderr,
+          "* linear scan, %zu routes:\n"
+          "\t%zu lookups in %.3f seconds (%.0f lookups/sec)\n",
+          resources * 3, linear_lookups, seconds, linear_lookups / seconds);
+
+  for (size_t i = 0; i < resources; ++i) {
+    fiobj_free(path_objs[i]);
+    free(paths[i]);
+  }
+  for (size_t i = 0; i < resources * 3; ++i)
+    free(patterns[i]);
+  free(path_objs);
+  free(paths);
+  free(patterns);
+  fiobj_free(h.method);
+  http_router_free(router); /* the build's reference */
+  http_router_free(router);
+  fio_cli_end();
+  return 0;
+}
@@ -0,0 +1,257 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+This program benchmarks the JSON parser, both on it's own (with callbacks that
+do nothing) and when building FIOBJ objects using `fiobj_json2obj`, as well as
+the JSON formatter (`fiobj_obj2json` and the chunked
+`fiobj_obj2json_stream_next`).
+
+By default, two synthetic corpora are generated: a "twitter.json" style corpus
+(objects with many String fields, escapes and nesting) and a "canada.json"
+style corpus (long arrays of floating point coordinates). JSON files (such as
+the original twitter.json / canada.json) can be benchmarked instead, by passing
+their names as arguments.
+
+To compare the structural index with the scalar parser, run the benchmark
+twice, the second time compiling with `-DJSON_SIMD=0`.
+
+use: make test/lib/json_parse
+*/
+#include <fio.h>
+#include <fio_cli.h>
+#include <fiobj.h>
+
+#include <fio_json_parser.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* *****************************************************************************
+Parser only callbacks (counting the objects)
+***************************************************************************** */
+
+static size_t counter;
+
+static void fio_json_on_null(json_parser_s *p) {
+  ++counter;
+  (void)p;
+}
+static void fio_json_on_true(json_parser_s *p) {
+  ++counter;
+  (void)p;
+}
+static void fio_json_on_false(json_parser_s *p) {
+  ++counter;
+  (void)p;
+}
+static void fio_json_on_number(json_parser_s *p, long long i) {
+  ++counter;
+  (void)p;
+  (void)i;
+}
+static void fio_json_on_float(json_parser_s *p, double f) {
+  ++counter;
+  (void)p;
+  (void)f;
+}
+static void fio_json_on_string(json_parser_s *p, void *start, size_t length) {
+  ++counter;
+  (void)p;
+  (void)start;
+  (void)length;
+}
+static int fio_json_on_start_object(json_parser_s *p) {
+  ++counter;
+  return 0;
+  (void)p;
+}
+static void fio_json_on_end_object(json_parser_s *p) { (void)p; }
+static int fio_json_on_start_array(json_parser_s *p) {
+  ++counter;
+  return 0;
+  (void)p;
+}
+static void fio_json_on_end_array(json_parser_s *p) { (void)p; }
+static void fio_json_on_json(json_parser_s *p) { (void)p; }
+static void fio_json_on_error(json_parser_s *p) {
+  counter = (size_t)-1;
+  (void)p;
+}
+
+/* *****************************************************************************
+Synthetic corpora
+***************************************************************************** */
+
+static FIOBJ corpus_twitter(size_t count) {
+  FIOBJ json = fiobj_str_buf(count * 1024);
+  fiobj_str_write(json, "{\n  \"statuses\": [\n", 18);
+  for (size_t i = 0; i < count; ++i) {
+    fiobj_str_printf(
+        json,
+        "%s    {\n"
+        "      \"created_at\": \"Sun Aug 31 00:29:%02zu +0000 2014\",\n"
+        "      \"id\": %zu,\n"
+        "      \"id_str\": \"%zu\",\n"
+        "      \"text\": \"@aym0566x \\n\\u540d\\u524d:\\u524d\\u7530\\u3042"
+        "\\u3086\\u307f \\\"quoted\\\" and a \\\\ backslash, with a "
+        "link https:\\/\\/t.co\\/%zu\",\n"
+        "      \"truncated\": false,\n"
+        "      \"entities\": {\"hashtags\": [], \"symbols\": [], \"urls\": "
+        "[{\"url\": \"http:\\/\\/t.co\\/%zu\", \"indices\": [%zu, %zu]}]},\n"
+        "      \"user\": {\n"
+        "        \"id\": %zu,\n"
+        "        \"name\": \"user number %zu\",\n"
+        "        \"screen_name\": \"user_%zu\",\n"
+        "        \"description\": \"A somewhat longer description, written by "
+        "a user that likes to write long descriptions about nothing at "
+        "all.\",\n"
+        "        \"followers_count\": %zu,\n"
+        "        \"verified\": %s,\n"
+        "        \"profile_background_color\": \"C0DEED\",\n"
+        "        \"lang\": \"ja\"\n"
+        "      },\n"
+        "      \"geo\": null,\n"
+        "      \"retweet_count\": %zu,\n"
+        "      \"favorited\": false,\n"
+        "      \"lang\": \"ja\"\n"
+        "    }",
+        (i ? ",\n" : ""), i % 60, (size_t)505874924095815681ULL + i,
+        (size_t)505874924095815681ULL + i, i, i, i % 140, (i % 140) + 22,
+        (size_t)1186275104ULL + i, i, i, (i * 7919) % 100000,
+        ((i & 7) ? "false" : "true"), i % 1000);
+  }
+  fiobj_str_write(json, "\n  ]\n}", 6);
+  return json;
+}
+
+static FIOBJ corpus_canada(size_t count) {
+  FIOBJ json = fiobj_str_buf(count * 48);
+  fiobj_str_write(json,
+                  "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":"
+                  "\"Feature\",\"properties\":{\"name\":\"Canada\"},"
+                  "\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[[",
+                  134);
+  for (size_t i = 0; i < count; ++i) {
+    fiobj_str_printf(json, "%s[%.15f,%.15f]", (i ? "," : ""),
+                     -65.613616999999977 + (i * 0.000123456789),
+                     43.420273000000009 + (i * 0.000987654321));
+  }
+  fiobj_str_write(json, "]]}}]}", 6);
+  return json;
+}
+
+/* *****************************************************************************
+Benchmark
+***************************************************************************** */
+
+static double seconds_since(struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) +
+         ((end.tv_nsec - start->tv_nsec) / 1000000000.0);
+}
+
+static void benchmark(const char *name, fio_str_info_s json, size_t rounds) {
+  struct timespec start;
+  json_parser_s p;
+  size_t objects = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < rounds; ++i) {
+    p = (json_parser_s){.dict = 0};
+    counter = 0;
+    if (fio_json_parse(&p, json.data, json.len) != json.len ||
+        counter == (size_t)-1) {
+      FIO_LOG_ERROR("%s: JSON parsing failed.", name);
+      return;
+    }
+    objects = counter;
+  }
+  double parser = seconds_since(&start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < rounds; ++i) {
+    FIOBJ obj = FIOBJ_INVALID;
+    if (!fiobj_json2obj(&obj, json.data, json.len)) {
+      FIO_LOG_ERROR("%s: fiobj_json2obj failed.", name);
+      return;
+    }
+    fiobj_free(obj);
+  }
+  double fiobj = seconds_since(&start);
+
+  FIOBJ obj = FIOBJ_INVALID;
+  fiobj_json2obj(&obj, json.data, json.len);
+  size_t formatted = 0;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < rounds; ++i) {
+    FIOBJ str = fiobj_obj2json(obj, 0);
+    formatted = fiobj_obj2cstr(str).len;
+    fiobj_free(str);
+  }
+  double format = seconds_since(&start);
+
+  /* chunked formatting, reusing a single chunk sized buffer */
+  FIOBJ chunk = fiobj_str_buf(JSON_SEND_CHUNK_SIZE);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < rounds; ++i) {
+    fiobj_obj2json_stream_s *formatter = fiobj_obj2json_stream_new(obj, 0);
+    int more;
+    do {
+      fiobj_str_resize(chunk, 0);
+      more = fiobj_obj2json_stream_next(formatter, chunk, JSON_SEND_CHUNK_SIZE);
+    } while (more);
+    fiobj_obj2json_stream_free(formatter);
+  }
+  double stream = seconds_since(&start);
+  fiobj_free(chunk);
+  fiobj_free(obj);
+
+  double mb = (json.len * rounds) / (1024.0 * 1024.0);
+  fprintf(stderr,
+          "* %s (%zu bytes, %zu objects):\n"
+          "\tparser only:    %8.2f MB/s\n"
+          "\tfiobj_json2obj: %8.2f MB/s\n"
+          "\tfiobj_obj2json: %8.2f MB/s (%zu bytes)\n"
+          "\tchunked:        %8.2f MB/s (%u byte chunks)\n",
+          name, json.len, objects, mb / parser, mb / fiobj,
+          ((formatted * rounds) / (1024.0 * 1024.0)) / format, formatted,
+          ((formatted * rounds) / (1024.0 * 1024.0)) / stream,
+          (unsigned int)JSON_SEND_CHUNK_SIZE);
+}
+
+int main(int argc, char const *argv[]) {
+  fio_cli_start(argc, argv, 0, -1,
+                "This program benchmarks the JSON parser. Any unnamed "
+                "arguments are treated as JSON files to be benchmarked.",
+                FIO_CLI_INT("-rounds -r the number of rounds per test "
+                            "(default 100)."));
+  fio_cli_set_default("-r", "100");
+  size_t rounds = fio_cli_get_i("-r");
+  if (!rounds)
+    rounds = 1;
+  fprintf(stderr, "JSON parser benchmark (structural index %s):\n",
+          (JSON_SIMD ? "enabled" : "disabled"));
+  if (fio_cli_unnamed_count()) {
+    for (unsigned int i = 0; i < fio_cli_unnamed_count(); ++i) {
+      FIOBJ file = fiobj_str_buf(0);
+      if (!fiobj_str_readfile(file, fio_cli_unnamed(i), 0, 0)) {
+        FIO_LOG_ERROR("couldn't read %s", fio_cli_unnamed(i));
+      } else {
+        benchmark(fio_cli_unnamed(i), fiobj_obj2cstr(file), rounds);
+      }
+      fiobj_free(file);
+    }
+  } else {
+    FIOBJ json = corpus_twitter(600);
+    benchmark("twitter.json style", fiobj_obj2cstr(json), rounds);
+    fiobj_free(json);
+    json = corpus_canada(55000);
+    benchmark("canada.json style", fiobj_obj2cstr(json), rounds);
+    fiobj_free(json);
+  }
+  fio_cli_end();
+  return 0;
+}
@@ -0,0 +1,117 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+
+This program benchmarks Mustache template rendering (fiobj_mustache).
+
+A template with sections and nested dot notation names is rendered
+repeatedly into a single (reused) String buffer.
+
+use: make test/lib/mustache_bench
+*/
+#include <fio.h>
+#include <fio_cli.h>
+#include <fiobj.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* builds the template data: a title, a footer and a list of users */
+static FIOBJ build_data(size_t count) {
+  FIOBJ data = fiobj_hash_new();
+  FIOBJ key = fiobj_str_new("title", 5);
+  fiobj_hash_set(data, key, fiobj_str_new("Users & Admins", 14));
+  fiobj_free(key);
+  key = fiobj_str_new("footer", 6);
+  fiobj_hash_set(data, key, fiobj_str_new("<footer>facil.io</footer>", 25));
+  fiobj_free(key);
+  FIOBJ users = fiobj_ary_new2(count);
+  key = fiobj_str_new("users", 5);
+  fiobj_hash_set(data, key, users);
+  fiobj_free(key);
+  FIOBJ k_id = fiobj_str_new("id", 2);
+  FIOBJ k_name = fiobj_str_new("name", 4);
+  FIOBJ k_admin = fiobj_str_new("admin", 5);
+  FIOBJ k_profile = fiobj_str_new("profile", 7);
+  FIOBJ k_email = fiobj_str_new("email", 5);
+  FIOBJ k_company = fiobj_str_new("company", 7);
+  for (size_t i = 0; i < count; ++i) {
+    FIOBJ usr = fiobj_hash_new();
+    fiobj_hash_set(usr, k_id, fiobj_num_new(i));
+    FIOBJ tmp = fiobj_str_buf(16);
+    fiobj_str_printf(tmp, "User %zu", i);
+    fiobj_hash_set(usr, k_name, tmp);
+    fiobj_hash_set(usr, k_admin, ((i & 7) ? fiobj_false() : fiobj_true()));
+    FIOBJ profile = fiobj_hash_new();
+    tmp = fiobj_str_buf(32);
+    fiobj_str_printf(tmp, "user%zu@example.com", i);
+    fiobj_hash_set(profile, k_email, tmp);
+    FIOBJ company = fiobj_hash_new();
+    tmp = fiobj_str_buf(16);
+    fiobj_str_printf(tmp, "Company %zu", i & 15);
+    fiobj_hash_set(company, k_name, tmp);
+    fiobj_hash_set(profile, k_company, company);
+    fiobj_hash_set(usr, k_profile, profile);
+    fiobj_ary_push(users, usr);
+  }
+  fiobj_free(k_id);
+  fiobj_free(k_name);
+  fiobj_free(k_admin);
+  fiobj_free(k_profile);
+  fiobj_free(k_email);
+  fiobj_free(k_company);
+  return data;
+}
+
+int main(int argc, char const *argv[]) {
+  fio_cli_start(argc, argv, 0, 0,
+                "This program benchmarks Mustache template rendering.",
+                FIO_CLI_INT("-users -u users listed by the template (default "
+                            "100)."),
+                FIO_CLI_INT("-rounds -r renders to perform (default 2000)."));
+  fio_cli_set_default("-u", "100");
+  fio_cli_set_default("-r", "2000");
+  const size_t count = fio_cli_get_i("-u");
+  const size_t rounds = fio_cli_get_i("-r");
+  fio_cli_end();
+  if (count < 1 || rounds < 1) {
+    FIO_LOG_ERROR("users and rounds must be positive.");
+    exit(-1);
+  }
+
+  char const *template =
+      "<h1>{{title}}</h1>\n<ul>\n"
+      "{{#users}}  <li>{{id}}. {{name}} &lt;{{profile.email}}&gt; "
+      "({{profile.company.name}}){{#admin}} [admin]{{/admin}}</li>\n"
+      "{{/users}}</ul>\n{{{footer}}}\n";
+  mustache_error_en err = MUSTACHE_OK;
+  mustache_s *m = fiobj_mustache_new(.data = template,
+                                     .data_len = strlen(template), .err = &err);
+  FIO_ASSERT(m, "Mustache benchmark template loading failed (%u)", err);
+  FIOBJ data = build_data(count);
+
+  /* render into a single (reused) buffer */
+  FIOBJ dest = fiobj_mustache_build(m, data);
+  const size_t length = fiobj_obj2cstr(dest).len;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < rounds; ++i) {
+    fiobj_str_resize(dest, 0);
+    fiobj_mustache_build2(dest, m, data);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  FIO_ASSERT(fiobj_obj2cstr(dest).len == length,
+             "Mustache benchmark rendering length error");
+  double seconds = (end.tv_sec - start.tv_sec) +
+                   ((end.tv_nsec - start.tv_nsec) / 1000000000.0);
+  fprintf(stderr,
+          "* %zu renders (%zu bytes each): %.2f renders / sec, %.2f MB/s\n",
+          rounds, length, rounds / seconds,
+          ((double)length * rounds) / (1024.0 * 1024.0 * seconds));
+  fiobj_free(dest);
+  fiobj_free(data);
+  fiobj_mustache_free(m);
+  return 0;
+}